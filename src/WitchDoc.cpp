@@ -15,18 +15,73 @@
 */
 
 #include "WitchDoc.h"
+#include "layerCore.h"
+#include "layerSettings.h"
 
 #include <iostream>
 
 namespace GWD {
 
-WitchDoctor::WitchDoctor() {}
+WitchDoctorInstance::WitchDoctorInstance()
+    : m_warning_aggregator(GetLayerSettings().warning_summary_interval_ms,
+                           GetLayerSettings().warning_rate_limit) {
+  const LayerSettings& settings = GetLayerSettings();
+  if (settings.async_warnings) {
+    m_warning_queue.reset(new AsyncWarningQueue(
+        settings.warning_queue_size,
+        [this](const WarningEvent& event) {
+          PerformanceWarningMessage(FormatWarning(event));
+        },
+        [this](uint64_t dropped_count) {
+          std::stringstream message;
+          message << "WitchDoctor dropped " << dropped_count
+                  << " warnings because the async warning queue was full";
+          PerformanceWarningMessage(message.str());
+        },
+        [this]() {
+          if (m_warning_aggregator.ClaimSummary()) {
+            EmitWarningSummary();
+          }
+        }));
+  }
+}
 
-WitchDoctor::~WitchDoctor() {}
+WitchDoctorInstance::~WitchDoctorInstance() {
+  // Stop the delivery thread first so the final summary comes last
+  m_warning_queue.reset();
+  EmitWarningSummary();
+}
 
-void WitchDoctor::PerformanceWarningMessage(std::string& message) {
+WitchDoctor::WitchDoctor(WitchDoctorInstance* instance_doc)
+    : m_reporter(instance_doc),
+      m_layerBypassDispatch(instance_doc->GetLayerBypassDispatch()) {}
+
+void WitchDoctorInstance::ReportWarning(const WarningEvent& event) {
+  if (m_warning_aggregator.Record(event)) {
+    if (m_warning_queue) {
+      m_warning_queue->Push(event);
+    } else {
+      PerformanceWarningMessage(FormatWarning(event));
+    }
+  }
+
+  // The delivery thread takes care of summaries in async mode
+  if (!m_warning_queue && m_warning_aggregator.ClaimSummary()) {
+    EmitWarningSummary();
+  }
+}
+
+void WitchDoctorInstance::EmitWarningSummary() {
+  const std::string summary = m_warning_aggregator.BuildSummary();
+  if (!summary.empty()) {
+    PerformanceWarningMessage(summary);
+  }
+}
+
+void WitchDoctorInstance::PerformanceWarningMessage(
+    const std::string& message) {
+  std::lock_guard<std::mutex> lock(m_debug_utils_messenger_mutex);
   if (m_debug_utils_messengers.size() > 0) {
-    std::lock_guard<std::mutex> lock(m_debug_utils_messenger_mutex);
     VkDebugUtilsMessengerCallbackDataEXT callback_data = {};
     callback_data.sType =
         VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CALLBACK_DATA_EXT;
@@ -48,4 +103,79 @@ void WitchDoctor::PerformanceWarningMessage(std::string& message) {
   }
 }
 
+PFN_vkVoidFunction WitchDoctor::GetDeviceProcAddr_DispatchHelper(
+    const char* pName) {
+  return GWDInterface::GwdGetDispatchedDeviceProcAddr(m_device, pName);
+}
+
+PFN_vkVoidFunction WitchDoctorInstance::GetInstanceProcAddr_DispatchHelper(
+    const char* pName) {
+  return GWDInterface::GwdGetDispatchedInstanceProcAddr(m_instance, pName);
+}
+
+void WitchDoctorInstance::PopulateInstanceLayerBypassDispatchTable() {
+  m_layerBypassDispatch.getPhysicalDeviceProperties =
+      (PFN_vkGetPhysicalDeviceProperties)GetInstanceProcAddr_DispatchHelper(
+          "vkGetPhysicalDeviceProperties");
+  m_layerBypassDispatch.getPhysicalDeviceMemoryProperties =
+      (PFN_vkGetPhysicalDeviceMemoryProperties)
+          GetInstanceProcAddr_DispatchHelper(
+              "vkGetPhysicalDeviceMemoryProperties");
+  m_layerBypassDispatch.getPhysicalDeviceQueueFamilyProperties =
+      (PFN_vkGetPhysicalDeviceQueueFamilyProperties)
+          GetInstanceProcAddr_DispatchHelper(
+              "vkGetPhysicalDeviceQueueFamilyProperties");
+}
+
+void WitchDoctor::PopulateDeviceLayerBypassDispatchTable() {}
+
+VkResult WitchDoctorInstance::PostCallCreateInstance(
+    const VkInstanceCreateInfo* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator, VkInstance* pInstance) {
+  m_instance = *pInstance;
+  PopulateInstanceLayerBypassDispatchTable();
+
+  return VK_SUCCESS;
+}
+
+VkResult WitchDoctorInstance::PostCallCreateDebugUtilsMessengerEXT(
+    const VkResult inResult, VkInstance instance,
+    VkDebugUtilsMessengerCreateInfoEXT const* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator,
+    VkDebugUtilsMessengerEXT* pMessenger) {
+  if (VK_SUCCESS != inResult) {
+    return inResult;
+  }
+
+  std::lock_guard<std::mutex> lock(m_debug_utils_messenger_mutex);
+  m_debug_utils_messengers.emplace(*pMessenger, *pCreateInfo);
+
+  return VK_SUCCESS;
+}
+
+void WitchDoctorInstance::PostCallDestroyDebugUtilsMessengerEXT(
+    VkInstance instance, VkDebugUtilsMessengerEXT messenger,
+    const VkAllocationCallbacks* pAllocator) {
+  std::lock_guard<std::mutex> lock(m_debug_utils_messenger_mutex);
+  m_debug_utils_messengers.erase(messenger);
+}
+
+VkResult WitchDoctor::PostCallCreateDevice(
+    VkPhysicalDevice physicalDevice, const VkDeviceCreateInfo* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator, VkDevice* pDevice) {
+  m_device = *pDevice;
+  PopulateDeviceLayerBypassDispatchTable();
+
+  VkPhysicalDeviceMemoryProperties memory_properties = {};
+  m_layerBypassDispatch.getPhysicalDeviceMemoryProperties(physicalDevice,
+                                                          &memory_properties);
+  VkPhysicalDeviceProperties physical_device_properties = {};
+  m_layerBypassDispatch.getPhysicalDeviceProperties(
+      physicalDevice, &physical_device_properties);
+  Initialize(*pDevice, memory_properties,
+             physical_device_properties.limits.maxMemoryAllocationCount);
+
+  return VK_SUCCESS;
+}
+
 }  // namespace GWD
@@ -20,10 +20,20 @@
 
 #include <vulkan/vulkan.h>
 
+#include <array>
+#include <functional>
 #include <sstream>
 #include <mutex>
 #include <vector>
+#include "allocationTelemetry.h"
+#include "concurrentMap.h"
+#include "descriptorTelemetry.h"
+#include "drawTelemetry.h"
 #include "flat_hash_map.hpp"
+#include "frameStats.h"
+#include "handleTable.h"
+#include "perfWarnings.h"
+#include "submitTelemetry.h"
 
 namespace GWD {
 
@@ -31,12 +41,231 @@ struct LayerBypassDispatch {
   // instance functions, used for layer-managed query pool setup
   PFN_vkGetPhysicalDeviceProperties getPhysicalDeviceProperties;
   PFN_vkGetPhysicalDeviceMemoryProperties getPhysicalDeviceMemoryProperties;
+  PFN_vkGetPhysicalDeviceQueueFamilyProperties
+      getPhysicalDeviceQueueFamilyProperties;
 };
 
-class WitchDoctor {
+// Memory type index of a buffer that hasn't been bound to memory yet
+static constexpr uint32_t kUnboundMemoryType = UINT32_MAX;
+
+struct MemoryRecord {
+  uint32_t memory_type_index = kUnboundMemoryType;
+  VkDeviceSize size = 0;
+  AllocationTelemetry::Clock::time_point allocation_time;
+};
+
+struct BufferRecord {
+  uint32_t memory_type_index = kUnboundMemoryType;
+  VkDeviceSize size = 0;
+};
+
+struct ImageRecord {
+  uint32_t memory_type_index = kUnboundMemoryType;
+  VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL;
+  VkImageUsageFlags usage = 0;
+  uint64_t texel_count = 0;
+};
+
+// Bindings past this many aren't tracked in DescriptorSetRecord
+static constexpr uint32_t kMaxTrackedDescriptorBindings = 64;
+
+// The descriptor types written through VkDescriptorBufferInfo
+inline bool IsBufferDescriptorType(VkDescriptorType type) {
+  return type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ||
+         type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER ||
+         type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC ||
+         type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+}
+
+// Which storage and uniform buffers a descriptor set references, as far as
+// the layer needs to know, and how its contents are used. Buffers have to be
+// bound to memory before they are written to a set, so their placement is
+// settled by then.
+struct DescriptorSetRecord {
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  // Bindings whose last write or copy put a buffer outside DEVICE_LOCAL
+  // memory in them
+  uint64_t non_device_local_bindings = 0;
+  // The last such buffer, to report
+  VkBuffer non_device_local_buffer = VK_NULL_HANDLE;
+  // Whether the current contents were written, and how often they have been
+  // bound since, counted as command buffers are submitted. Counting stops at
+  // 2, past what DescriptorTelemetry needs.
+  bool written = false;
+  uint32_t binds_since_write = 0;
+
+  // Tallies the current contents as a write, a free or a reset replaces
+  // them. Contents that were never bound are still being filled in, so
+  // several writes in a row only count once.
+  void Retire(RetiredContents* retired) const {
+    if (written && binds_since_write > 0) {
+      retired->count++;
+      if (binds_since_write == 1) {
+        retired->single_bind_count++;
+      }
+    }
+  }
+
+  void BeginWrite(RetiredContents* retired) {
+    Retire(retired);
+    written = true;
+    binds_since_write = 0;
+  }
+
+  // For each write or copy to a storage or uniform buffer binding
+  void WriteBufferBinding(uint32_t binding, VkBuffer buffer_to_report) {
+    const uint64_t binding_bit = (uint64_t)1 << binding;
+    if (buffer_to_report != VK_NULL_HANDLE) {
+      non_device_local_bindings |= binding_bit;
+      non_device_local_buffer = buffer_to_report;
+    } else {
+      non_device_local_bindings &= ~binding_bit;
+      if (non_device_local_bindings == 0) {
+        non_device_local_buffer = VK_NULL_HANDLE;
+      }
+    }
+  }
+};
+
+// The buffer entries of a descriptor update template, the only ones the
+// layer reads
+struct DescriptorUpdateTemplate {
+  std::vector<VkDescriptorUpdateTemplateEntry> buffer_entries;
+};
+
+// Vulkan guarantees at least 16 vertex input bindings and every desktop driver
+// we care about exposes 32, which conveniently fits a bitmask.
+static constexpr uint32_t kMaxTrackedVertexBindings = 32;
+// Vulkan only guarantees 4 bound descriptor sets, and few engines go past 8
+static constexpr uint32_t kMaxTrackedDescriptorSets = 8;
+// Graphics and compute, the bind points of core Vulkan
+static constexpr uint32_t kTrackedBindPointCount = 2;
+// Index values 16 bits can hold, leaving out the primitive restart value
+static constexpr uint64_t kMaxUint16IndexCount = 0xFFFF;
+
+// Shadow of the binding state recorded into a single VkCommandBuffer. Command
+// buffers are externally synchronized, so only the recording thread touches
+// this block and it needs no locking of its own.
+struct CommandBufferState {
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+
+  VkBuffer index_buffer = VK_NULL_HANDLE;
+  VkDeviceSize index_buffer_offset = 0;
+  // Bytes from the offset to the end of the buffer, or 0 if unknown
+  VkDeviceSize index_buffer_range = 0;
+  VkIndexType index_type = VK_INDEX_TYPE_UINT16;
+  bool index_buffer_is_device_local = true;
+
+  std::array<VkBuffer, kMaxTrackedVertexBindings> vertex_buffers = {};
+  std::array<VkDeviceSize, kMaxTrackedVertexBindings> vertex_buffer_offsets =
+      {};
+  uint32_t bound_vertex_bindings = 0;
+  uint32_t non_device_local_vertex_bindings = 0;
+
+  // Indexed by VkPipelineBindPoint
+  struct BindPointState {
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    // Sets are only compared while they were bound with this layout
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    std::array<VkDescriptorSet, kMaxTrackedDescriptorSets> descriptor_sets =
+        {};
+    uint32_t bound_descriptor_sets = 0;
+    // A buffer outside DEVICE_LOCAL memory in each set, resolved when the set
+    // is bound. Only filled in for the compute bind point.
+    std::array<VkBuffer, kMaxTrackedDescriptorSets> non_device_local_buffers =
+        {};
+
+    VkBuffer FirstNonDeviceLocalDescriptorBuffer() const {
+      for (uint32_t set = 0; set < kMaxTrackedDescriptorSets; set++) {
+        if ((bound_descriptor_sets & (1u << set)) != 0 &&
+            non_device_local_buffers[set] != VK_NULL_HANDLE) {
+          return non_device_local_buffers[set];
+        }
+      }
+      return VK_NULL_HANDLE;
+    }
+  };
+  std::array<BindPointState, kTrackedBindPointCount> bind_points;
+
+  // Bumped by every bind that changes more than buffer or dynamic offsets, so
+  // draws recorded at the same generation share their state
+  uint64_t bind_generation = 0;
+
+  // Draw calls recorded since vkBeginCommandBuffer, counted the same way as
+  // FrameCounter::kDraws
+  uint64_t draw_count = 0;
+  DrawRun draw_run;
+  IndirectRun indirect_run;
+  DrawSummary draw_summary;
+  // Set when a bind brings in freshly written descriptor sets, cleared by the
+  // next draw
+  bool fresh_descriptor_sets = false;
+  uint64_t fresh_set_draw_count = 0;
+
+  // Every descriptor set bound in the recording, with what the binds need from
+  // its record as of the first of them. The bind counts only reach the records
+  // at submit, so binding a set again takes no lock.
+  struct DescriptorSetBinds {
+    VkBuffer non_device_local_buffer = VK_NULL_HANDLE;
+    uint32_t bind_count = 0;
+  };
+  ska::flat_hash_map<VkDescriptorSet, DescriptorSetBinds> descriptor_set_binds;
+
+  void ResetBindings() {
+    index_buffer = VK_NULL_HANDLE;
+    index_buffer_offset = 0;
+    index_buffer_range = 0;
+    index_type = VK_INDEX_TYPE_UINT16;
+    index_buffer_is_device_local = true;
+    vertex_buffers.fill(VK_NULL_HANDLE);
+    vertex_buffer_offsets.fill(0);
+    bound_vertex_bindings = 0;
+    non_device_local_vertex_bindings = 0;
+    bind_points.fill(BindPointState());
+  }
+
+  // For every draw call, direct or indirect
+  void CountFreshSetDraw() {
+    if (fresh_descriptor_sets) {
+      fresh_set_draw_count++;
+      fresh_descriptor_sets = false;
+    }
+  }
+
+  bool VertexBuffersAreDeviceLocal() const {
+    return (non_device_local_vertex_bindings & bound_vertex_bindings) == 0;
+  }
+
+  VkBuffer FirstNonDeviceLocalVertexBuffer() const {
+    const uint32_t offending_bindings =
+        non_device_local_vertex_bindings & bound_vertex_bindings;
+    for (uint32_t binding = 0; binding < kMaxTrackedVertexBindings;
+         binding++) {
+      if ((offending_bindings & (1u << binding)) != 0) {
+        return vertex_buffers[binding];
+      }
+    }
+    return VK_NULL_HANDLE;
+  }
+};
+
+// Where a WitchDoctor's warnings end up: the instance's debug utils messengers
+// in the layer, or the report of the offline trace analyzer.
+class WarningReporter {
  public:
-  WitchDoctor();
-  ~WitchDoctor();
+  virtual ~WarningReporter() {}
+
+  virtual void PerformanceWarningMessage(const std::string& message) = 0;
+  virtual void ReportWarning(const WarningEvent& event) = 0;
+};
+
+// Instance-level state shared by the WitchDoctor of every device created from
+// this instance: the bypass dispatch for physical device queries, and the debug
+// utils messengers that warnings get routed to.
+class WitchDoctorInstance : public WarningReporter {
+ public:
+  WitchDoctorInstance();
+  ~WitchDoctorInstance();
 
   VkResult PostCallCreateInstance(const VkInstanceCreateInfo* pCreateInfo,
                                   const VkAllocationCallbacks* pAllocator,
@@ -49,10 +278,74 @@ class WitchDoctor {
   void PostCallDestroyDebugUtilsMessengerEXT(
       VkInstance instance, VkDebugUtilsMessengerEXT messenger,
       const VkAllocationCallbacks* pAllocator);
+
+  void PerformanceWarningMessage(const std::string& message) override;
+
+  // Delivers the first occurrence of an issue right away, or queues it for
+  // the delivery thread when async warnings are enabled. Repeats are only
+  // counted and reported in periodic summaries.
+  void ReportWarning(const WarningEvent& event) override;
+
+  VkInstance GetInstance() const { return m_instance; }
+  const LayerBypassDispatch& GetLayerBypassDispatch() const {
+    return m_layerBypassDispatch;
+  }
+
+ protected:
+  PFN_vkVoidFunction GetInstanceProcAddr_DispatchHelper(const char* pName);
+
+  void PopulateInstanceLayerBypassDispatchTable();
+
+  void EmitWarningSummary();
+
+ private:
+  LayerBypassDispatch m_layerBypassDispatch = {};
+
+  VkInstance m_instance = VK_NULL_HANDLE;
+
+  std::mutex m_debug_utils_messenger_mutex;
+  ska::flat_hash_map<VkDebugUtilsMessengerEXT,
+                     VkDebugUtilsMessengerCreateInfoEXT>
+      m_debug_utils_messengers;
+
+  WarningAggregator m_warning_aggregator;
+
+  // Declared last so the delivery thread is joined before the messengers go
+  std::unique_ptr<AsyncWarningQueue> m_warning_queue;
+};
+
+// Analysis context for a single VkDevice. Each device gets its own memory
+// properties, handle maps and statistics so that independent devices never
+// share state or locks.
+//
+// The checks (apiLogic.cpp) only see the calls' arguments, never a live
+// device, so the trace analyzer runs them on recorded calls as well. Only
+// PostCallCreateDevice and the dispatch helpers (WitchDoc.cpp) need the layer.
+class WitchDoctor {
+ public:
+  explicit WitchDoctor(WitchDoctorInstance* instance_doc);
+  // Without a layer to query through, Initialize() replaces
+  // PostCallCreateDevice
+  explicit WitchDoctor(WarningReporter* reporter);
+  ~WitchDoctor();
+
+  using TimeSource = std::function<AllocationTelemetry::Clock::time_point()>;
+  // Replays time allocations with the trace's timestamps instead of the
+  // steady clock
+  void SetTimeSource(TimeSource time_source) {
+    m_time_source = std::move(time_source);
+  }
+
+  void Initialize(VkDevice device,
+                  const VkPhysicalDeviceMemoryProperties& memory_properties,
+                  uint32_t max_memory_allocation_count);
+
   VkResult PostCallCreateDevice(VkPhysicalDevice physicalDevice,
                                 const VkDeviceCreateInfo* pCreateInfo,
                                 const VkAllocationCallbacks* pAllocator,
                                 VkDevice* pDevice);
+  void PostCallDestroyDevice(VkDevice device,
+                             const VkAllocationCallbacks* pAllocator);
   VkResult PostCallAllocateMemory(const VkResult inResult, VkDevice device,
                                   const VkMemoryAllocateInfo* pAllocateInfo,
                                   const VkAllocationCallbacks* pAllocator,
@@ -71,6 +364,61 @@ class WitchDoctor {
   VkResult PostCallBindBufferMemory2(const VkResult inResult, VkDevice device,
                                      uint32_t bindInfoCount,
                                      const VkBindBufferMemoryInfo* pBindInfos);
+  VkResult PostCallCreateImage(const VkResult inResult, VkDevice device,
+                               const VkImageCreateInfo* pCreateInfo,
+                               const VkAllocationCallbacks* pAllocator,
+                               VkImage* pImage);
+  void PostCallDestroyImage(VkDevice device, VkImage image,
+                            const VkAllocationCallbacks* pAllocator);
+  VkResult PostCallBindImageMemory(const VkResult inResult, VkDevice device,
+                                   VkImage image, VkDeviceMemory memory,
+                                   VkDeviceSize memoryOffset);
+  VkResult PostCallBindImageMemory2(const VkResult inResult, VkDevice device,
+                                    uint32_t bindInfoCount,
+                                    const VkBindImageMemoryInfo* pBindInfos);
+  VkResult PostCallAllocateCommandBuffers(
+      const VkResult inResult, VkDevice device,
+      const VkCommandBufferAllocateInfo* pAllocateInfo,
+      VkCommandBuffer* pCommandBuffers);
+  void PostCallFreeCommandBuffers(VkDevice device, VkCommandPool commandPool,
+                                  uint32_t commandBufferCount,
+                                  const VkCommandBuffer* pCommandBuffers);
+  void PostCallDestroyCommandPool(VkDevice device, VkCommandPool commandPool,
+                                  const VkAllocationCallbacks* pAllocator);
+  VkResult PostCallBeginCommandBuffer(
+      const VkResult inResult, VkCommandBuffer commandBuffer,
+      const VkCommandBufferBeginInfo* pBeginInfo);
+  VkResult PostCallAllocateDescriptorSets(
+      const VkResult inResult, VkDevice device,
+      const VkDescriptorSetAllocateInfo* pAllocateInfo,
+      VkDescriptorSet* pDescriptorSets);
+  VkResult PostCallFreeDescriptorSets(const VkResult inResult, VkDevice device,
+                                      VkDescriptorPool descriptorPool,
+                                      uint32_t descriptorSetCount,
+                                      const VkDescriptorSet* pDescriptorSets);
+  VkResult PostCallResetDescriptorPool(const VkResult inResult,
+                                       VkDevice device,
+                                       VkDescriptorPool descriptorPool,
+                                       VkDescriptorPoolResetFlags flags);
+  void PostCallDestroyDescriptorPool(VkDevice device,
+                                     VkDescriptorPool descriptorPool,
+                                     const VkAllocationCallbacks* pAllocator);
+  void PostCallUpdateDescriptorSets(
+      VkDevice device, uint32_t descriptorWriteCount,
+      const VkWriteDescriptorSet* pDescriptorWrites,
+      uint32_t descriptorCopyCount,
+      const VkCopyDescriptorSet* pDescriptorCopies);
+  VkResult PostCallCreateDescriptorUpdateTemplate(
+      const VkResult inResult, VkDevice device,
+      const VkDescriptorUpdateTemplateCreateInfo* pCreateInfo,
+      const VkAllocationCallbacks* pAllocator,
+      VkDescriptorUpdateTemplate* pDescriptorUpdateTemplate);
+  void PostCallDestroyDescriptorUpdateTemplate(
+      VkDevice device, VkDescriptorUpdateTemplate descriptorUpdateTemplate,
+      const VkAllocationCallbacks* pAllocator);
+  void PostCallUpdateDescriptorSetWithTemplate(
+      VkDevice device, VkDescriptorSet descriptorSet,
+      VkDescriptorUpdateTemplate descriptorUpdateTemplate, const void* pData);
   void PostCallCmdDraw(VkCommandBuffer commandBuffer, uint32_t vertexCount,
                        uint32_t instanceCount, uint32_t firstVertex,
                        uint32_t firstInstance);
@@ -84,6 +432,22 @@ class WitchDoctor {
   void PostCallCmdDrawIndexedIndirect(VkCommandBuffer commandBuffer,
                                       VkBuffer buffer, VkDeviceSize offset,
                                       uint32_t drawCount, uint32_t stride);
+  void PostCallCmdDrawIndirectCount(VkCommandBuffer commandBuffer,
+                                    VkBuffer buffer, VkDeviceSize offset,
+                                    VkBuffer countBuffer,
+                                    VkDeviceSize countBufferOffset,
+                                    uint32_t maxDrawCount, uint32_t stride);
+  void PostCallCmdDrawIndexedIndirectCount(
+      VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+      VkBuffer countBuffer, VkDeviceSize countBufferOffset,
+      uint32_t maxDrawCount, uint32_t stride);
+  void PostCallCmdDispatch(VkCommandBuffer commandBuffer, uint32_t groupCountX,
+                           uint32_t groupCountY, uint32_t groupCountZ);
+  void PostCallCmdDispatchIndirect(VkCommandBuffer commandBuffer,
+                                   VkBuffer buffer, VkDeviceSize offset);
+  void PostCallCmdExecuteCommands(VkCommandBuffer commandBuffer,
+                                  uint32_t commandBufferCount,
+                                  const VkCommandBuffer* pCommandBuffers);
   void PostCallCmdBindIndexBuffer(VkCommandBuffer commandBuffer,
                                   VkBuffer buffer, VkDeviceSize offset,
                                   VkIndexType indexType);
@@ -92,15 +456,73 @@ class WitchDoctor {
                                     uint32_t bindingCount,
                                     const VkBuffer* pBuffers,
                                     const VkDeviceSize* pOffsets);
+  void PostCallCmdBindPipeline(VkCommandBuffer commandBuffer,
+                               VkPipelineBindPoint pipelineBindPoint,
+                               VkPipeline pipeline);
+  void PostCallCmdBindDescriptorSets(
+      VkCommandBuffer commandBuffer, VkPipelineBindPoint pipelineBindPoint,
+      VkPipelineLayout layout, uint32_t firstSet, uint32_t descriptorSetCount,
+      const VkDescriptorSet* pDescriptorSets, uint32_t dynamicOffsetCount,
+      const uint32_t* pDynamicOffsets);
+  VkResult PostCallQueueSubmit(const VkResult inResult, VkQueue queue,
+                               uint32_t submitCount,
+                               const VkSubmitInfo* pSubmits, VkFence fence);
+  VkResult PostCallAcquireNextImageKHR(const VkResult inResult,
+                                       VkDevice device,
+                                       VkSwapchainKHR swapchain,
+                                       uint64_t timeout, VkSemaphore semaphore,
+                                       VkFence fence, uint32_t* pImageIndex);
+  VkResult PostCallQueuePresentKHR(const VkResult inResult, VkQueue queue,
+                                   const VkPresentInfoKHR* pPresentInfo);
 
  protected:
   PFN_vkVoidFunction GetDeviceProcAddr_DispatchHelper(const char* pName);
-  PFN_vkVoidFunction GetInstanceProcAddr_DispatchHelper(const char* pName);
 
-  void PopulateInstanceLayerBypassDispatchTable();
   void PopulateDeviceLayerBypassDispatchTable();
 
-  void PerformanceWarningMessage(std::string& message);
+  void PerformanceWarningMessage(const std::string& message);
+  void ReportWarning(PerfCheck check, const char* entry_point,
+                     uint64_t object);
+
+  AllocationTelemetry::Clock::time_point Now() const;
+
+  bool IsBufferDeviceLocal(VkBuffer buffer) const;
+  VkMemoryPropertyFlags GetMemoryPropertyFlags(
+      uint32_t memory_type_index) const;
+  // Checks an image's memory placement once it has been bound
+  void CheckImagePlacement(const char* entry_point, VkImage image,
+                           const ImageRecord& image_record);
+  uint32_t GetMemoryTypeIndex(VkDeviceMemory memory) const;
+  // Counts a bind for the frame statistics, and reports it if it changed
+  // nothing
+  void RecordBind(bool redundant, const char* entry_point,
+                  VkCommandBuffer commandBuffer);
+  // Adds a direct draw to the command buffer's draw sizes and draw run
+  void RecordDirectDraw(CommandBufferState* cb_state, bool indexed,
+                        uint32_t element_count, uint32_t instance_count);
+  // Reports the run and returns true if it's long enough to be worth merging
+  bool ReportInstancingCandidate(const DrawRun& run);
+  // Ends the current draw run, keeping it if it's an instancing candidate
+  void CloseDrawRun(CommandBufferState* cb_state);
+  // Checks the placement of an indirect call's buffers and adds it to the
+  // command buffer's indirect run. countBuffer is VK_NULL_HANDLE for calls
+  // without a count buffer.
+  void RecordIndirectDraw(CommandBufferState* cb_state, const char* entry_point,
+                          bool indexed, VkBuffer buffer, VkDeviceSize offset,
+                          uint32_t drawCount, VkBuffer countBuffer);
+  // Reports the run and returns true if it's long enough to be worth merging
+  bool ReportMultiDrawCandidate(const IndirectRun& run);
+  // Ends the current indirect run, keeping it if it's a multi-draw candidate
+  void CloseIndirectRun(CommandBufferState* cb_state);
+  // The buffer a compute dispatch would read outside DEVICE_LOCAL memory
+  void CheckComputeBuffers(const char* entry_point,
+                           const CommandBufferState& cb_state);
+  // Adds a submitted command buffer's binds to the descriptor set records
+  void CountDescriptorSetBinds(const CommandBufferState& cb_state);
+  // Memory type of each bound allocation, resolved under one lock per shard
+  template <typename BindInfo>
+  std::vector<uint32_t> GetBoundMemoryTypeIndices(uint32_t bindInfoCount,
+                                                  const BindInfo* pBindInfos);
 
   class MessageLogger {
    public:
@@ -121,25 +543,32 @@ class WitchDoctor {
   };
 
  private:
+  WarningReporter* m_reporter = nullptr;
   LayerBypassDispatch m_layerBypassDispatch = {};
+  TimeSource m_time_source;
 
-  VkInstance m_instance = VK_NULL_HANDLE;
   VkDevice m_device = VK_NULL_HANDLE;
 
-  std::mutex m_debug_utils_messenger_mutex;
-  ska::flat_hash_map<VkDebugUtilsMessengerEXT,
-                     VkDebugUtilsMessengerCreateInfoEXT>
-      m_debug_utils_messengers;
-
   VkPhysicalDeviceMemoryProperties m_physDevMemProps = {};
   std::vector<bool> m_memTypeIsDeviceLocal;
+  // Whether there is somewhere better to put images than where they ended up
+  bool m_hasDeviceOnlyMemoryType = false;
+  bool m_hasLazilyAllocatedMemoryType = false;
+
+  HandleTable<VkDeviceMemory, MemoryRecord> m_memoryRecords;
+  AllocationTelemetry m_allocationTelemetry;
+  HandleTable<VkBuffer, BufferRecord> m_bufferRecords;
+  HandleTable<VkImage, ImageRecord> m_imageRecords;
+  HandleTable<VkDescriptorSet, DescriptorSetRecord> m_descriptorSetRecords;
+  ConcurrentMap<VkDescriptorUpdateTemplate, DescriptorUpdateTemplate>
+      m_descriptorUpdateTemplates;
 
-  // TODO: Replace with my own data structure in the FUTURE
-  ska::flat_hash_map<VkDeviceMemory, uint32_t> m_allocToMemTypeMap;
-  ska::flat_hash_map<VkBuffer, uint32_t> m_bufferToMemTypeMap;
+  ConcurrentMap<VkCommandBuffer, CommandBufferState> m_cmdBufStates;
 
-  bool m_index_buffer_is_device_local = false;
-  bool m_vertex_buffers_are_device_local = false;
+  FrameStats m_frameStats;
+  SubmitTelemetry m_submitTelemetry;
+  DrawTelemetry m_drawTelemetry;
+  DescriptorTelemetry m_descriptorTelemetry;
 };
 
 }  // namespace GWD
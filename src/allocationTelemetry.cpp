@@ -0,0 +1,213 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "allocationTelemetry.h"
+#include "layerSettings.h"
+
+#include <iomanip>
+#include <sstream>
+
+namespace GWD {
+
+// Allocations freed sooner than this are counted as short lived
+static constexpr std::chrono::seconds kShortLivedAllocation(1);
+
+// Fraction of maxMemoryAllocationCount, in percent, that we warn at
+static constexpr uint64_t kAllocationCountWarningPercent = 90;
+
+static std::string FormatBytes(VkDeviceSize bytes) {
+  static const char* const kUnits[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+  double value = (double)bytes;
+  size_t unit_index = 0;
+  while (value >= 1024.0 && unit_index + 1 < sizeof(kUnits) / sizeof(*kUnits)) {
+    value /= 1024.0;
+    unit_index++;
+  }
+  std::stringstream formatted;
+  formatted << std::fixed << std::setprecision(unit_index == 0 ? 0 : 1)
+            << value << " " << kUnits[unit_index];
+  return formatted.str();
+}
+
+void AllocationTelemetry::Initialize(
+    const VkPhysicalDeviceMemoryProperties& memory_properties,
+    uint32_t max_allocation_count) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_memory_properties = memory_properties;
+  m_max_allocation_count = max_allocation_count;
+  m_allocation_count_threshold =
+      (uint64_t)max_allocation_count * kAllocationCountWarningPercent / 100;
+  m_small_allocation_size = GetLayerSettings().small_allocation_size;
+  m_small_allocation_rate = GetLayerSettings().small_allocation_rate;
+  m_rate_window_start = Clock::now();
+}
+
+size_t AllocationTelemetry::GetSizeBucket(VkDeviceSize size) {
+  size_t bucket = 0;
+  for (VkDeviceSize bucket_end = 8 * 1024; size >= bucket_end;
+       bucket_end *= 2) {
+    bucket++;
+    if (bucket == kSizeHistogramBuckets - 1) {
+      break;
+    }
+  }
+  return bucket;
+}
+
+AllocationTelemetry::Alerts AllocationTelemetry::RecordAllocation(
+    uint32_t memory_type_index, VkDeviceSize size, Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  Alerts alerts;
+  if (memory_type_index >= m_memory_properties.memoryTypeCount) {
+    return alerts;
+  }
+
+  MemoryTypeStats& type_stats = m_type_stats[memory_type_index];
+  type_stats.allocation_count++;
+  type_stats.live_count++;
+  type_stats.live_bytes += size;
+  type_stats.total_bytes += size;
+  type_stats.size_histogram[GetSizeBucket(size)]++;
+
+  const uint32_t heap_index =
+      m_memory_properties.memoryTypes[memory_type_index].heapIndex;
+  HeapStats& heap_stats = m_heap_stats[heap_index];
+  heap_stats.live_bytes += size;
+  if (heap_stats.live_bytes > heap_stats.peak_bytes) {
+    heap_stats.peak_bytes = heap_stats.live_bytes;
+  }
+
+  m_live_count++;
+  if (m_live_count > m_peak_live_count) {
+    m_peak_live_count = m_live_count;
+  }
+  // Only on the way up through the threshold, not on every allocation above
+  if (m_allocation_count_threshold != 0 &&
+      m_live_count == m_allocation_count_threshold) {
+    alerts.allocation_count_near_limit = true;
+  }
+
+  if (now - m_rate_window_start >= std::chrono::seconds(1)) {
+    m_rate_window_start = now;
+    m_allocations_in_window = 0;
+    m_small_allocations_in_window = 0;
+  }
+  m_allocations_in_window++;
+  if (m_allocations_in_window > m_peak_allocation_rate) {
+    m_peak_allocation_rate = m_allocations_in_window;
+  }
+  if (size < m_small_allocation_size) {
+    m_small_allocations_in_window++;
+    if (m_small_allocation_rate != 0 &&
+        m_small_allocations_in_window == m_small_allocation_rate) {
+      alerts.small_allocation_churn = true;
+    }
+  }
+
+  return alerts;
+}
+
+void AllocationTelemetry::RecordFree(uint32_t memory_type_index,
+                                     VkDeviceSize size,
+                                     Clock::time_point allocation_time,
+                                     Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (memory_type_index >= m_memory_properties.memoryTypeCount) {
+    return;
+  }
+
+  const Clock::duration lifetime = now - allocation_time;
+  MemoryTypeStats& type_stats = m_type_stats[memory_type_index];
+  type_stats.free_count++;
+  type_stats.live_count--;
+  type_stats.live_bytes -= size;
+  type_stats.total_lifetime_seconds +=
+      std::chrono::duration<double>(lifetime).count();
+  if (lifetime < kShortLivedAllocation) {
+    type_stats.short_lived_count++;
+  }
+
+  const uint32_t heap_index =
+      m_memory_properties.memoryTypes[memory_type_index].heapIndex;
+  m_heap_stats[heap_index].live_bytes -= size;
+
+  m_live_count--;
+}
+
+std::string AllocationTelemetry::BuildReport() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::stringstream report;
+  report << "WitchDoctor allocation report: peak of " << m_peak_live_count
+         << " live allocations (maxMemoryAllocationCount "
+         << m_max_allocation_count << "), peak rate of "
+         << m_peak_allocation_rate << " allocations/s";
+
+  for (uint32_t heap_index = 0;
+       heap_index < m_memory_properties.memoryHeapCount; heap_index++) {
+    const HeapStats& heap_stats = m_heap_stats[heap_index];
+    report << "\n  heap " << heap_index << " ("
+           << FormatBytes(m_memory_properties.memoryHeaps[heap_index].size)
+           << "): peak " << FormatBytes(heap_stats.peak_bytes) << ", live "
+           << FormatBytes(heap_stats.live_bytes);
+  }
+
+  for (uint32_t type_index = 0;
+       type_index < m_memory_properties.memoryTypeCount; type_index++) {
+    const MemoryTypeStats& type_stats = m_type_stats[type_index];
+    if (type_stats.allocation_count == 0) {
+      continue;
+    }
+
+    report << "\n  memory type " << type_index << " (heap "
+           << m_memory_properties.memoryTypes[type_index].heapIndex
+           << ", flags 0x" << std::hex
+           << m_memory_properties.memoryTypes[type_index].propertyFlags
+           << std::dec << "): " << type_stats.allocation_count
+           << " allocations, " << FormatBytes(type_stats.total_bytes)
+           << " total, " << type_stats.live_count << " live ("
+           << FormatBytes(type_stats.live_bytes) << ")";
+    if (type_stats.free_count > 0) {
+      report << ", mean lifetime " << std::fixed << std::setprecision(2)
+             << type_stats.total_lifetime_seconds / type_stats.free_count
+             << "s, " << type_stats.short_lived_count << " freed within "
+             << kShortLivedAllocation.count() << "s";
+    }
+
+    report << "\n    sizes:";
+    const char* separator = " ";
+    for (size_t bucket = 0; bucket < kSizeHistogramBuckets; bucket++) {
+      if (type_stats.size_histogram[bucket] == 0) {
+        continue;
+      }
+      const VkDeviceSize bucket_end = (VkDeviceSize)(8 * 1024) << bucket;
+      report << separator;
+      if (bucket + 1 == kSizeHistogramBuckets) {
+        report << ">=" << FormatBytes(bucket_end / 2);
+      } else {
+        report << "<" << FormatBytes(bucket_end);
+      }
+      report << ": " << type_stats.size_histogram[bucket];
+      separator = ", ";
+    }
+  }
+
+  return report.str();
+}
+
+}  // namespace GWD
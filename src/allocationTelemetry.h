@@ -0,0 +1,95 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+namespace GWD {
+
+// Per-device vkAllocateMemory/vkFreeMemory statistics: sizes, lifetimes and
+// rates per memory type, and live/peak usage per heap. Allocations are rare
+// compared to recording, so everything sits behind a single lock.
+class AllocationTelemetry {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // What a single allocation tripped over, for the caller to report
+  struct Alerts {
+    bool small_allocation_churn = false;
+    bool allocation_count_near_limit = false;
+  };
+
+  void Initialize(const VkPhysicalDeviceMemoryProperties& memory_properties,
+                  uint32_t max_allocation_count);
+
+  Alerts RecordAllocation(uint32_t memory_type_index, VkDeviceSize size,
+                          Clock::time_point now);
+  void RecordFree(uint32_t memory_type_index, VkDeviceSize size,
+                  Clock::time_point allocation_time, Clock::time_point now);
+
+  std::string BuildReport() const;
+
+ private:
+  // Bucket 0 holds everything below 8 KiB, bucket n holds
+  // [2^(n+12), 2^(n+13)) and the last bucket holds everything larger.
+  static constexpr size_t kSizeHistogramBuckets = 20;
+
+  struct MemoryTypeStats {
+    uint64_t allocation_count = 0;
+    uint64_t free_count = 0;
+    uint64_t live_count = 0;
+    VkDeviceSize live_bytes = 0;
+    VkDeviceSize total_bytes = 0;
+    double total_lifetime_seconds = 0.0;
+    uint64_t short_lived_count = 0;
+    std::array<uint64_t, kSizeHistogramBuckets> size_histogram = {};
+  };
+
+  struct HeapStats {
+    VkDeviceSize live_bytes = 0;
+    VkDeviceSize peak_bytes = 0;
+  };
+
+  static size_t GetSizeBucket(VkDeviceSize size);
+
+  mutable std::mutex m_mutex;
+
+  VkPhysicalDeviceMemoryProperties m_memory_properties = {};
+  uint32_t m_max_allocation_count = 0;
+  uint64_t m_allocation_count_threshold = 0;
+  uint32_t m_small_allocation_size = 0;
+  uint32_t m_small_allocation_rate = 0;
+
+  std::array<MemoryTypeStats, VK_MAX_MEMORY_TYPES> m_type_stats;
+  std::array<HeapStats, VK_MAX_MEMORY_HEAPS> m_heap_stats;
+
+  uint64_t m_live_count = 0;
+  uint64_t m_peak_live_count = 0;
+
+  // One second windows for the allocation rate
+  Clock::time_point m_rate_window_start;
+  uint32_t m_allocations_in_window = 0;
+  uint32_t m_small_allocations_in_window = 0;
+  uint32_t m_peak_allocation_rate = 0;
+};
+
+}  // namespace GWD
@@ -15,8 +15,9 @@
 */
 
 #include "WitchDoc.h"
-#include "layerCore.h"
+#include "layerSettings.h"
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
@@ -24,77 +25,69 @@ namespace GWD {
 
 #define LOG_MESSAGE MessageLogger(this).stream()
 
-PFN_vkVoidFunction WitchDoctor::GetDeviceProcAddr_DispatchHelper(
-    const char* pName) {
-  return GWDInterface::GwdGetDispatchedDeviceProcAddr(m_device, pName);
-}
-
-PFN_vkVoidFunction WitchDoctor::GetInstanceProcAddr_DispatchHelper(
-    const char* pName) {
-  return GWDInterface::GwdGetDispatchedInstanceProcAddr(m_instance, pName);
-}
-
-void WitchDoctor::PopulateInstanceLayerBypassDispatchTable() {
-  m_layerBypassDispatch.getPhysicalDeviceProperties =
-      (PFN_vkGetPhysicalDeviceProperties)GetInstanceProcAddr_DispatchHelper(
-          "vkGetPhysicalDeviceProperties");
-  m_layerBypassDispatch.getPhysicalDeviceMemoryProperties =
-      (PFN_vkGetPhysicalDeviceMemoryProperties)
-          GetInstanceProcAddr_DispatchHelper(
-              "vkGetPhysicalDeviceMemoryProperties");
-}
+WitchDoctor::WitchDoctor(WarningReporter* reporter) : m_reporter(reporter) {}
 
-void WitchDoctor::PopulateDeviceLayerBypassDispatchTable() {}
+WitchDoctor::~WitchDoctor() {}
 
-VkResult WitchDoctor::PostCallCreateInstance(
-    const VkInstanceCreateInfo* pCreateInfo,
-    const VkAllocationCallbacks* pAllocator, VkInstance* pInstance) {
-  m_instance = *pInstance;
-  PopulateInstanceLayerBypassDispatchTable();
-
-  return VK_SUCCESS;
+void WitchDoctor::PerformanceWarningMessage(const std::string& message) {
+  m_reporter->PerformanceWarningMessage(message);
 }
 
-VkResult WitchDoctor::PostCallCreateDebugUtilsMessengerEXT(
-    const VkResult inResult, VkInstance instance,
-    VkDebugUtilsMessengerCreateInfoEXT const* pCreateInfo,
-    const VkAllocationCallbacks* pAllocator,
-    VkDebugUtilsMessengerEXT* pMessenger) {
-  if (VK_SUCCESS != inResult) {
-    return inResult;
-  }
-
-  std::lock_guard<std::mutex> lock(m_debug_utils_messenger_mutex);
-  m_debug_utils_messengers.emplace(*pMessenger, *pCreateInfo);
-
-  return VK_SUCCESS;
+void WitchDoctor::ReportWarning(PerfCheck check, const char* entry_point,
+                                uint64_t object) {
+  m_frameStats.Count(FrameCounter::kWarnings);
+  m_reporter->ReportWarning(
+      {check, entry_point, object, m_frameStats.GetFrameCount()});
 }
 
-void WitchDoctor::PostCallDestroyDebugUtilsMessengerEXT(
-    VkInstance instance, VkDebugUtilsMessengerEXT messenger,
-    const VkAllocationCallbacks* pAllocator) {
-  std::lock_guard<std::mutex> lock(m_debug_utils_messenger_mutex);
-  m_debug_utils_messengers.erase(messenger);
+AllocationTelemetry::Clock::time_point WitchDoctor::Now() const {
+  return m_time_source ? m_time_source() : AllocationTelemetry::Clock::now();
 }
 
-VkResult WitchDoctor::PostCallCreateDevice(
-    VkPhysicalDevice physicalDevice, const VkDeviceCreateInfo* pCreateInfo,
-    const VkAllocationCallbacks* pAllocator, VkDevice* pDevice) {
-  m_device = *pDevice;
-  PopulateDeviceLayerBypassDispatchTable();
-
-  m_layerBypassDispatch.getPhysicalDeviceMemoryProperties(physicalDevice,
-                                                          &m_physDevMemProps);
+void WitchDoctor::Initialize(
+    VkDevice device, const VkPhysicalDeviceMemoryProperties& memory_properties,
+    uint32_t max_memory_allocation_count) {
+  m_device = device;
+  m_physDevMemProps = memory_properties;
 
   m_memTypeIsDeviceLocal.resize(m_physDevMemProps.memoryTypeCount);
   for (uint32_t mem_type_index = 0;
        mem_type_index < m_physDevMemProps.memoryTypeCount; mem_type_index++) {
+    const VkMemoryPropertyFlags property_flags =
+        m_physDevMemProps.memoryTypes[mem_type_index].propertyFlags;
     m_memTypeIsDeviceLocal[mem_type_index] =
-        ((m_physDevMemProps.memoryTypes[mem_type_index].propertyFlags &
-          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0);
+        ((property_flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0);
+    if ((property_flags & (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) ==
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+      m_hasDeviceOnlyMemoryType = true;
+    }
+    if ((property_flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0) {
+      m_hasLazilyAllocatedMemoryType = true;
+    }
   }
 
-  return VK_SUCCESS;
+  m_allocationTelemetry.Initialize(m_physDevMemProps,
+                                   max_memory_allocation_count);
+}
+
+void WitchDoctor::PostCallDestroyDevice(
+    VkDevice device, const VkAllocationCallbacks* pAllocator) {
+  if (GetLayerSettings().allocation_report) {
+    PerformanceWarningMessage(m_allocationTelemetry.BuildReport());
+  }
+  if (GetLayerSettings().frame_report && m_frameStats.GetFrameCount() > 0) {
+    PerformanceWarningMessage(m_frameStats.BuildReport());
+  }
+  if (GetLayerSettings().submit_report) {
+    PerformanceWarningMessage(m_submitTelemetry.BuildReport());
+  }
+  if (GetLayerSettings().draw_report) {
+    PerformanceWarningMessage(m_drawTelemetry.BuildReport());
+  }
+  if (GetLayerSettings().descriptor_report) {
+    PerformanceWarningMessage(m_descriptorTelemetry.BuildReport());
+  }
 }
 
 VkResult WitchDoctor::PostCallAllocateMemory(
@@ -105,16 +98,61 @@ VkResult WitchDoctor::PostCallAllocateMemory(
     return inResult;
   }
 
-  m_allocToMemTypeMap[*pMemory] = pAllocateInfo->memoryTypeIndex;
+  MemoryRecord memory_record;
+  memory_record.memory_type_index = pAllocateInfo->memoryTypeIndex;
+  memory_record.size = pAllocateInfo->allocationSize;
+  memory_record.allocation_time = Now();
+  m_memoryRecords.Insert(*pMemory, memory_record);
+  m_frameStats.Count(FrameCounter::kAllocations);
+
+  const AllocationTelemetry::Alerts alerts =
+      m_allocationTelemetry.RecordAllocation(memory_record.memory_type_index,
+                                             memory_record.size,
+                                             memory_record.allocation_time);
+  if (alerts.small_allocation_churn) {
+    ReportWarning(PerfCheck::kSmallAllocationChurn, "vkAllocateMemory",
+                  (uint64_t)m_device);
+  }
+  if (alerts.allocation_count_near_limit) {
+    ReportWarning(PerfCheck::kAllocationCountNearLimit, "vkAllocateMemory",
+                  (uint64_t)m_device);
+  }
 
   return VK_SUCCESS;
 }
 
 void WitchDoctor::PostCallFreeMemory(VkDevice device, VkDeviceMemory memory,
                                      const VkAllocationCallbacks* pAllocator) {
-  if (m_allocToMemTypeMap.find(memory) != m_allocToMemTypeMap.end()) {
-    m_allocToMemTypeMap[memory] = UINT32_MAX;
+  MemoryRecord memory_record;
+  if (m_memoryRecords.Erase(memory, &memory_record)) {
+    m_allocationTelemetry.RecordFree(memory_record.memory_type_index,
+                                     memory_record.size,
+                                     memory_record.allocation_time, Now());
+  }
+}
+
+uint32_t WitchDoctor::GetMemoryTypeIndex(VkDeviceMemory memory) const {
+  MemoryRecord memory_record;
+  if (!m_memoryRecords.Find(memory, &memory_record)) {
+    return kUnboundMemoryType;
   }
+  return memory_record.memory_type_index;
+}
+
+template <typename BindInfo>
+std::vector<uint32_t> WitchDoctor::GetBoundMemoryTypeIndices(
+    uint32_t bindInfoCount, const BindInfo* pBindInfos) {
+  std::vector<uint32_t> memory_type_indices(bindInfoCount,
+                                            kUnboundMemoryType);
+  m_memoryRecords.VisitBatch(
+      bindInfoCount,
+      [pBindInfos](size_t bind_index) { return pBindInfos[bind_index].memory; },
+      [&memory_type_indices](size_t bind_index, MemoryRecord* record) {
+        if (record != nullptr) {
+          memory_type_indices[bind_index] = record->memory_type_index;
+        }
+      });
+  return memory_type_indices;
 }
 
 VkResult WitchDoctor::PostCallBindBufferMemory(const VkResult inResult,
@@ -125,9 +163,10 @@ VkResult WitchDoctor::PostCallBindBufferMemory(const VkResult inResult,
     return inResult;
   }
 
-  if (m_bufferToMemTypeMap.find(buffer) != m_bufferToMemTypeMap.end()) {
-    m_bufferToMemTypeMap[buffer] = m_allocToMemTypeMap[memory];
-  }
+  const uint32_t memory_type_index = GetMemoryTypeIndex(memory);
+  m_bufferRecords.Update(buffer, [memory_type_index](BufferRecord& record) {
+    record.memory_type_index = memory_type_index;
+  });
 
   return VK_SUCCESS;
 }
@@ -141,8 +180,13 @@ VkResult WitchDoctor::PostCallCreateBuffer(
   }
 
   if ((pCreateInfo->usage & (VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-                             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)) != 0) {
-    m_bufferToMemTypeMap[*pBuffer] = UINT32_MAX;
+                             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                             VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)) != 0) {
+    BufferRecord buffer_record;
+    buffer_record.size = pCreateInfo->size;
+    m_bufferRecords.Insert(*pBuffer, buffer_record);
   }
 
   return VK_SUCCESS;
@@ -150,9 +194,8 @@ VkResult WitchDoctor::PostCallCreateBuffer(
 
 void WitchDoctor::PostCallDestroyBuffer(
     VkDevice device, VkBuffer buffer, const VkAllocationCallbacks* pAllocator) {
-  if (m_bufferToMemTypeMap.find(buffer) != m_bufferToMemTypeMap.end()) {
-    m_bufferToMemTypeMap.erase(buffer);
-  }
+  m_bufferRecords.Erase(buffer);
+  m_drawTelemetry.RecordBufferDestroyed((uint64_t)buffer);
 }
 
 VkResult WitchDoctor::PostCallBindBufferMemory2(
@@ -162,43 +205,564 @@ VkResult WitchDoctor::PostCallBindBufferMemory2(
     return inResult;
   }
 
-  // TODO: implement
+  const std::vector<uint32_t> memory_type_indices =
+      GetBoundMemoryTypeIndices(bindInfoCount, pBindInfos);
+  m_bufferRecords.VisitBatch(
+      bindInfoCount,
+      [pBindInfos](size_t bind_index) { return pBindInfos[bind_index].buffer; },
+      [&memory_type_indices](size_t bind_index, BufferRecord* record) {
+        if (record != nullptr) {
+          record->memory_type_index = memory_type_indices[bind_index];
+        }
+      });
+
+  return VK_SUCCESS;
+}
+
+VkResult WitchDoctor::PostCallCreateImage(
+    const VkResult inResult, VkDevice device,
+    const VkImageCreateInfo* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator, VkImage* pImage) {
+  if (inResult != VK_SUCCESS) {
+    return inResult;
+  }
+
+  ImageRecord image_record;
+  image_record.tiling = pCreateInfo->tiling;
+  image_record.usage = pCreateInfo->usage;
+  image_record.texel_count = (uint64_t)pCreateInfo->extent.width *
+                             pCreateInfo->extent.height *
+                             pCreateInfo->extent.depth *
+                             pCreateInfo->arrayLayers;
+  m_imageRecords.Insert(*pImage, image_record);
+
+  // Staging images are expected to be LINEAR, only complain about the ones
+  // the GPU actually renders to or samples from.
+  const VkImageUsageFlags gpu_access_usage =
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+      VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+  if (pCreateInfo->tiling == VK_IMAGE_TILING_LINEAR &&
+      (pCreateInfo->usage & gpu_access_usage) != 0 &&
+      image_record.texel_count >=
+          GetLayerSettings().large_linear_image_texels) {
+    ReportWarning(PerfCheck::kLargeLinearImage, "vkCreateImage",
+                  (uint64_t)*pImage);
+  }
+
+  return VK_SUCCESS;
+}
+
+void WitchDoctor::PostCallDestroyImage(
+    VkDevice device, VkImage image, const VkAllocationCallbacks* pAllocator) {
+  m_imageRecords.Erase(image);
+}
+
+VkResult WitchDoctor::PostCallBindImageMemory(const VkResult inResult,
+                                              VkDevice device, VkImage image,
+                                              VkDeviceMemory memory,
+                                              VkDeviceSize memoryOffset) {
+  if (inResult != VK_SUCCESS) {
+    return inResult;
+  }
+
+  const uint32_t memory_type_index = GetMemoryTypeIndex(memory);
+  ImageRecord image_record;
+  const bool tracked = m_imageRecords.Update(
+      image, [memory_type_index, &image_record](ImageRecord& record) {
+        record.memory_type_index = memory_type_index;
+        image_record = record;
+      });
+  if (tracked) {
+    CheckImagePlacement("vkBindImageMemory", image, image_record);
+  }
+
+  return VK_SUCCESS;
+}
+
+VkResult WitchDoctor::PostCallBindImageMemory2(
+    const VkResult inResult, VkDevice device, uint32_t bindInfoCount,
+    const VkBindImageMemoryInfo* pBindInfos) {
+  if (inResult != VK_SUCCESS) {
+    return inResult;
+  }
+
+  const std::vector<uint32_t> memory_type_indices =
+      GetBoundMemoryTypeIndices(bindInfoCount, pBindInfos);
+  // Checks run after the shard locks are released, since they may report
+  std::vector<ImageRecord> image_records(bindInfoCount);
+  std::vector<bool> tracked(bindInfoCount, false);
+  m_imageRecords.VisitBatch(
+      bindInfoCount,
+      [pBindInfos](size_t bind_index) { return pBindInfos[bind_index].image; },
+      [&](size_t bind_index, ImageRecord* record) {
+        if (record != nullptr) {
+          record->memory_type_index = memory_type_indices[bind_index];
+          image_records[bind_index] = *record;
+          tracked[bind_index] = true;
+        }
+      });
+  for (uint32_t bind_index = 0; bind_index < bindInfoCount; bind_index++) {
+    if (tracked[bind_index]) {
+      CheckImagePlacement("vkBindImageMemory2", pBindInfos[bind_index].image,
+                          image_records[bind_index]);
+    }
+  }
+
+  return VK_SUCCESS;
+}
+
+VkMemoryPropertyFlags WitchDoctor::GetMemoryPropertyFlags(
+    uint32_t memory_type_index) const {
+  if (memory_type_index >= m_physDevMemProps.memoryTypeCount) {
+    return 0;
+  }
+  return m_physDevMemProps.memoryTypes[memory_type_index].propertyFlags;
+}
+
+void WitchDoctor::CheckImagePlacement(const char* entry_point, VkImage image,
+                                      const ImageRecord& image_record) {
+  if (image_record.memory_type_index >= m_physDevMemProps.memoryTypeCount) {
+    // Memory we don't know about, e.g. allocated before the layer was loaded
+    return;
+  }
+  const VkMemoryPropertyFlags property_flags =
+      GetMemoryPropertyFlags(image_record.memory_type_index);
+  const bool is_device_local =
+      (property_flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+
+  const bool is_attachment =
+      (image_record.usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                             VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT)) != 0;
+  const bool is_sampled =
+      (image_record.usage & VK_IMAGE_USAGE_SAMPLED_BIT) != 0;
+
+  if (is_attachment && !is_device_local) {
+    ReportWarning(PerfCheck::kAttachmentNotDeviceLocal, entry_point,
+                  (uint64_t)image);
+  } else if (is_sampled && !is_device_local) {
+    ReportWarning(PerfCheck::kSampledImageNotDeviceLocal, entry_point,
+                  (uint64_t)image);
+  } else if ((is_attachment || is_sampled) && m_hasDeviceOnlyMemoryType &&
+             (property_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0) {
+    // On UMA parts every memory type is HOST_VISIBLE, so only complain when
+    // the device offers memory the host can't see.
+    ReportWarning(PerfCheck::kImageInHostVisibleMemory, entry_point,
+                  (uint64_t)image);
+  }
+
+  if ((image_record.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0 &&
+      m_hasLazilyAllocatedMemoryType &&
+      (property_flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) == 0) {
+    ReportWarning(PerfCheck::kTransientAttachmentNotLazilyAllocated,
+                  entry_point, (uint64_t)image);
+  }
+}
+
+bool WitchDoctor::IsBufferDeviceLocal(VkBuffer buffer) const {
+  BufferRecord buffer_record;
+  if (!m_bufferRecords.Find(buffer, &buffer_record)) {
+    // Not a buffer we track, so we can't say anything about it
+    return true;
+  }
+
+  const uint32_t mem_type_index = buffer_record.memory_type_index;
+  if (mem_type_index >= m_memTypeIsDeviceLocal.size()) {
+    // Created, but not bound to memory (yet)
+    return true;
+  }
+
+  return m_memTypeIsDeviceLocal[mem_type_index];
+}
+
+VkResult WitchDoctor::PostCallAllocateCommandBuffers(
+    const VkResult inResult, VkDevice device,
+    const VkCommandBufferAllocateInfo* pAllocateInfo,
+    VkCommandBuffer* pCommandBuffers) {
+  if (inResult != VK_SUCCESS) {
+    return inResult;
+  }
+
+  for (uint32_t cb_index = 0; cb_index < pAllocateInfo->commandBufferCount;
+       cb_index++) {
+    std::unique_ptr<CommandBufferState> cb_state(new CommandBufferState);
+    cb_state->command_pool = pAllocateInfo->commandPool;
+    m_cmdBufStates.Insert(pCommandBuffers[cb_index], std::move(cb_state));
+  }
+
+  return VK_SUCCESS;
+}
+
+void WitchDoctor::PostCallFreeCommandBuffers(
+    VkDevice device, VkCommandPool commandPool, uint32_t commandBufferCount,
+    const VkCommandBuffer* pCommandBuffers) {
+  for (uint32_t cb_index = 0; cb_index < commandBufferCount; cb_index++) {
+    if (pCommandBuffers[cb_index] != VK_NULL_HANDLE) {
+      m_cmdBufStates.Erase(pCommandBuffers[cb_index]);
+    }
+  }
+}
+
+void WitchDoctor::PostCallDestroyCommandPool(
+    VkDevice device, VkCommandPool commandPool,
+    const VkAllocationCallbacks* pAllocator) {
+  // Destroying a pool implicitly frees every command buffer allocated from it
+  m_cmdBufStates.EraseIf([commandPool](const CommandBufferState& cb_state) {
+    return cb_state.command_pool == commandPool;
+  });
+}
+
+VkResult WitchDoctor::PostCallBeginCommandBuffer(
+    const VkResult inResult, VkCommandBuffer commandBuffer,
+    const VkCommandBufferBeginInfo* pBeginInfo) {
+  if (inResult != VK_SUCCESS) {
+    return inResult;
+  }
+
+  // Bindings and draw counts don't carry over between recordings
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state != nullptr) {
+    cb_state->ResetBindings();
+    cb_state->draw_count = 0;
+    cb_state->draw_run = DrawRun();
+    cb_state->indirect_run = IndirectRun();
+    cb_state->draw_summary.Reset();
+    cb_state->fresh_descriptor_sets = false;
+    cb_state->fresh_set_draw_count = 0;
+    cb_state->descriptor_set_binds.clear();
+  }
 
   return VK_SUCCESS;
 }
 
+VkResult WitchDoctor::PostCallAllocateDescriptorSets(
+    const VkResult inResult, VkDevice device,
+    const VkDescriptorSetAllocateInfo* pAllocateInfo,
+    VkDescriptorSet* pDescriptorSets) {
+  if (inResult != VK_SUCCESS) {
+    return inResult;
+  }
+
+  DescriptorSetRecord set_record;
+  set_record.pool = pAllocateInfo->descriptorPool;
+  for (uint32_t set_index = 0; set_index < pAllocateInfo->descriptorSetCount;
+       set_index++) {
+    m_descriptorSetRecords.Insert(pDescriptorSets[set_index], set_record);
+  }
+  m_frameStats.Count(FrameCounter::kDescriptorSetAllocations,
+                     pAllocateInfo->descriptorSetCount);
+  m_descriptorTelemetry.RecordAllocate(
+      (uint64_t)pAllocateInfo->descriptorPool,
+      pAllocateInfo->descriptorSetCount);
+
+  return VK_SUCCESS;
+}
+
+VkResult WitchDoctor::PostCallFreeDescriptorSets(
+    const VkResult inResult, VkDevice device, VkDescriptorPool descriptorPool,
+    uint32_t descriptorSetCount, const VkDescriptorSet* pDescriptorSets) {
+  if (inResult != VK_SUCCESS) {
+    return inResult;
+  }
+
+  RetiredContents retired;
+  uint32_t freed_set_count = 0;
+  for (uint32_t set_index = 0; set_index < descriptorSetCount; set_index++) {
+    DescriptorSetRecord set_record;
+    if (pDescriptorSets[set_index] != VK_NULL_HANDLE &&
+        m_descriptorSetRecords.Erase(pDescriptorSets[set_index],
+                                     &set_record)) {
+      set_record.Retire(&retired);
+      freed_set_count++;
+    }
+  }
+  m_descriptorTelemetry.RecordFree((uint64_t)descriptorPool, freed_set_count);
+  m_descriptorTelemetry.RecordRetiredContents(retired);
+
+  return VK_SUCCESS;
+}
+
+VkResult WitchDoctor::PostCallResetDescriptorPool(
+    const VkResult inResult, VkDevice device, VkDescriptorPool descriptorPool,
+    VkDescriptorPoolResetFlags flags) {
+  if (inResult != VK_SUCCESS) {
+    return inResult;
+  }
+
+  // Resetting a pool implicitly frees every set allocated from it
+  RetiredContents retired;
+  m_descriptorSetRecords.EraseIf(
+      [descriptorPool, &retired](const DescriptorSetRecord& set_record) {
+        if (set_record.pool != descriptorPool) {
+          return false;
+        }
+        set_record.Retire(&retired);
+        return true;
+      });
+  m_frameStats.Count(FrameCounter::kDescriptorPoolResets);
+  m_descriptorTelemetry.RecordReset((uint64_t)descriptorPool);
+  m_descriptorTelemetry.RecordRetiredContents(retired);
+
+  return VK_SUCCESS;
+}
+
+void WitchDoctor::PostCallDestroyDescriptorPool(
+    VkDevice device, VkDescriptorPool descriptorPool,
+    const VkAllocationCallbacks* pAllocator) {
+  RetiredContents retired;
+  m_descriptorSetRecords.EraseIf(
+      [descriptorPool, &retired](const DescriptorSetRecord& set_record) {
+        if (set_record.pool != descriptorPool) {
+          return false;
+        }
+        set_record.Retire(&retired);
+        return true;
+      });
+  m_descriptorTelemetry.RecordDestroy((uint64_t)descriptorPool);
+  m_descriptorTelemetry.RecordRetiredContents(retired);
+}
+
+void WitchDoctor::PostCallUpdateDescriptorSets(
+    VkDevice device, uint32_t descriptorWriteCount,
+    const VkWriteDescriptorSet* pDescriptorWrites,
+    uint32_t descriptorCopyCount,
+    const VkCopyDescriptorSet* pDescriptorCopies) {
+  m_frameStats.Count(FrameCounter::kDescriptorWrites,
+                     descriptorWriteCount + descriptorCopyCount);
+
+  // The last write or copy to a binding decides whether it is flagged. Writes
+  // that spill over into the following bindings only count for the first.
+  RetiredContents retired;
+  for (uint32_t write_index = 0; write_index < descriptorWriteCount;
+       write_index++) {
+    const VkWriteDescriptorSet& write = pDescriptorWrites[write_index];
+    const bool buffer_write =
+        write.dstBinding < kMaxTrackedDescriptorBindings &&
+        IsBufferDescriptorType(write.descriptorType);
+
+    VkBuffer non_device_local_buffer = VK_NULL_HANDLE;
+    for (uint32_t element = 0; buffer_write && element < write.descriptorCount;
+         element++) {
+      const VkBuffer buffer = write.pBufferInfo[element].buffer;
+      if (buffer != VK_NULL_HANDLE && !IsBufferDeviceLocal(buffer)) {
+        non_device_local_buffer = buffer;
+        break;
+      }
+    }
+
+    m_descriptorSetRecords.Update(
+        write.dstSet, [&](DescriptorSetRecord& set_record) {
+          set_record.BeginWrite(&retired);
+          if (buffer_write) {
+            set_record.WriteBufferBinding(write.dstBinding,
+                                          non_device_local_buffer);
+          }
+        });
+  }
+
+  for (uint32_t copy_index = 0; copy_index < descriptorCopyCount;
+       copy_index++) {
+    const VkCopyDescriptorSet& copy = pDescriptorCopies[copy_index];
+    DescriptorSetRecord src_record;
+    if (!m_descriptorSetRecords.Find(copy.srcSet, &src_record)) {
+      continue;
+    }
+
+    // Whatever the copied binding holds, only buffer bindings are ever
+    // flagged
+    const bool buffer_copy =
+        copy.srcBinding < kMaxTrackedDescriptorBindings &&
+        copy.dstBinding < kMaxTrackedDescriptorBindings;
+    const bool non_device_local =
+        buffer_copy && (src_record.non_device_local_bindings &
+                        ((uint64_t)1 << copy.srcBinding)) != 0;
+    m_descriptorSetRecords.Update(
+        copy.dstSet, [&](DescriptorSetRecord& set_record) {
+          set_record.BeginWrite(&retired);
+          if (buffer_copy) {
+            set_record.WriteBufferBinding(
+                copy.dstBinding, non_device_local
+                                     ? src_record.non_device_local_buffer
+                                     : VK_NULL_HANDLE);
+          }
+        });
+  }
+
+  m_descriptorTelemetry.RecordRetiredContents(retired);
+}
+
+VkResult WitchDoctor::PostCallCreateDescriptorUpdateTemplate(
+    const VkResult inResult, VkDevice device,
+    const VkDescriptorUpdateTemplateCreateInfo* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator,
+    VkDescriptorUpdateTemplate* pDescriptorUpdateTemplate) {
+  if (inResult != VK_SUCCESS) {
+    return inResult;
+  }
+
+  // Push descriptor templates never touch a set
+  if (pCreateInfo->templateType ==
+      VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET) {
+    std::unique_ptr<DescriptorUpdateTemplate> update_template(
+        new DescriptorUpdateTemplate);
+    for (uint32_t entry_index = 0;
+         entry_index < pCreateInfo->descriptorUpdateEntryCount;
+         entry_index++) {
+      const VkDescriptorUpdateTemplateEntry& entry =
+          pCreateInfo->pDescriptorUpdateEntries[entry_index];
+      if (entry.dstBinding < kMaxTrackedDescriptorBindings &&
+          IsBufferDescriptorType(entry.descriptorType)) {
+        update_template->buffer_entries.push_back(entry);
+      }
+    }
+    m_descriptorUpdateTemplates.Insert(*pDescriptorUpdateTemplate,
+                                       std::move(update_template));
+  }
+
+  return VK_SUCCESS;
+}
+
+void WitchDoctor::PostCallDestroyDescriptorUpdateTemplate(
+    VkDevice device, VkDescriptorUpdateTemplate descriptorUpdateTemplate,
+    const VkAllocationCallbacks* pAllocator) {
+  m_descriptorUpdateTemplates.Erase(descriptorUpdateTemplate);
+}
+
+void WitchDoctor::PostCallUpdateDescriptorSetWithTemplate(
+    VkDevice device, VkDescriptorSet descriptorSet,
+    VkDescriptorUpdateTemplate descriptorUpdateTemplate, const void* pData) {
+  m_frameStats.Count(FrameCounter::kDescriptorWrites);
+
+  // Without the template or its data, as in a replayed trace, the update
+  // still counts but the buffers it writes are unknown
+  const DescriptorUpdateTemplate* update_template =
+      pData != nullptr ? m_descriptorUpdateTemplates.Find(
+                             descriptorUpdateTemplate)
+                       : nullptr;
+  std::vector<VkBuffer> non_device_local_buffers;
+  if (update_template != nullptr) {
+    non_device_local_buffers.resize(update_template->buffer_entries.size());
+    for (size_t entry_index = 0;
+         entry_index < update_template->buffer_entries.size();
+         entry_index++) {
+      const VkDescriptorUpdateTemplateEntry& entry =
+          update_template->buffer_entries[entry_index];
+      for (uint32_t element = 0; element < entry.descriptorCount; element++) {
+        const VkDescriptorBufferInfo* buffer_info =
+            reinterpret_cast<const VkDescriptorBufferInfo*>(
+                static_cast<const char*>(pData) + entry.offset +
+                element * entry.stride);
+        if (buffer_info->buffer != VK_NULL_HANDLE &&
+            !IsBufferDeviceLocal(buffer_info->buffer)) {
+          non_device_local_buffers[entry_index] = buffer_info->buffer;
+          break;
+        }
+      }
+    }
+  }
+
+  RetiredContents retired;
+  m_descriptorSetRecords.Update(
+      descriptorSet, [&](DescriptorSetRecord& set_record) {
+        set_record.BeginWrite(&retired);
+        for (size_t entry_index = 0;
+             entry_index < non_device_local_buffers.size(); entry_index++) {
+          set_record.WriteBufferBinding(
+              update_template->buffer_entries[entry_index].dstBinding,
+              non_device_local_buffers[entry_index]);
+        }
+      });
+  m_descriptorTelemetry.RecordRetiredContents(retired);
+}
+
 // TODO: Report through debug_utils or stderr
 
 void WitchDoctor::PostCallCmdDraw(VkCommandBuffer commandBuffer,
                                   uint32_t vertexCount, uint32_t instanceCount,
                                   uint32_t firstVertex,
                                   uint32_t firstInstance) {
-  if (!m_vertex_buffers_are_device_local) {
-    LOG_MESSAGE
-        << "vkCmdDraw is using vertex buffers that are not DEVICE_LOCAL";
+  m_frameStats.Count(FrameCounter::kDraws);
+
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    return;
+  }
+  cb_state->draw_count++;
+  RecordDirectDraw(cb_state, false, vertexCount, instanceCount);
+
+  if (!cb_state->VertexBuffersAreDeviceLocal()) {
+    ReportWarning(PerfCheck::kVertexBufferNotDeviceLocal, "vkCmdDraw",
+                  (uint64_t)cb_state->FirstNonDeviceLocalVertexBuffer());
   }
 }
 
 void WitchDoctor::PostCallCmdDrawIndexed(
     VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount,
     uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) {
-  if (!m_index_buffer_is_device_local) {
-    LOG_MESSAGE
-        << "vkCmdDrawIndexed is using index buffer that is not DEVICE_LOCAL";
+  m_frameStats.Count(FrameCounter::kDraws);
+
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    return;
+  }
+  cb_state->draw_count++;
+  RecordDirectDraw(cb_state, true, indexCount, instanceCount);
+
+  if (!cb_state->index_buffer_is_device_local) {
+    ReportWarning(PerfCheck::kIndexBufferNotDeviceLocal, "vkCmdDrawIndexed",
+                  (uint64_t)cb_state->index_buffer);
+  }
+
+  // The layer never sees the index values, but a buffer holding no more
+  // indices than 16 bits can address can't reference more distinct vertices
+  // than that either. Whether they span a small enough range to rebase with
+  // vertexOffset is up to the application, so the draws are only aggregated
+  // per buffer and warned about once per stretch of draws from it.
+  const uint64_t index_capacity =
+      cb_state->index_buffer_range / sizeof(uint32_t);
+  const uint64_t index_end = (uint64_t)firstIndex + indexCount;
+  if (cb_state->index_type == VK_INDEX_TYPE_UINT32 && index_capacity != 0 &&
+      index_capacity <= kMaxUint16IndexCount && index_end <= index_capacity) {
+    // Every instance fetches the indices again
+    const uint64_t saveable_bytes = (uint64_t)indexCount * instanceCount *
+                                    (sizeof(uint32_t) - sizeof(uint16_t));
+    m_frameStats.Count(FrameCounter::kSaveableIndexBytes, saveable_bytes);
+    // The index capacity is counted from the bound offset, the report's
+    // ranges from the start of the buffer
+    const uint64_t offset_indices =
+        cb_state->index_buffer_offset / sizeof(uint32_t);
+    if (cb_state->draw_summary.RecordIndexBufferUse(
+            (uint64_t)cb_state->index_buffer, offset_indices + index_capacity,
+            offset_indices + index_end, vertexOffset, saveable_bytes)) {
+      ReportWarning(PerfCheck::kIndexBufferCouldBe16Bit, "vkCmdDrawIndexed",
+                    (uint64_t)cb_state->index_buffer);
+    }
   }
 
-  if (!m_vertex_buffers_are_device_local) {
-    LOG_MESSAGE
-        << "vkCmdDraw is using vertex buffers that are not DEVICE_LOCAL";
+  if (!cb_state->VertexBuffersAreDeviceLocal()) {
+    ReportWarning(PerfCheck::kVertexBufferNotDeviceLocal, "vkCmdDrawIndexed",
+                  (uint64_t)cb_state->FirstNonDeviceLocalVertexBuffer());
   }
 }
 
 void WitchDoctor::PostCallCmdDrawIndirect(VkCommandBuffer commandBuffer,
                                           VkBuffer buffer, VkDeviceSize offset,
                                           uint32_t drawCount, uint32_t stride) {
-  if (!m_vertex_buffers_are_device_local) {
-    LOG_MESSAGE << "vkCmdDrawIndirect is using vertex buffers that are not "
-                   "DEVICE_LOCAL";
+  m_frameStats.Count(FrameCounter::kDraws);
+
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    return;
+  }
+  cb_state->draw_count++;
+  RecordIndirectDraw(cb_state, "vkCmdDrawIndirect", false, buffer, offset,
+                     drawCount, VK_NULL_HANDLE);
+
+  if (!cb_state->VertexBuffersAreDeviceLocal()) {
+    ReportWarning(PerfCheck::kVertexBufferNotDeviceLocal, "vkCmdDrawIndirect",
+                  (uint64_t)cb_state->FirstNonDeviceLocalVertexBuffer());
   }
 }
 void WitchDoctor::PostCallCmdDrawIndexedIndirect(VkCommandBuffer commandBuffer,
@@ -206,14 +770,138 @@ void WitchDoctor::PostCallCmdDrawIndexedIndirect(VkCommandBuffer commandBuffer,
                                                  VkDeviceSize offset,
                                                  uint32_t drawCount,
                                                  uint32_t stride) {
-  if (!m_index_buffer_is_device_local) {
-    LOG_MESSAGE << "vkCmdDrawIndexedIndirect is using index buffer that is not "
-                   "DEVICE_LOCAL";
+  m_frameStats.Count(FrameCounter::kDraws);
+
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    return;
   }
+  cb_state->draw_count++;
+  RecordIndirectDraw(cb_state, "vkCmdDrawIndexedIndirect", true, buffer,
+                     offset, drawCount, VK_NULL_HANDLE);
 
-  if (!m_vertex_buffers_are_device_local) {
-    LOG_MESSAGE << "vkCmdDrawIndexedIndirect is using vertex buffers that are "
-                   "not DEVICE_LOCAL";
+  if (!cb_state->index_buffer_is_device_local) {
+    ReportWarning(PerfCheck::kIndexBufferNotDeviceLocal,
+                  "vkCmdDrawIndexedIndirect", (uint64_t)cb_state->index_buffer);
+  }
+
+  if (!cb_state->VertexBuffersAreDeviceLocal()) {
+    ReportWarning(PerfCheck::kVertexBufferNotDeviceLocal,
+                  "vkCmdDrawIndexedIndirect",
+                  (uint64_t)cb_state->FirstNonDeviceLocalVertexBuffer());
+  }
+}
+
+void WitchDoctor::PostCallCmdDrawIndirectCount(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+    VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount,
+    uint32_t stride) {
+  m_frameStats.Count(FrameCounter::kDraws);
+
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    return;
+  }
+  cb_state->draw_count++;
+  RecordIndirectDraw(cb_state, "vkCmdDrawIndirectCount", false, buffer, offset,
+                     maxDrawCount, countBuffer);
+
+  if (!cb_state->VertexBuffersAreDeviceLocal()) {
+    ReportWarning(PerfCheck::kVertexBufferNotDeviceLocal,
+                  "vkCmdDrawIndirectCount",
+                  (uint64_t)cb_state->FirstNonDeviceLocalVertexBuffer());
+  }
+}
+
+void WitchDoctor::PostCallCmdDrawIndexedIndirectCount(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+    VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount,
+    uint32_t stride) {
+  m_frameStats.Count(FrameCounter::kDraws);
+
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    return;
+  }
+  cb_state->draw_count++;
+  RecordIndirectDraw(cb_state, "vkCmdDrawIndexedIndirectCount", true, buffer,
+                     offset, maxDrawCount, countBuffer);
+
+  if (!cb_state->index_buffer_is_device_local) {
+    ReportWarning(PerfCheck::kIndexBufferNotDeviceLocal,
+                  "vkCmdDrawIndexedIndirectCount",
+                  (uint64_t)cb_state->index_buffer);
+  }
+
+  if (!cb_state->VertexBuffersAreDeviceLocal()) {
+    ReportWarning(PerfCheck::kVertexBufferNotDeviceLocal,
+                  "vkCmdDrawIndexedIndirectCount",
+                  (uint64_t)cb_state->FirstNonDeviceLocalVertexBuffer());
+  }
+}
+
+void WitchDoctor::PostCallCmdDispatch(VkCommandBuffer commandBuffer,
+                                      uint32_t groupCountX,
+                                      uint32_t groupCountY,
+                                      uint32_t groupCountZ) {
+  m_frameStats.Count(FrameCounter::kDispatches);
+
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    return;
+  }
+  // Merging draws across a dispatch would reorder them against it
+  CloseDrawRun(cb_state);
+  CloseIndirectRun(cb_state);
+
+  CheckComputeBuffers("vkCmdDispatch", *cb_state);
+}
+
+void WitchDoctor::PostCallCmdDispatchIndirect(VkCommandBuffer commandBuffer,
+                                              VkBuffer buffer,
+                                              VkDeviceSize offset) {
+  m_frameStats.Count(FrameCounter::kDispatches);
+
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    return;
+  }
+  CloseDrawRun(cb_state);
+  CloseIndirectRun(cb_state);
+
+  if (!IsBufferDeviceLocal(buffer)) {
+    ReportWarning(PerfCheck::kIndirectBufferNotDeviceLocal,
+                  "vkCmdDispatchIndirect", (uint64_t)buffer);
+  }
+  CheckComputeBuffers("vkCmdDispatchIndirect", *cb_state);
+}
+
+void WitchDoctor::PostCallCmdExecuteCommands(
+    VkCommandBuffer commandBuffer, uint32_t commandBufferCount,
+    const VkCommandBuffer* pCommandBuffers) {
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    return;
+  }
+
+  // The state bound in the primary is undefined after executing secondaries,
+  // so the binds that follow are required rather than redundant
+  CloseDrawRun(cb_state);
+  CloseIndirectRun(cb_state);
+  cb_state->ResetBindings();
+  cb_state->bind_generation++;
+
+  // Only primaries are submitted, so they carry the binds of their secondaries
+  for (uint32_t cb_index = 0; cb_index < commandBufferCount; cb_index++) {
+    const CommandBufferState* secondary_state =
+        m_cmdBufStates.Find(pCommandBuffers[cb_index]);
+    if (secondary_state == nullptr) {
+      continue;
+    }
+    for (const auto& secondary_binds : secondary_state->descriptor_set_binds) {
+      cb_state->descriptor_set_binds[secondary_binds.first].bind_count +=
+          secondary_binds.second.bind_count;
+    }
   }
 }
 
@@ -221,12 +909,32 @@ void WitchDoctor::PostCallCmdBindIndexBuffer(VkCommandBuffer commandBuffer,
                                              VkBuffer buffer,
                                              VkDeviceSize offset,
                                              VkIndexType indexType) {
-  // TODO: Monitor for using VK_INDEX_TYPE_UINT32 if they don't have large index
-  // counts
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    m_frameStats.Count(FrameCounter::kBinds);
+    return;
+  }
+
+  const bool redundant = cb_state->index_buffer != VK_NULL_HANDLE &&
+                         cb_state->index_buffer == buffer &&
+                         cb_state->index_buffer_offset == offset &&
+                         cb_state->index_type == indexType;
+  RecordBind(redundant, "vkCmdBindIndexBuffer", commandBuffer);
+  if (cb_state->index_buffer != buffer || cb_state->index_type != indexType) {
+    cb_state->bind_generation++;
+  }
 
-  uint32_t mem_type_index = m_bufferToMemTypeMap[buffer];
-  m_index_buffer_is_device_local =
-      (m_memTypeIsDeviceLocal[mem_type_index] == true);
+  BufferRecord buffer_record;
+  const bool buffer_is_tracked = m_bufferRecords.Find(buffer, &buffer_record);
+
+  cb_state->index_buffer = buffer;
+  cb_state->index_buffer_offset = offset;
+  cb_state->index_buffer_range =
+      buffer_is_tracked && buffer_record.size > offset
+          ? buffer_record.size - offset
+          : 0;
+  cb_state->index_type = indexType;
+  cb_state->index_buffer_is_device_local = IsBufferDeviceLocal(buffer);
 }
 
 void WitchDoctor::PostCallCmdBindVertexBuffers(VkCommandBuffer commandBuffer,
@@ -234,18 +942,381 @@ void WitchDoctor::PostCallCmdBindVertexBuffers(VkCommandBuffer commandBuffer,
                                                uint32_t bindingCount,
                                                const VkBuffer* pBuffers,
                                                const VkDeviceSize* pOffsets) {
-  bool all_buffers_device_local = true;
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr) {
+    m_frameStats.Count(FrameCounter::kBinds);
+    return;
+  }
+
+  // Bindings past the tracked ones can't be compared, so they always count
+  // as a change
+  bool same_buffers = bindingCount > 0 &&
+                      firstBinding + bindingCount <= kMaxTrackedVertexBindings;
+  bool redundant = same_buffers;
+  for (uint32_t buffer_index = 0; same_buffers && buffer_index < bindingCount;
+       buffer_index++) {
+    const uint32_t binding = firstBinding + buffer_index;
+    same_buffers =
+        (cb_state->bound_vertex_bindings & (1u << binding)) != 0 &&
+        cb_state->vertex_buffers[binding] == pBuffers[buffer_index];
+    redundant = same_buffers && redundant &&
+                cb_state->vertex_buffer_offsets[binding] ==
+                    pOffsets[buffer_index];
+  }
+  RecordBind(redundant, "vkCmdBindVertexBuffers", commandBuffer);
+  // Moving the offsets within the same buffers keeps draw runs going
+  if (!same_buffers) {
+    cb_state->bind_generation++;
+  }
+
   for (uint32_t buffer_index = 0; buffer_index < bindingCount; buffer_index++) {
+    const uint32_t binding = firstBinding + buffer_index;
+    if (binding >= kMaxTrackedVertexBindings) {
+      break;
+    }
+
+    const uint32_t binding_bit = (1u << binding);
     VkBuffer buffer = pBuffers[buffer_index];
-    uint32_t mem_type_index = m_bufferToMemTypeMap[buffer];
-    if (m_memTypeIsDeviceLocal[mem_type_index] == false) {
-      all_buffers_device_local = false;
+    cb_state->vertex_buffers[binding] = buffer;
+    cb_state->vertex_buffer_offsets[binding] = pOffsets[buffer_index];
+
+    if (buffer == VK_NULL_HANDLE) {
+      // Allowed with nullDescriptor, and means the slot is unused
+      cb_state->bound_vertex_bindings &= ~binding_bit;
+    } else {
+      cb_state->bound_vertex_bindings |= binding_bit;
+    }
+
+    if (IsBufferDeviceLocal(buffer)) {
+      cb_state->non_device_local_vertex_bindings &= ~binding_bit;
+    } else {
+      cb_state->non_device_local_vertex_bindings |= binding_bit;
+    }
+  }
+}
+
+void WitchDoctor::PostCallCmdBindPipeline(VkCommandBuffer commandBuffer,
+                                          VkPipelineBindPoint pipelineBindPoint,
+                                          VkPipeline pipeline) {
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr ||
+      (uint32_t)pipelineBindPoint >= kTrackedBindPointCount) {
+    m_frameStats.Count(FrameCounter::kBinds);
+    return;
+  }
+
+  CommandBufferState::BindPointState& bind_point =
+      cb_state->bind_points[pipelineBindPoint];
+  const bool redundant = bind_point.pipeline == pipeline;
+  RecordBind(redundant, "vkCmdBindPipeline", commandBuffer);
+  if (!redundant) {
+    cb_state->bind_generation++;
+  }
+  bind_point.pipeline = pipeline;
+}
+
+void WitchDoctor::PostCallCmdBindDescriptorSets(
+    VkCommandBuffer commandBuffer, VkPipelineBindPoint pipelineBindPoint,
+    VkPipelineLayout layout, uint32_t firstSet, uint32_t descriptorSetCount,
+    const VkDescriptorSet* pDescriptorSets, uint32_t dynamicOffsetCount,
+    const uint32_t* pDynamicOffsets) {
+  CommandBufferState* cb_state = m_cmdBufStates.Find(commandBuffer);
+  if (cb_state == nullptr ||
+      (uint32_t)pipelineBindPoint >= kTrackedBindPointCount) {
+    m_frameStats.Count(FrameCounter::kBinds);
+    return;
+  }
+
+  CommandBufferState::BindPointState& bind_point =
+      cb_state->bind_points[pipelineBindPoint];
+  // Binding with another layout may disturb sets outside the range, so
+  // nothing is known about them afterwards. Dynamic offsets are not tracked,
+  // so binds that carry any always count as a change.
+  if (bind_point.layout != layout) {
+    bind_point.layout = layout;
+    bind_point.bound_descriptor_sets = 0;
+  }
+  bool same_sets = descriptorSetCount > 0 &&
+                   firstSet + descriptorSetCount <= kMaxTrackedDescriptorSets;
+  for (uint32_t set_index = 0; same_sets && set_index < descriptorSetCount;
+       set_index++) {
+    const uint32_t set = firstSet + set_index;
+    same_sets = (bind_point.bound_descriptor_sets & (1u << set)) != 0 &&
+                bind_point.descriptor_sets[set] == pDescriptorSets[set_index];
+  }
+  RecordBind(same_sets && dynamicOffsetCount == 0, "vkCmdBindDescriptorSets",
+             commandBuffer);
+  // Moving the dynamic offsets within the same sets keeps draw runs going
+  if (!same_sets) {
+    cb_state->bind_generation++;
+  }
+
+  for (uint32_t set_index = 0; set_index < descriptorSetCount; set_index++) {
+    const uint32_t set = firstSet + set_index;
+    if (set >= kMaxTrackedDescriptorSets) {
       break;
     }
+    bind_point.descriptor_sets[set] = pDescriptorSets[set_index];
+    bind_point.bound_descriptor_sets |= (1u << set);
+
+    auto set_binds = cb_state->descriptor_set_binds.emplace(
+        pDescriptorSets[set_index], CommandBufferState::DescriptorSetBinds());
+    if (set_binds.second) {
+      DescriptorSetRecord set_record;
+      if (m_descriptorSetRecords.Find(pDescriptorSets[set_index],
+                                      &set_record)) {
+        if (set_record.written && set_record.binds_since_write == 0) {
+          cb_state->fresh_descriptor_sets = true;
+        }
+        set_binds.first->second.non_device_local_buffer =
+            set_record.non_device_local_buffer;
+      }
+    }
+    set_binds.first->second.bind_count++;
+    // Only compute dispatches are checked, see CheckComputeBuffers()
+    if (pipelineBindPoint == VK_PIPELINE_BIND_POINT_COMPUTE) {
+      bind_point.non_device_local_buffers[set] =
+          set_binds.first->second.non_device_local_buffer;
+    }
+  }
+}
+
+void WitchDoctor::RecordBind(bool redundant, const char* entry_point,
+                             VkCommandBuffer commandBuffer) {
+  m_frameStats.Count(FrameCounter::kBinds);
+  if (redundant) {
+    m_frameStats.Count(FrameCounter::kRedundantBinds);
+    ReportWarning(PerfCheck::kRedundantBind, entry_point,
+                  (uint64_t)commandBuffer);
+  }
+}
+
+void WitchDoctor::RecordDirectDraw(CommandBufferState* cb_state, bool indexed,
+                                   uint32_t element_count,
+                                   uint32_t instance_count) {
+  // Merging indirect calls across a direct draw would reorder the draws
+  CloseIndirectRun(cb_state);
+  cb_state->CountFreshSetDraw();
+  cb_state->draw_summary.RecordDrawSize(
+      (uint64_t)element_count * instance_count,
+      GetLayerSettings().tiny_draw_vertices);
+
+  DrawRun draw;
+  draw.pipeline =
+      (uint64_t)cb_state->bind_points[VK_PIPELINE_BIND_POINT_GRAPHICS].pipeline;
+  draw.indexed = indexed;
+  draw.element_count = element_count;
+  draw.instance_count = instance_count;
+  draw.bind_generation = cb_state->bind_generation;
+  if (cb_state->draw_run.Extends(draw)) {
+    cb_state->draw_run.draw_count++;
+    return;
+  }
+
+  CloseDrawRun(cb_state);
+  draw.draw_count = 1;
+  cb_state->draw_run = draw;
+}
+
+bool WitchDoctor::ReportInstancingCandidate(const DrawRun& run) {
+  const uint32_t min_instancing_run = GetLayerSettings().min_instancing_run;
+  if (min_instancing_run == 0 || run.draw_count < min_instancing_run) {
+    return false;
+  }
+  ReportWarning(PerfCheck::kInstancingCandidate,
+                run.indexed ? "vkCmdDrawIndexed" : "vkCmdDraw", run.pipeline);
+  return true;
+}
+
+void WitchDoctor::CloseDrawRun(CommandBufferState* cb_state) {
+  if (ReportInstancingCandidate(cb_state->draw_run)) {
+    cb_state->draw_summary.merge_candidates.push_back(cb_state->draw_run);
+  }
+  cb_state->draw_run = DrawRun();
+}
+
+void WitchDoctor::RecordIndirectDraw(CommandBufferState* cb_state,
+                                     const char* entry_point, bool indexed,
+                                     VkBuffer buffer, VkDeviceSize offset,
+                                     uint32_t drawCount, VkBuffer countBuffer) {
+  cb_state->CountFreshSetDraw();
+  // Both are read by the GPU every time the command buffer executes
+  if (!IsBufferDeviceLocal(buffer)) {
+    ReportWarning(PerfCheck::kIndirectBufferNotDeviceLocal, entry_point,
+                  (uint64_t)buffer);
+  }
+  if (countBuffer != VK_NULL_HANDLE && !IsBufferDeviceLocal(countBuffer)) {
+    ReportWarning(PerfCheck::kIndirectBufferNotDeviceLocal, entry_point,
+                  (uint64_t)countBuffer);
+  }
+
+  // The layer can't see what indirect draws draw
+  CloseDrawRun(cb_state);
+
+  DrawSummary& draw_summary = cb_state->draw_summary;
+  draw_summary.indirect_call_count++;
+  if (countBuffer != VK_NULL_HANDLE) {
+    draw_summary.indirect_count_call_count++;
+  }
+  // Calls with a count buffer or several draws are multi-draw calls already
+  if (countBuffer != VK_NULL_HANDLE || drawCount != 1) {
+    CloseIndirectRun(cb_state);
+    return;
+  }
+  draw_summary.single_indirect_call_count++;
+
+  IndirectRun& run = cb_state->indirect_run;
+  if (run.call_count > 0 && run.buffer == (uint64_t)buffer &&
+      run.indexed == indexed &&
+      run.bind_generation == cb_state->bind_generation &&
+      offset > run.last_offset) {
+    // The first step sets the stride, and has to be one a multi-draw call
+    // accepts
+    const uint64_t step = offset - run.last_offset;
+    const uint64_t command_size = indexed
+                                      ? sizeof(VkDrawIndexedIndirectCommand)
+                                      : sizeof(VkDrawIndirectCommand);
+    const bool extends = run.stride == 0
+                             ? step >= command_size && step % 4 == 0
+                             : step == run.stride;
+    if (extends) {
+      run.stride = step;
+      run.last_offset = offset;
+      run.call_count++;
+      return;
+    }
+  }
+
+  CloseIndirectRun(cb_state);
+  run.buffer = (uint64_t)buffer;
+  run.indexed = indexed;
+  run.last_offset = offset;
+  run.bind_generation = cb_state->bind_generation;
+  run.call_count = 1;
+}
+
+bool WitchDoctor::ReportMultiDrawCandidate(const IndirectRun& run) {
+  const uint32_t min_multi_draw_run = GetLayerSettings().min_multi_draw_run;
+  if (min_multi_draw_run == 0 || run.call_count < min_multi_draw_run) {
+    return false;
+  }
+  ReportWarning(PerfCheck::kMultiDrawCandidate,
+                run.indexed ? "vkCmdDrawIndexedIndirect" : "vkCmdDrawIndirect",
+                run.buffer);
+  return true;
+}
+
+void WitchDoctor::CloseIndirectRun(CommandBufferState* cb_state) {
+  if (ReportMultiDrawCandidate(cb_state->indirect_run)) {
+    cb_state->draw_summary.multi_draw_candidates.push_back(
+        cb_state->indirect_run);
+  }
+  cb_state->indirect_run = IndirectRun();
+}
+
+// Graphics pipelines aren't checked the same way: small uniform buffers that
+// the host rewrites every frame are usually best left in host-visible memory.
+// Compute work tends to stream through large storage buffers instead.
+void WitchDoctor::CheckComputeBuffers(const char* entry_point,
+                                      const CommandBufferState& cb_state) {
+  const VkBuffer buffer =
+      cb_state.bind_points[VK_PIPELINE_BIND_POINT_COMPUTE]
+          .FirstNonDeviceLocalDescriptorBuffer();
+  if (buffer != VK_NULL_HANDLE) {
+    ReportWarning(PerfCheck::kComputeBufferNotDeviceLocal, entry_point,
+                  (uint64_t)buffer);
   }
-  m_vertex_buffers_are_device_local = all_buffers_device_local;
 }
 
-// TODO: What about compute buffers?
+// Once per submit rather than per bind, since updating a record takes a lock
+void WitchDoctor::CountDescriptorSetBinds(const CommandBufferState& cb_state) {
+  for (const auto& set_binds : cb_state.descriptor_set_binds) {
+    const uint32_t bind_count = set_binds.second.bind_count;
+    m_descriptorSetRecords.Update(
+        set_binds.first, [bind_count](DescriptorSetRecord& set_record) {
+          // DescriptorSetRecord only counts up to 2
+          set_record.binds_since_write =
+              std::min(set_record.binds_since_write + bind_count, 2u);
+        });
+  }
+}
+
+VkResult WitchDoctor::PostCallQueueSubmit(const VkResult inResult,
+                                          VkQueue queue, uint32_t submitCount,
+                                          const VkSubmitInfo* pSubmits,
+                                          VkFence fence) {
+  m_frameStats.Count(FrameCounter::kSubmits);
+  if (inResult != VK_SUCCESS) {
+    return inResult;
+  }
+
+  uint32_t command_buffer_count = 0;
+  uint64_t draw_count = 0;
+  for (uint32_t submit_index = 0; submit_index < submitCount; submit_index++) {
+    const VkSubmitInfo& submit_info = pSubmits[submit_index];
+    command_buffer_count += submit_info.commandBufferCount;
+    for (uint32_t cb_index = 0; cb_index < submit_info.commandBufferCount;
+         cb_index++) {
+      const CommandBufferState* cb_state =
+          m_cmdBufStates.Find(submit_info.pCommandBuffers[cb_index]);
+      if (cb_state != nullptr) {
+        draw_count += cb_state->draw_count;
+        // The runs still open at the end of the recording are handed over as
+        // they are, since the command buffer may be in flight on another queue
+        ReportInstancingCandidate(cb_state->draw_run);
+        ReportMultiDrawCandidate(cb_state->indirect_run);
+        m_drawTelemetry.RecordSubmit(cb_state->draw_summary,
+                                     cb_state->draw_run,
+                                     cb_state->indirect_run);
+        m_descriptorTelemetry.RecordSubmit(cb_state->draw_count,
+                                           cb_state->fresh_set_draw_count);
+        CountDescriptorSetBinds(*cb_state);
+      }
+    }
+  }
+  m_submitTelemetry.RecordSubmit(submitCount, command_buffer_count,
+                                 draw_count);
+
+  return VK_SUCCESS;
+}
+
+VkResult WitchDoctor::PostCallAcquireNextImageKHR(
+    const VkResult inResult, VkDevice device, VkSwapchainKHR swapchain,
+    uint64_t timeout, VkSemaphore semaphore, VkFence fence,
+    uint32_t* pImageIndex) {
+  // A suboptimal swapchain still hands out an image
+  if (inResult == VK_SUCCESS || inResult == VK_SUBOPTIMAL_KHR) {
+    m_frameStats.RecordAcquire(Now());
+  }
+  return inResult;
+}
+
+VkResult WitchDoctor::PostCallQueuePresentKHR(
+    const VkResult inResult, VkQueue queue,
+    const VkPresentInfoKHR* pPresentInfo) {
+  // Failed presents still end the application's frame
+  const FrameStats::Frame frame = m_frameStats.RecordPresent(Now());
+  if (frame.report_spike) {
+    PerformanceWarningMessage(FrameStats::FormatSpike(frame));
+  }
+
+  const SubmitTelemetry::Alerts alerts = m_submitTelemetry.RecordPresent();
+  if (alerts.many_submits) {
+    ReportWarning(PerfCheck::kManySubmitsPerFrame, "vkQueueSubmit",
+                  (uint64_t)m_device);
+  }
+  if (alerts.many_tiny_submits) {
+    ReportWarning(PerfCheck::kManyTinySubmits, "vkQueueSubmit",
+                  (uint64_t)m_device);
+  }
+
+  if (m_drawTelemetry.RecordPresent().many_tiny_draws) {
+    ReportWarning(PerfCheck::kManyTinyDraws, "vkQueuePresentKHR",
+                  (uint64_t)m_device);
+  }
+  m_descriptorTelemetry.RecordPresent();
+
+  return inResult;
+}
 
 }  // namespace GWD
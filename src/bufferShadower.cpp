@@ -0,0 +1,469 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "bufferShadower.h"
+#include "layerSettings.h"
+
+#include <algorithm>
+
+namespace GWD {
+
+// Geometry-only usage. Anything else could read the buffer from stages our
+// upload barriers don't cover, or write it on the GPU behind our back.
+static constexpr VkBufferUsageFlags kGeometryUsage =
+    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+
+// Looking for new shadows means walking every candidate, so it only happens
+// every few submits. A candidate counts as in use if it was bound since the
+// previous walk.
+static constexpr uint64_t kShadowScanInterval = 16;
+
+BufferShadower::BufferShadower(
+    VkDevice device, const DeviceFunctions& functions,
+    const VkPhysicalDeviceMemoryProperties& memory_properties,
+    const std::vector<uint32_t>& graphics_queue_families)
+    : m_device(device),
+      m_functions(functions),
+      m_memory_properties(memory_properties),
+      m_graphics_queue_families(graphics_queue_families) {
+  m_stable_submits = GetLayerSettings().shadow_stable_submits;
+}
+
+BufferShadower::~BufferShadower() {
+  for (ShadowedBuffer* entry : m_shadowed_buffers) {
+    DestroyShadow(entry);
+  }
+  for (auto& batch : m_upload_batches) {
+    m_functions.destroy_fence(m_device, batch->fence, nullptr);
+  }
+  // Destroying the pools frees their command buffers
+  for (auto& family_pool : m_command_pools) {
+    m_functions.destroy_command_pool(m_device, family_pool.second, nullptr);
+  }
+}
+
+bool BufferShadower::IsCandidate(const VkBufferCreateInfo* pCreateInfo) const {
+  // Sparse, protected, external and concurrently shared buffers can't be
+  // mirrored by a plain exclusive buffer
+  return pCreateInfo->pNext == nullptr && pCreateInfo->flags == 0 &&
+         pCreateInfo->sharingMode == VK_SHARING_MODE_EXCLUSIVE &&
+         (pCreateInfo->usage & kGeometryUsage) != 0 &&
+         (pCreateInfo->usage &
+          ~(kGeometryUsage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) == 0;
+}
+
+const VkBufferCreateInfo* BufferShadower::AdjustCreateInfo(
+    const VkBufferCreateInfo* pCreateInfo,
+    VkBufferCreateInfo* adjusted_create_info) const {
+  if (!IsCandidate(pCreateInfo) ||
+      (pCreateInfo->usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) != 0) {
+    return pCreateInfo;
+  }
+  *adjusted_create_info = *pCreateInfo;
+  adjusted_create_info->usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  return adjusted_create_info;
+}
+
+void BufferShadower::OnGetDeviceQueue(VkQueue queue,
+                                      uint32_t queue_family_index) {
+  // Compute and transfer queues can't run the vertex input barriers around
+  // the uploads, nor consume the shadows
+  if (std::find(m_graphics_queue_families.begin(),
+                m_graphics_queue_families.end(),
+                queue_family_index) == m_graphics_queue_families.end()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_queue_families[queue] = queue_family_index;
+}
+
+void BufferShadower::OnAllocateMemory(VkDeviceMemory memory,
+                                      uint32_t memory_type_index) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  MemoryState state;
+  state.memory_type_index = memory_type_index;
+  state.last_map_submit = m_submit_count.load(std::memory_order_relaxed);
+  m_memory_states[memory] = state;
+}
+
+void BufferShadower::OnFreeMemory(VkDeviceMemory memory) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_memory_states.erase(memory);
+}
+
+void BufferShadower::OnMapMemory(VkDeviceMemory memory) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto state = m_memory_states.find(memory);
+  if (state != m_memory_states.end()) {
+    state->second.mapped = true;
+    state->second.map_generation++;
+    state->second.last_map_submit =
+        m_submit_count.load(std::memory_order_relaxed);
+  }
+}
+
+void BufferShadower::OnUnmapMemory(VkDeviceMemory memory) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto state = m_memory_states.find(memory);
+  if (state != m_memory_states.end()) {
+    state->second.mapped = false;
+  }
+}
+
+void BufferShadower::OnCreateBuffer(VkBuffer buffer,
+                                    const VkBufferCreateInfo* pCreateInfo) {
+  if (!IsCandidate(pCreateInfo)) {
+    return;
+  }
+  std::unique_ptr<ShadowedBuffer> entry(new ShadowedBuffer);
+  entry->buffer = buffer;
+  entry->size = pCreateInfo->size;
+  entry->usage = pCreateInfo->usage;
+  m_candidates.Insert(buffer, std::move(entry));
+}
+
+void BufferShadower::OnBindBufferMemory(VkBuffer buffer,
+                                        VkDeviceMemory memory) {
+  ShadowedBuffer* entry = m_candidates.Find(buffer);
+  if (entry == nullptr) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto state = m_memory_states.find(memory);
+  VkMemoryPropertyFlags property_flags = 0;
+  if (state != m_memory_states.end()) {
+    property_flags =
+        m_memory_properties.memoryTypes[state->second.memory_type_index]
+            .propertyFlags;
+  }
+  // Only geometry the GPU has to fetch across the bus is worth a shadow
+  if ((property_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0 ||
+      (property_flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0) {
+    m_candidates.Erase(buffer);
+    return;
+  }
+  entry->memory = memory;
+}
+
+void BufferShadower::OnDestroyBuffer(VkBuffer buffer) {
+  ShadowedBuffer* entry = m_candidates.Find(buffer);
+  if (entry == nullptr) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (entry->shadow != VK_NULL_HANDLE) {
+    DestroyShadow(entry);
+    m_shadowed_buffers.erase(std::find(m_shadowed_buffers.begin(),
+                                       m_shadowed_buffers.end(), entry));
+  }
+  m_candidates.Erase(buffer);
+}
+
+VkBuffer BufferShadower::Substitute(VkBuffer buffer) {
+  ShadowedBuffer* entry = m_candidates.Find(buffer);
+  if (entry == nullptr) {
+    return buffer;
+  }
+  entry->last_bound_submit.store(
+      m_submit_count.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  const VkBuffer shadow =
+      entry->published_shadow.load(std::memory_order_acquire);
+  return shadow != VK_NULL_HANDLE ? shadow : buffer;
+}
+
+// Prefers memory the host can't see at all, which on discrete GPUs is the only
+// memory that is fast for the GPU.
+uint32_t BufferShadower::FindShadowMemoryType(uint32_t memory_type_bits) const {
+  uint32_t device_local_type = UINT32_MAX;
+  for (uint32_t type_index = 0;
+       type_index < m_memory_properties.memoryTypeCount; type_index++) {
+    if ((memory_type_bits & (1u << type_index)) == 0) {
+      continue;
+    }
+    const VkMemoryPropertyFlags property_flags =
+        m_memory_properties.memoryTypes[type_index].propertyFlags;
+    if ((property_flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == 0 ||
+        (property_flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0) {
+      continue;
+    }
+    if ((property_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0) {
+      return type_index;
+    }
+    if (device_local_type == UINT32_MAX) {
+      device_local_type = type_index;
+    }
+  }
+  return device_local_type;
+}
+
+// Called with m_mutex held. The shadow isn't published until its first upload
+// has been submitted.
+bool BufferShadower::CreateShadow(ShadowedBuffer* entry,
+                                  uint32_t queue_family_index) {
+  VkBufferCreateInfo create_info = {};
+  create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  create_info.size = entry->size;
+  create_info.usage =
+      (entry->usage & kGeometryUsage) | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  // Command buffers binding the shadow may be submitted to any graphics
+  // family, and the layer can't record ownership transfers in them
+  if (m_graphics_queue_families.size() > 1) {
+    create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    create_info.queueFamilyIndexCount =
+        (uint32_t)m_graphics_queue_families.size();
+    create_info.pQueueFamilyIndices = m_graphics_queue_families.data();
+  }
+
+  VkBuffer shadow = VK_NULL_HANDLE;
+  if (m_functions.create_buffer(m_device, &create_info, nullptr, &shadow) !=
+      VK_SUCCESS) {
+    return false;
+  }
+
+  VkMemoryRequirements requirements = {};
+  m_functions.get_buffer_memory_requirements(m_device, shadow, &requirements);
+
+  VkMemoryAllocateInfo allocate_info = {};
+  allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocate_info.allocationSize = requirements.size;
+  allocate_info.memoryTypeIndex =
+      FindShadowMemoryType(requirements.memoryTypeBits);
+
+  VkDeviceMemory shadow_memory = VK_NULL_HANDLE;
+  if (allocate_info.memoryTypeIndex == UINT32_MAX ||
+      m_functions.allocate_memory(m_device, &allocate_info, nullptr,
+                                  &shadow_memory) != VK_SUCCESS) {
+    m_functions.destroy_buffer(m_device, shadow, nullptr);
+    return false;
+  }
+  if (m_functions.bind_buffer_memory(m_device, shadow, shadow_memory, 0) !=
+      VK_SUCCESS) {
+    m_functions.free_memory(m_device, shadow_memory, nullptr);
+    m_functions.destroy_buffer(m_device, shadow, nullptr);
+    return false;
+  }
+
+  entry->shadow = shadow;
+  entry->shadow_memory = shadow_memory;
+  entry->queue_family_index = queue_family_index;
+  m_shadowed_buffers.push_back(entry);
+  return true;
+}
+
+// Called with m_mutex held
+void BufferShadower::DestroyShadow(ShadowedBuffer* entry) {
+  entry->published_shadow.store(VK_NULL_HANDLE, std::memory_order_relaxed);
+  m_functions.destroy_buffer(m_device, entry->shadow, nullptr);
+  m_functions.free_memory(m_device, entry->shadow_memory, nullptr);
+  entry->shadow = VK_NULL_HANDLE;
+  entry->shadow_memory = VK_NULL_HANDLE;
+}
+
+// Called with m_mutex held. Returns a batch whose command buffer is free to be
+// re-recorded, creating one if every batch of the family is still in flight.
+BufferShadower::UploadBatch* BufferShadower::AcquireUploadBatch(
+    uint32_t queue_family_index) {
+  for (auto& batch : m_upload_batches) {
+    if (batch->queue_family_index != queue_family_index) {
+      continue;
+    }
+    if (batch->in_flight &&
+        m_functions.get_fence_status(m_device, batch->fence) == VK_SUCCESS) {
+      m_functions.reset_fences(m_device, 1, &batch->fence);
+      batch->in_flight = false;
+    }
+    if (!batch->in_flight) {
+      return batch.get();
+    }
+  }
+
+  VkCommandPool& command_pool = m_command_pools[queue_family_index];
+  if (command_pool == VK_NULL_HANDLE) {
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex = queue_family_index;
+    if (m_functions.create_command_pool(m_device, &pool_info, nullptr,
+                                        &command_pool) != VK_SUCCESS) {
+      m_command_pools.erase(queue_family_index);
+      return nullptr;
+    }
+  }
+
+  std::unique_ptr<UploadBatch> batch(new UploadBatch);
+  batch->queue_family_index = queue_family_index;
+
+  VkCommandBufferAllocateInfo allocate_info = {};
+  allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocate_info.commandPool = command_pool;
+  allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocate_info.commandBufferCount = 1;
+  if (m_functions.allocate_command_buffers(m_device, &allocate_info,
+                                           &batch->command_buffer) !=
+      VK_SUCCESS) {
+    return nullptr;
+  }
+  // Dispatchable objects made below the layer need the loader's dispatch
+  // pointer before the next layer will accept them
+  m_functions.set_device_loader_data(m_device, batch->command_buffer);
+
+  VkFenceCreateInfo fence_info = {};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  if (m_functions.create_fence(m_device, &fence_info, nullptr,
+                               &batch->fence) != VK_SUCCESS) {
+    return nullptr;
+  }
+
+  m_upload_batches.push_back(std::move(batch));
+  return m_upload_batches.back().get();
+}
+
+// Called with m_mutex held
+bool BufferShadower::SubmitUploads(
+    VkQueue queue, uint32_t queue_family_index,
+    const std::vector<ShadowedBuffer*>& uploads) {
+  UploadBatch* batch = AcquireUploadBatch(queue_family_index);
+  if (batch == nullptr) {
+    return false;
+  }
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  if (m_functions.begin_command_buffer(batch->command_buffer, &begin_info) !=
+      VK_SUCCESS) {
+    return false;
+  }
+
+  // Earlier submissions may still be fetching from the shadows
+  m_functions.cmd_pipeline_barrier(
+      batch->command_buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+  for (const ShadowedBuffer* entry : uploads) {
+    VkBufferCopy region = {};
+    region.size = entry->size;
+    m_functions.cmd_copy_buffer(batch->command_buffer, entry->buffer,
+                                entry->shadow, 1, &region);
+  }
+
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+  m_functions.cmd_pipeline_barrier(
+      batch->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, nullptr, 0,
+      nullptr);
+
+  if (m_functions.end_command_buffer(batch->command_buffer) != VK_SUCCESS) {
+    return false;
+  }
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &batch->command_buffer;
+  if (m_functions.queue_submit(queue, 1, &submit_info, batch->fence) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  batch->in_flight = true;
+  return true;
+}
+
+void BufferShadower::BeforeQueueSubmit(VkQueue queue) {
+  const uint64_t submit =
+      m_submit_count.fetch_add(1, std::memory_order_relaxed) + 1;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  // Non-graphics queues and queues from vkGetDeviceQueue2 aren't tracked, and
+  // get no uploads
+  auto queue_family = m_queue_families.find(queue);
+  if (queue_family == m_queue_families.end()) {
+    return;
+  }
+
+  // Counted from the last walk rather than taken modulo the interval, since
+  // submits to untracked queues advance the count too. Submits racing for the
+  // lock may arrive out of order, hence no subtraction.
+  if (submit >= m_last_scan_submit + kShadowScanInterval) {
+    const uint64_t previous_scan_submit = m_last_scan_submit;
+    m_last_scan_submit = submit;
+
+    std::vector<ShadowedBuffer*> in_use;
+    m_candidates.ForEach(
+        [&in_use, previous_scan_submit](ShadowedBuffer& entry) {
+          const uint64_t last_bound_submit =
+              entry.last_bound_submit.load(std::memory_order_relaxed);
+          if (entry.shadow == VK_NULL_HANDLE && !entry.unshadowable &&
+              entry.memory != VK_NULL_HANDLE && last_bound_submit != 0 &&
+              last_bound_submit >= previous_scan_submit) {
+            in_use.push_back(&entry);
+          }
+        });
+
+    for (ShadowedBuffer* entry : in_use) {
+      auto state = m_memory_states.find(entry->memory);
+      if (state == m_memory_states.end() || state->second.mapped ||
+          submit - state->second.last_map_submit < m_stable_submits) {
+        continue;
+      }
+      entry->unshadowable = !CreateShadow(entry, queue_family->second);
+    }
+  }
+
+  // New shadows, and shadows whose memory was written since their last upload.
+  // Memory that stays mapped could be written at any time, so it is uploaded
+  // on every submit. Shadows of other families wait for one of their queues.
+  std::vector<ShadowedBuffer*> uploads;
+  std::vector<uint64_t> map_generations;
+  for (ShadowedBuffer* entry : m_shadowed_buffers) {
+    if (entry->queue_family_index != queue_family->second) {
+      continue;
+    }
+    auto state = m_memory_states.find(entry->memory);
+    if (state == m_memory_states.end()) {
+      continue;
+    }
+    if (entry->published_shadow.load(std::memory_order_relaxed) ==
+            VK_NULL_HANDLE ||
+        state->second.mapped ||
+        state->second.map_generation != entry->uploaded_map_generation) {
+      uploads.push_back(entry);
+      map_generations.push_back(state->second.map_generation);
+    }
+  }
+  if (uploads.empty() ||
+      !SubmitUploads(queue, queue_family->second, uploads)) {
+    return;
+  }
+
+  for (size_t upload_index = 0; upload_index < uploads.size();
+       upload_index++) {
+    ShadowedBuffer* entry = uploads[upload_index];
+    entry->uploaded_map_generation = map_generations[upload_index];
+    entry->published_shadow.store(entry->shadow, std::memory_order_release);
+  }
+}
+
+}  // namespace GWD
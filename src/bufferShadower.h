@@ -0,0 +1,181 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <vulkan/vk_layer.h>
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "concurrentMap.h"
+#include "flat_hash_map.hpp"
+
+namespace GWD {
+
+// Opt-in fix-it mode (GWD_SHADOW_BUFFERS) that moves rarely written geometry
+// out of host-visible memory, to measure what DEVICE_LOCAL vertex and index
+// buffers would buy a title without changing its code.
+//
+// Candidates are buffers used only as vertex and/or index buffers, bound to
+// host-visible memory that isn't DEVICE_LOCAL. Candidates can't be written by
+// the GPU (they have no TRANSFER_DST or storage usage), so the only writes to
+// track are host writes through vkMapMemory. Once a candidate is being bound
+// and its memory has gone unmapped for a while, the layer gives it a
+// DEVICE_LOCAL shadow and binds that instead. Whenever the memory has been
+// mapped since the last upload, a copy into the shadow is submitted on the
+// same queue ahead of the application's next submission.
+//
+// Only graphics queues can fetch vertices, so only they create shadows and
+// submit uploads. A shadow is shared by every graphics family of the device,
+// but its uploads all go to queues of the family that created it, since the
+// application's buffer they copy from is exclusively owned.
+//
+// Uploads are ordered against the application's work by queue submission
+// order only, so an application that records with shadowed buffers on one
+// queue while another queue submits first may read stale geometry.
+class BufferShadower {
+ public:
+  struct DeviceFunctions {
+    PFN_vkSetDeviceLoaderData set_device_loader_data;
+    PFN_vkCreateBuffer create_buffer;
+    PFN_vkDestroyBuffer destroy_buffer;
+    PFN_vkGetBufferMemoryRequirements get_buffer_memory_requirements;
+    PFN_vkAllocateMemory allocate_memory;
+    PFN_vkFreeMemory free_memory;
+    PFN_vkBindBufferMemory bind_buffer_memory;
+    PFN_vkCreateCommandPool create_command_pool;
+    PFN_vkDestroyCommandPool destroy_command_pool;
+    PFN_vkAllocateCommandBuffers allocate_command_buffers;
+    PFN_vkBeginCommandBuffer begin_command_buffer;
+    PFN_vkEndCommandBuffer end_command_buffer;
+    PFN_vkCmdPipelineBarrier cmd_pipeline_barrier;
+    PFN_vkCmdCopyBuffer cmd_copy_buffer;
+    PFN_vkCreateFence create_fence;
+    PFN_vkDestroyFence destroy_fence;
+    PFN_vkGetFenceStatus get_fence_status;
+    PFN_vkResetFences reset_fences;
+    PFN_vkQueueSubmit queue_submit;
+  };
+
+  // graphics_queue_families lists the families the device has queues from
+  // that support graphics
+  BufferShadower(VkDevice device, const DeviceFunctions& functions,
+                 const VkPhysicalDeviceMemoryProperties& memory_properties,
+                 const std::vector<uint32_t>& graphics_queue_families);
+  // Releases the shadows, so this must run before the device is destroyed
+  ~BufferShadower();
+
+  BufferShadower(const BufferShadower&) = delete;
+  BufferShadower& operator=(const BufferShadower&) = delete;
+
+  // Candidates need TRANSFER_SRC usage for the uploads. Returns the create
+  // info to pass down, which is adjusted_create_info if usage was added.
+  const VkBufferCreateInfo* AdjustCreateInfo(
+      const VkBufferCreateInfo* pCreateInfo,
+      VkBufferCreateInfo* adjusted_create_info) const;
+
+  // Tracking, called with the application's handles once the driver succeeded
+  void OnGetDeviceQueue(VkQueue queue, uint32_t queue_family_index);
+  void OnAllocateMemory(VkDeviceMemory memory, uint32_t memory_type_index);
+  void OnFreeMemory(VkDeviceMemory memory);
+  void OnMapMemory(VkDeviceMemory memory);
+  void OnUnmapMemory(VkDeviceMemory memory);
+  void OnCreateBuffer(VkBuffer buffer, const VkBufferCreateInfo* pCreateInfo);
+  void OnBindBufferMemory(VkBuffer buffer, VkDeviceMemory memory);
+  void OnDestroyBuffer(VkBuffer buffer);
+
+  // Lock-free. Notes that the buffer is in use and returns the buffer to bind
+  // in its place, which is the buffer itself unless it has a shadow.
+  VkBuffer Substitute(VkBuffer buffer);
+
+  // Creates shadows for candidates that have settled, and submits the uploads
+  // that bring stale shadows up to date. Must be called before the
+  // application's own submission on the same queue.
+  void BeforeQueueSubmit(VkQueue queue);
+
+ private:
+  struct MemoryState {
+    uint32_t memory_type_index = 0;
+    bool mapped = false;
+    // Bumped by every vkMapMemory, to tell whether a shadow is stale
+    uint64_t map_generation = 0;
+    uint64_t last_map_submit = 0;
+  };
+
+  struct ShadowedBuffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    VkBufferUsageFlags usage = 0;
+    std::atomic<uint64_t> last_bound_submit{0};
+    // What Substitute() hands out, set once the first upload has been
+    // submitted
+    std::atomic<VkBuffer> published_shadow{VK_NULL_HANDLE};
+
+    // The rest is only touched under m_mutex
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkBuffer shadow = VK_NULL_HANDLE;
+    VkDeviceMemory shadow_memory = VK_NULL_HANDLE;
+    // Family whose queues submit the uploads
+    uint32_t queue_family_index = 0;
+    uint64_t uploaded_map_generation = 0;
+    // Set when no DEVICE_LOCAL shadow could be made, so we stop trying
+    bool unshadowable = false;
+  };
+
+  // A command buffer of uploads and the fence that says it can be reused
+  struct UploadBatch {
+    uint32_t queue_family_index = 0;
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    bool in_flight = false;
+  };
+
+  bool IsCandidate(const VkBufferCreateInfo* pCreateInfo) const;
+  uint32_t FindShadowMemoryType(uint32_t memory_type_bits) const;
+
+  bool CreateShadow(ShadowedBuffer* entry, uint32_t queue_family_index);
+  void DestroyShadow(ShadowedBuffer* entry);
+  UploadBatch* AcquireUploadBatch(uint32_t queue_family_index);
+  bool SubmitUploads(VkQueue queue, uint32_t queue_family_index,
+                     const std::vector<ShadowedBuffer*>& uploads);
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  DeviceFunctions m_functions = {};
+  VkPhysicalDeviceMemoryProperties m_memory_properties = {};
+  std::vector<uint32_t> m_graphics_queue_families;
+  uint64_t m_stable_submits = 0;
+
+  // Starts at 1 so a zero submit index means "never"
+  std::atomic<uint64_t> m_submit_count{1};
+
+  std::mutex m_mutex;
+  // Submit index of the last walk for new shadows
+  uint64_t m_last_scan_submit = 0;
+  // Graphics queues only
+  ska::flat_hash_map<VkQueue, uint32_t> m_queue_families;
+  ska::flat_hash_map<VkDeviceMemory, MemoryState> m_memory_states;
+  std::vector<ShadowedBuffer*> m_shadowed_buffers;
+  ska::flat_hash_map<uint32_t, VkCommandPool> m_command_pools;
+  std::vector<std::unique_ptr<UploadBatch>> m_upload_batches;
+
+  // Lock-free lookups from the bind intercepts
+  ConcurrentMap<VkBuffer, ShadowedBuffer> m_candidates;
+};
+
+}  // namespace GWD
@@ -0,0 +1,367 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "handleHash.h"
+
+namespace GWD {
+
+// Read-mostly map from a pointer-sized key to a value owned by the map.
+//
+// Find() never takes a lock, so it is safe to call from the command recording
+// hot path on any number of threads. Insert() and Erase() are serialized on an
+// internal mutex. The table is open addressed with linear probing; erased slots
+// become tombstones so that concurrent probes are never cut short. When the
+// table fills up, a new one is published and the old one is freed once every
+// reader that might still be probing it has finished. Readers announce
+// themselves on a per-thread counter tagged with the current epoch, so the
+// writer only has to wait for the counters of the epoch it just closed.
+//
+// Erase() deletes the value immediately. Callers must guarantee (as Vulkan
+// external synchronization rules already do for handles) that no thread is
+// still using a value when its key is erased. Values without such a guarantee
+// are accessed through Apply() and removed with RetireIf() instead.
+template <typename Key, typename Value>
+class ConcurrentMap {
+ public:
+  ConcurrentMap() { m_table.store(NewTable(kMinCapacity)); }
+
+  ~ConcurrentMap() {
+    Table* table = m_table.load();
+    for (size_t slot_index = 0; slot_index < table->capacity; slot_index++) {
+      delete table->slots[slot_index].value.load();
+    }
+    delete table;
+  }
+
+  ConcurrentMap(const ConcurrentMap&) = delete;
+  ConcurrentMap& operator=(const ConcurrentMap&) = delete;
+
+  Value* Find(Key key) const {
+    const uintptr_t raw_key = (uintptr_t)key;
+    ReadGuard guard(*this);
+    const Table* table = m_table.load();
+    size_t slot_index = Hash(raw_key) & (table->capacity - 1);
+    for (;;) {
+      const Slot& slot = table->slots[slot_index];
+      const uintptr_t slot_key = slot.key.load(std::memory_order_acquire);
+      if (slot_key == raw_key) {
+        return slot.value.load(std::memory_order_acquire);
+      }
+      if (slot_key == kEmptyKey) {
+        return nullptr;
+      }
+      slot_index = (slot_index + 1) & (table->capacity - 1);
+    }
+  }
+
+  // Calls function on the value for key, if there is one, and returns whether
+  // there was. Unlike a pointer returned by Find(), the value can't be deleted
+  // by RetireIf() while function runs.
+  template <typename Function>
+  bool Apply(Key key, Function function) const {
+    const uintptr_t raw_key = (uintptr_t)key;
+    ReadGuard guard(*this);
+    const Table* table = m_table.load();
+    size_t slot_index = Hash(raw_key) & (table->capacity - 1);
+    for (;;) {
+      const Slot& slot = table->slots[slot_index];
+      const uintptr_t slot_key = slot.key.load(std::memory_order_acquire);
+      if (slot_key == raw_key) {
+        Value* value = slot.value.load(std::memory_order_acquire);
+        if (value == nullptr) {
+          return false;
+        }
+        function(*value);
+        return true;
+      }
+      if (slot_key == kEmptyKey) {
+        return false;
+      }
+      slot_index = (slot_index + 1) & (table->capacity - 1);
+    }
+  }
+
+  // Takes ownership of value. If the key is already present, the old value is
+  // replaced and deleted.
+  Value* Insert(Key key, std::unique_ptr<Value> value) {
+    const uintptr_t raw_key = (uintptr_t)key;
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+
+    if ((m_used_slots + 1) * 4 > m_table.load()->capacity * 3) {
+      Rehash();
+    }
+
+    Table* table = m_table.load();
+    Slot* reusable_slot = nullptr;
+    size_t slot_index = Hash(raw_key) & (table->capacity - 1);
+    for (;;) {
+      Slot& slot = table->slots[slot_index];
+      const uintptr_t slot_key = slot.key.load(std::memory_order_relaxed);
+      if (slot_key == raw_key) {
+        Value* old_value = slot.value.exchange(value.release());
+        delete old_value;
+        return slot.value.load(std::memory_order_relaxed);
+      }
+      if (slot_key == kTombstoneKey && reusable_slot == nullptr) {
+        reusable_slot = &slot;
+      }
+      if (slot_key == kEmptyKey) {
+        if (reusable_slot == nullptr) {
+          reusable_slot = &slot;
+          m_used_slots++;
+        }
+        break;
+      }
+      slot_index = (slot_index + 1) & (table->capacity - 1);
+    }
+
+    // Publish the value before the key so a reader that matches the key always
+    // sees a fully constructed value.
+    Value* inserted = value.release();
+    reusable_slot->value.store(inserted, std::memory_order_release);
+    reusable_slot->key.store(raw_key, std::memory_order_release);
+    m_live_entries++;
+    return inserted;
+  }
+
+  void Erase(Key key) {
+    const uintptr_t raw_key = (uintptr_t)key;
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+
+    Table* table = m_table.load();
+    size_t slot_index = Hash(raw_key) & (table->capacity - 1);
+    for (;;) {
+      Slot& slot = table->slots[slot_index];
+      const uintptr_t slot_key = slot.key.load(std::memory_order_relaxed);
+      if (slot_key == raw_key) {
+        EraseSlot(slot);
+        return;
+      }
+      if (slot_key == kEmptyKey) {
+        return;
+      }
+      slot_index = (slot_index + 1) & (table->capacity - 1);
+    }
+  }
+
+  // Erases every entry whose value matches the predicate, e.g. all command
+  // buffers belonging to a destroyed pool.
+  template <typename Predicate>
+  void EraseIf(Predicate predicate) {
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+
+    Table* table = m_table.load();
+    for (size_t slot_index = 0; slot_index < table->capacity; slot_index++) {
+      Slot& slot = table->slots[slot_index];
+      Value* value = slot.value.load(std::memory_order_relaxed);
+      if (value != nullptr && predicate(*value)) {
+        EraseSlot(slot);
+      }
+    }
+  }
+
+  // Like EraseIf(), but for values that readers may still be using through
+  // Apply(): they are only deleted once every such reader has finished.
+  template <typename Predicate>
+  void RetireIf(Predicate predicate) {
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+
+    std::vector<Value*> retired_values;
+    Table* table = m_table.load();
+    for (size_t slot_index = 0; slot_index < table->capacity; slot_index++) {
+      Slot& slot = table->slots[slot_index];
+      Value* value = slot.value.load(std::memory_order_relaxed);
+      if (value != nullptr && predicate(*value)) {
+        retired_values.push_back(UnlinkSlot(slot));
+      }
+    }
+    if (retired_values.empty()) {
+      return;
+    }
+
+    WaitForReaders();
+    for (Value* value : retired_values) {
+      delete value;
+    }
+  }
+
+  // Visits every live value with writers locked out. Readers may still run.
+  template <typename Visitor>
+  void ForEach(Visitor visitor) const {
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+
+    const Table* table = m_table.load();
+    for (size_t slot_index = 0; slot_index < table->capacity; slot_index++) {
+      Value* value = table->slots[slot_index].value.load();
+      if (value != nullptr) {
+        visitor(*value);
+      }
+    }
+  }
+
+  size_t Size() const {
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    return m_live_entries;
+  }
+
+ private:
+  static constexpr uintptr_t kEmptyKey = 0;
+  static constexpr uintptr_t kTombstoneKey = 1;
+  static constexpr size_t kMinCapacity = 64;
+  static constexpr size_t kReaderShardCount = 16;
+
+  struct Slot {
+    std::atomic<uintptr_t> key{kEmptyKey};
+    std::atomic<Value*> value{nullptr};
+  };
+
+  struct Table {
+    size_t capacity;
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  // Readers in flight, by the parity of the epoch they entered in. Two
+  // counters are enough because WaitForReaders() drains the closed epoch
+  // before returning and releasing the write lock.
+  struct ReaderShard {
+    std::array<std::atomic<uint32_t>, 2> readers = {};
+    char cache_line_padding[64];
+  };
+
+  // Keeps the table a reader loaded alive until the reader is done with it.
+  // The epoch is checked again after announcing, so a reader can never count
+  // itself against an epoch that a writer has already waited out.
+  class ReadGuard {
+   public:
+    explicit ReadGuard(const ConcurrentMap& map) {
+      ReaderShard& shard = map.m_reader_shards[GetReaderShard()];
+      for (;;) {
+        const uint64_t epoch = map.m_epoch.load();
+        m_readers = &shard.readers[epoch & 1];
+        m_readers->fetch_add(1);
+        if (map.m_epoch.load() == epoch) {
+          return;
+        }
+        m_readers->fetch_sub(1);
+      }
+    }
+
+    ~ReadGuard() { m_readers->fetch_sub(1, std::memory_order_release); }
+
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+
+   private:
+    std::atomic<uint32_t>* m_readers;
+  };
+
+  static size_t GetReaderShard() {
+    static std::atomic<size_t> s_next_shard{0};
+    static thread_local const size_t t_shard =
+        s_next_shard.fetch_add(1, std::memory_order_relaxed) %
+        kReaderShardCount;
+    return t_shard;
+  }
+
+  static Table* NewTable(size_t capacity) {
+    Table* table = new Table;
+    table->capacity = capacity;
+    table->slots.reset(new Slot[capacity]);
+    return table;
+  }
+
+  static size_t Hash(uintptr_t raw_key) {
+    return (size_t)MixHandleBits((uint64_t)raw_key);
+  }
+
+  Value* UnlinkSlot(Slot& slot) {
+    Value* value = slot.value.exchange(nullptr);
+    slot.key.store(kTombstoneKey, std::memory_order_release);
+    m_live_entries--;
+    return value;
+  }
+
+  void EraseSlot(Slot& slot) { delete UnlinkSlot(slot); }
+
+  // Called with m_write_mutex held. Returns once every reader that might have
+  // seen the table as it was before the call has finished.
+  void WaitForReaders() {
+    // Any such reader announced itself under the epoch that is closed here
+    const uint64_t closed_epoch = m_epoch.load();
+    m_epoch.store(closed_epoch + 1);
+    for (const ReaderShard& shard : m_reader_shards) {
+      while (shard.readers[closed_epoch & 1].load() != 0) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Called with m_write_mutex held. The new table keeps the load factor at or
+  // below 1/4 so tombstone-driven rehashes stay rare. Readers only ever probe
+  // for a few slots, so waiting for them to leave the old table is short.
+  void Rehash() {
+    Table* old_table = m_table.load();
+    size_t new_capacity = old_table->capacity;
+    while (new_capacity < (m_live_entries + 1) * 4) {
+      new_capacity *= 2;
+    }
+
+    Table* new_table = NewTable(new_capacity);
+    for (size_t slot_index = 0; slot_index < old_table->capacity;
+         slot_index++) {
+      const Slot& old_slot = old_table->slots[slot_index];
+      Value* value = old_slot.value.load(std::memory_order_relaxed);
+      if (value == nullptr) {
+        continue;
+      }
+      const uintptr_t raw_key = old_slot.key.load(std::memory_order_relaxed);
+      size_t new_index = Hash(raw_key) & (new_capacity - 1);
+      while (new_table->slots[new_index].key.load(std::memory_order_relaxed) !=
+             kEmptyKey) {
+        new_index = (new_index + 1) & (new_capacity - 1);
+      }
+      new_table->slots[new_index].value.store(value, std::memory_order_relaxed);
+      new_table->slots[new_index].key.store(raw_key, std::memory_order_relaxed);
+    }
+
+    m_table.store(new_table);
+    m_used_slots = m_live_entries;
+
+    WaitForReaders();
+    delete old_table;
+  }
+
+  std::atomic<Table*> m_table;
+  std::atomic<uint64_t> m_epoch{0};
+  mutable std::array<ReaderShard, kReaderShardCount> m_reader_shards;
+
+  mutable std::mutex m_write_mutex;
+  size_t m_used_slots = 0;
+  size_t m_live_entries = 0;
+};
+
+}  // namespace GWD
@@ -0,0 +1,154 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "descriptorTelemetry.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "handleHash.h"
+
+namespace GWD {
+
+size_t DescriptorTelemetry::PoolHash::operator()(uint64_t pool) const {
+  return (size_t)MixHandleBits(pool);
+}
+
+void DescriptorTelemetry::RecordAllocate(uint64_t pool, uint32_t set_count) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  PoolStats& stats = m_pools[pool];
+  stats.allocated_set_count += set_count;
+  stats.sets_since_reset += set_count;
+}
+
+void DescriptorTelemetry::RecordFree(uint64_t pool, uint32_t set_count) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_pools[pool].freed_set_count += set_count;
+}
+
+void DescriptorTelemetry::RecordReset(uint64_t pool) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  PoolStats& stats = m_pools[pool];
+  stats.reset_count++;
+  if (stats.last_reset_frame != m_frame_count) {
+    stats.reset_frame_count++;
+    stats.last_reset_frame = m_frame_count;
+  }
+  stats.peak_sets_per_reset =
+      std::max(stats.peak_sets_per_reset, stats.sets_since_reset);
+  stats.sets_since_reset = 0;
+}
+
+void DescriptorTelemetry::RecordDestroy(uint64_t pool) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  // Pools created and destroyed every frame would pile up otherwise
+  auto stats = m_pools.find(pool);
+  m_destroyed_pool_count++;
+  if (stats != m_pools.end()) {
+    m_destroyed_pool_set_count += stats->second.allocated_set_count;
+    m_pools.erase(stats);
+  }
+}
+
+void DescriptorTelemetry::RecordRetiredContents(
+    const RetiredContents& retired) {
+  if (retired.count == 0) {
+    return;
+  }
+  m_retired_contents_count.fetch_add(retired.count, std::memory_order_relaxed);
+  m_single_bind_contents_count.fetch_add(retired.single_bind_count,
+                                         std::memory_order_relaxed);
+}
+
+void DescriptorTelemetry::RecordSubmit(uint64_t draw_count,
+                                       uint64_t fresh_set_draw_count) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_draw_count += draw_count;
+  m_fresh_set_draw_count += fresh_set_draw_count;
+}
+
+void DescriptorTelemetry::RecordPresent() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_frame_count++;
+}
+
+std::string DescriptorTelemetry::BuildReport() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  uint64_t allocated_set_count = m_destroyed_pool_set_count;
+  for (const auto& pool : m_pools) {
+    allocated_set_count += pool.second.allocated_set_count;
+  }
+  const uint64_t retired_count =
+      m_retired_contents_count.load(std::memory_order_relaxed);
+  const uint64_t single_bind_count =
+      m_single_bind_contents_count.load(std::memory_order_relaxed);
+
+  std::stringstream report;
+  report << "WitchDoctor descriptor report: " << allocated_set_count
+         << " sets allocated from " << m_pools.size() << " live and "
+         << m_destroyed_pool_count << " destroyed pools";
+  report << std::fixed << std::setprecision(1);
+
+  // Contents used once, and draws that each need sets of their own, are
+  // what push descriptors, update templates and dynamic offsets are for
+  if (retired_count > 0) {
+    report << "\n  " << single_bind_count << " of " << retired_count
+           << " bound set contents were bound only once before being "
+              "rewritten or freed ("
+           << 100.0 * single_bind_count / retired_count << "%)";
+  }
+  if (m_draw_count > 0) {
+    report << "\n  " << m_fresh_set_draw_count << " of " << m_draw_count
+           << " draw calls came right after binding freshly written sets ("
+           << 100.0 * m_fresh_set_draw_count / m_draw_count << "%)";
+  }
+
+  // The pools that churn the most sets
+  static constexpr size_t kReportedPoolCount = 5;
+  using Pool = std::pair<uint64_t, PoolStats>;
+  std::vector<Pool> pools(m_pools.begin(), m_pools.end());
+  std::sort(pools.begin(), pools.end(), [](const Pool& a, const Pool& b) {
+    return a.second.allocated_set_count > b.second.allocated_set_count;
+  });
+  if (pools.size() > kReportedPoolCount) {
+    pools.resize(kReportedPoolCount);
+  }
+  for (const Pool& pool : pools) {
+    const PoolStats& stats = pool.second;
+    report << "\n  pool 0x" << std::hex << pool.first << std::dec << ": "
+           << stats.allocated_set_count << " sets allocated, "
+           << stats.freed_set_count << " freed one by one, "
+           << stats.reset_count << " resets in " << stats.reset_frame_count
+           << " of " << m_frame_count << " frames";
+    if (stats.reset_count > 0) {
+      // Sets allocated since the last reset are still in use, so they don't
+      // count towards the average
+      report << ", "
+             << (double)(stats.allocated_set_count - stats.sets_since_reset) /
+                    stats.reset_count
+             << " sets avg and " << stats.peak_sets_per_reset
+             << " peak between resets";
+    }
+  }
+
+  return report.str();
+}
+
+}  // namespace GWD
@@ -0,0 +1,89 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include "flat_hash_map.hpp"
+
+namespace GWD {
+
+// Written descriptor set contents that were bound at least once before a
+// write, a free or a reset replaced them
+struct RetiredContents {
+  uint64_t count = 0;
+  // Bound exactly once
+  uint64_t single_bind_count = 0;
+};
+
+// Per-device descriptor churn: how each pool is allocated from, freed and
+// reset, how often a set's contents are bound only once before they are
+// replaced, and how many draw calls come right after binding freshly written
+// sets.
+// Pool events are merged under a lock; set contents retire far more often, so
+// those are plain atomic counts.
+class DescriptorTelemetry {
+ public:
+  DescriptorTelemetry() = default;
+
+  void RecordAllocate(uint64_t pool, uint32_t set_count);
+  void RecordFree(uint64_t pool, uint32_t set_count);
+  void RecordReset(uint64_t pool);
+  void RecordDestroy(uint64_t pool);
+  void RecordRetiredContents(const RetiredContents& retired);
+  // Per submitted command buffer
+  void RecordSubmit(uint64_t draw_count, uint64_t fresh_set_draw_count);
+  // Closes the current frame
+  void RecordPresent();
+
+  std::string BuildReport() const;
+
+ private:
+  struct PoolStats {
+    uint64_t allocated_set_count = 0;
+    // Returned with vkFreeDescriptorSets rather than a reset
+    uint64_t freed_set_count = 0;
+    uint64_t reset_count = 0;
+    // Frames with at least one reset of the pool
+    uint64_t reset_frame_count = 0;
+    uint64_t last_reset_frame = UINT64_MAX;
+    uint64_t sets_since_reset = 0;
+    uint64_t peak_sets_per_reset = 0;
+  };
+
+  struct PoolHash {
+    size_t operator()(uint64_t pool) const;
+  };
+
+  mutable std::mutex m_mutex;
+
+  ska::flat_hash_map<uint64_t, PoolStats, PoolHash> m_pools;
+  uint64_t m_destroyed_pool_count = 0;
+  uint64_t m_destroyed_pool_set_count = 0;
+  uint64_t m_draw_count = 0;
+  uint64_t m_fresh_set_draw_count = 0;
+  uint64_t m_frame_count = 0;
+
+  std::atomic<uint64_t> m_retired_contents_count{0};
+  std::atomic<uint64_t> m_single_bind_contents_count{0};
+};
+
+}  // namespace GWD
@@ -0,0 +1,346 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "drawTelemetry.h"
+#include "handleHash.h"
+#include "layerSettings.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace GWD {
+
+static size_t GetDrawSizeBucket(uint64_t vertex_count) {
+  size_t bucket = 0;
+  while (vertex_count != 0 && bucket + 1 < kDrawSizeBucketCount) {
+    vertex_count >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void DrawSummary::RecordDrawSize(uint64_t vertex_count,
+                                 uint32_t tiny_draw_vertices) {
+  draw_sizes[GetDrawSizeBucket(vertex_count)]++;
+  if (vertex_count < tiny_draw_vertices) {
+    tiny_draw_count++;
+  }
+}
+
+bool DrawSummary::RecordIndexBufferUse(uint64_t buffer,
+                                       uint64_t index_capacity,
+                                       uint64_t index_end,
+                                       int32_t vertex_offset,
+                                       uint64_t saveable_bytes) {
+  // Draws from one buffer are usually recorded back to back, and the entries
+  // for the same buffer are merged at submit
+  if (index_buffer_uses.empty() ||
+      index_buffer_uses.back().buffer != buffer) {
+    IndexBufferUse use;
+    use.buffer = buffer;
+    use.min_vertex_offset = vertex_offset;
+    use.max_vertex_offset = vertex_offset;
+    index_buffer_uses.push_back(use);
+  }
+
+  IndexBufferUse& use = index_buffer_uses.back();
+  const bool first_draw = use.draw_count == 0;
+  use.index_capacity = std::max(use.index_capacity, index_capacity);
+  use.max_index_end = std::max(use.max_index_end, index_end);
+  use.min_vertex_offset = std::min(use.min_vertex_offset, vertex_offset);
+  use.max_vertex_offset = std::max(use.max_vertex_offset, vertex_offset);
+  use.draw_count++;
+  use.saveable_bytes += saveable_bytes;
+  return first_draw;
+}
+
+void DrawSummary::Reset() {
+  draw_sizes.fill(0);
+  tiny_draw_count = 0;
+  merge_candidates.clear();
+  indirect_call_count = 0;
+  single_indirect_call_count = 0;
+  indirect_count_call_count = 0;
+  multi_draw_candidates.clear();
+  index_buffer_uses.clear();
+}
+
+size_t DrawTelemetry::CandidateKeyHash::operator()(
+    const CandidateKey& key) const {
+  uint64_t hash = key.pipeline ^ ((uint64_t)key.element_count << 17) ^
+                  (uint64_t)key.indexed;
+  return (size_t)MixHandleBits(hash);
+}
+
+size_t DrawTelemetry::MultiDrawKeyHash::operator()(
+    const MultiDrawKey& key) const {
+  uint64_t hash = key.buffer ^ (key.stride << 17) ^ (uint64_t)key.indexed;
+  return (size_t)MixHandleBits(hash);
+}
+
+size_t DrawTelemetry::BufferHash::operator()(uint64_t buffer) const {
+  return (size_t)MixHandleBits(buffer);
+}
+
+// The candidates that would save the most calls, since merging a run turns
+// its calls into one
+template <typename Key, typename Stats, typename Hash>
+static std::vector<std::pair<Key, Stats>> GetTopCandidates(
+    const ska::flat_hash_map<Key, Stats, Hash>& candidate_map) {
+  static constexpr size_t kReportedCandidateCount = 5;
+  using Candidate = std::pair<Key, Stats>;
+  std::vector<Candidate> candidates(candidate_map.begin(),
+                                    candidate_map.end());
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate& a, const Candidate& b) {
+              return a.second.draw_count - a.second.run_count >
+                     b.second.draw_count - b.second.run_count;
+            });
+  if (candidates.size() > kReportedCandidateCount) {
+    candidates.resize(kReportedCandidateCount);
+  }
+  return candidates;
+}
+
+DrawTelemetry::DrawTelemetry()
+    : m_tiny_draw_vertices(GetLayerSettings().tiny_draw_vertices),
+      m_max_tiny_draw_percent(GetLayerSettings().max_tiny_draw_percent),
+      m_min_instancing_run(GetLayerSettings().min_instancing_run),
+      m_min_multi_draw_run(GetLayerSettings().min_multi_draw_run) {}
+
+void DrawTelemetry::RecordSubmit(const DrawSummary& summary,
+                                 const DrawRun& pending_run,
+                                 const IndirectRun& pending_indirect_run) {
+  uint64_t draw_count = 0;
+  for (uint64_t bucket_count : summary.draw_sizes) {
+    draw_count += bucket_count;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (size_t bucket = 0; bucket < kDrawSizeBucketCount; bucket++) {
+    m_draw_sizes[bucket] += summary.draw_sizes[bucket];
+  }
+  m_draw_count += draw_count;
+  m_tiny_draw_count += summary.tiny_draw_count;
+  m_frame_draw_count += draw_count;
+  m_frame_tiny_draw_count += summary.tiny_draw_count;
+  m_indirect_call_count += summary.indirect_call_count;
+  m_single_indirect_call_count += summary.single_indirect_call_count;
+  m_indirect_count_call_count += summary.indirect_count_call_count;
+
+  for (const DrawRun& run : summary.merge_candidates) {
+    RecordCandidate(run);
+  }
+  if (m_min_instancing_run != 0 &&
+      pending_run.draw_count >= m_min_instancing_run) {
+    RecordCandidate(pending_run);
+  }
+
+  for (const IndirectRun& run : summary.multi_draw_candidates) {
+    RecordMultiDrawCandidate(run);
+  }
+  if (m_min_multi_draw_run != 0 &&
+      pending_indirect_run.call_count >= m_min_multi_draw_run) {
+    RecordMultiDrawCandidate(pending_indirect_run);
+  }
+
+  for (const IndexBufferUse& use : summary.index_buffer_uses) {
+    RecordIndexBufferUse(use);
+  }
+}
+
+void DrawTelemetry::RecordCandidate(const DrawRun& run) {
+  CandidateStats& stats =
+      m_candidates[{run.pipeline, run.indexed, run.element_count}];
+  stats.run_count++;
+  stats.draw_count += run.draw_count;
+  stats.longest_run = std::max(stats.longest_run, (uint64_t)run.draw_count);
+}
+
+void DrawTelemetry::RecordMultiDrawCandidate(const IndirectRun& run) {
+  CandidateStats& stats =
+      m_multi_draw_candidates[{run.buffer, run.indexed, run.stride}];
+  stats.run_count++;
+  stats.draw_count += run.call_count;
+  stats.longest_run = std::max(stats.longest_run, (uint64_t)run.call_count);
+}
+
+void DrawTelemetry::RecordIndexBufferUse(const IndexBufferUse& use) {
+  auto inserted = m_index_buffers.emplace(use.buffer, use);
+  if (inserted.second) {
+    return;
+  }
+  IndexBufferUse& merged = inserted.first->second;
+  merged.index_capacity = std::max(merged.index_capacity, use.index_capacity);
+  merged.max_index_end = std::max(merged.max_index_end, use.max_index_end);
+  merged.min_vertex_offset =
+      std::min(merged.min_vertex_offset, use.min_vertex_offset);
+  merged.max_vertex_offset =
+      std::max(merged.max_vertex_offset, use.max_vertex_offset);
+  merged.draw_count += use.draw_count;
+  merged.saveable_bytes += use.saveable_bytes;
+}
+
+void DrawTelemetry::RecordBufferDestroyed(uint64_t buffer) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto index_buffer = m_index_buffers.find(buffer);
+  if (index_buffer == m_index_buffers.end()) {
+    return;
+  }
+  m_retired_index_buffer_count++;
+  m_retired_index_buffer_draw_count += index_buffer->second.draw_count;
+  m_retired_index_buffer_saveable_bytes += index_buffer->second.saveable_bytes;
+  m_index_buffers.erase(index_buffer);
+}
+
+DrawTelemetry::Alerts DrawTelemetry::RecordPresent() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Alerts alerts;
+  if (m_max_tiny_draw_percent != 0 &&
+      m_frame_draw_count >= kMinDrawsForTinyDrawAlert &&
+      m_frame_tiny_draw_count * 100 >
+          m_frame_draw_count * m_max_tiny_draw_percent) {
+    alerts.many_tiny_draws = true;
+    m_frames_over_tiny_draw_limit++;
+  }
+  m_frame_count++;
+  m_frame_draw_count = 0;
+  m_frame_tiny_draw_count = 0;
+  return alerts;
+}
+
+std::string DrawTelemetry::BuildReport() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::stringstream report;
+  report << "WitchDoctor draw report: " << m_draw_count
+         << " direct draws and " << m_indirect_call_count
+         << " indirect calls submitted";
+  report << std::fixed << std::setprecision(1);
+
+  if (m_draw_count > 0) {
+    report << "\n  " << m_tiny_draw_count << " direct draws with fewer than "
+           << m_tiny_draw_vertices << " vertices ("
+           << 100.0 * m_tiny_draw_count / m_draw_count << "%)";
+
+    report << "\n  vertices per draw:";
+    const char* separator = " ";
+    for (size_t bucket = 0; bucket < kDrawSizeBucketCount; bucket++) {
+      if (m_draw_sizes[bucket] == 0) {
+        continue;
+      }
+      report << separator;
+      if (bucket == 0) {
+        report << "0";
+      } else if (bucket == 1) {
+        report << "1";
+      } else if (bucket + 1 == kDrawSizeBucketCount) {
+        report << ((uint64_t)1 << (bucket - 1)) << "+";
+      } else {
+        report << ((uint64_t)1 << (bucket - 1)) << "-"
+               << ((uint64_t)1 << bucket) - 1;
+      }
+      report << ": " << m_draw_sizes[bucket];
+      separator = ", ";
+    }
+
+    if (m_frame_count > 0 && m_max_tiny_draw_percent != 0) {
+      report << "\n  " << m_frames_over_tiny_draw_limit << " of "
+             << m_frame_count << " frames with more than "
+             << m_max_tiny_draw_percent << "% tiny draws";
+    }
+  }
+
+  if (m_indirect_call_count > 0) {
+    report << "\n  indirect calls: " << m_single_indirect_call_count
+           << " with a drawCount of 1, " << m_indirect_count_call_count
+           << " with a count buffer";
+  }
+
+  const auto report_stats = [&report](const CandidateStats& stats) {
+    report << stats.run_count << " runs of "
+           << (double)stats.draw_count / stats.run_count << " calls avg, "
+           << stats.longest_run << " longest, "
+           << stats.draw_count - stats.run_count << " calls saved";
+  };
+
+  if (!m_candidates.empty()) {
+    report << "\n  instancing candidates, runs of at least "
+           << m_min_instancing_run
+           << " draws with the same state and geometry:";
+    for (const auto& candidate : GetTopCandidates(m_candidates)) {
+      const CandidateKey& key = candidate.first;
+      report << "\n    pipeline 0x" << std::hex << key.pipeline << std::dec
+             << ", " << key.element_count
+             << (key.indexed ? " indices: " : " vertices: ");
+      report_stats(candidate.second);
+    }
+  }
+
+  if (!m_multi_draw_candidates.empty()) {
+    report << "\n  multi-draw candidates, runs of at least "
+           << m_min_multi_draw_run
+           << " single indirect draws at a fixed stride:";
+    for (const auto& candidate : GetTopCandidates(m_multi_draw_candidates)) {
+      const MultiDrawKey& key = candidate.first;
+      report << "\n    buffer 0x" << std::hex << key.buffer << std::dec
+             << (key.indexed ? ", indexed" : "") << ", stride " << key.stride
+             << ": ";
+      report_stats(candidate.second);
+    }
+  }
+
+  if (!m_index_buffers.empty() || m_retired_index_buffer_count > 0) {
+    static constexpr size_t kReportedIndexBufferCount = 5;
+    std::vector<IndexBufferUse> index_buffers;
+    index_buffers.reserve(m_index_buffers.size());
+    for (const auto& index_buffer : m_index_buffers) {
+      index_buffers.push_back(index_buffer.second);
+    }
+    std::sort(index_buffers.begin(), index_buffers.end(),
+              [](const IndexBufferUse& a, const IndexBufferUse& b) {
+                return a.saveable_bytes > b.saveable_bytes;
+              });
+    if (index_buffers.size() > kReportedIndexBufferCount) {
+      index_buffers.resize(kReportedIndexBufferCount);
+    }
+
+    report << "\n  32-bit index buffers holding few enough indices for 16 "
+              "bits, if the values allow rebasing ("
+           << m_index_buffers.size() << " live buffers):";
+    for (const IndexBufferUse& use : index_buffers) {
+      report << "\n    buffer 0x" << std::hex << use.buffer << std::dec
+             << ": " << use.draw_count << " draws of indices up to "
+             << use.max_index_end << " of " << use.index_capacity
+             << ", vertexOffset " << use.min_vertex_offset;
+      if (use.max_vertex_offset != use.min_vertex_offset) {
+        report << " to " << use.max_vertex_offset;
+      }
+      report << ", " << use.saveable_bytes << " index bytes saveable";
+    }
+    if (m_retired_index_buffer_count > 0) {
+      report << "\n    " << m_retired_index_buffer_count
+             << " destroyed buffers: " << m_retired_index_buffer_draw_count
+             << " draws, " << m_retired_index_buffer_saveable_bytes
+             << " index bytes saveable";
+    }
+  }
+
+  return report.str();
+}
+
+}  // namespace GWD
@@ -0,0 +1,219 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "flat_hash_map.hpp"
+
+namespace GWD {
+
+// Consecutive direct draws recorded with the same bound state and the same
+// geometry, differing only in their first vertex, index or instance. Each run
+// could have been one instanced draw, or one draw over merged geometry.
+struct DrawRun {
+  uint64_t pipeline = 0;
+  bool indexed = false;
+  // Vertices, or indices, per instance
+  uint32_t element_count = 0;
+  uint32_t instance_count = 0;
+  // CommandBufferState::bind_generation the draws were recorded at
+  uint64_t bind_generation = 0;
+  uint32_t draw_count = 0;
+
+  bool Extends(const DrawRun& other) const {
+    return draw_count > 0 && pipeline == other.pipeline &&
+           indexed == other.indexed && element_count == other.element_count &&
+           instance_count == other.instance_count &&
+           bind_generation == other.bind_generation;
+  }
+};
+
+// Consecutive vkCmdDrawIndirect or vkCmdDrawIndexedIndirect calls with a
+// drawCount of 1 and the same bound state, reading their commands from one
+// buffer at a fixed stride. Each run could have been one multi-draw call.
+struct IndirectRun {
+  uint64_t buffer = 0;
+  bool indexed = false;
+  uint64_t last_offset = 0;
+  // Between the offsets of consecutive calls, 0 until the second call
+  uint64_t stride = 0;
+  uint64_t bind_generation = 0;
+  uint32_t call_count = 0;
+};
+
+// Indexed draws from one 32-bit index buffer that holds no more indices than
+// 16 bits can address. The layer never sees the index values, so whether they
+// would fit after rebasing is up to the application; the report shows the
+// index range drawn and the vertexOffsets used to help judge it.
+struct IndexBufferUse {
+  uint64_t buffer = 0;
+  // From the start of the buffer
+  uint64_t index_capacity = 0;
+  uint64_t max_index_end = 0;
+  int32_t min_vertex_offset = 0;
+  int32_t max_vertex_offset = 0;
+  uint64_t draw_count = 0;
+  // Index fetch bandwidth 16-bit indices would have saved, instances included
+  uint64_t saveable_bytes = 0;
+};
+
+// Power-of-two buckets of vertices per direct draw, instances included. The
+// last bucket holds everything from 2^(kDrawSizeBucketCount - 2) up.
+static constexpr size_t kDrawSizeBucketCount = 21;
+
+// What one recording of a command buffer drew, handed to DrawTelemetry each
+// time it is submitted. Only the recording thread touches it while recording.
+struct DrawSummary {
+  std::array<uint64_t, kDrawSizeBucketCount> draw_sizes = {};
+  uint64_t tiny_draw_count = 0;
+  // Finished runs long enough to be worth merging
+  std::vector<DrawRun> merge_candidates;
+
+  uint64_t indirect_call_count = 0;
+  // Indirect calls with a drawCount of 1
+  uint64_t single_indirect_call_count = 0;
+  // vkCmdDraw*IndirectCount calls, already counted as indirect calls
+  uint64_t indirect_count_call_count = 0;
+  // Finished indirect runs long enough to be worth merging
+  std::vector<IndirectRun> multi_draw_candidates;
+  // One entry per stretch of draws from the same index buffer
+  std::vector<IndexBufferUse> index_buffer_uses;
+
+  void RecordDrawSize(uint64_t vertex_count, uint32_t tiny_draw_vertices);
+  // Returns true when the draw starts a new entry rather than extending the
+  // last one
+  bool RecordIndexBufferUse(uint64_t buffer, uint64_t index_capacity,
+                            uint64_t index_end, int32_t vertex_offset,
+                            uint64_t saveable_bytes);
+  void Reset();
+};
+
+// Per-device draw statistics: the spread of draw sizes, frames dominated by
+// tiny draws, the runs of draws that instancing would merge and the runs of
+// indirect calls that a multi-draw call would merge, both ranked by the draw
+// calls they would save, and the 32-bit index buffers that might do with 16
+// bits. Merged under a lock once per submitted command buffer, never per draw.
+class DrawTelemetry {
+ public:
+  // What a frame tripped over, for the caller to report
+  struct Alerts {
+    bool many_tiny_draws = false;
+  };
+
+  DrawTelemetry();
+
+  // The pending runs are the ones still open when the command buffer was
+  // submitted
+  void RecordSubmit(const DrawSummary& summary, const DrawRun& pending_run,
+                    const IndirectRun& pending_indirect_run);
+  // Closes the current frame
+  Alerts RecordPresent();
+  // Folds the buffer's index buffer statistics into the retired total, so a
+  // reused handle starts afresh and the table only holds live buffers
+  void RecordBufferDestroyed(uint64_t buffer);
+
+  std::string BuildReport() const;
+
+ private:
+  // Frames with fewer direct draws than this are never judged tiny-draw-heavy
+  static constexpr uint64_t kMinDrawsForTinyDrawAlert = 100;
+
+  // Runs are ranked by pipeline and geometry, not by where they were recorded
+  struct CandidateKey {
+    uint64_t pipeline;
+    bool indexed;
+    uint32_t element_count;
+
+    bool operator==(const CandidateKey& other) const {
+      return pipeline == other.pipeline && indexed == other.indexed &&
+             element_count == other.element_count;
+    }
+  };
+
+  struct CandidateKeyHash {
+    size_t operator()(const CandidateKey& key) const;
+  };
+
+  struct CandidateStats {
+    uint64_t run_count = 0;
+    // Draws, or indirect calls, in all of the runs
+    uint64_t draw_count = 0;
+    uint64_t longest_run = 0;
+  };
+
+  // Indirect runs are ranked by where their commands live
+  struct MultiDrawKey {
+    uint64_t buffer;
+    bool indexed;
+    uint64_t stride;
+
+    bool operator==(const MultiDrawKey& other) const {
+      return buffer == other.buffer && indexed == other.indexed &&
+             stride == other.stride;
+    }
+  };
+
+  struct MultiDrawKeyHash {
+    size_t operator()(const MultiDrawKey& key) const;
+  };
+
+  struct BufferHash {
+    size_t operator()(uint64_t buffer) const;
+  };
+
+  void RecordCandidate(const DrawRun& run);
+  void RecordMultiDrawCandidate(const IndirectRun& run);
+  void RecordIndexBufferUse(const IndexBufferUse& use);
+
+  mutable std::mutex m_mutex;
+
+  uint32_t m_tiny_draw_vertices = 0;
+  uint32_t m_max_tiny_draw_percent = 0;
+  uint32_t m_min_instancing_run = 0;
+  uint32_t m_min_multi_draw_run = 0;
+
+  std::array<uint64_t, kDrawSizeBucketCount> m_draw_sizes = {};
+  uint64_t m_draw_count = 0;
+  uint64_t m_tiny_draw_count = 0;
+  uint64_t m_indirect_call_count = 0;
+  uint64_t m_single_indirect_call_count = 0;
+  uint64_t m_indirect_count_call_count = 0;
+
+  uint64_t m_frame_draw_count = 0;
+  uint64_t m_frame_tiny_draw_count = 0;
+  uint64_t m_frame_count = 0;
+  uint64_t m_frames_over_tiny_draw_limit = 0;
+
+  ska::flat_hash_map<CandidateKey, CandidateStats, CandidateKeyHash>
+      m_candidates;
+  ska::flat_hash_map<MultiDrawKey, CandidateStats, MultiDrawKeyHash>
+      m_multi_draw_candidates;
+  // Keyed by buffer, IndexBufferUse::buffer is left as is. Live buffers only.
+  ska::flat_hash_map<uint64_t, IndexBufferUse, BufferHash> m_index_buffers;
+  // Index buffers destroyed since
+  uint64_t m_retired_index_buffer_count = 0;
+  uint64_t m_retired_index_buffer_draw_count = 0;
+  uint64_t m_retired_index_buffer_saveable_bytes = 0;
+};
+
+}  // namespace GWD
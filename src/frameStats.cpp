@@ -0,0 +1,247 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "frameStats.h"
+#include "layerSettings.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace GWD {
+
+static const char* const kFrameCounterNames[] = {
+    "draw calls",      "dispatches",        "binds",
+    "redundant binds", "submits",           "allocations",
+    "set allocations", "descriptor writes", "pool resets",
+    "warnings",        "saveable index bytes",
+};
+static_assert(sizeof(kFrameCounterNames) / sizeof(kFrameCounterNames[0]) ==
+                  (size_t)FrameCounter::kCount,
+              "Every frame counter needs a name");
+
+static uint64_t ToMicroseconds(FrameStats::Clock::duration duration) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+             duration)
+      .count();
+}
+
+static std::string FormatMilliseconds(uint64_t microseconds) {
+  std::stringstream formatted;
+  formatted << std::fixed << std::setprecision(2) << microseconds / 1000.0
+            << " ms";
+  return formatted.str();
+}
+
+size_t DurationHistogram::GetBucketIndex(uint64_t value) {
+  if (value < kSubBucketCount) {
+    return (size_t)value;
+  }
+  uint32_t top_bit = kSubBucketBits;
+  while (top_bit + 1 < 64 && (value >> (top_bit + 1)) != 0) {
+    top_bit++;
+  }
+  const uint32_t shift = top_bit - kSubBucketBits;
+  return (shift + 1) * kSubBucketCount +
+         (size_t)((value >> shift) - kSubBucketCount);
+}
+
+uint64_t DurationHistogram::GetBucketMidpoint(size_t bucket_index) {
+  if (bucket_index < kSubBucketCount) {
+    return bucket_index;
+  }
+  const uint32_t shift = (uint32_t)(bucket_index / kSubBucketCount) - 1;
+  const uint64_t bucket_start =
+      (uint64_t)(kSubBucketCount + bucket_index % kSubBucketCount) << shift;
+  return bucket_start + ((uint64_t)1 << shift) / 2;
+}
+
+void DurationHistogram::Record(uint64_t value_us) {
+  const uint64_t max_value = ((uint64_t)1 << kMaxValueBits) - 1;
+  if (value_us > max_value) {
+    value_us = max_value;
+  }
+  m_buckets[GetBucketIndex(value_us)]++;
+  m_count++;
+  if (value_us > m_max) {
+    m_max = value_us;
+  }
+}
+
+uint64_t DurationHistogram::GetQuantile(double quantile) const {
+  if (m_count == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(quantile * m_count + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (size_t bucket_index = 0; bucket_index < kBucketCount; bucket_index++) {
+    seen += m_buckets[bucket_index];
+    if (seen >= rank) {
+      // The midpoint of the last bucket can lie past the largest value
+      return std::min(GetBucketMidpoint(bucket_index), m_max);
+    }
+  }
+  return m_max;
+}
+
+FrameStats::FrameStats()
+    : m_spike_threshold_percent(GetLayerSettings().frame_spike_percent) {
+  for (auto& shard : m_counter_shards) {
+    for (auto& count : shard.counts) {
+      count.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+size_t FrameStats::GetCounterShard() {
+  static std::atomic<size_t> s_next_shard{0};
+  static thread_local const size_t t_shard =
+      s_next_shard.fetch_add(1, std::memory_order_relaxed) %
+      kCounterShardCount;
+  return t_shard;
+}
+
+void FrameStats::RecordAcquire(Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  // Only the first acquire of a frame starts it
+  if (!m_acquired) {
+    m_acquired = true;
+    m_acquire_time = now;
+  }
+}
+
+FrameStats::Frame FrameStats::RecordPresent(Clock::time_point now) {
+  Frame frame;
+  for (auto& shard : m_counter_shards) {
+    for (size_t counter = 0; counter < frame.counters.size(); counter++) {
+      frame.counters[counter] +=
+          shard.counts[counter].exchange(0, std::memory_order_relaxed);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  frame.index = m_frame_count.fetch_add(1, std::memory_order_relaxed);
+
+  if (m_acquired) {
+    frame.frame_time = now - m_acquire_time;
+    m_frame_times.Record(ToMicroseconds(frame.frame_time));
+    m_acquired = false;
+  }
+
+  if (m_presented) {
+    frame.present_interval = now - m_present_time;
+    const uint64_t interval_us = ToMicroseconds(frame.present_interval);
+    if (m_spike_threshold_percent != 0 &&
+        m_present_intervals.GetCount() >= kMinFramesForSpikes) {
+      const uint64_t median_us = m_present_intervals.GetQuantile(0.5);
+      if (interval_us * 100 > median_us * m_spike_threshold_percent) {
+        m_spike_count++;
+        frame.median_present_interval = std::chrono::microseconds(median_us);
+        if (now - m_last_spike_report >= std::chrono::seconds(1)) {
+          frame.report_spike = true;
+          m_last_spike_report = now;
+        }
+      }
+    }
+    m_present_intervals.Record(interval_us);
+  }
+  m_presented = true;
+  m_present_time = now;
+
+  for (size_t counter = 0; counter < frame.counters.size(); counter++) {
+    m_counter_totals[counter] += frame.counters[counter];
+    m_counter_peaks[counter] =
+        std::max(m_counter_peaks[counter], frame.counters[counter]);
+  }
+
+  return frame;
+}
+
+std::string FrameStats::BuildReport() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const uint64_t frame_count = m_frame_count.load(std::memory_order_relaxed);
+
+  std::stringstream report;
+  report << "WitchDoctor frame report: " << frame_count << " frames";
+
+  const auto report_histogram = [&report](const char* name,
+                                          const DurationHistogram& histogram) {
+    if (histogram.GetCount() == 0) {
+      return;
+    }
+    report << "\n  " << name << ": p50 "
+           << FormatMilliseconds(histogram.GetQuantile(0.5)) << ", p99 "
+           << FormatMilliseconds(histogram.GetQuantile(0.99)) << ", p99.9 "
+           << FormatMilliseconds(histogram.GetQuantile(0.999)) << ", max "
+           << FormatMilliseconds(histogram.GetMax());
+  };
+  report_histogram("CPU frame time (acquire to present)", m_frame_times);
+  report_histogram("present interval", m_present_intervals);
+
+  if (m_spike_threshold_percent != 0) {
+    report << "\n  " << m_spike_count
+           << " frames with a present interval over "
+           << m_spike_threshold_percent << "% of the median";
+  }
+
+  const uint64_t bind_count = m_counter_totals[(size_t)FrameCounter::kBinds];
+  if (bind_count > 0) {
+    const uint64_t redundant_bind_count =
+        m_counter_totals[(size_t)FrameCounter::kRedundantBinds];
+    report << "\n  " << redundant_bind_count << " of " << bind_count
+           << " binds were redundant (" << std::fixed << std::setprecision(1)
+           << 100.0 * redundant_bind_count / bind_count << "%)";
+  }
+
+  if (frame_count > 0) {
+    report << "\n  per frame:";
+    const char* separator = " ";
+    for (size_t counter = 0; counter < m_counter_totals.size(); counter++) {
+      report << separator << kFrameCounterNames[counter] << " "
+             << std::fixed << std::setprecision(1)
+             << (double)m_counter_totals[counter] / frame_count
+             << " avg, " << m_counter_peaks[counter] << " peak";
+      separator = "; ";
+    }
+  }
+
+  return report.str();
+}
+
+std::string FrameStats::FormatSpike(const Frame& frame) {
+  std::stringstream message;
+  message << "WitchDoctor frame " << frame.index << " took "
+          << FormatMilliseconds(ToMicroseconds(frame.present_interval))
+          << " from the previous present, against a median of "
+          << FormatMilliseconds(ToMicroseconds(frame.median_present_interval));
+  if (frame.frame_time != Clock::duration::zero()) {
+    message << " (" << FormatMilliseconds(ToMicroseconds(frame.frame_time))
+            << " since acquire)";
+  }
+  message << ", with";
+  const char* separator = " ";
+  for (size_t counter = 0; counter < frame.counters.size(); counter++) {
+    message << separator << frame.counters[counter] << " "
+            << kFrameCounterNames[counter];
+    separator = ", ";
+  }
+  return message.str();
+}
+
+}  // namespace GWD
@@ -0,0 +1,160 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+namespace GWD {
+
+// Log-linear histogram of durations in microseconds, in the style of
+// HdrHistogram: values are bucketed by power of two, and each power of two is
+// split into kSubBucketCount linear sub-buckets, so a bucket is never wider
+// than ~6% of the values it holds.
+class DurationHistogram {
+ public:
+  void Record(uint64_t value_us);
+
+  uint64_t GetCount() const { return m_count; }
+  uint64_t GetMax() const { return m_max; }
+  // Approximate value that the given fraction of the recorded values are at
+  // or below
+  uint64_t GetQuantile(double quantile) const;
+
+ private:
+  static constexpr uint32_t kSubBucketBits = 4;
+  static constexpr uint32_t kSubBucketCount = 1u << kSubBucketBits;
+  // Larger values, over 12 days, are clamped
+  static constexpr uint32_t kMaxValueBits = 40;
+  static constexpr size_t kBucketCount =
+      (kMaxValueBits - kSubBucketBits + 1) * kSubBucketCount;
+
+  static size_t GetBucketIndex(uint64_t value);
+  static uint64_t GetBucketMidpoint(size_t bucket_index);
+
+  std::array<uint64_t, kBucketCount> m_buckets = {};
+  uint64_t m_count = 0;
+  uint64_t m_max = 0;
+};
+
+// What gets counted per frame
+enum class FrameCounter : uint32_t {
+  // Draw calls. An indirect call counts once whatever its drawCount, since
+  // the *IndirectCount variants only learn theirs on the GPU.
+  kDraws,
+  kDispatches,
+  kBinds,
+  // Binds that left the bound state as it was
+  kRedundantBinds,
+  kSubmits,
+  kAllocations,
+  kDescriptorSetAllocations,
+  // VkWriteDescriptorSets, VkCopyDescriptorSets and template updates
+  kDescriptorWrites,
+  kDescriptorPoolResets,
+  kWarnings,
+  // Index fetch bandwidth that 16-bit indices would have saved
+  kSaveableIndexBytes,
+  kCount
+};
+
+// Per-device frame pacing, with vkQueuePresentKHR as the frame boundary. The
+// CPU frame time runs from the return of vkAcquireNextImageKHR to the next
+// present, the present interval from one present to the next. Devices that
+// present to several swapchains with separate calls see each call as a frame.
+//
+// Counters are bumped from every recording thread, so they are sharded per
+// thread and only summed up once per frame.
+class FrameStats {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Frame {
+    uint64_t index = 0;
+    // Zero when no image was acquired during the frame
+    Clock::duration frame_time = Clock::duration::zero();
+    // Zero for the first frame
+    Clock::duration present_interval = Clock::duration::zero();
+    std::array<uint64_t, (size_t)FrameCounter::kCount> counters = {};
+    // Set when the present interval is far above the median so far, at most
+    // once per second
+    bool report_spike = false;
+    Clock::duration median_present_interval = Clock::duration::zero();
+  };
+
+  FrameStats();
+
+  FrameStats(const FrameStats&) = delete;
+  FrameStats& operator=(const FrameStats&) = delete;
+
+  // Lock-free
+  void Count(FrameCounter counter, uint64_t amount = 1) {
+    m_counter_shards[GetCounterShard()]
+        .counts[(size_t)counter]
+        .fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  void RecordAcquire(Clock::time_point now);
+  // Closes the current frame and returns it
+  Frame RecordPresent(Clock::time_point now);
+
+  // Lock-free
+  uint64_t GetFrameCount() const {
+    return m_frame_count.load(std::memory_order_relaxed);
+  }
+  std::string BuildReport() const;
+  static std::string FormatSpike(const Frame& frame);
+
+ private:
+  static constexpr size_t kCounterShardCount = 16;
+  // Spikes are only judged once the median has settled a little
+  static constexpr uint64_t kMinFramesForSpikes = 30;
+
+  struct CounterShard {
+    std::array<std::atomic<uint64_t>, (size_t)FrameCounter::kCount> counts;
+    char cache_line_padding[64];
+  };
+
+  static size_t GetCounterShard();
+
+  std::array<CounterShard, kCounterShardCount> m_counter_shards;
+
+  uint32_t m_spike_threshold_percent = 0;
+
+  mutable std::mutex m_mutex;
+  // Only written with m_mutex held
+  std::atomic<uint64_t> m_frame_count{0};
+  bool m_acquired = false;
+  Clock::time_point m_acquire_time;
+  bool m_presented = false;
+  Clock::time_point m_present_time;
+  Clock::time_point m_last_spike_report;
+  uint64_t m_spike_count = 0;
+
+  DurationHistogram m_frame_times;
+  DurationHistogram m_present_intervals;
+  std::array<uint64_t, (size_t)FrameCounter::kCount> m_counter_totals = {};
+  std::array<uint64_t, (size_t)FrameCounter::kCount> m_counter_peaks = {};
+};
+
+}  // namespace GWD
@@ -0,0 +1,310 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <vector>
+
+#include "handleHash.h"
+
+namespace GWD {
+
+// Table of small per-handle records (memory type of a VkBuffer, and so on).
+//
+// Unlike ConcurrentMap, which suits a few long-lived objects, this is meant for
+// handles that are created and destroyed all the time. Records are stored
+// inline in open-addressed slots, and Erase() compacts the probe sequence
+// (backward shift deletion) so freed slots are reclaimed immediately instead of
+// piling up as tombstones. Tables shrink again once most handles are gone.
+//
+// The table is split into shards picked by handle hash, each with its own lock,
+// so threads creating and destroying unrelated handles rarely contend. Records
+// are copied in and out under the shard lock; callers never hold a pointer into
+// the table.
+template <typename Handle, typename Record>
+class HandleTable {
+ public:
+  HandleTable() = default;
+
+  HandleTable(const HandleTable&) = delete;
+  HandleTable& operator=(const HandleTable&) = delete;
+
+  // Inserts the record, or overwrites it if the handle is already present
+  void Insert(Handle handle, const Record& record) {
+    const uint64_t raw_handle = (uint64_t)handle;
+    const uint64_t hash = Hash(raw_handle);
+    Shard& shard = GetShard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if ((shard.live_entries + 1) * 4 > shard.slots.size() * 3) {
+      shard.Resize(std::max((size_t)kMinShardCapacity, shard.slots.size() * 2));
+    }
+
+    Slot* slot = shard.Probe(raw_handle, hash);
+    if (slot->handle == kEmptyHandle) {
+      slot->handle = raw_handle;
+      shard.live_entries++;
+    }
+    slot->record = record;
+  }
+
+  // Returns false if the handle isn't tracked. The erased record is copied to
+  // erased_record if it is non-null.
+  bool Erase(Handle handle, Record* erased_record = nullptr) {
+    const uint64_t raw_handle = (uint64_t)handle;
+    const uint64_t hash = Hash(raw_handle);
+    Shard& shard = GetShard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if (shard.slots.empty()) {
+      return false;
+    }
+    Slot* slot = shard.Probe(raw_handle, hash);
+    if (slot->handle == kEmptyHandle) {
+      return false;
+    }
+    if (erased_record != nullptr) {
+      *erased_record = slot->record;
+    }
+    shard.EraseSlot((size_t)(slot - shard.slots.data()));
+
+    if (shard.slots.size() > kMinShardCapacity &&
+        shard.live_entries * 8 < shard.slots.size()) {
+      shard.Resize(shard.slots.size() / 2);
+    }
+    return true;
+  }
+
+  // Copies the record out. Returns false if the handle isn't tracked.
+  bool Find(Handle handle, Record* record) const {
+    const uint64_t raw_handle = (uint64_t)handle;
+    const uint64_t hash = Hash(raw_handle);
+    const Shard& shard = GetShard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if (shard.slots.empty()) {
+      return false;
+    }
+    const Slot* slot = shard.Probe(raw_handle, hash);
+    if (slot->handle == kEmptyHandle) {
+      return false;
+    }
+    *record = slot->record;
+    return true;
+  }
+
+  // Runs updater on the record in place, under the shard lock. Returns false
+  // if the handle isn't tracked.
+  template <typename Updater>
+  bool Update(Handle handle, Updater updater) {
+    const uint64_t raw_handle = (uint64_t)handle;
+    const uint64_t hash = Hash(raw_handle);
+    Shard& shard = GetShard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if (shard.slots.empty()) {
+      return false;
+    }
+    Slot* slot = shard.Probe(raw_handle, hash);
+    if (slot->handle == kEmptyHandle) {
+      return false;
+    }
+    updater(slot->record);
+    return true;
+  }
+
+  // Batched Find()/Update() for the vkBind*2 style entry points. The handles
+  // are grouped by shard so each shard's lock is taken once for the whole
+  // batch instead of once per element. get_handle(index) returns the handle of
+  // an element, and visitor(index, record) is called for every element, with
+  // a null record for handles that aren't tracked.
+  template <typename GetHandle, typename Visitor>
+  void VisitBatch(size_t count, GetHandle get_handle, Visitor visitor) {
+    std::vector<uint64_t> hashes(count);
+    std::array<size_t, kShardCount + 1> shard_starts = {};
+    for (size_t index = 0; index < count; index++) {
+      hashes[index] = Hash((uint64_t)get_handle(index));
+      shard_starts[ShardIndex(hashes[index]) + 1]++;
+    }
+    for (size_t shard_index = 0; shard_index < kShardCount; shard_index++) {
+      shard_starts[shard_index + 1] += shard_starts[shard_index];
+    }
+
+    std::vector<size_t> indices_by_shard(count);
+    std::array<size_t, kShardCount + 1> shard_fill = shard_starts;
+    for (size_t index = 0; index < count; index++) {
+      indices_by_shard[shard_fill[ShardIndex(hashes[index])]++] = index;
+    }
+
+    for (size_t shard_index = 0; shard_index < kShardCount; shard_index++) {
+      const size_t begin = shard_starts[shard_index];
+      const size_t end = shard_starts[shard_index + 1];
+      if (begin == end) {
+        continue;
+      }
+
+      Shard& shard = m_shards[shard_index];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      for (size_t position = begin; position < end; position++) {
+        const size_t index = indices_by_shard[position];
+        Record* record = nullptr;
+        if (!shard.slots.empty()) {
+          Slot* slot =
+              shard.Probe((uint64_t)get_handle(index), hashes[index]);
+          if (slot->handle != kEmptyHandle) {
+            record = &slot->record;
+          }
+        }
+        visitor(index, record);
+      }
+    }
+  }
+
+  // Erases every record predicate(record) returns true for, e.g. the objects
+  // of a pool that is reset. Walks the whole table, so it's only meant for
+  // rare bulk frees.
+  template <typename Predicate>
+  void EraseIf(Predicate predicate) {
+    std::vector<uint64_t> erased_handles;
+    for (Shard& shard : m_shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+
+      // Erasing shifts later slots back, so collect the handles first
+      erased_handles.clear();
+      for (const Slot& slot : shard.slots) {
+        if (slot.handle != kEmptyHandle && predicate(slot.record)) {
+          erased_handles.push_back(slot.handle);
+        }
+      }
+      for (uint64_t raw_handle : erased_handles) {
+        Slot* slot = shard.Probe(raw_handle, Hash(raw_handle));
+        shard.EraseSlot((size_t)(slot - shard.slots.data()));
+      }
+
+      size_t capacity = shard.slots.size();
+      while (capacity > kMinShardCapacity &&
+             shard.live_entries * 8 < capacity) {
+        capacity /= 2;
+      }
+      if (capacity != shard.slots.size()) {
+        shard.Resize(capacity);
+      }
+    }
+  }
+
+  size_t Size() const {
+    size_t size = 0;
+    for (const Shard& shard : m_shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      size += shard.live_entries;
+    }
+    return size;
+  }
+
+ private:
+  // VK_NULL_HANDLE is never tracked, so it doubles as the empty marker
+  static constexpr uint64_t kEmptyHandle = 0;
+  static constexpr size_t kShardCount = 16;
+  static constexpr size_t kMinShardCapacity = 16;
+
+  struct Slot {
+    uint64_t handle = kEmptyHandle;
+    Record record = {};
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::vector<Slot> slots;
+    size_t live_entries = 0;
+    // Keep neighbouring shards' locks off each other's cache lines
+    char cache_line_padding[64];
+
+    size_t HomeIndex(uint64_t hash) const {
+      return (size_t)hash & (slots.size() - 1);
+    }
+
+    // Returns the slot holding the handle, or the empty slot that ends its
+    // probe sequence. The table must not be empty.
+    Slot* Probe(uint64_t raw_handle, uint64_t hash) {
+      const size_t mask = slots.size() - 1;
+      size_t slot_index = HomeIndex(hash);
+      while (slots[slot_index].handle != raw_handle &&
+             slots[slot_index].handle != kEmptyHandle) {
+        slot_index = (slot_index + 1) & mask;
+      }
+      return &slots[slot_index];
+    }
+    const Slot* Probe(uint64_t raw_handle, uint64_t hash) const {
+      return const_cast<Shard*>(this)->Probe(raw_handle, hash);
+    }
+
+    // Pulls later members of the probe sequence back into the hole so lookups
+    // never need tombstones.
+    void EraseSlot(size_t hole_index) {
+      const size_t mask = slots.size() - 1;
+      size_t slot_index = hole_index;
+      for (;;) {
+        slot_index = (slot_index + 1) & mask;
+        Slot& slot = slots[slot_index];
+        if (slot.handle == kEmptyHandle) {
+          break;
+        }
+        const size_t home_index = HomeIndex(Hash(slot.handle));
+        // Move the slot only if its home isn't cyclically in (hole, slot]
+        const size_t distance_to_slot = (slot_index - home_index) & mask;
+        const size_t distance_to_hole = (slot_index - hole_index) & mask;
+        if (distance_to_slot >= distance_to_hole) {
+          slots[hole_index] = slot;
+          hole_index = slot_index;
+        }
+      }
+      slots[hole_index] = Slot();
+      live_entries--;
+    }
+
+    void Resize(size_t new_capacity) {
+      std::vector<Slot> old_slots(new_capacity);
+      old_slots.swap(slots);
+      for (const Slot& old_slot : old_slots) {
+        if (old_slot.handle != kEmptyHandle) {
+          *Probe(old_slot.handle, Hash(old_slot.handle)) = old_slot;
+        }
+      }
+    }
+  };
+
+  // Handles are mostly aligned pointers, so mix the bits. The top bits pick
+  // the shard and the low bits the slot, so the two stay independent.
+  static uint64_t Hash(uint64_t raw_handle) {
+    return MixHandleBits(raw_handle);
+  }
+
+  static size_t ShardIndex(uint64_t hash) { return (size_t)(hash >> 60); }
+
+  Shard& GetShard(uint64_t hash) { return m_shards[ShardIndex(hash)]; }
+  const Shard& GetShard(uint64_t hash) const {
+    return m_shards[ShardIndex(hash)];
+  }
+
+  std::array<Shard, kShardCount> m_shards;
+};
+
+}  // namespace GWD
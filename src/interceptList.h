@@ -0,0 +1,92 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+// Every entry point the layer hands out. Instance-level functions are only
+// available through GetInstanceProcAddr, while device-level functions are
+// available through both GetInstanceProcAddr and GetDeviceProcAddr.
+//
+// X(func) is expanded once per entry point, with func the name without its
+// vk prefix. layerCore.cpp builds its lookup table from these lists, and the
+// proc address benchmark its reference strcmp chain.
+#define GWD_INSTANCE_LEVEL_INTERCEPTS(X)  \
+  X(GetInstanceProcAddr)                  \
+  X(CreateInstance)                       \
+  X(DestroyInstance)                      \
+  X(CreateDebugUtilsMessengerEXT)         \
+  X(DestroyDebugUtilsMessengerEXT)        \
+  X(EnumerateInstanceLayerProperties)     \
+  X(EnumerateInstanceExtensionProperties)
+
+#define GWD_DEVICE_LEVEL_INTERCEPTS(X)  \
+  X(GetDeviceProcAddr)                  \
+  X(EnumerateDeviceLayerProperties)     \
+  X(EnumerateDeviceExtensionProperties) \
+  X(CreateDevice)                       \
+  X(DestroyDevice)                      \
+  X(GetDeviceQueue)                     \
+  X(QueueSubmit)                        \
+  X(QueueBindSparse)                    \
+  X(AcquireNextImageKHR)                \
+  X(QueuePresentKHR)                    \
+  X(AllocateMemory)                     \
+  X(FreeMemory)                         \
+  X(MapMemory)                          \
+  X(UnmapMemory)                        \
+  X(FlushMappedMemoryRanges)            \
+  X(InvalidateMappedMemoryRanges)       \
+  X(GetDeviceMemoryCommitment)          \
+  X(BindBufferMemory)                   \
+  X(CreateBuffer)                       \
+  X(DestroyBuffer)                      \
+  X(BindBufferMemory2)                  \
+  X(CreateImage)                        \
+  X(DestroyImage)                       \
+  X(BindImageMemory)                    \
+  X(BindImageMemory2)                   \
+  X(BindBufferMemory2KHR)               \
+  X(BindImageMemory2KHR)                \
+  X(CmdDraw)                            \
+  X(CmdDrawIndexed)                     \
+  X(CmdDrawIndirect)                    \
+  X(CmdDrawIndexedIndirect)             \
+  X(CmdDrawIndirectCount)               \
+  X(CmdDrawIndexedIndirectCount)        \
+  X(CmdDrawIndirectCountKHR)            \
+  X(CmdDrawIndexedIndirectCountKHR)     \
+  X(CmdDispatch)                        \
+  X(CmdDispatchIndirect)                \
+  X(CmdExecuteCommands)                 \
+  X(AllocateCommandBuffers)             \
+  X(FreeCommandBuffers)                 \
+  X(DestroyCommandPool)                 \
+  X(AllocateDescriptorSets)             \
+  X(FreeDescriptorSets)                 \
+  X(ResetDescriptorPool)                \
+  X(DestroyDescriptorPool)              \
+  X(UpdateDescriptorSets)               \
+  X(CreateDescriptorUpdateTemplate)     \
+  X(DestroyDescriptorUpdateTemplate)    \
+  X(UpdateDescriptorSetWithTemplate)    \
+  X(CreateDescriptorUpdateTemplateKHR)  \
+  X(DestroyDescriptorUpdateTemplateKHR) \
+  X(UpdateDescriptorSetWithTemplateKHR) \
+  X(BeginCommandBuffer)                 \
+  X(CmdBindIndexBuffer)                 \
+  X(CmdBindVertexBuffers)               \
+  X(CmdBindPipeline)                    \
+  X(CmdBindDescriptorSets)
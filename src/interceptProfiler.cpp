@@ -0,0 +1,173 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "interceptProfiler.h"
+#include "layerSettings.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace GWD {
+
+InterceptProfiler& InterceptProfiler::Get() {
+  static InterceptProfiler s_profiler;
+  return s_profiler;
+}
+
+InterceptProfiler::InterceptProfiler()
+    : m_enabled(GetLayerSettings().profile_intercepts),
+      m_report_interval(
+          std::chrono::seconds(GetLayerSettings().profile_report_interval_s)) {
+  // An interval of 0 means only the reports at device destruction are wanted
+  const int64_t first_report_ticks =
+      m_report_interval == Clock::duration::zero()
+          ? INT64_MAX
+          : (Clock::now() + m_report_interval).time_since_epoch().count();
+  m_next_report_ticks.store(first_report_ticks);
+}
+
+uint32_t InterceptProfiler::RegisterEntryPoint(const char* name) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const uint32_t entry_point =
+      m_entry_point_count.load(std::memory_order_relaxed);
+  if (entry_point == kMaxEntryPoints) {
+    return kMaxEntryPoints;
+  }
+  m_entry_point_names[entry_point] = name;
+  m_entry_point_count.store(entry_point + 1, std::memory_order_release);
+  return entry_point;
+}
+
+InterceptProfiler::ThreadCounters* InterceptProfiler::GetThreadCounters() {
+  // Owned by the profiler, so that the counts outlive their thread
+  static thread_local ThreadCounters* t_counters = nullptr;
+  if (t_counters == nullptr) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_thread_counters.emplace_back(new ThreadCounters);
+    t_counters = m_thread_counters.back().get();
+  }
+  return t_counters;
+}
+
+void InterceptProfiler::Record(uint32_t entry_point,
+                               Clock::duration downstream_time,
+                               Clock::duration layer_time) {
+  if (entry_point >= kMaxEntryPoints) {
+    return;
+  }
+  // Only this thread writes its counters, so plain loads and stores do; the
+  // atomics are there for the reports reading them from other threads.
+  EntryPointCounters& counters = (*GetThreadCounters())[entry_point];
+  const auto add = [](std::atomic<uint64_t>* counter, uint64_t amount) {
+    counter->store(counter->load(std::memory_order_relaxed) + amount,
+                   std::memory_order_relaxed);
+  };
+  add(&counters.call_count, 1);
+  add(&counters.downstream_ns,
+      (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+          downstream_time)
+          .count());
+  add(&counters.layer_ns,
+      (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+          layer_time)
+          .count());
+}
+
+bool InterceptProfiler::ClaimPeriodicReport() {
+  if (!m_enabled) {
+    return false;
+  }
+  const int64_t now_ticks = Clock::now().time_since_epoch().count();
+  int64_t next_report_ticks =
+      m_next_report_ticks.load(std::memory_order_relaxed);
+  if (now_ticks < next_report_ticks) {
+    return false;
+  }
+  return m_next_report_ticks.compare_exchange_strong(
+      next_report_ticks, now_ticks + m_report_interval.count());
+}
+
+std::string InterceptProfiler::BuildReport() const {
+  struct EntryPointTotals {
+    const char* name = nullptr;
+    uint64_t call_count = 0;
+    uint64_t downstream_ns = 0;
+    uint64_t layer_ns = 0;
+  };
+
+  std::vector<EntryPointTotals> totals;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const uint32_t entry_point_count =
+        m_entry_point_count.load(std::memory_order_acquire);
+    totals.resize(entry_point_count);
+    for (uint32_t entry_point = 0; entry_point < entry_point_count;
+         entry_point++) {
+      totals[entry_point].name = m_entry_point_names[entry_point];
+    }
+    for (const auto& thread_counters : m_thread_counters) {
+      for (uint32_t entry_point = 0; entry_point < entry_point_count;
+           entry_point++) {
+        const EntryPointCounters& counters = (*thread_counters)[entry_point];
+        EntryPointTotals& entry_point_totals = totals[entry_point];
+        entry_point_totals.call_count +=
+            counters.call_count.load(std::memory_order_relaxed);
+        entry_point_totals.downstream_ns +=
+            counters.downstream_ns.load(std::memory_order_relaxed);
+        entry_point_totals.layer_ns +=
+            counters.layer_ns.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Costliest first
+  std::sort(totals.begin(), totals.end(),
+            [](const EntryPointTotals& a, const EntryPointTotals& b) {
+              return a.layer_ns > b.layer_ns;
+            });
+
+  uint64_t total_layer_ns = 0;
+  uint64_t total_downstream_ns = 0;
+  for (const EntryPointTotals& entry_point_totals : totals) {
+    total_layer_ns += entry_point_totals.layer_ns;
+    total_downstream_ns += entry_point_totals.downstream_ns;
+  }
+
+  std::stringstream report;
+  report << std::fixed << std::setprecision(3);
+  report << "WitchDoctor overhead report: " << total_layer_ns / 1.0e6
+         << " ms in the layer, " << total_downstream_ns / 1.0e6
+         << " ms downstream";
+  for (const EntryPointTotals& entry_point_totals : totals) {
+    if (entry_point_totals.call_count == 0) {
+      continue;
+    }
+    const double call_count = (double)entry_point_totals.call_count;
+    report << "\n  " << entry_point_totals.name << ": "
+           << entry_point_totals.call_count << " calls, layer "
+           << entry_point_totals.layer_ns / 1.0e6 << " ms ("
+           << std::setprecision(0) << entry_point_totals.layer_ns / call_count
+           << " ns/call), downstream " << std::setprecision(3)
+           << entry_point_totals.downstream_ns / 1.0e6 << " ms ("
+           << std::setprecision(0)
+           << entry_point_totals.downstream_ns / call_count << " ns/call)"
+           << std::setprecision(3);
+  }
+  return report.str();
+}
+
+}  // namespace GWD
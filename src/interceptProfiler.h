@@ -0,0 +1,140 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace GWD {
+
+// Optional accounting of the layer's own cost, enabled with
+// GWD_PROFILE_INTERCEPTS. Each intercept is split into the time spent in the
+// downstream call and the time spent everywhere else, i.e. in the layer.
+//
+// Every thread accumulates into its own block of counters, which only that
+// thread writes, so timing a call never touches shared cache lines. Reports
+// sum up every block, including those of threads that have exited.
+class InterceptProfiler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr uint32_t kMaxEntryPoints = 64;
+
+  static InterceptProfiler& Get();
+
+  InterceptProfiler(const InterceptProfiler&) = delete;
+  InterceptProfiler& operator=(const InterceptProfiler&) = delete;
+
+  bool IsEnabled() const { return m_enabled; }
+
+  // Called once per intercept. Returns kMaxEntryPoints, which is never
+  // recorded, once every slot is taken.
+  uint32_t RegisterEntryPoint(const char* name);
+
+  void Record(uint32_t entry_point, Clock::duration downstream_time,
+              Clock::duration layer_time);
+
+  // True once per GWD_PROFILE_REPORT_INTERVAL_S; the caller that gets true
+  // should print the report
+  bool ClaimPeriodicReport();
+
+  std::string BuildReport() const;
+
+ private:
+  InterceptProfiler();
+
+  struct EntryPointCounters {
+    std::atomic<uint64_t> call_count{0};
+    std::atomic<uint64_t> downstream_ns{0};
+    std::atomic<uint64_t> layer_ns{0};
+  };
+  using ThreadCounters = std::array<EntryPointCounters, kMaxEntryPoints>;
+
+  ThreadCounters* GetThreadCounters();
+
+  const bool m_enabled;
+  const Clock::duration m_report_interval;
+  std::atomic<int64_t> m_next_report_ticks;
+
+  std::array<const char*, kMaxEntryPoints> m_entry_point_names = {};
+  std::atomic<uint32_t> m_entry_point_count{0};
+
+  mutable std::mutex m_mutex;
+  std::vector<std::unique_ptr<ThreadCounters>> m_thread_counters;
+};
+
+// Times one call of an intercept for InterceptProfiler, and does nothing when
+// profiling is disabled.
+class InterceptTimer {
+ public:
+  explicit InterceptTimer(uint32_t entry_point)
+      : m_entry_point(entry_point),
+        m_enabled(InterceptProfiler::Get().IsEnabled()) {
+    if (m_enabled) {
+      m_start = InterceptProfiler::Clock::now();
+    }
+  }
+
+  ~InterceptTimer() {
+    if (m_enabled) {
+      const InterceptProfiler::Clock::duration total_time =
+          InterceptProfiler::Clock::now() - m_start;
+      InterceptProfiler::Get().Record(m_entry_point, m_downstream_time,
+                                      total_time - m_downstream_time);
+    }
+  }
+
+  InterceptTimer(const InterceptTimer&) = delete;
+  InterceptTimer& operator=(const InterceptTimer&) = delete;
+
+  void BeginDownstream() {
+    if (m_enabled) {
+      m_downstream_start = InterceptProfiler::Clock::now();
+    }
+  }
+
+  void EndDownstream() {
+    if (m_enabled) {
+      m_downstream_time +=
+          InterceptProfiler::Clock::now() - m_downstream_start;
+    }
+  }
+
+ private:
+  const uint32_t m_entry_point;
+  const bool m_enabled;
+  InterceptProfiler::Clock::time_point m_start;
+  InterceptProfiler::Clock::time_point m_downstream_start;
+  InterceptProfiler::Clock::duration m_downstream_time =
+      InterceptProfiler::Clock::duration::zero();
+};
+
+}  // namespace GWD
+
+// Times the rest of the enclosing intercept as vk<func>. The downstream call
+// goes between intercept_timer.BeginDownstream() and EndDownstream().
+#define GWD_PROFILE_INTERCEPT(func)                                 \
+  static const uint32_t s_profiled_entry_point =                    \
+      GWD::InterceptProfiler::Get().RegisterEntryPoint("vk" #func); \
+  GWD::InterceptTimer intercept_timer(s_profiled_entry_point)
@@ -21,11 +21,19 @@
 #include "vk_layer_dispatch_table.h"
 
 #include <assert.h>
-#include <mutex>
-#include <unordered_map>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
 
 #include "WitchDoc.h"
+#include "bufferShadower.h"
+#include "interceptList.h"
+#include "interceptProfiler.h"
 #include "layerCore.h"
+#include "layerSettings.h"
+#include "memorySuballocator.h"
+#include "traceWriter.h"
 
 namespace GWDInterface {
 
@@ -45,69 +53,242 @@ static constexpr const uint32_t kLayerSpecVersion = VK_API_VERSION_1_1;
 // static const VkExtensionProperties s_deviceExtensions[] = {};
 static const uint32_t s_numDeviceExtensions = 0;
 
-// Dispatch tables required for routing instance and device calls onto the next
-// layer in the dispatch chain among our handling of functions we intercept.
-static ska::flat_hash_map<VkInstance, VkLayerInstanceDispatchTable>
-    s_instance_dt;
-static ska::flat_hash_map<VkDevice, VkLayerDispatchTable> s_device_dt;
+// Vertex bindings per vkCmdBindVertexBuffers that the buffer shadower rewrites
+static constexpr uint32_t kMaxShadowedVertexBindings = 32;
 
-// For finding a dispatch table in EnumeratePhysicalDeviceExtensionProperties
-static ska::flat_hash_map<VkPhysicalDevice, VkInstance> s_device_instance_map;
+typedef void* dispatch_key;
+static inline dispatch_key get_dispatch_key(const void* object) {
+  return (dispatch_key) * (VkLayerDispatchTable**)object;
+}
 
-// helper maps to find parent device until we try dispatch_keys
-static ska::flat_hash_map<VkCommandBuffer, VkDevice> s_cmdbuf_device_map;
-static ska::flat_hash_map<VkQueue, VkDevice> s_queue_device_map;
+// Per-instance layer state: the dispatch table required for routing instance
+// calls onto the next layer in the dispatch chain, and the instance-level
+// WitchDoctor state shared by the devices created from it.
+struct InstanceData {
+  VkLayerInstanceDispatchTable dispatch_table = {};
+  GWD::WitchDoctorInstance witch_doc;
+};
 
-// Must protect access to state (maps above) by mutex since the Vulkan
-// application may be calling these functions from different threads.
-static std::mutex s_layer_mutex;
-using LocalGuard = std::lock_guard<std::mutex>;
+// Per-device layer state: the device dispatch table, the device's own
+// WitchDoctor analysis context, and the fix-it modes that rewrite calls on
+// their way down the chain.
+struct DeviceData {
+  explicit DeviceData(GWD::WitchDoctorInstance* instance_doc)
+      : instance_doc(instance_doc), witch_doc(instance_doc) {}
 
-// TODO: Build some structure where we can check if certain downstream
-// extensions actually exist, and if they don't, we don't have to check if we
-// should dispatch
-static uint32_t s_numDevices = 0;
-static VkLayerDispatchTable* s_global_dispatch_table = nullptr;
+  VkLayerDispatchTable dispatch_table = {};
+  // For messages that aren't about this device alone
+  GWD::WitchDoctorInstance* instance_doc = nullptr;
+  GWD::WitchDoctor witch_doc;
+
+  // Only set when GWD_SUBALLOCATE is enabled
+  std::unique_ptr<GWD::MemorySuballocator> suballocator;
+  // Only set when GWD_SHADOW_BUFFERS is enabled
+  std::unique_ptr<GWD::BufferShadower> buffer_shadower;
+  // Only set when GWD_TRACE_FILE is set. Shared by every device.
+  GWD::TraceWriter* trace_writer = nullptr;
+};
+
+// Layer state is keyed on the loader's dispatch key, which is shared by an
+// instance and its physical devices, and by a device and its queues and
+// command buffers. Lookups are lock-free since every intercept performs one.
+static GWD::ConcurrentMap<dispatch_key, InstanceData> s_instance_data;
+static GWD::ConcurrentMap<dispatch_key, DeviceData> s_device_data;
+
+static inline InstanceData* GetInstanceData(const void* object) {
+  return s_instance_data.Find(get_dispatch_key(object));
+}
 
-typedef void* dispatch_key;
-static inline dispatch_key get_dispatch_key(const void* object) {
-  return (dispatch_key) * (VkLayerDispatchTable**)object;
+static inline DeviceData* GetDeviceData(const void* object) {
+  return s_device_data.Find(get_dispatch_key(object));
 }
 
-static GWD::WitchDoctor WitchDoc_inst;
+// Rewrites a binding to a suballocator proxy into one to the block it lives in
+static inline void ResolveMemoryBinding(const DeviceData* device_data,
+                                        VkDeviceMemory* memory,
+                                        VkDeviceSize* memoryOffset) {
+  GWD::MemorySuballocator::Location location;
+  if (device_data->suballocator != nullptr &&
+      device_data->suballocator->Resolve(*memory, &location)) {
+    *memory = location.memory;
+    *memoryOffset += location.offset;
+  }
+}
+
+// Same as above for VkBind*MemoryInfo arrays. Returns the array to pass down,
+// which is the application's own unless the suballocator is enabled.
+template <typename BindInfo>
+static const BindInfo* ResolveMemoryBindings(
+    const DeviceData* device_data, uint32_t bindInfoCount,
+    const BindInfo* pBindInfos, std::vector<BindInfo>* resolved_bind_infos) {
+  if (device_data->suballocator == nullptr) {
+    return pBindInfos;
+  }
+  resolved_bind_infos->assign(pBindInfos, pBindInfos + bindInfoCount);
+  for (BindInfo& bind_info : *resolved_bind_infos) {
+    ResolveMemoryBinding(device_data, &bind_info.memory,
+                         &bind_info.memoryOffset);
+  }
+  return resolved_bind_infos->data();
+}
+
+// Backing storage for a vkQueueBindSparse call with its proxies resolved
+struct ResolvedSparseBindings {
+  std::vector<VkBindSparseInfo> bind_infos;
+  std::vector<VkSparseBufferMemoryBindInfo> buffer_binds;
+  std::vector<VkSparseImageOpaqueMemoryBindInfo> image_opaque_binds;
+  std::vector<VkSparseImageMemoryBindInfo> image_binds;
+  std::vector<VkSparseMemoryBind> memory_binds;
+  std::vector<VkSparseImageMemoryBind> image_memory_binds;
+};
+
+// Copies the binds of one VkSparse*MemoryBindInfo onto the end of binds,
+// resolving each one, and points the copy at them. binds must have been
+// reserved up front so earlier copies stay where they are.
+template <typename BindInfo, typename Bind>
+static void ResolveSparseBinds(const DeviceData* device_data,
+                               BindInfo* bind_info, std::vector<Bind>* binds) {
+  const size_t first_bind = binds->size();
+  binds->insert(binds->end(), bind_info->pBinds,
+                bind_info->pBinds + bind_info->bindCount);
+  for (size_t bind_index = first_bind; bind_index < binds->size();
+       bind_index++) {
+    Bind& bind = (*binds)[bind_index];
+    ResolveMemoryBinding(device_data, &bind.memory, &bind.memoryOffset);
+  }
+  bind_info->pBinds = binds->data() + first_bind;
+}
+
+// Same as ResolveMemoryBindings() for the nested arrays of vkQueueBindSparse
+static const VkBindSparseInfo* ResolveSparseBindings(
+    const DeviceData* device_data, uint32_t bindInfoCount,
+    const VkBindSparseInfo* pBindInfo, ResolvedSparseBindings* resolved) {
+  if (device_data->suballocator == nullptr) {
+    return pBindInfo;
+  }
+
+  size_t memory_bind_count = 0;
+  size_t image_memory_bind_count = 0;
+  size_t buffer_bind_count = 0;
+  size_t image_opaque_bind_count = 0;
+  size_t image_bind_count = 0;
+  for (uint32_t info_index = 0; info_index < bindInfoCount; info_index++) {
+    const VkBindSparseInfo& bind_info = pBindInfo[info_index];
+    buffer_bind_count += bind_info.bufferBindCount;
+    image_opaque_bind_count += bind_info.imageOpaqueBindCount;
+    image_bind_count += bind_info.imageBindCount;
+    for (uint32_t bind_index = 0; bind_index < bind_info.bufferBindCount;
+         bind_index++) {
+      memory_bind_count += bind_info.pBufferBinds[bind_index].bindCount;
+    }
+    for (uint32_t bind_index = 0; bind_index < bind_info.imageOpaqueBindCount;
+         bind_index++) {
+      memory_bind_count += bind_info.pImageOpaqueBinds[bind_index].bindCount;
+    }
+    for (uint32_t bind_index = 0; bind_index < bind_info.imageBindCount;
+         bind_index++) {
+      image_memory_bind_count += bind_info.pImageBinds[bind_index].bindCount;
+    }
+  }
+  resolved->buffer_binds.reserve(buffer_bind_count);
+  resolved->image_opaque_binds.reserve(image_opaque_bind_count);
+  resolved->image_binds.reserve(image_bind_count);
+  resolved->memory_binds.reserve(memory_bind_count);
+  resolved->image_memory_binds.reserve(image_memory_bind_count);
+
+  resolved->bind_infos.assign(pBindInfo, pBindInfo + bindInfoCount);
+  for (VkBindSparseInfo& bind_info : resolved->bind_infos) {
+    const size_t first_buffer_bind = resolved->buffer_binds.size();
+    for (uint32_t bind_index = 0; bind_index < bind_info.bufferBindCount;
+         bind_index++) {
+      resolved->buffer_binds.push_back(bind_info.pBufferBinds[bind_index]);
+      ResolveSparseBinds(device_data, &resolved->buffer_binds.back(),
+                         &resolved->memory_binds);
+    }
+    bind_info.pBufferBinds = resolved->buffer_binds.data() + first_buffer_bind;
+
+    const size_t first_image_opaque_bind = resolved->image_opaque_binds.size();
+    for (uint32_t bind_index = 0; bind_index < bind_info.imageOpaqueBindCount;
+         bind_index++) {
+      resolved->image_opaque_binds.push_back(
+          bind_info.pImageOpaqueBinds[bind_index]);
+      ResolveSparseBinds(device_data, &resolved->image_opaque_binds.back(),
+                         &resolved->memory_binds);
+    }
+    bind_info.pImageOpaqueBinds =
+        resolved->image_opaque_binds.data() + first_image_opaque_bind;
+
+    const size_t first_image_bind = resolved->image_binds.size();
+    for (uint32_t bind_index = 0; bind_index < bind_info.imageBindCount;
+         bind_index++) {
+      resolved->image_binds.push_back(bind_info.pImageBinds[bind_index]);
+      ResolveSparseBinds(device_data, &resolved->image_binds.back(),
+                         &resolved->image_memory_binds);
+    }
+    bind_info.pImageBinds = resolved->image_binds.data() + first_image_bind;
+  }
+  return resolved->bind_infos.data();
+}
+
+// Lets the buffer shadower see which memory its candidates ended up in
+static void TrackBufferBindings(const DeviceData* device_data,
+                                uint32_t bindInfoCount,
+                                const VkBindBufferMemoryInfo* pBindInfos) {
+  if (device_data->buffer_shadower == nullptr) {
+    return;
+  }
+  for (uint32_t bind_index = 0; bind_index < bindInfoCount; bind_index++) {
+    device_data->buffer_shadower->OnBindBufferMemory(
+        pBindInfos[bind_index].buffer, pBindInfos[bind_index].memory);
+  }
+}
+
+// Writes one trace record per element of a vkBind*Memory2 call. The record
+// is laid out as device, resource, memory and offset.
+template <typename Record, typename BindInfo, typename Resource>
+static void TraceMemoryBindings(GWD::TraceWriter* trace_writer,
+                                VkDevice device, uint32_t bindInfoCount,
+                                const BindInfo* pBindInfos,
+                                Resource BindInfo::*resource) {
+  for (uint32_t bind_index = 0; bind_index < bindInfoCount; bind_index++) {
+    const BindInfo& bind_info = pBindInfos[bind_index];
+    trace_writer->Write(Record{(uint64_t)device,
+                               (uint64_t)(bind_info.*resource),
+                               (uint64_t)bind_info.memory,
+                               bind_info.memoryOffset});
+  }
+}
 
 // Layer helper for external clients to dispatch
 PFN_vkVoidFunction GwdGetDispatchedDeviceProcAddr(VkDevice device,
                                                   const char* pName) {
-  LocalGuard lock(s_layer_mutex);
-  return s_device_dt[device].GetDeviceProcAddr(device, pName);
+  return GetDeviceData(device)->dispatch_table.GetDeviceProcAddr(device,
+                                                                 pName);
 }
 
 PFN_vkVoidFunction GwdGetDispatchedInstanceProcAddr(VkInstance instance,
                                                     const char* pName) {
-  LocalGuard lock(s_layer_mutex);
-  return s_instance_dt[instance].GetInstanceProcAddr(instance, pName);
+  return GetInstanceData(instance)->dispatch_table.GetInstanceProcAddr(
+      instance, pName);
 }
 
 // ----------------------------------------------------------------------------
 // Core layer logic
 // ----------------------------------------------------------------------------
 
-// TODO: For VkCommandBuffer and VkQueue, we store a map between VkCommandBuffer
-// and VkQueue to VkDevice. We might want to see if we can use the same
-// mechanism as the dispatch_key from layer_factory
-
 VKAPI_ATTR VkResult VKAPI_CALL GwdCreateDebugUtilsMessengerEXT(
     VkInstance instance, VkDebugUtilsMessengerCreateInfoEXT const* pCreateInfo,
     VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pMessenger) {
+  InstanceData* instance_data = GetInstanceData(instance);
+
   PFN_vkCreateDebugUtilsMessengerEXT fp_CreateDebugUtilsMessengerEXT = nullptr;
   fp_CreateDebugUtilsMessengerEXT =
-      s_instance_dt[instance].CreateDebugUtilsMessengerEXT;
+      instance_data->dispatch_table.CreateDebugUtilsMessengerEXT;
 
   VkResult result = fp_CreateDebugUtilsMessengerEXT(instance, pCreateInfo,
                                                     pAllocator, pMessenger);
 
-  result = WitchDoc_inst.PostCallCreateDebugUtilsMessengerEXT(
+  result = instance_data->witch_doc.PostCallCreateDebugUtilsMessengerEXT(
       result, instance, pCreateInfo, pAllocator, pMessenger);
 
   return result;
@@ -116,29 +297,39 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdCreateDebugUtilsMessengerEXT(
 VKAPI_ATTR void VKAPI_CALL GwdDestroyDebugUtilsMessengerEXT(
     VkInstance instance, VkDebugUtilsMessengerEXT messenger,
     VkAllocationCallbacks* pAllocator) {
+  InstanceData* instance_data = GetInstanceData(instance);
+
   PFN_vkDestroyDebugUtilsMessengerEXT fp_DestroyDebugUtilsMessengerEXT =
       nullptr;
   fp_DestroyDebugUtilsMessengerEXT =
-      s_instance_dt[instance].DestroyDebugUtilsMessengerEXT;
+      instance_data->dispatch_table.DestroyDebugUtilsMessengerEXT;
 
   fp_DestroyDebugUtilsMessengerEXT(instance, messenger, pAllocator);
 
-  WitchDoc_inst.PostCallDestroyDebugUtilsMessengerEXT(instance, messenger,
-                                                      pAllocator);
+  instance_data->witch_doc.PostCallDestroyDebugUtilsMessengerEXT(
+      instance, messenger, pAllocator);
 }
 
 VKAPI_ATTR void VKAPI_CALL GwdGetDeviceQueue(VkDevice device,
                                              uint32_t queueFamilyIndex,
                                              uint32_t queueIndex,
                                              VkQueue* pQueue) {
+  GWD_PROFILE_INTERCEPT(GetDeviceQueue);
+  DeviceData* device_data = GetDeviceData(device);
+
   PFN_vkGetDeviceQueue fp_GetDeviceQueue = nullptr;
-  fp_GetDeviceQueue = s_global_dispatch_table->GetDeviceQueue;
+  fp_GetDeviceQueue = device_data->dispatch_table.GetDeviceQueue;
 
+  intercept_timer.BeginDownstream();
   fp_GetDeviceQueue(device, queueFamilyIndex, queueIndex, pQueue);
+  intercept_timer.EndDownstream();
 
-  {
-    LocalGuard lock(s_layer_mutex);
-    s_queue_device_map[*pQueue] = device;
+  if (device_data->buffer_shadower != nullptr) {
+    device_data->buffer_shadower->OnGetDeviceQueue(*pQueue, queueFamilyIndex);
+  }
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::GetDeviceQueue{
+        (uint64_t)device, (uint64_t)*pQueue, queueFamilyIndex, queueIndex});
   }
 }
 
@@ -146,15 +337,134 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdQueueSubmit(VkQueue queue,
                                               uint32_t submitCount,
                                               const VkSubmitInfo* pSubmits,
                                               VkFence fence) {
-  VkDevice device = s_queue_device_map[queue];
+  GWD_PROFILE_INTERCEPT(QueueSubmit);
+  DeviceData* device_data = GetDeviceData(queue);
 
   PFN_vkQueueSubmit fp_QueueSubmit = nullptr;
-  fp_QueueSubmit = s_global_dispatch_table->QueueSubmit;
+  fp_QueueSubmit = device_data->dispatch_table.QueueSubmit;
 
+  // Shadow uploads have to land ahead of the work that reads the shadows
+  if (device_data->buffer_shadower != nullptr) {
+    device_data->buffer_shadower->BeforeQueueSubmit(queue);
+  }
+
+  intercept_timer.BeginDownstream();
   VkResult result = fp_QueueSubmit(queue, submitCount, pSubmits, fence);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    static constexpr uint32_t kMaxCommandBuffersPerRecord =
+        (uint32_t)(GWD::TraceWriter::MaxTailSize(
+                       sizeof(GWD::Trace::QueueSubmit)) /
+                   sizeof(uint64_t));
+    uint64_t command_buffers[kMaxCommandBuffersPerRecord];
+    if (submitCount == 0) {
+      device_data->trace_writer->Write(GWD::Trace::QueueSubmit{
+          (uint64_t)queue, (uint64_t)fence, 0, 0, 0, 0, 0, 0});
+    }
+    for (uint32_t submit_index = 0; submit_index < submitCount;
+         submit_index++) {
+      const VkSubmitInfo& submit_info = pSubmits[submit_index];
+      uint32_t first_command_buffer = 0;
+      do {
+        const uint32_t command_buffer_count =
+            std::min(submit_info.commandBufferCount - first_command_buffer,
+                     kMaxCommandBuffersPerRecord);
+        for (uint32_t cb_index = 0; cb_index < command_buffer_count;
+             cb_index++) {
+          command_buffers[cb_index] = (uint64_t)
+              submit_info.pCommandBuffers[first_command_buffer + cb_index];
+        }
+        device_data->trace_writer->Write(
+            GWD::Trace::QueueSubmit{
+                (uint64_t)queue, (uint64_t)fence, submitCount, submit_index,
+                submit_info.commandBufferCount, first_command_buffer,
+                command_buffer_count, 0},
+            command_buffers, command_buffer_count);
+        first_command_buffer += command_buffer_count;
+      } while (first_command_buffer < submit_info.commandBufferCount);
+    }
+  }
+
+  result = device_data->witch_doc.PostCallQueueSubmit(result, queue,
+                                                      submitCount, pSubmits,
+                                                      fence);
+
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+GwdQueueBindSparse(VkQueue queue, uint32_t bindInfoCount,
+                   const VkBindSparseInfo* pBindInfo, VkFence fence) {
+  GWD_PROFILE_INTERCEPT(QueueBindSparse);
+  DeviceData* device_data = GetDeviceData(queue);
+
+  PFN_vkQueueBindSparse fp_QueueBindSparse = nullptr;
+  fp_QueueBindSparse = device_data->dispatch_table.QueueBindSparse;
+
+  // Sparse resources can be bound to suballocated memory like any other
+  ResolvedSparseBindings resolved;
+  const VkBindSparseInfo* bind_infos =
+      ResolveSparseBindings(device_data, bindInfoCount, pBindInfo, &resolved);
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_QueueBindSparse(queue, bindInfoCount, bind_infos, fence);
+  intercept_timer.EndDownstream();
 
-  // TODO: Multiple VkSubmitInfo vs multiple VkCommandBuffer
-  // WitchDoc_inst.PostCallQueueSubmit(queue, submitCount, pSubmits, fence);
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL GwdAcquireNextImageKHR(
+    VkDevice device, VkSwapchainKHR swapchain, uint64_t timeout,
+    VkSemaphore semaphore, VkFence fence, uint32_t* pImageIndex) {
+  GWD_PROFILE_INTERCEPT(AcquireNextImageKHR);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkAcquireNextImageKHR fp_AcquireNextImageKHR = nullptr;
+  fp_AcquireNextImageKHR = device_data->dispatch_table.AcquireNextImageKHR;
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_AcquireNextImageKHR(device, swapchain, timeout,
+                                           semaphore, fence, pImageIndex);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::AcquireNextImage{
+        (uint64_t)device, (uint64_t)swapchain, *pImageIndex,
+        (int32_t)result});
+  }
+
+  result = device_data->witch_doc.PostCallAcquireNextImageKHR(
+      result, device, swapchain, timeout, semaphore, fence, pImageIndex);
+
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+GwdQueuePresentKHR(VkQueue queue, const VkPresentInfoKHR* pPresentInfo) {
+  GWD_PROFILE_INTERCEPT(QueuePresentKHR);
+  DeviceData* device_data = GetDeviceData(queue);
+
+  PFN_vkQueuePresentKHR fp_QueuePresentKHR = nullptr;
+  fp_QueuePresentKHR = device_data->dispatch_table.QueuePresentKHR;
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_QueuePresentKHR(queue, pPresentInfo);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::QueuePresent{
+        (uint64_t)queue, pPresentInfo->swapchainCount, (int32_t)result});
+  }
+
+  result = device_data->witch_doc.PostCallQueuePresentKHR(result, queue,
+                                                          pPresentInfo);
+
+  GWD::InterceptProfiler& profiler = GWD::InterceptProfiler::Get();
+  if (profiler.ClaimPeriodicReport()) {
+    device_data->instance_doc->PerformanceWarningMessage(
+        profiler.BuildReport());
+  }
 
   return result;
 }
@@ -162,14 +472,38 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdQueueSubmit(VkQueue queue,
 VKAPI_ATTR VkResult VKAPI_CALL GwdAllocateMemory(
     VkDevice device, const VkMemoryAllocateInfo* pAllocateInfo,
     const VkAllocationCallbacks* pAllocator, VkDeviceMemory* pMemory) {
-  PFN_vkAllocateMemory fp_AllocateMemory = nullptr;
-  fp_AllocateMemory = s_global_dispatch_table->AllocateMemory;
+  GWD_PROFILE_INTERCEPT(AllocateMemory);
+  DeviceData* device_data = GetDeviceData(device);
 
-  VkResult result =
-      fp_AllocateMemory(device, pAllocateInfo, pAllocator, pMemory);
+  PFN_vkAllocateMemory fp_AllocateMemory = nullptr;
+  fp_AllocateMemory = device_data->dispatch_table.AllocateMemory;
+
+  // Falls back to a real allocation whenever the suballocator can't help
+  GWD::MemorySuballocator* suballocator = device_data->suballocator.get();
+  VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  if (suballocator != nullptr &&
+      suballocator->ShouldSuballocate(pAllocateInfo)) {
+    result = suballocator->Allocate(pAllocateInfo, pMemory);
+  }
+  if (result != VK_SUCCESS) {
+    intercept_timer.BeginDownstream();
+    result = fp_AllocateMemory(device, pAllocateInfo, pAllocator, pMemory);
+    intercept_timer.EndDownstream();
+  }
+  if (result == VK_SUCCESS && device_data->buffer_shadower != nullptr) {
+    device_data->buffer_shadower->OnAllocateMemory(
+        *pMemory, pAllocateInfo->memoryTypeIndex);
+  }
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::AllocateMemory{
+        (uint64_t)device,
+        result == VK_SUCCESS ? (uint64_t)*pMemory : 0,
+        pAllocateInfo->allocationSize, pAllocateInfo->memoryTypeIndex,
+        result});
+  }
 
-  result = WitchDoc_inst.PostCallAllocateMemory(result, device, pAllocateInfo,
-                                                pAllocator, pMemory);
+  result = device_data->witch_doc.PostCallAllocateMemory(
+      result, device, pAllocateInfo, pAllocator, pMemory);
 
   return result;
 }
@@ -177,25 +511,204 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdAllocateMemory(
 VKAPI_ATTR void VKAPI_CALL
 GwdFreeMemory(VkDevice device, VkDeviceMemory memory,
               const VkAllocationCallbacks* pAllocator) {
+  GWD_PROFILE_INTERCEPT(FreeMemory);
+  DeviceData* device_data = GetDeviceData(device);
+
   PFN_vkFreeMemory fp_FreeMemory = nullptr;
-  fp_FreeMemory = s_global_dispatch_table->FreeMemory;
+  fp_FreeMemory = device_data->dispatch_table.FreeMemory;
 
-  fp_FreeMemory(device, memory, pAllocator);
+  if (device_data->suballocator == nullptr ||
+      !device_data->suballocator->Free(memory)) {
+    intercept_timer.BeginDownstream();
+    fp_FreeMemory(device, memory, pAllocator);
+    intercept_timer.EndDownstream();
+  }
+  if (device_data->buffer_shadower != nullptr) {
+    device_data->buffer_shadower->OnFreeMemory(memory);
+  }
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(
+        GWD::Trace::FreeMemory{(uint64_t)device, (uint64_t)memory});
+  }
+
+  device_data->witch_doc.PostCallFreeMemory(device, memory, pAllocator);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL GwdMapMemory(VkDevice device,
+                                            VkDeviceMemory memory,
+                                            VkDeviceSize offset,
+                                            VkDeviceSize size,
+                                            VkMemoryMapFlags flags,
+                                            void** ppData) {
+  GWD_PROFILE_INTERCEPT(MapMemory);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkMapMemory fp_MapMemory = nullptr;
+  fp_MapMemory = device_data->dispatch_table.MapMemory;
+
+  VkResult result = VK_SUCCESS;
+  GWD::MemorySuballocator::Location location;
+  if (device_data->suballocator != nullptr &&
+      device_data->suballocator->Resolve(memory, &location)) {
+    result = device_data->suballocator->Map(memory, offset, size, ppData);
+  } else {
+    intercept_timer.BeginDownstream();
+    result = fp_MapMemory(device, memory, offset, size, flags, ppData);
+    intercept_timer.EndDownstream();
+  }
+
+  // A mapping is the only way a shadowed buffer's contents can change
+  if (result == VK_SUCCESS && device_data->buffer_shadower != nullptr) {
+    device_data->buffer_shadower->OnMapMemory(memory);
+  }
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::MapMemory{
+        (uint64_t)device, (uint64_t)memory, offset, size});
+  }
+
+  return result;
+}
 
-  WitchDoc_inst.PostCallFreeMemory(device, memory, pAllocator);
+VKAPI_ATTR void VKAPI_CALL GwdUnmapMemory(VkDevice device,
+                                          VkDeviceMemory memory) {
+  GWD_PROFILE_INTERCEPT(UnmapMemory);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkUnmapMemory fp_UnmapMemory = nullptr;
+  fp_UnmapMemory = device_data->dispatch_table.UnmapMemory;
+
+  if (device_data->buffer_shadower != nullptr) {
+    device_data->buffer_shadower->OnUnmapMemory(memory);
+  }
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(
+        GWD::Trace::UnmapMemory{(uint64_t)device, (uint64_t)memory});
+  }
+
+  GWD::MemorySuballocator::Location location;
+  if (device_data->suballocator != nullptr &&
+      device_data->suballocator->Resolve(memory, &location)) {
+    device_data->suballocator->Unmap(memory);
+    return;
+  }
+
+  intercept_timer.BeginDownstream();
+  fp_UnmapMemory(device, memory);
+  intercept_timer.EndDownstream();
+}
+
+// Returns the ranges to pass down, which are the application's own unless the
+// suballocator is enabled.
+static const VkMappedMemoryRange* ResolveMappedMemoryRanges(
+    const DeviceData* device_data, uint32_t memoryRangeCount,
+    const VkMappedMemoryRange* pMemoryRanges,
+    std::vector<VkMappedMemoryRange>* resolved_ranges) {
+  if (device_data->suballocator == nullptr) {
+    return pMemoryRanges;
+  }
+  resolved_ranges->assign(pMemoryRanges, pMemoryRanges + memoryRangeCount);
+  for (VkMappedMemoryRange& range : *resolved_ranges) {
+    device_data->suballocator->TranslateRange(&range);
+  }
+  return resolved_ranges->data();
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+GwdFlushMappedMemoryRanges(VkDevice device, uint32_t memoryRangeCount,
+                           const VkMappedMemoryRange* pMemoryRanges) {
+  GWD_PROFILE_INTERCEPT(FlushMappedMemoryRanges);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkFlushMappedMemoryRanges fp_FlushMappedMemoryRanges = nullptr;
+  fp_FlushMappedMemoryRanges =
+      device_data->dispatch_table.FlushMappedMemoryRanges;
+
+  std::vector<VkMappedMemoryRange> resolved_ranges;
+  const VkMappedMemoryRange* ranges = ResolveMappedMemoryRanges(
+      device_data, memoryRangeCount, pMemoryRanges, &resolved_ranges);
+
+  intercept_timer.BeginDownstream();
+  VkResult result =
+      fp_FlushMappedMemoryRanges(device, memoryRangeCount, ranges);
+  intercept_timer.EndDownstream();
+
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+GwdInvalidateMappedMemoryRanges(VkDevice device, uint32_t memoryRangeCount,
+                                const VkMappedMemoryRange* pMemoryRanges) {
+  GWD_PROFILE_INTERCEPT(InvalidateMappedMemoryRanges);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkInvalidateMappedMemoryRanges fp_InvalidateMappedMemoryRanges = nullptr;
+  fp_InvalidateMappedMemoryRanges =
+      device_data->dispatch_table.InvalidateMappedMemoryRanges;
+
+  std::vector<VkMappedMemoryRange> resolved_ranges;
+  const VkMappedMemoryRange* ranges = ResolveMappedMemoryRanges(
+      device_data, memoryRangeCount, pMemoryRanges, &resolved_ranges);
+
+  intercept_timer.BeginDownstream();
+  VkResult result =
+      fp_InvalidateMappedMemoryRanges(device, memoryRangeCount, ranges);
+  intercept_timer.EndDownstream();
+
+  return result;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+GwdGetDeviceMemoryCommitment(VkDevice device, VkDeviceMemory memory,
+                             VkDeviceSize* pCommittedMemoryInBytes) {
+  GWD_PROFILE_INTERCEPT(GetDeviceMemoryCommitment);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkGetDeviceMemoryCommitment fp_GetDeviceMemoryCommitment = nullptr;
+  fp_GetDeviceMemoryCommitment =
+      device_data->dispatch_table.GetDeviceMemoryCommitment;
+
+  // Proxies are never lazily allocated, so they are always fully committed
+  GWD::MemorySuballocator::Location location;
+  if (device_data->suballocator != nullptr &&
+      device_data->suballocator->Resolve(memory, &location)) {
+    *pCommittedMemoryInBytes = location.size;
+    return;
+  }
+
+  intercept_timer.BeginDownstream();
+  fp_GetDeviceMemoryCommitment(device, memory, pCommittedMemoryInBytes);
+  intercept_timer.EndDownstream();
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL GwdBindBufferMemory(VkDevice device,
                                                    VkBuffer buffer,
                                                    VkDeviceMemory memory,
                                                    VkDeviceSize memoryOffset) {
+  GWD_PROFILE_INTERCEPT(BindBufferMemory);
+  DeviceData* device_data = GetDeviceData(device);
+
   PFN_vkBindBufferMemory fp_BindBufferMemory = nullptr;
-  fp_BindBufferMemory = s_global_dispatch_table->BindBufferMemory;
+  fp_BindBufferMemory = device_data->dispatch_table.BindBufferMemory;
+
+  VkDeviceMemory resolved_memory = memory;
+  VkDeviceSize resolved_offset = memoryOffset;
+  ResolveMemoryBinding(device_data, &resolved_memory, &resolved_offset);
 
-  VkResult result = fp_BindBufferMemory(device, buffer, memory, memoryOffset);
+  intercept_timer.BeginDownstream();
+  VkResult result =
+      fp_BindBufferMemory(device, buffer, resolved_memory, resolved_offset);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->buffer_shadower != nullptr) {
+    device_data->buffer_shadower->OnBindBufferMemory(buffer, memory);
+  }
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::BindBufferMemory{
+        (uint64_t)device, (uint64_t)buffer, (uint64_t)memory, memoryOffset});
+  }
 
-  result = WitchDoc_inst.PostCallBindBufferMemory(result, device, buffer,
-                                                  memory, memoryOffset);
+  result = device_data->witch_doc.PostCallBindBufferMemory(
+      result, device, buffer, memory, memoryOffset);
 
   return result;
 }
@@ -203,37 +716,257 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdBindBufferMemory(VkDevice device,
 VKAPI_ATTR VkResult VKAPI_CALL
 GwdCreateBuffer(VkDevice device, const VkBufferCreateInfo* pCreateInfo,
                 const VkAllocationCallbacks* pAllocator, VkBuffer* pBuffer) {
+  GWD_PROFILE_INTERCEPT(CreateBuffer);
+  DeviceData* device_data = GetDeviceData(device);
+
   PFN_vkCreateBuffer fp_CreateBuffer = nullptr;
-  fp_CreateBuffer = s_global_dispatch_table->CreateBuffer;
+  fp_CreateBuffer = device_data->dispatch_table.CreateBuffer;
 
-  VkResult result = fp_CreateBuffer(device, pCreateInfo, pAllocator, pBuffer);
+  VkBufferCreateInfo adjusted_create_info;
+  const VkBufferCreateInfo* create_info = pCreateInfo;
+  if (device_data->buffer_shadower != nullptr) {
+    create_info = device_data->buffer_shadower->AdjustCreateInfo(
+        pCreateInfo, &adjusted_create_info);
+  }
 
-  result = WitchDoc_inst.PostCallCreateBuffer(result, device, pCreateInfo,
-                                              pAllocator, pBuffer);
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_CreateBuffer(device, create_info, pAllocator, pBuffer);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->buffer_shadower != nullptr) {
+    device_data->buffer_shadower->OnCreateBuffer(*pBuffer, pCreateInfo);
+  }
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CreateBuffer{
+        (uint64_t)device, (uint64_t)*pBuffer, pCreateInfo->size,
+        pCreateInfo->usage, pCreateInfo->flags});
+  }
+
+  result = device_data->witch_doc.PostCallCreateBuffer(
+      result, device, pCreateInfo, pAllocator, pBuffer);
 
   return result;
 }
 
 VKAPI_ATTR void VKAPI_CALL GwdDestroyBuffer(
     VkDevice device, VkBuffer buffer, const VkAllocationCallbacks* pAllocator) {
+  GWD_PROFILE_INTERCEPT(DestroyBuffer);
+  DeviceData* device_data = GetDeviceData(device);
+
   PFN_vkDestroyBuffer fp_DestroyBuffer = nullptr;
-  fp_DestroyBuffer = s_global_dispatch_table->DestroyBuffer;
+  fp_DestroyBuffer = device_data->dispatch_table.DestroyBuffer;
 
+  intercept_timer.BeginDownstream();
   fp_DestroyBuffer(device, buffer, pAllocator);
+  intercept_timer.EndDownstream();
+
+  if (device_data->buffer_shadower != nullptr) {
+    device_data->buffer_shadower->OnDestroyBuffer(buffer);
+  }
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(
+        GWD::Trace::DestroyBuffer{(uint64_t)device, (uint64_t)buffer});
+  }
 
-  WitchDoc_inst.PostCallDestroyBuffer(device, buffer, pAllocator);
+  device_data->witch_doc.PostCallDestroyBuffer(device, buffer, pAllocator);
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL
 GwdBindBufferMemory2(VkDevice device, uint32_t bindInfoCount,
                      const VkBindBufferMemoryInfo* pBindInfos) {
+  GWD_PROFILE_INTERCEPT(BindBufferMemory2);
+  DeviceData* device_data = GetDeviceData(device);
+
   PFN_vkBindBufferMemory2 fp_BindBufferMemory2 = nullptr;
-  fp_BindBufferMemory2 = s_global_dispatch_table->BindBufferMemory2;
+  fp_BindBufferMemory2 = device_data->dispatch_table.BindBufferMemory2;
+
+  std::vector<VkBindBufferMemoryInfo> resolved_bind_infos;
+  const VkBindBufferMemoryInfo* bind_infos = ResolveMemoryBindings(
+      device_data, bindInfoCount, pBindInfos, &resolved_bind_infos);
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_BindBufferMemory2(device, bindInfoCount, bind_infos);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS) {
+    TrackBufferBindings(device_data, bindInfoCount, pBindInfos);
+  }
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    TraceMemoryBindings<GWD::Trace::BindBufferMemory>(
+        device_data->trace_writer, device, bindInfoCount, pBindInfos,
+        &VkBindBufferMemoryInfo::buffer);
+  }
+
+  result = device_data->witch_doc.PostCallBindBufferMemory2(
+      result, device, bindInfoCount, pBindInfos);
 
-  VkResult result = fp_BindBufferMemory2(device, bindInfoCount, pBindInfos);
+  return result;
+}
 
-  result = WitchDoc_inst.PostCallBindBufferMemory2(result, device,
-                                                   bindInfoCount, pBindInfos);
+VKAPI_ATTR VkResult VKAPI_CALL
+GwdCreateImage(VkDevice device, const VkImageCreateInfo* pCreateInfo,
+               const VkAllocationCallbacks* pAllocator, VkImage* pImage) {
+  GWD_PROFILE_INTERCEPT(CreateImage);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkCreateImage fp_CreateImage = nullptr;
+  fp_CreateImage = device_data->dispatch_table.CreateImage;
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_CreateImage(device, pCreateInfo, pAllocator, pImage);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CreateImage{
+        (uint64_t)device, (uint64_t)*pImage, (uint32_t)pCreateInfo->format,
+        (uint32_t)pCreateInfo->tiling, pCreateInfo->usage,
+        (uint32_t)pCreateInfo->samples, pCreateInfo->extent.width,
+        pCreateInfo->extent.height, pCreateInfo->extent.depth,
+        pCreateInfo->arrayLayers});
+  }
+
+  result = device_data->witch_doc.PostCallCreateImage(
+      result, device, pCreateInfo, pAllocator, pImage);
+
+  return result;
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdDestroyImage(
+    VkDevice device, VkImage image, const VkAllocationCallbacks* pAllocator) {
+  GWD_PROFILE_INTERCEPT(DestroyImage);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkDestroyImage fp_DestroyImage = nullptr;
+  fp_DestroyImage = device_data->dispatch_table.DestroyImage;
+
+  intercept_timer.BeginDownstream();
+  fp_DestroyImage(device, image, pAllocator);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(
+        GWD::Trace::DestroyImage{(uint64_t)device, (uint64_t)image});
+  }
+
+  device_data->witch_doc.PostCallDestroyImage(device, image, pAllocator);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL GwdBindImageMemory(VkDevice device,
+                                                  VkImage image,
+                                                  VkDeviceMemory memory,
+                                                  VkDeviceSize memoryOffset) {
+  GWD_PROFILE_INTERCEPT(BindImageMemory);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkBindImageMemory fp_BindImageMemory = nullptr;
+  fp_BindImageMemory = device_data->dispatch_table.BindImageMemory;
+
+  VkDeviceMemory resolved_memory = memory;
+  VkDeviceSize resolved_offset = memoryOffset;
+  ResolveMemoryBinding(device_data, &resolved_memory, &resolved_offset);
+
+  intercept_timer.BeginDownstream();
+  VkResult result =
+      fp_BindImageMemory(device, image, resolved_memory, resolved_offset);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::BindImageMemory{
+        (uint64_t)device, (uint64_t)image, (uint64_t)memory, memoryOffset});
+  }
+
+  result = device_data->witch_doc.PostCallBindImageMemory(
+      result, device, image, memory, memoryOffset);
+
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+GwdBindImageMemory2(VkDevice device, uint32_t bindInfoCount,
+                    const VkBindImageMemoryInfo* pBindInfos) {
+  GWD_PROFILE_INTERCEPT(BindImageMemory2);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkBindImageMemory2 fp_BindImageMemory2 = nullptr;
+  fp_BindImageMemory2 = device_data->dispatch_table.BindImageMemory2;
+
+  std::vector<VkBindImageMemoryInfo> resolved_bind_infos;
+  const VkBindImageMemoryInfo* bind_infos = ResolveMemoryBindings(
+      device_data, bindInfoCount, pBindInfos, &resolved_bind_infos);
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_BindImageMemory2(device, bindInfoCount, bind_infos);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    TraceMemoryBindings<GWD::Trace::BindImageMemory>(
+        device_data->trace_writer, device, bindInfoCount, pBindInfos,
+        &VkBindImageMemoryInfo::image);
+  }
+
+  result = device_data->witch_doc.PostCallBindImageMemory2(
+      result, device, bindInfoCount, pBindInfos);
+
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+GwdBindBufferMemory2KHR(VkDevice device, uint32_t bindInfoCount,
+                        const VkBindBufferMemoryInfo* pBindInfos) {
+  GWD_PROFILE_INTERCEPT(BindBufferMemory2KHR);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkBindBufferMemory2KHR fp_BindBufferMemory2KHR = nullptr;
+  fp_BindBufferMemory2KHR = device_data->dispatch_table.BindBufferMemory2KHR;
+
+  std::vector<VkBindBufferMemoryInfo> resolved_bind_infos;
+  const VkBindBufferMemoryInfo* bind_infos = ResolveMemoryBindings(
+      device_data, bindInfoCount, pBindInfos, &resolved_bind_infos);
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_BindBufferMemory2KHR(device, bindInfoCount, bind_infos);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS) {
+    TrackBufferBindings(device_data, bindInfoCount, pBindInfos);
+  }
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    TraceMemoryBindings<GWD::Trace::BindBufferMemory>(
+        device_data->trace_writer, device, bindInfoCount, pBindInfos,
+        &VkBindBufferMemoryInfo::buffer);
+  }
+
+  result = device_data->witch_doc.PostCallBindBufferMemory2(
+      result, device, bindInfoCount, pBindInfos);
+
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+GwdBindImageMemory2KHR(VkDevice device, uint32_t bindInfoCount,
+                       const VkBindImageMemoryInfo* pBindInfos) {
+  GWD_PROFILE_INTERCEPT(BindImageMemory2KHR);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkBindImageMemory2KHR fp_BindImageMemory2KHR = nullptr;
+  fp_BindImageMemory2KHR = device_data->dispatch_table.BindImageMemory2KHR;
+
+  std::vector<VkBindImageMemoryInfo> resolved_bind_infos;
+  const VkBindImageMemoryInfo* bind_infos = ResolveMemoryBindings(
+      device_data, bindInfoCount, pBindInfos, &resolved_bind_infos);
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_BindImageMemory2KHR(device, bindInfoCount, bind_infos);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    TraceMemoryBindings<GWD::Trace::BindImageMemory>(
+        device_data->trace_writer, device, bindInfoCount, pBindInfos,
+        &VkBindImageMemoryInfo::image);
+  }
+
+  result = device_data->witch_doc.PostCallBindImageMemory2(
+      result, device, bindInfoCount, pBindInfos);
 
   return result;
 }
@@ -241,66 +974,563 @@ GwdBindBufferMemory2(VkDevice device, uint32_t bindInfoCount,
 VKAPI_ATTR VkResult VKAPI_CALL GwdAllocateCommandBuffers(
     VkDevice device, const VkCommandBufferAllocateInfo* pAllocateInfo,
     VkCommandBuffer* pCommandBuffers) {
+  GWD_PROFILE_INTERCEPT(AllocateCommandBuffers);
+  DeviceData* device_data = GetDeviceData(device);
+
   PFN_vkAllocateCommandBuffers fp_AllocateCommandBuffers = nullptr;
-  fp_AllocateCommandBuffers = s_global_dispatch_table->AllocateCommandBuffers;
+  fp_AllocateCommandBuffers =
+      device_data->dispatch_table.AllocateCommandBuffers;
 
+  intercept_timer.BeginDownstream();
   VkResult result =
       fp_AllocateCommandBuffers(device, pAllocateInfo, pCommandBuffers);
-
-  if (VK_SUCCESS == result) {
-    LocalGuard lock(s_layer_mutex);
-    for (uint32_t cbIdx = 0; cbIdx < pAllocateInfo->commandBufferCount;
-         cbIdx++) {
-      s_cmdbuf_device_map[pCommandBuffers[cbIdx]] = device;
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    for (uint32_t cb_index = 0; cb_index < pAllocateInfo->commandBufferCount;
+         cb_index++) {
+      device_data->trace_writer->Write(GWD::Trace::AllocateCommandBuffer{
+          (uint64_t)device, (uint64_t)pAllocateInfo->commandPool,
+          (uint64_t)pCommandBuffers[cb_index]});
     }
   }
 
+  result = device_data->witch_doc.PostCallAllocateCommandBuffers(
+      result, device, pAllocateInfo, pCommandBuffers);
+
   return result;
 }
 
 VKAPI_ATTR void VKAPI_CALL GwdFreeCommandBuffers(
     VkDevice device, VkCommandPool commandPool, uint32_t commandBufferCount,
     const VkCommandBuffer* pCommandBuffers) {
+  GWD_PROFILE_INTERCEPT(FreeCommandBuffers);
+  DeviceData* device_data = GetDeviceData(device);
+
   PFN_vkFreeCommandBuffers fp_FreeCommandBuffers = nullptr;
-  fp_FreeCommandBuffers = s_global_dispatch_table->FreeCommandBuffers;
+  fp_FreeCommandBuffers = device_data->dispatch_table.FreeCommandBuffers;
 
+  intercept_timer.BeginDownstream();
   fp_FreeCommandBuffers(device, commandPool, commandBufferCount,
                         pCommandBuffers);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    for (uint32_t cb_index = 0; cb_index < commandBufferCount; cb_index++) {
+      if (pCommandBuffers[cb_index] != VK_NULL_HANDLE) {
+        device_data->trace_writer->Write(GWD::Trace::FreeCommandBuffer{
+            (uint64_t)device, (uint64_t)commandPool,
+            (uint64_t)pCommandBuffers[cb_index]});
+      }
+    }
+  }
 
-  {
-    LocalGuard lock(s_layer_mutex);
-    for (uint32_t cbIdx = 0; cbIdx < commandBufferCount; cbIdx++) {
-      s_cmdbuf_device_map.erase(pCommandBuffers[cbIdx]);
+  device_data->witch_doc.PostCallFreeCommandBuffers(
+      device, commandPool, commandBufferCount, pCommandBuffers);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+GwdDestroyCommandPool(VkDevice device, VkCommandPool commandPool,
+                      const VkAllocationCallbacks* pAllocator) {
+  GWD_PROFILE_INTERCEPT(DestroyCommandPool);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkDestroyCommandPool fp_DestroyCommandPool = nullptr;
+  fp_DestroyCommandPool = device_data->dispatch_table.DestroyCommandPool;
+
+  intercept_timer.BeginDownstream();
+  fp_DestroyCommandPool(device, commandPool, pAllocator);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::DestroyCommandPool{
+        (uint64_t)device, (uint64_t)commandPool});
+  }
+
+  device_data->witch_doc.PostCallDestroyCommandPool(device, commandPool,
+                                                    pAllocator);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL GwdAllocateDescriptorSets(
+    VkDevice device, const VkDescriptorSetAllocateInfo* pAllocateInfo,
+    VkDescriptorSet* pDescriptorSets) {
+  GWD_PROFILE_INTERCEPT(AllocateDescriptorSets);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkAllocateDescriptorSets fp_AllocateDescriptorSets = nullptr;
+  fp_AllocateDescriptorSets =
+      device_data->dispatch_table.AllocateDescriptorSets;
+
+  intercept_timer.BeginDownstream();
+  VkResult result =
+      fp_AllocateDescriptorSets(device, pAllocateInfo, pDescriptorSets);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    for (uint32_t set_index = 0; set_index < pAllocateInfo->descriptorSetCount;
+         set_index++) {
+      device_data->trace_writer->Write(GWD::Trace::AllocateDescriptorSet{
+          (uint64_t)device, (uint64_t)pAllocateInfo->descriptorPool,
+          (uint64_t)pDescriptorSets[set_index]});
     }
   }
+
+  result = device_data->witch_doc.PostCallAllocateDescriptorSets(
+      result, device, pAllocateInfo, pDescriptorSets);
+
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL GwdFreeDescriptorSets(
+    VkDevice device, VkDescriptorPool descriptorPool,
+    uint32_t descriptorSetCount, const VkDescriptorSet* pDescriptorSets) {
+  GWD_PROFILE_INTERCEPT(FreeDescriptorSets);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkFreeDescriptorSets fp_FreeDescriptorSets = nullptr;
+  fp_FreeDescriptorSets = device_data->dispatch_table.FreeDescriptorSets;
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_FreeDescriptorSets(device, descriptorPool,
+                                          descriptorSetCount, pDescriptorSets);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    for (uint32_t set_index = 0; set_index < descriptorSetCount; set_index++) {
+      if (pDescriptorSets[set_index] != VK_NULL_HANDLE) {
+        device_data->trace_writer->Write(GWD::Trace::FreeDescriptorSet{
+            (uint64_t)device, (uint64_t)descriptorPool,
+            (uint64_t)pDescriptorSets[set_index]});
+      }
+    }
+  }
+
+  result = device_data->witch_doc.PostCallFreeDescriptorSets(
+      result, device, descriptorPool, descriptorSetCount, pDescriptorSets);
+
+  return result;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+GwdResetDescriptorPool(VkDevice device, VkDescriptorPool descriptorPool,
+                       VkDescriptorPoolResetFlags flags) {
+  GWD_PROFILE_INTERCEPT(ResetDescriptorPool);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkResetDescriptorPool fp_ResetDescriptorPool = nullptr;
+  fp_ResetDescriptorPool = device_data->dispatch_table.ResetDescriptorPool;
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_ResetDescriptorPool(device, descriptorPool, flags);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::ResetDescriptorPool{
+        (uint64_t)device, (uint64_t)descriptorPool});
+  }
+
+  result = device_data->witch_doc.PostCallResetDescriptorPool(
+      result, device, descriptorPool, flags);
+
+  return result;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+GwdDestroyDescriptorPool(VkDevice device, VkDescriptorPool descriptorPool,
+                         const VkAllocationCallbacks* pAllocator) {
+  GWD_PROFILE_INTERCEPT(DestroyDescriptorPool);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkDestroyDescriptorPool fp_DestroyDescriptorPool = nullptr;
+  fp_DestroyDescriptorPool = device_data->dispatch_table.DestroyDescriptorPool;
+
+  intercept_timer.BeginDownstream();
+  fp_DestroyDescriptorPool(device, descriptorPool, pAllocator);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::DestroyDescriptorPool{
+        (uint64_t)device, (uint64_t)descriptorPool});
+  }
+
+  device_data->witch_doc.PostCallDestroyDescriptorPool(device, descriptorPool,
+                                                       pAllocator);
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdUpdateDescriptorSets(
+    VkDevice device, uint32_t descriptorWriteCount,
+    const VkWriteDescriptorSet* pDescriptorWrites,
+    uint32_t descriptorCopyCount,
+    const VkCopyDescriptorSet* pDescriptorCopies) {
+  GWD_PROFILE_INTERCEPT(UpdateDescriptorSets);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkUpdateDescriptorSets fp_UpdateDescriptorSets = nullptr;
+  fp_UpdateDescriptorSets = device_data->dispatch_table.UpdateDescriptorSets;
+
+  intercept_timer.BeginDownstream();
+  fp_UpdateDescriptorSets(device, descriptorWriteCount, pDescriptorWrites,
+                          descriptorCopyCount, pDescriptorCopies);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    static constexpr uint32_t kMaxBuffersPerRecord = 32;
+    uint64_t buffers[kMaxBuffersPerRecord];
+    for (uint32_t write_index = 0; write_index < descriptorWriteCount;
+         write_index++) {
+      const VkWriteDescriptorSet& write = pDescriptorWrites[write_index];
+      if (!GWD::IsBufferDescriptorType(write.descriptorType)) {
+        device_data->trace_writer->Write(GWD::Trace::UpdateDescriptorSet{
+            (uint64_t)device, (uint64_t)write.dstSet, write.dstBinding,
+            write.dstArrayElement, (uint32_t)write.descriptorType,
+            write.descriptorCount});
+        continue;
+      }
+      for (uint32_t first_element = 0; first_element < write.descriptorCount;
+           first_element += kMaxBuffersPerRecord) {
+        const uint32_t record_buffer_count = std::min(
+            write.descriptorCount - first_element, kMaxBuffersPerRecord);
+        for (uint32_t element = 0; element < record_buffer_count; element++) {
+          buffers[element] =
+              (uint64_t)write.pBufferInfo[first_element + element].buffer;
+        }
+        device_data->trace_writer->Write(
+            GWD::Trace::UpdateDescriptorSet{
+                (uint64_t)device, (uint64_t)write.dstSet, write.dstBinding,
+                write.dstArrayElement + first_element,
+                (uint32_t)write.descriptorType, record_buffer_count},
+            buffers, record_buffer_count);
+      }
+    }
+    for (uint32_t copy_index = 0; copy_index < descriptorCopyCount;
+         copy_index++) {
+      const VkCopyDescriptorSet& copy = pDescriptorCopies[copy_index];
+      device_data->trace_writer->Write(GWD::Trace::CopyDescriptorSet{
+          (uint64_t)device, (uint64_t)copy.srcSet, (uint64_t)copy.dstSet,
+          copy.srcBinding, copy.srcArrayElement, copy.dstBinding,
+          copy.dstArrayElement, copy.descriptorCount, 0});
+    }
+  }
+
+  device_data->witch_doc.PostCallUpdateDescriptorSets(
+      device, descriptorWriteCount, pDescriptorWrites, descriptorCopyCount,
+      pDescriptorCopies);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL GwdCreateDescriptorUpdateTemplate(
+    VkDevice device, const VkDescriptorUpdateTemplateCreateInfo* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator,
+    VkDescriptorUpdateTemplate* pDescriptorUpdateTemplate) {
+  GWD_PROFILE_INTERCEPT(CreateDescriptorUpdateTemplate);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkCreateDescriptorUpdateTemplate fp_CreateDescriptorUpdateTemplate =
+      nullptr;
+  fp_CreateDescriptorUpdateTemplate =
+      device_data->dispatch_table.CreateDescriptorUpdateTemplate;
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_CreateDescriptorUpdateTemplate(
+      device, pCreateInfo, pAllocator, pDescriptorUpdateTemplate);
+  intercept_timer.EndDownstream();
+
+  result = device_data->witch_doc.PostCallCreateDescriptorUpdateTemplate(
+      result, device, pCreateInfo, pAllocator, pDescriptorUpdateTemplate);
+
+  return result;
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdDestroyDescriptorUpdateTemplate(
+    VkDevice device, VkDescriptorUpdateTemplate descriptorUpdateTemplate,
+    const VkAllocationCallbacks* pAllocator) {
+  GWD_PROFILE_INTERCEPT(DestroyDescriptorUpdateTemplate);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkDestroyDescriptorUpdateTemplate fp_DestroyDescriptorUpdateTemplate =
+      nullptr;
+  fp_DestroyDescriptorUpdateTemplate =
+      device_data->dispatch_table.DestroyDescriptorUpdateTemplate;
+
+  intercept_timer.BeginDownstream();
+  fp_DestroyDescriptorUpdateTemplate(device, descriptorUpdateTemplate,
+                                      pAllocator);
+  intercept_timer.EndDownstream();
+
+  device_data->witch_doc.PostCallDestroyDescriptorUpdateTemplate(
+      device, descriptorUpdateTemplate, pAllocator);
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdUpdateDescriptorSetWithTemplate(
+    VkDevice device, VkDescriptorSet descriptorSet,
+    VkDescriptorUpdateTemplate descriptorUpdateTemplate, const void* pData) {
+  GWD_PROFILE_INTERCEPT(UpdateDescriptorSetWithTemplate);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkUpdateDescriptorSetWithTemplate fp_UpdateDescriptorSetWithTemplate =
+      nullptr;
+  fp_UpdateDescriptorSetWithTemplate =
+      device_data->dispatch_table.UpdateDescriptorSetWithTemplate;
+
+  intercept_timer.BeginDownstream();
+  fp_UpdateDescriptorSetWithTemplate(device, descriptorSet,
+                                      descriptorUpdateTemplate, pData);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(
+        GWD::Trace::UpdateDescriptorSetWithTemplate{
+            (uint64_t)device, (uint64_t)descriptorSet,
+            (uint64_t)descriptorUpdateTemplate});
+  }
+
+  device_data->witch_doc.PostCallUpdateDescriptorSetWithTemplate(
+      device, descriptorSet, descriptorUpdateTemplate, pData);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL GwdCreateDescriptorUpdateTemplateKHR(
+    VkDevice device, const VkDescriptorUpdateTemplateCreateInfo* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator,
+    VkDescriptorUpdateTemplate* pDescriptorUpdateTemplate) {
+  GWD_PROFILE_INTERCEPT(CreateDescriptorUpdateTemplateKHR);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkCreateDescriptorUpdateTemplateKHR
+      fp_CreateDescriptorUpdateTemplateKHR = nullptr;
+  fp_CreateDescriptorUpdateTemplateKHR =
+      device_data->dispatch_table.CreateDescriptorUpdateTemplateKHR;
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_CreateDescriptorUpdateTemplateKHR(
+      device, pCreateInfo, pAllocator, pDescriptorUpdateTemplate);
+  intercept_timer.EndDownstream();
+
+  result = device_data->witch_doc.PostCallCreateDescriptorUpdateTemplate(
+      result, device, pCreateInfo, pAllocator, pDescriptorUpdateTemplate);
+
+  return result;
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdDestroyDescriptorUpdateTemplateKHR(
+    VkDevice device, VkDescriptorUpdateTemplate descriptorUpdateTemplate,
+    const VkAllocationCallbacks* pAllocator) {
+  GWD_PROFILE_INTERCEPT(DestroyDescriptorUpdateTemplateKHR);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkDestroyDescriptorUpdateTemplateKHR
+      fp_DestroyDescriptorUpdateTemplateKHR = nullptr;
+  fp_DestroyDescriptorUpdateTemplateKHR =
+      device_data->dispatch_table.DestroyDescriptorUpdateTemplateKHR;
+
+  intercept_timer.BeginDownstream();
+  fp_DestroyDescriptorUpdateTemplateKHR(device, descriptorUpdateTemplate,
+                                         pAllocator);
+  intercept_timer.EndDownstream();
+
+  device_data->witch_doc.PostCallDestroyDescriptorUpdateTemplate(
+      device, descriptorUpdateTemplate, pAllocator);
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdUpdateDescriptorSetWithTemplateKHR(
+    VkDevice device, VkDescriptorSet descriptorSet,
+    VkDescriptorUpdateTemplate descriptorUpdateTemplate, const void* pData) {
+  GWD_PROFILE_INTERCEPT(UpdateDescriptorSetWithTemplateKHR);
+  DeviceData* device_data = GetDeviceData(device);
+
+  PFN_vkUpdateDescriptorSetWithTemplateKHR
+      fp_UpdateDescriptorSetWithTemplateKHR = nullptr;
+  fp_UpdateDescriptorSetWithTemplateKHR =
+      device_data->dispatch_table.UpdateDescriptorSetWithTemplateKHR;
+
+  intercept_timer.BeginDownstream();
+  fp_UpdateDescriptorSetWithTemplateKHR(device, descriptorSet,
+                                         descriptorUpdateTemplate, pData);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(
+        GWD::Trace::UpdateDescriptorSetWithTemplate{
+            (uint64_t)device, (uint64_t)descriptorSet,
+            (uint64_t)descriptorUpdateTemplate});
+  }
+
+  device_data->witch_doc.PostCallUpdateDescriptorSetWithTemplate(
+      device, descriptorSet, descriptorUpdateTemplate, pData);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+GwdBeginCommandBuffer(VkCommandBuffer commandBuffer,
+                      const VkCommandBufferBeginInfo* pBeginInfo) {
+  GWD_PROFILE_INTERCEPT(BeginCommandBuffer);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
+  PFN_vkBeginCommandBuffer fp_BeginCommandBuffer = nullptr;
+  fp_BeginCommandBuffer = device_data->dispatch_table.BeginCommandBuffer;
+
+  intercept_timer.BeginDownstream();
+  VkResult result = fp_BeginCommandBuffer(commandBuffer, pBeginInfo);
+  intercept_timer.EndDownstream();
+
+  if (result == VK_SUCCESS && device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::BeginCommandBuffer{
+        (uint64_t)commandBuffer, pBeginInfo->flags, 0});
+  }
+
+  result = device_data->witch_doc.PostCallBeginCommandBuffer(
+      result, commandBuffer, pBeginInfo);
+
+  return result;
 }
 
 VKAPI_ATTR void VKAPI_CALL GwdCmdBindIndexBuffer(VkCommandBuffer commandBuffer,
                                                  VkBuffer buffer,
                                                  VkDeviceSize offset,
                                                  VkIndexType indexType) {
-  // const VkDevice device = s_cmdbuf_device_map[commandBuffer];
+  GWD_PROFILE_INTERCEPT(CmdBindIndexBuffer);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
 
   PFN_vkCmdBindIndexBuffer fp_CmdBindIndexBuffer = nullptr;
-  fp_CmdBindIndexBuffer = s_global_dispatch_table->CmdBindIndexBuffer;
+  fp_CmdBindIndexBuffer = device_data->dispatch_table.CmdBindIndexBuffer;
+
+  // Analysis below still sees the application's own buffer
+  VkBuffer bound_buffer = buffer;
+  if (device_data->buffer_shadower != nullptr) {
+    bound_buffer = device_data->buffer_shadower->Substitute(buffer);
+  }
+
+  intercept_timer.BeginDownstream();
+  fp_CmdBindIndexBuffer(commandBuffer, bound_buffer, offset, indexType);
+  intercept_timer.EndDownstream();
 
-  fp_CmdBindIndexBuffer(commandBuffer, buffer, offset, indexType);
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdBindIndexBuffer{
+        (uint64_t)commandBuffer, (uint64_t)buffer, offset,
+        (uint32_t)indexType, 0});
+  }
 
-  WitchDoc_inst.PostCallCmdBindIndexBuffer(commandBuffer, buffer, offset,
-                                           indexType);
+  device_data->witch_doc.PostCallCmdBindIndexBuffer(commandBuffer, buffer,
+                                                    offset, indexType);
 }
 
 VKAPI_ATTR void VKAPI_CALL GwdCmdBindVertexBuffers(
     VkCommandBuffer commandBuffer, uint32_t firstBinding, uint32_t bindingCount,
     const VkBuffer* pBuffers, const VkDeviceSize* pOffsets) {
+  GWD_PROFILE_INTERCEPT(CmdBindVertexBuffers);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
   PFN_vkCmdBindVertexBuffers fp_CmdBindVertexBuffers = nullptr;
-  fp_CmdBindVertexBuffers = s_global_dispatch_table->CmdBindVertexBuffers;
+  fp_CmdBindVertexBuffers =
+      device_data->dispatch_table.CmdBindVertexBuffers;
+
+  // Analysis below still sees the application's own buffers. Bindings past
+  // the array are rare enough to be left alone.
+  VkBuffer bound_buffers[kMaxShadowedVertexBindings];
+  const VkBuffer* buffers = pBuffers;
+  if (device_data->buffer_shadower != nullptr &&
+      bindingCount <= kMaxShadowedVertexBindings) {
+    for (uint32_t binding_index = 0; binding_index < bindingCount;
+         binding_index++) {
+      bound_buffers[binding_index] =
+          device_data->buffer_shadower->Substitute(pBuffers[binding_index]);
+    }
+    buffers = bound_buffers;
+  }
 
-  fp_CmdBindVertexBuffers(commandBuffer, firstBinding, bindingCount, pBuffers,
+  intercept_timer.BeginDownstream();
+  fp_CmdBindVertexBuffers(commandBuffer, firstBinding, bindingCount, buffers,
                           pOffsets);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    GWD::Trace::VertexBufferBinding bindings[kMaxShadowedVertexBindings];
+    for (uint32_t first_index = 0; first_index < bindingCount;
+         first_index += kMaxShadowedVertexBindings) {
+      const uint32_t record_binding_count =
+          std::min(bindingCount - first_index, kMaxShadowedVertexBindings);
+      for (uint32_t binding_index = 0; binding_index < record_binding_count;
+           binding_index++) {
+        bindings[binding_index].buffer =
+            (uint64_t)pBuffers[first_index + binding_index];
+        bindings[binding_index].offset = pOffsets[first_index + binding_index];
+      }
+      device_data->trace_writer->Write(
+          GWD::Trace::CmdBindVertexBuffers{(uint64_t)commandBuffer,
+                                           firstBinding + first_index,
+                                           record_binding_count},
+          bindings, record_binding_count);
+    }
+  }
+
+  device_data->witch_doc.PostCallCmdBindVertexBuffers(
+      commandBuffer, firstBinding, bindingCount, pBuffers, pOffsets);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+GwdCmdBindPipeline(VkCommandBuffer commandBuffer,
+                   VkPipelineBindPoint pipelineBindPoint, VkPipeline pipeline) {
+  GWD_PROFILE_INTERCEPT(CmdBindPipeline);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
+  PFN_vkCmdBindPipeline fp_CmdBindPipeline = nullptr;
+  fp_CmdBindPipeline = device_data->dispatch_table.CmdBindPipeline;
+
+  intercept_timer.BeginDownstream();
+  fp_CmdBindPipeline(commandBuffer, pipelineBindPoint, pipeline);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdBindPipeline{
+        (uint64_t)commandBuffer, (uint64_t)pipeline,
+        (uint32_t)pipelineBindPoint, 0});
+  }
+
+  device_data->witch_doc.PostCallCmdBindPipeline(
+      commandBuffer, pipelineBindPoint, pipeline);
+}
 
-  WitchDoc_inst.PostCallCmdBindVertexBuffers(commandBuffer, firstBinding,
-                                             bindingCount, pBuffers, pOffsets);
+VKAPI_ATTR void VKAPI_CALL GwdCmdBindDescriptorSets(
+    VkCommandBuffer commandBuffer, VkPipelineBindPoint pipelineBindPoint,
+    VkPipelineLayout layout, uint32_t firstSet, uint32_t descriptorSetCount,
+    const VkDescriptorSet* pDescriptorSets, uint32_t dynamicOffsetCount,
+    const uint32_t* pDynamicOffsets) {
+  GWD_PROFILE_INTERCEPT(CmdBindDescriptorSets);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
+  PFN_vkCmdBindDescriptorSets fp_CmdBindDescriptorSets = nullptr;
+  fp_CmdBindDescriptorSets =
+      device_data->dispatch_table.CmdBindDescriptorSets;
+
+  intercept_timer.BeginDownstream();
+  fp_CmdBindDescriptorSets(commandBuffer, pipelineBindPoint, layout, firstSet,
+                           descriptorSetCount, pDescriptorSets,
+                           dynamicOffsetCount, pDynamicOffsets);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    // Every chunk keeps the dynamic offset count, so that none of them
+    // replays as a plain rebind
+    static constexpr uint32_t kMaxDescriptorSetsPerRecord = 32;
+    uint64_t descriptor_sets[kMaxDescriptorSetsPerRecord];
+    for (uint32_t first_index = 0; first_index < descriptorSetCount;
+         first_index += kMaxDescriptorSetsPerRecord) {
+      const uint32_t record_set_count = std::min(
+          descriptorSetCount - first_index, kMaxDescriptorSetsPerRecord);
+      for (uint32_t set_index = 0; set_index < record_set_count;
+           set_index++) {
+        descriptor_sets[set_index] =
+            (uint64_t)pDescriptorSets[first_index + set_index];
+      }
+      device_data->trace_writer->Write(
+          GWD::Trace::CmdBindDescriptorSets{
+              (uint64_t)commandBuffer, (uint64_t)layout,
+              (uint32_t)pipelineBindPoint, firstSet + first_index,
+              record_set_count, dynamicOffsetCount},
+          descriptor_sets, record_set_count);
+    }
+  }
+
+  device_data->witch_doc.PostCallCmdBindDescriptorSets(
+      commandBuffer, pipelineBindPoint, layout, firstSet, descriptorSetCount,
+      pDescriptorSets, dynamicOffsetCount, pDynamicOffsets);
 }
 
 VKAPI_ATTR void VKAPI_CALL GwdCmdDraw(VkCommandBuffer commandBuffer,
@@ -308,27 +1538,50 @@ VKAPI_ATTR void VKAPI_CALL GwdCmdDraw(VkCommandBuffer commandBuffer,
                                       uint32_t instanceCount,
                                       uint32_t firstVertex,
                                       uint32_t firstInstance) {
+  GWD_PROFILE_INTERCEPT(CmdDraw);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
   PFN_vkCmdDraw fp_CmdDraw = nullptr;
-  fp_CmdDraw = s_global_dispatch_table->CmdDraw;
+  fp_CmdDraw = device_data->dispatch_table.CmdDraw;
 
+  intercept_timer.BeginDownstream();
   fp_CmdDraw(commandBuffer, vertexCount, instanceCount, firstVertex,
              firstInstance);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(
+        GWD::Trace::CmdDraw{(uint64_t)commandBuffer, vertexCount,
+                            instanceCount, firstVertex, firstInstance});
+  }
 
-  WitchDoc_inst.PostCallCmdDraw(commandBuffer, vertexCount, instanceCount,
-                                firstVertex, firstInstance);
+  device_data->witch_doc.PostCallCmdDraw(
+      commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
 }
 
 VKAPI_ATTR void VKAPI_CALL GwdCmdDrawIndexed(
     VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount,
     uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) {
+  GWD_PROFILE_INTERCEPT(CmdDrawIndexed);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
   PFN_vkCmdDrawIndexed fp_CmdDrawIndexed = nullptr;
-  fp_CmdDrawIndexed = s_global_dispatch_table->CmdDrawIndexed;
+  fp_CmdDrawIndexed = device_data->dispatch_table.CmdDrawIndexed;
 
+  intercept_timer.BeginDownstream();
   fp_CmdDrawIndexed(commandBuffer, indexCount, instanceCount, firstIndex,
                     vertexOffset, firstInstance);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdDrawIndexed{
+        (uint64_t)commandBuffer, indexCount, instanceCount, firstIndex,
+        vertexOffset, firstInstance, 0});
+  }
 
-  WitchDoc_inst.PostCallCmdDrawIndexed(commandBuffer, indexCount, instanceCount,
-                                       firstIndex, vertexOffset, firstInstance);
+  device_data->witch_doc.PostCallCmdDrawIndexed(commandBuffer, indexCount,
+                                                instanceCount, firstIndex,
+                                                vertexOffset, firstInstance);
 }
 
 VKAPI_ATTR void VKAPI_CALL GwdCmdDrawIndirect(VkCommandBuffer commandBuffer,
@@ -336,25 +1589,222 @@ VKAPI_ATTR void VKAPI_CALL GwdCmdDrawIndirect(VkCommandBuffer commandBuffer,
                                               VkDeviceSize offset,
                                               uint32_t drawCount,
                                               uint32_t stride) {
+  GWD_PROFILE_INTERCEPT(CmdDrawIndirect);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
   PFN_vkCmdDrawIndirect fp_CmdDrawIndirect = nullptr;
-  fp_CmdDrawIndirect = s_global_dispatch_table->CmdDrawIndirect;
+  fp_CmdDrawIndirect = device_data->dispatch_table.CmdDrawIndirect;
 
+  intercept_timer.BeginDownstream();
   fp_CmdDrawIndirect(commandBuffer, buffer, offset, drawCount, stride);
+  intercept_timer.EndDownstream();
 
-  WitchDoc_inst.PostCallCmdDrawIndirect(commandBuffer, buffer, offset,
-                                        drawCount, stride);
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdDrawIndirect{
+        (uint64_t)commandBuffer, (uint64_t)buffer, offset, drawCount, stride});
+  }
+
+  device_data->witch_doc.PostCallCmdDrawIndirect(commandBuffer, buffer, offset,
+                                                 drawCount, stride);
 }
 
 VKAPI_ATTR void VKAPI_CALL GwdCmdDrawIndexedIndirect(
     VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
     uint32_t drawCount, uint32_t stride) {
+  GWD_PROFILE_INTERCEPT(CmdDrawIndexedIndirect);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
   PFN_vkCmdDrawIndexedIndirect fp_CmdDrawIndexedIndirect = nullptr;
-  fp_CmdDrawIndexedIndirect = s_global_dispatch_table->CmdDrawIndexedIndirect;
+  fp_CmdDrawIndexedIndirect =
+      device_data->dispatch_table.CmdDrawIndexedIndirect;
 
+  intercept_timer.BeginDownstream();
   fp_CmdDrawIndexedIndirect(commandBuffer, buffer, offset, drawCount, stride);
+  intercept_timer.EndDownstream();
 
-  WitchDoc_inst.PostCallCmdDrawIndexedIndirect(commandBuffer, buffer, offset,
-                                               drawCount, stride);
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdDrawIndexedIndirect{
+        (uint64_t)commandBuffer, (uint64_t)buffer, offset, drawCount, stride});
+  }
+
+  device_data->witch_doc.PostCallCmdDrawIndexedIndirect(
+      commandBuffer, buffer, offset, drawCount, stride);
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdCmdDrawIndirectCount(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+    VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount,
+    uint32_t stride) {
+  GWD_PROFILE_INTERCEPT(CmdDrawIndirectCount);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
+  PFN_vkCmdDrawIndirectCount fp_CmdDrawIndirectCount = nullptr;
+  fp_CmdDrawIndirectCount = device_data->dispatch_table.CmdDrawIndirectCount;
+
+  intercept_timer.BeginDownstream();
+  fp_CmdDrawIndirectCount(commandBuffer, buffer, offset, countBuffer,
+                          countBufferOffset, maxDrawCount, stride);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdDrawIndirectCount{
+        (uint64_t)commandBuffer, (uint64_t)buffer, offset,
+        (uint64_t)countBuffer, countBufferOffset, maxDrawCount, stride});
+  }
+
+  device_data->witch_doc.PostCallCmdDrawIndirectCount(
+      commandBuffer, buffer, offset, countBuffer, countBufferOffset,
+      maxDrawCount, stride);
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdCmdDrawIndexedIndirectCount(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+    VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount,
+    uint32_t stride) {
+  GWD_PROFILE_INTERCEPT(CmdDrawIndexedIndirectCount);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
+  PFN_vkCmdDrawIndexedIndirectCount fp_CmdDrawIndexedIndirectCount = nullptr;
+  fp_CmdDrawIndexedIndirectCount =
+      device_data->dispatch_table.CmdDrawIndexedIndirectCount;
+
+  intercept_timer.BeginDownstream();
+  fp_CmdDrawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer,
+                                 countBufferOffset, maxDrawCount, stride);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdDrawIndexedIndirectCount{
+        (uint64_t)commandBuffer, (uint64_t)buffer, offset,
+        (uint64_t)countBuffer, countBufferOffset, maxDrawCount, stride});
+  }
+
+  device_data->witch_doc.PostCallCmdDrawIndexedIndirectCount(
+      commandBuffer, buffer, offset, countBuffer, countBufferOffset,
+      maxDrawCount, stride);
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdCmdDrawIndirectCountKHR(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+    VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount,
+    uint32_t stride) {
+  GWD_PROFILE_INTERCEPT(CmdDrawIndirectCountKHR);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
+  PFN_vkCmdDrawIndirectCountKHR fp_CmdDrawIndirectCountKHR = nullptr;
+  fp_CmdDrawIndirectCountKHR =
+      device_data->dispatch_table.CmdDrawIndirectCountKHR;
+
+  intercept_timer.BeginDownstream();
+  fp_CmdDrawIndirectCountKHR(commandBuffer, buffer, offset, countBuffer,
+                             countBufferOffset, maxDrawCount, stride);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdDrawIndirectCount{
+        (uint64_t)commandBuffer, (uint64_t)buffer, offset,
+        (uint64_t)countBuffer, countBufferOffset, maxDrawCount, stride});
+  }
+
+  device_data->witch_doc.PostCallCmdDrawIndirectCount(
+      commandBuffer, buffer, offset, countBuffer, countBufferOffset,
+      maxDrawCount, stride);
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdCmdDrawIndexedIndirectCountKHR(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+    VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount,
+    uint32_t stride) {
+  GWD_PROFILE_INTERCEPT(CmdDrawIndexedIndirectCountKHR);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
+  PFN_vkCmdDrawIndexedIndirectCountKHR fp_CmdDrawIndexedIndirectCountKHR =
+      nullptr;
+  fp_CmdDrawIndexedIndirectCountKHR =
+      device_data->dispatch_table.CmdDrawIndexedIndirectCountKHR;
+
+  intercept_timer.BeginDownstream();
+  fp_CmdDrawIndexedIndirectCountKHR(commandBuffer, buffer, offset, countBuffer,
+                                    countBufferOffset, maxDrawCount, stride);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdDrawIndexedIndirectCount{
+        (uint64_t)commandBuffer, (uint64_t)buffer, offset,
+        (uint64_t)countBuffer, countBufferOffset, maxDrawCount, stride});
+  }
+
+  device_data->witch_doc.PostCallCmdDrawIndexedIndirectCount(
+      commandBuffer, buffer, offset, countBuffer, countBufferOffset,
+      maxDrawCount, stride);
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdCmdDispatch(VkCommandBuffer commandBuffer,
+                                          uint32_t groupCountX,
+                                          uint32_t groupCountY,
+                                          uint32_t groupCountZ) {
+  GWD_PROFILE_INTERCEPT(CmdDispatch);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
+  PFN_vkCmdDispatch fp_CmdDispatch = nullptr;
+  fp_CmdDispatch = device_data->dispatch_table.CmdDispatch;
+
+  intercept_timer.BeginDownstream();
+  fp_CmdDispatch(commandBuffer, groupCountX, groupCountY, groupCountZ);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(
+        GWD::Trace::CmdDispatch{(uint64_t)commandBuffer, groupCountX,
+                                groupCountY, groupCountZ, 0});
+  }
+
+  device_data->witch_doc.PostCallCmdDispatch(commandBuffer, groupCountX,
+                                             groupCountY, groupCountZ);
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdCmdDispatchIndirect(VkCommandBuffer commandBuffer,
+                                                  VkBuffer buffer,
+                                                  VkDeviceSize offset) {
+  GWD_PROFILE_INTERCEPT(CmdDispatchIndirect);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
+  PFN_vkCmdDispatchIndirect fp_CmdDispatchIndirect = nullptr;
+  fp_CmdDispatchIndirect = device_data->dispatch_table.CmdDispatchIndirect;
+
+  intercept_timer.BeginDownstream();
+  fp_CmdDispatchIndirect(commandBuffer, buffer, offset);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdDispatchIndirect{
+        (uint64_t)commandBuffer, (uint64_t)buffer, offset});
+  }
+
+  device_data->witch_doc.PostCallCmdDispatchIndirect(commandBuffer, buffer,
+                                                     offset);
+}
+
+VKAPI_ATTR void VKAPI_CALL GwdCmdExecuteCommands(
+    VkCommandBuffer commandBuffer, uint32_t commandBufferCount,
+    const VkCommandBuffer* pCommandBuffers) {
+  GWD_PROFILE_INTERCEPT(CmdExecuteCommands);
+  DeviceData* device_data = GetDeviceData(commandBuffer);
+
+  PFN_vkCmdExecuteCommands fp_CmdExecuteCommands = nullptr;
+  fp_CmdExecuteCommands = device_data->dispatch_table.CmdExecuteCommands;
+
+  intercept_timer.BeginDownstream();
+  fp_CmdExecuteCommands(commandBuffer, commandBufferCount, pCommandBuffers);
+  intercept_timer.EndDownstream();
+
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(GWD::Trace::CmdExecuteCommands{
+        (uint64_t)commandBuffer, commandBufferCount, 0});
+  }
+
+  device_data->witch_doc.PostCallCmdExecuteCommands(
+      commandBuffer, commandBufferCount, pCommandBuffers);
 }
 
 // ----------------------------------------------------------------------------
@@ -389,35 +1839,6 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdEnumerateInstanceExtensionProperties(
   return VK_ERROR_LAYER_NOT_PRESENT;
 }
 
-VKAPI_ATTR VkResult VKAPI_CALL
-GwdEnumeratePhysicalDevices(VkInstance instance, uint32_t* pPhysicalDeviceCount,
-                            VkPhysicalDevice* pPhysicalDevices) {
-  PFN_vkEnumeratePhysicalDevices fp_EnumeratePhysicalDevices = nullptr;
-  {
-    LocalGuard lock(s_layer_mutex);
-    fp_EnumeratePhysicalDevices =
-        s_instance_dt[instance].EnumeratePhysicalDevices;
-  }
-  VkResult result = fp_EnumeratePhysicalDevices(instance, pPhysicalDeviceCount,
-                                                pPhysicalDevices);
-
-  if (pPhysicalDeviceCount != nullptr && pPhysicalDevices != nullptr) {
-    // Map these devices to this instance so that we can map each physical
-    // device back to a dispatch table when handling
-    // EnumerateDeviceExtensionProperties. Note that this is hardly error-proof,
-    // but it's impossible to handle this perfectly since physical devices may
-    // be in use by multiple instances.
-    {
-      LocalGuard lock(s_layer_mutex);
-      for (uint32_t i = 0; i < *pPhysicalDeviceCount; ++i) {
-        s_device_instance_map[pPhysicalDevices[i]] = instance;
-      }
-    }
-  }
-
-  return result;
-}
-
 // Deprecated by Khronos, but we'll support it in case older applications still
 // use it.
 VKAPI_ATTR VkResult VKAPI_CALL GwdEnumerateDeviceLayerProperties(
@@ -462,12 +1883,9 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdEnumerateDeviceExtensionProperties(
 
   PFN_vkEnumerateDeviceExtensionProperties
       fp_EnumerateDeviceExtensionProperties = nullptr;
-  {
-    LocalGuard lock(s_layer_mutex);
-    VkInstance instance = s_device_instance_map[physicalDevice];
-    fp_EnumerateDeviceExtensionProperties =
-        s_instance_dt[instance].EnumerateDeviceExtensionProperties;
-  }
+  fp_EnumerateDeviceExtensionProperties =
+      GetInstanceData(physicalDevice)
+          ->dispatch_table.EnumerateDeviceExtensionProperties;
 
   if (pLayerName != nullptr) {
     // if this is another layer, we can just return the data from it!
@@ -566,6 +1984,9 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdCreateInstance(
   PFN_vkCreateInstance create_instance =
       (PFN_vkCreateInstance)next_gipa(VK_NULL_HANDLE, "vkCreateInstance");
   VkResult result = create_instance(pCreateInfo, pAllocator, pInstance);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
 
   VkLayerInstanceDispatchTable dispatch_table = {};
   GWD_GETINSTDISPATCHADDR(GetInstanceProcAddr);
@@ -573,14 +1994,14 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdCreateInstance(
   GWD_GETINSTDISPATCHADDR(CreateDebugUtilsMessengerEXT);
   GWD_GETINSTDISPATCHADDR(DestroyDebugUtilsMessengerEXT);
   GWD_GETINSTDISPATCHADDR(EnumerateDeviceExtensionProperties);
-  GWD_GETINSTDISPATCHADDR(EnumeratePhysicalDevices);
 
-  {
-    LocalGuard lock(s_layer_mutex);
-    s_instance_dt[*pInstance] = dispatch_table;
-  }
+  std::unique_ptr<InstanceData> instance_data(new InstanceData);
+  instance_data->dispatch_table = dispatch_table;
+  InstanceData* inserted_data = s_instance_data.Insert(
+      get_dispatch_key(*pInstance), std::move(instance_data));
 
-  WitchDoc_inst.PostCallCreateInstance(pCreateInfo, pAllocator, pInstance);
+  inserted_data->witch_doc.PostCallCreateInstance(pCreateInfo, pAllocator,
+                                                  pInstance);
 
   return result;
 }
@@ -589,10 +2010,15 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdCreateInstance(
 
 VKAPI_ATTR void VKAPI_CALL GwdDestroyInstance(
     VkInstance instance, const VkAllocationCallbacks* pAllocator) {
-  LocalGuard lock(s_layer_mutex);
-  s_instance_dt.erase(instance);
+  dispatch_key instance_key = get_dispatch_key(instance);
+
+  PFN_vkDestroyInstance fp_DestroyInstance = nullptr;
+  fp_DestroyInstance =
+      s_instance_data.Find(instance_key)->dispatch_table.DestroyInstance;
+
+  fp_DestroyInstance(instance, pAllocator);
 
-  // TODO: Call down the chain??
+  s_instance_data.Erase(instance_key);
 }
 
 #define GWD_GETDEVDISPATCHADDR(func) \
@@ -624,11 +2050,26 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdCreateDevice(
   // Advance linkage for next layer
   layer_ci->u.pLayerInfo = layer_ci->u.pLayerInfo->pNext;
 
+  PFN_vkSetDeviceLoaderData set_device_loader_data = nullptr;
+  for (VkLayerDeviceCreateInfo* loader_data_ci =
+           (VkLayerDeviceCreateInfo*)pCreateInfo->pNext;
+       loader_data_ci != nullptr;
+       loader_data_ci = (VkLayerDeviceCreateInfo*)loader_data_ci->pNext) {
+    if (loader_data_ci->sType == VK_STRUCTURE_TYPE_LOADER_DEVICE_CREATE_INFO &&
+        loader_data_ci->function == VK_LOADER_DATA_CALLBACK) {
+      set_device_loader_data = loader_data_ci->u.pfnSetDeviceLoaderData;
+      break;
+    }
+  }
+
   // Need to call vkCreateDevice down the chain to actually create the device
   PFN_vkCreateDevice createFunc =
       (PFN_vkCreateDevice)next_gipa(VK_NULL_HANDLE, "vkCreateDevice");
   VkResult result =
       createFunc(physicalDevice, pCreateInfo, pAllocator, pDevice);
+  if (result != VK_SUCCESS) {
+    return result;
+  }
 
   // TODO: Instead of the manual fetch of proc addresses, we might want to use
   // the functionality in LayerFactor/vk_dispatch_table_helper.h We can fill in
@@ -643,34 +2084,166 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdCreateDevice(
   GWD_GETDEVDISPATCHADDR(DestroyDevice);
   GWD_GETDEVDISPATCHADDR(GetDeviceQueue);
   GWD_GETDEVDISPATCHADDR(QueueSubmit);
+  GWD_GETDEVDISPATCHADDR(QueueBindSparse);
+  GWD_GETDEVDISPATCHADDR(AcquireNextImageKHR);
+  GWD_GETDEVDISPATCHADDR(QueuePresentKHR);
   GWD_GETDEVDISPATCHADDR(AllocateMemory);
   GWD_GETDEVDISPATCHADDR(FreeMemory);
+  GWD_GETDEVDISPATCHADDR(MapMemory);
+  GWD_GETDEVDISPATCHADDR(UnmapMemory);
+  GWD_GETDEVDISPATCHADDR(FlushMappedMemoryRanges);
+  GWD_GETDEVDISPATCHADDR(InvalidateMappedMemoryRanges);
+  GWD_GETDEVDISPATCHADDR(GetDeviceMemoryCommitment);
   GWD_GETDEVDISPATCHADDR(BindBufferMemory);
   GWD_GETDEVDISPATCHADDR(CreateBuffer);
   GWD_GETDEVDISPATCHADDR(DestroyBuffer);
   GWD_GETDEVDISPATCHADDR(BindBufferMemory2);
+  GWD_GETDEVDISPATCHADDR(CreateImage);
+  GWD_GETDEVDISPATCHADDR(DestroyImage);
+  GWD_GETDEVDISPATCHADDR(BindImageMemory);
+  GWD_GETDEVDISPATCHADDR(BindImageMemory2);
+  GWD_GETDEVDISPATCHADDR(BindBufferMemory2KHR);
+  GWD_GETDEVDISPATCHADDR(BindImageMemory2KHR);
   GWD_GETDEVDISPATCHADDR(CmdDraw);
   GWD_GETDEVDISPATCHADDR(CmdDrawIndexed);
   GWD_GETDEVDISPATCHADDR(CmdDrawIndirect);
   GWD_GETDEVDISPATCHADDR(CmdDrawIndexedIndirect);
+  GWD_GETDEVDISPATCHADDR(CmdDrawIndirectCount);
+  GWD_GETDEVDISPATCHADDR(CmdDrawIndexedIndirectCount);
+  GWD_GETDEVDISPATCHADDR(CmdDrawIndirectCountKHR);
+  GWD_GETDEVDISPATCHADDR(CmdDrawIndexedIndirectCountKHR);
+  GWD_GETDEVDISPATCHADDR(CmdDispatch);
+  GWD_GETDEVDISPATCHADDR(CmdDispatchIndirect);
+  GWD_GETDEVDISPATCHADDR(CmdExecuteCommands);
   GWD_GETDEVDISPATCHADDR(AllocateCommandBuffers);
   GWD_GETDEVDISPATCHADDR(FreeCommandBuffers);
+  GWD_GETDEVDISPATCHADDR(DestroyCommandPool);
+  GWD_GETDEVDISPATCHADDR(AllocateDescriptorSets);
+  GWD_GETDEVDISPATCHADDR(FreeDescriptorSets);
+  GWD_GETDEVDISPATCHADDR(ResetDescriptorPool);
+  GWD_GETDEVDISPATCHADDR(DestroyDescriptorPool);
+  GWD_GETDEVDISPATCHADDR(UpdateDescriptorSets);
+  GWD_GETDEVDISPATCHADDR(CreateDescriptorUpdateTemplate);
+  GWD_GETDEVDISPATCHADDR(DestroyDescriptorUpdateTemplate);
+  GWD_GETDEVDISPATCHADDR(UpdateDescriptorSetWithTemplate);
+  GWD_GETDEVDISPATCHADDR(CreateDescriptorUpdateTemplateKHR);
+  GWD_GETDEVDISPATCHADDR(DestroyDescriptorUpdateTemplateKHR);
+  GWD_GETDEVDISPATCHADDR(UpdateDescriptorSetWithTemplateKHR);
+  GWD_GETDEVDISPATCHADDR(BeginCommandBuffer);
   GWD_GETDEVDISPATCHADDR(CmdBindIndexBuffer);
   GWD_GETDEVDISPATCHADDR(CmdBindVertexBuffers);
+  GWD_GETDEVDISPATCHADDR(CmdBindPipeline);
+  GWD_GETDEVDISPATCHADDR(CmdBindDescriptorSets);
+  // Only used by the layer's own work, not intercepted
+  GWD_GETDEVDISPATCHADDR(GetBufferMemoryRequirements);
+  GWD_GETDEVDISPATCHADDR(CreateCommandPool);
+  GWD_GETDEVDISPATCHADDR(EndCommandBuffer);
+  GWD_GETDEVDISPATCHADDR(CmdPipelineBarrier);
+  GWD_GETDEVDISPATCHADDR(CmdCopyBuffer);
+  GWD_GETDEVDISPATCHADDR(CreateFence);
+  GWD_GETDEVDISPATCHADDR(DestroyFence);
+  GWD_GETDEVDISPATCHADDR(GetFenceStatus);
+  GWD_GETDEVDISPATCHADDR(ResetFences);
+
+  InstanceData* instance_data = GetInstanceData(physicalDevice);
+  std::unique_ptr<DeviceData> device_data(
+      new DeviceData(&instance_data->witch_doc));
+  device_data->dispatch_table = dispatch_table;
+
+  const GWD::LayerSettings& settings = GWD::GetLayerSettings();
+  VkPhysicalDeviceProperties properties = {};
+  VkPhysicalDeviceMemoryProperties memory_properties = {};
+  GWD::TraceWriter* trace_writer = GWD::TraceWriter::Get();
+  if (settings.suballocate || settings.shadow_buffers ||
+      trace_writer != nullptr) {
+    const GWD::LayerBypassDispatch& bypass_dispatch =
+        instance_data->witch_doc.GetLayerBypassDispatch();
+    bypass_dispatch.getPhysicalDeviceProperties(physicalDevice, &properties);
+    bypass_dispatch.getPhysicalDeviceMemoryProperties(physicalDevice,
+                                                      &memory_properties);
+  }
 
-  {
-    LocalGuard lock(s_layer_mutex);
-    s_device_dt[*pDevice] = dispatch_table;
-    s_numDevices++;
-    if (1 == s_numDevices) {
-      s_global_dispatch_table = &s_device_dt[*pDevice];
-    } else if (s_numDevices > 1) {
-      assert(!"Too many devices for WitchDoctor");
+  if (settings.suballocate) {
+    GWD::MemorySuballocator::DeviceFunctions functions = {};
+    functions.allocate_memory = dispatch_table.AllocateMemory;
+    functions.free_memory = dispatch_table.FreeMemory;
+    functions.map_memory = dispatch_table.MapMemory;
+    functions.unmap_memory = dispatch_table.UnmapMemory;
+    device_data->suballocator.reset(new GWD::MemorySuballocator(
+        *pDevice, functions, memory_properties, properties.limits));
+  }
+
+  // The shadower creates command buffers, which need the loader's dispatch
+  // pointer set before the next layer will accept them
+  if (settings.shadow_buffers && set_device_loader_data != nullptr) {
+    GWD::BufferShadower::DeviceFunctions functions = {};
+    functions.set_device_loader_data = set_device_loader_data;
+    functions.create_buffer = dispatch_table.CreateBuffer;
+    functions.destroy_buffer = dispatch_table.DestroyBuffer;
+    functions.get_buffer_memory_requirements =
+        dispatch_table.GetBufferMemoryRequirements;
+    functions.allocate_memory = dispatch_table.AllocateMemory;
+    functions.free_memory = dispatch_table.FreeMemory;
+    functions.bind_buffer_memory = dispatch_table.BindBufferMemory;
+    functions.create_command_pool = dispatch_table.CreateCommandPool;
+    functions.destroy_command_pool = dispatch_table.DestroyCommandPool;
+    functions.allocate_command_buffers = dispatch_table.AllocateCommandBuffers;
+    functions.begin_command_buffer = dispatch_table.BeginCommandBuffer;
+    functions.end_command_buffer = dispatch_table.EndCommandBuffer;
+    functions.cmd_pipeline_barrier = dispatch_table.CmdPipelineBarrier;
+    functions.cmd_copy_buffer = dispatch_table.CmdCopyBuffer;
+    functions.create_fence = dispatch_table.CreateFence;
+    functions.destroy_fence = dispatch_table.DestroyFence;
+    functions.get_fence_status = dispatch_table.GetFenceStatus;
+    functions.reset_fences = dispatch_table.ResetFences;
+    functions.queue_submit = dispatch_table.QueueSubmit;
+
+    // Shadows are only read by vertex input, so only the graphics-capable
+    // families the device was created with can consume them
+    const GWD::LayerBypassDispatch& bypass_dispatch =
+        instance_data->witch_doc.GetLayerBypassDispatch();
+    uint32_t queue_family_count = 0;
+    bypass_dispatch.getPhysicalDeviceQueueFamilyProperties(
+        physicalDevice, &queue_family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+    bypass_dispatch.getPhysicalDeviceQueueFamilyProperties(
+        physicalDevice, &queue_family_count, queue_families.data());
+    std::vector<uint32_t> graphics_queue_families;
+    for (uint32_t queue_info_index = 0;
+         queue_info_index < pCreateInfo->queueCreateInfoCount;
+         queue_info_index++) {
+      const uint32_t queue_family_index =
+          pCreateInfo->pQueueCreateInfos[queue_info_index].queueFamilyIndex;
+      if (queue_family_index < queue_family_count &&
+          (queue_families[queue_family_index].queueFlags &
+           VK_QUEUE_GRAPHICS_BIT) != 0 &&
+          std::find(graphics_queue_families.begin(),
+                    graphics_queue_families.end(),
+                    queue_family_index) == graphics_queue_families.end()) {
+        graphics_queue_families.push_back(queue_family_index);
+      }
     }
+    device_data->buffer_shadower.reset(
+        new GWD::BufferShadower(*pDevice, functions, memory_properties,
+                                graphics_queue_families));
   }
 
-  WitchDoc_inst.PostCallCreateDevice(physicalDevice, pCreateInfo, pAllocator,
-                                     pDevice);
+  if (trace_writer != nullptr) {
+    GWD::Trace::CreateDevice record = {};
+    record.device = (uint64_t)*pDevice;
+    record.physical_device = (uint64_t)physicalDevice;
+    record.max_memory_allocation_count =
+        properties.limits.maxMemoryAllocationCount;
+    record.memory_properties = memory_properties;
+    trace_writer->Write(record);
+    device_data->trace_writer = trace_writer;
+  }
+
+  DeviceData* inserted_data =
+      s_device_data.Insert(get_dispatch_key(*pDevice), std::move(device_data));
+
+  inserted_data->witch_doc.PostCallCreateDevice(physicalDevice, pCreateInfo,
+                                                pAllocator, pDevice);
 
   return result;
 }
@@ -679,89 +2252,192 @@ VKAPI_ATTR VkResult VKAPI_CALL GwdCreateDevice(
 
 VKAPI_ATTR void VKAPI_CALL
 GwdDestroyDevice(VkDevice device, const VkAllocationCallbacks* pAllocator) {
-  LocalGuard lock(s_layer_mutex);
-  s_device_dt.erase(device);
-  s_numDevices--;
+  dispatch_key device_key = get_dispatch_key(device);
+
+  PFN_vkDestroyDevice fp_DestroyDevice = nullptr;
+  DeviceData* device_data = s_device_data.Find(device_key);
+  fp_DestroyDevice = device_data->dispatch_table.DestroyDevice;
+
+  // The fix-it modes' own Vulkan objects have to go before the device does
+  device_data->buffer_shadower.reset();
+  device_data->suballocator.reset();
+
+  fp_DestroyDevice(device, pAllocator);
+
+  device_data->witch_doc.PostCallDestroyDevice(device, pAllocator);
+
+  // Covers every device, and every thread that ever called into the layer
+  GWD::InterceptProfiler& profiler = GWD::InterceptProfiler::Get();
+  if (profiler.IsEnabled()) {
+    device_data->instance_doc->PerformanceWarningMessage(
+        profiler.BuildReport());
+  }
+
+  // Other threads' partial blocks too, in case the process never exits cleanly
+  if (device_data->trace_writer != nullptr) {
+    device_data->trace_writer->Write(
+        GWD::Trace::DestroyDevice{(uint64_t)device});
+    device_data->trace_writer->Flush();
+  }
+
+  s_device_data.Erase(device_key);
+}
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+GwdGetInstanceProcAddr(VkInstance instance, const char* pName);
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+GwdGetDeviceProcAddr(VkDevice device, const char* pName);
+
+#define GWD_INTERCEPT_NAME(func) "vk" #func,
+#define GWD_INTERCEPT_PROC(func) (PFN_vkVoidFunction) & Gwd##func,
+#define GWD_INTERCEPT_COUNT(func) +1
+
+// Instance-level intercepts come first, so device-level lookups only consider
+// indices from kNumInstanceLevelIntercepts onwards.
+static constexpr const char* const kInterceptNames[] = {
+    GWD_INSTANCE_LEVEL_INTERCEPTS(GWD_INTERCEPT_NAME)
+        GWD_DEVICE_LEVEL_INTERCEPTS(GWD_INTERCEPT_NAME)};
+static const PFN_vkVoidFunction kInterceptProcs[] = {
+    GWD_INSTANCE_LEVEL_INTERCEPTS(GWD_INTERCEPT_PROC)
+        GWD_DEVICE_LEVEL_INTERCEPTS(GWD_INTERCEPT_PROC)};
+static constexpr size_t kNumInstanceLevelIntercepts =
+    0 GWD_INSTANCE_LEVEL_INTERCEPTS(GWD_INTERCEPT_COUNT);
+static constexpr size_t kNumIntercepts =
+    sizeof(kInterceptNames) / sizeof(kInterceptNames[0]);
+
+#undef GWD_INTERCEPT_COUNT
+#undef GWD_INTERCEPT_PROC
+#undef GWD_INTERCEPT_NAME
+
+// FNV-1a, usable both at compile time for the table and at runtime on pName
+static constexpr uint32_t HashProcName(const char* name) {
+  uint32_t hash = 2166136261u;
+  while (*name != '\0') {
+    hash ^= (uint8_t)*name++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Intercept name hashes, sorted at compile time, with the index of the
+// matching entry in kInterceptNames/kInterceptProcs.
+struct InterceptLookupTable {
+  uint32_t hashes[kNumIntercepts];
+  uint32_t indices[kNumIntercepts];
+};
+
+static constexpr InterceptLookupTable BuildInterceptLookupTable() {
+  InterceptLookupTable table = {};
+  for (uint32_t name_index = 0; name_index < kNumIntercepts; name_index++) {
+    const uint32_t hash = HashProcName(kInterceptNames[name_index]);
+    uint32_t insert_index = name_index;
+    while (insert_index > 0 && table.hashes[insert_index - 1] > hash) {
+      table.hashes[insert_index] = table.hashes[insert_index - 1];
+      table.indices[insert_index] = table.indices[insert_index - 1];
+      insert_index--;
+    }
+    table.hashes[insert_index] = hash;
+    table.indices[insert_index] = name_index;
+  }
+  return table;
+}
+
+static constexpr InterceptLookupTable kInterceptLookup =
+    BuildInterceptLookupTable();
+
+static constexpr bool InterceptHashesAreUnique() {
+  for (uint32_t table_index = 1; table_index < kNumIntercepts; table_index++) {
+    if (kInterceptLookup.hashes[table_index - 1] ==
+        kInterceptLookup.hashes[table_index]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// With unique hashes the table is a perfect hash, and a lookup costs one hash
+// of pName, a binary search and a single strcmp to reject unknown names.
+static_assert(InterceptHashesAreUnique(),
+              "Intercept names collide in HashProcName, pick a new hash");
+
+static PFN_vkVoidFunction FindIntercept(const char* pName,
+                                        size_t first_intercept_index) {
+  const uint32_t hash = HashProcName(pName);
+  const uint32_t* hashes_begin = kInterceptLookup.hashes;
+  const uint32_t* hashes_end = hashes_begin + kNumIntercepts;
+  const uint32_t* found = std::lower_bound(hashes_begin, hashes_end, hash);
+  if (found == hashes_end || *found != hash) {
+    return nullptr;
+  }
+
+  const uint32_t name_index = kInterceptLookup.indices[found - hashes_begin];
+  if (name_index < first_intercept_index ||
+      strcmp(kInterceptNames[name_index], pName) != 0) {
+    return nullptr;
+  }
+
+  return kInterceptProcs[name_index];
 }
 
-#define GWD_GETPROCADDR(func) \
-  if (strcmp(pName, "vk" #func) == 0) return (PFN_vkVoidFunction)&Gwd##func;
+// The functions the layer answers itself instead of forwarding down the chain
+static bool IsLayerEntryPoint(PFN_vkVoidFunction intercept) {
+  return intercept == (PFN_vkVoidFunction)&GwdGetInstanceProcAddr ||
+         intercept == (PFN_vkVoidFunction)&GwdGetDeviceProcAddr ||
+         intercept == (PFN_vkVoidFunction)&GwdCreateInstance ||
+         intercept == (PFN_vkVoidFunction)&GwdCreateDevice ||
+         intercept ==
+             (PFN_vkVoidFunction)&GwdEnumerateInstanceLayerProperties ||
+         intercept ==
+             (PFN_vkVoidFunction)&GwdEnumerateInstanceExtensionProperties ||
+         intercept == (PFN_vkVoidFunction)&GwdEnumerateDeviceLayerProperties ||
+         intercept ==
+             (PFN_vkVoidFunction)&GwdEnumerateDeviceExtensionProperties;
+}
+
+// Extension and newer core functions are only intercepted when the next layer
+// or driver provides them as well. Otherwise an application probing for an
+// extension it did not enable would get our intercept, which then calls a
+// null dispatch table entry.
+static PFN_vkVoidFunction SelectProc(PFN_vkVoidFunction intercept,
+                                     PFN_vkVoidFunction downstream) {
+  if (intercept != nullptr &&
+      (downstream != nullptr || IsLayerEntryPoint(intercept))) {
+    return intercept;
+  }
+  return downstream;
+}
 
-// GetDeviceProcAddr is declared before GetInstanceProcAddr because otherwise
-// we'd need a forward declaration of GwdGetDeviceProcAddr -_-
 VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
 GwdGetDeviceProcAddr(VkDevice device, const char* pName) {
-  // Functions available through GetInstanceProcAddr and GetDeviceProcAddr
-  GWD_GETPROCADDR(GetDeviceProcAddr);
-  GWD_GETPROCADDR(EnumerateDeviceLayerProperties);
-  GWD_GETPROCADDR(EnumerateDeviceExtensionProperties);
-  GWD_GETPROCADDR(CreateDevice);
-  GWD_GETPROCADDR(DestroyDevice);
-  GWD_GETPROCADDR(GetDeviceQueue);
-  GWD_GETPROCADDR(QueueSubmit);
-  GWD_GETPROCADDR(AllocateMemory);
-  GWD_GETPROCADDR(FreeMemory);
-  GWD_GETPROCADDR(BindBufferMemory);
-  GWD_GETPROCADDR(CreateBuffer);
-  GWD_GETPROCADDR(DestroyBuffer);
-  GWD_GETPROCADDR(BindBufferMemory2);
-  GWD_GETPROCADDR(CmdDraw);
-  GWD_GETPROCADDR(CmdDrawIndexed);
-  GWD_GETPROCADDR(CmdDrawIndirect);
-  GWD_GETPROCADDR(CmdDrawIndexedIndirect);
-  GWD_GETPROCADDR(AllocateCommandBuffers);
-  GWD_GETPROCADDR(FreeCommandBuffers);
-  GWD_GETPROCADDR(CmdBindIndexBuffer);
-  GWD_GETPROCADDR(CmdBindVertexBuffers);
-
-  {
-    LocalGuard lock(s_layer_mutex);
-    return s_device_dt[device].GetDeviceProcAddr(device, pName);
+  PFN_vkVoidFunction intercept =
+      FindIntercept(pName, kNumInstanceLevelIntercepts);
+
+  if (device == VK_NULL_HANDLE) {
+    return intercept;
   }
+  DeviceData* device_data = GetDeviceData(device);
+  if (device_data == nullptr) {
+    return intercept;
+  }
+  return SelectProc(
+      intercept, device_data->dispatch_table.GetDeviceProcAddr(device, pName));
 }
 
 VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
 GwdGetInstanceProcAddr(VkInstance instance, const char* pName) {
-  // Functions available only through GetInstanceProcAddr
-  GWD_GETPROCADDR(GetInstanceProcAddr);
-  GWD_GETPROCADDR(CreateInstance);
-  GWD_GETPROCADDR(DestroyInstance);
-  GWD_GETPROCADDR(CreateDebugUtilsMessengerEXT);
-  GWD_GETPROCADDR(DestroyDebugUtilsMessengerEXT);
-  GWD_GETPROCADDR(EnumerateInstanceLayerProperties);
-  GWD_GETPROCADDR(EnumerateInstanceExtensionProperties);
-  GWD_GETPROCADDR(EnumeratePhysicalDevices);
-
-  // Functions available through GetInstanceProcAddr and GetDeviceProcAddr
-  GWD_GETPROCADDR(GetDeviceProcAddr);
-  GWD_GETPROCADDR(EnumerateDeviceLayerProperties);
-  GWD_GETPROCADDR(EnumerateDeviceExtensionProperties);
-  GWD_GETPROCADDR(CreateDevice);
-  GWD_GETPROCADDR(DestroyDevice);
-  GWD_GETPROCADDR(GetDeviceQueue);
-  GWD_GETPROCADDR(QueueSubmit);
-  GWD_GETPROCADDR(AllocateMemory);
-  GWD_GETPROCADDR(FreeMemory);
-  GWD_GETPROCADDR(BindBufferMemory);
-  GWD_GETPROCADDR(CreateBuffer);
-  GWD_GETPROCADDR(DestroyBuffer);
-  GWD_GETPROCADDR(BindBufferMemory2);
-  GWD_GETPROCADDR(CmdDraw);
-  GWD_GETPROCADDR(CmdDrawIndexed);
-  GWD_GETPROCADDR(CmdDrawIndirect);
-  GWD_GETPROCADDR(CmdDrawIndexedIndirect);
-  GWD_GETPROCADDR(AllocateCommandBuffers);
-  GWD_GETPROCADDR(FreeCommandBuffers);
-  GWD_GETPROCADDR(CmdBindIndexBuffer);
-  GWD_GETPROCADDR(CmdBindVertexBuffers);
-
-  {
-    LocalGuard lock(s_layer_mutex);
-    return s_instance_dt[instance].GetInstanceProcAddr(instance, pName);
-  }
-}
-
-#undef GWD_GETPROCADDR
+  PFN_vkVoidFunction intercept = FindIntercept(pName, 0);
+
+  if (instance == VK_NULL_HANDLE) {
+    return intercept;
+  }
+  InstanceData* instance_data = GetInstanceData(instance);
+  if (instance_data == nullptr) {
+    return intercept;
+  }
+  return SelectProc(
+      intercept,
+      instance_data->dispatch_table.GetInstanceProcAddr(instance, pName));
+}
 
 // TODO: Not clear if we really need the __declspec for Windows
 // The linker complains about functions being exported multiple times
@@ -0,0 +1,127 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "layerSettings.h"
+
+#include <stdlib.h>
+
+namespace GWD {
+
+static bool ReadBoolSetting(const char* name, bool default_value) {
+  const char* value = getenv(name);
+  if (value == nullptr || value[0] == '\0') {
+    return default_value;
+  }
+  return (value[0] != '0' && value[0] != 'f' && value[0] != 'F' &&
+          value[0] != 'n' && value[0] != 'N');
+}
+
+static uint32_t ReadUintSetting(const char* name, uint32_t default_value) {
+  const char* value = getenv(name);
+  if (value == nullptr || value[0] == '\0') {
+    return default_value;
+  }
+  char* end = nullptr;
+  unsigned long parsed = strtoul(value, &end, 0);
+  if (end == value) {
+    return default_value;
+  }
+  return (uint32_t)parsed;
+}
+
+static std::string ReadStringSetting(const char* name,
+                                     const std::string& default_value) {
+  const char* value = getenv(name);
+  if (value == nullptr || value[0] == '\0') {
+    return default_value;
+  }
+  return value;
+}
+
+static LayerSettings ReadLayerSettings() {
+  LayerSettings settings;
+  settings.async_warnings =
+      ReadBoolSetting("GWD_ASYNC_WARNINGS", settings.async_warnings);
+  settings.warning_queue_size =
+      ReadUintSetting("GWD_WARNING_QUEUE_SIZE", settings.warning_queue_size);
+  settings.warning_summary_interval_ms =
+      ReadUintSetting("GWD_WARNING_SUMMARY_INTERVAL_MS",
+                      settings.warning_summary_interval_ms);
+  settings.warning_rate_limit =
+      ReadUintSetting("GWD_WARNING_RATE_LIMIT", settings.warning_rate_limit);
+  settings.large_linear_image_texels = ReadUintSetting(
+      "GWD_LARGE_LINEAR_IMAGE_TEXELS", settings.large_linear_image_texels);
+  settings.allocation_report =
+      ReadBoolSetting("GWD_ALLOCATION_REPORT", settings.allocation_report);
+  settings.small_allocation_size = ReadUintSetting(
+      "GWD_SMALL_ALLOCATION_SIZE", settings.small_allocation_size);
+  settings.small_allocation_rate = ReadUintSetting(
+      "GWD_SMALL_ALLOCATION_RATE", settings.small_allocation_rate);
+  settings.frame_report =
+      ReadBoolSetting("GWD_FRAME_REPORT", settings.frame_report);
+  settings.frame_spike_percent = ReadUintSetting(
+      "GWD_FRAME_SPIKE_PERCENT", settings.frame_spike_percent);
+  settings.submit_report =
+      ReadBoolSetting("GWD_SUBMIT_REPORT", settings.submit_report);
+  settings.max_submits_per_frame = ReadUintSetting(
+      "GWD_MAX_SUBMITS_PER_FRAME", settings.max_submits_per_frame);
+  settings.tiny_submit_draws =
+      ReadUintSetting("GWD_TINY_SUBMIT_DRAWS", settings.tiny_submit_draws);
+  settings.max_tiny_submits_per_frame = ReadUintSetting(
+      "GWD_MAX_TINY_SUBMITS_PER_FRAME", settings.max_tiny_submits_per_frame);
+  settings.draw_report =
+      ReadBoolSetting("GWD_DRAW_REPORT", settings.draw_report);
+  settings.tiny_draw_vertices =
+      ReadUintSetting("GWD_TINY_DRAW_VERTICES", settings.tiny_draw_vertices);
+  settings.max_tiny_draw_percent = ReadUintSetting(
+      "GWD_MAX_TINY_DRAW_PERCENT", settings.max_tiny_draw_percent);
+  settings.min_instancing_run =
+      ReadUintSetting("GWD_MIN_INSTANCING_RUN", settings.min_instancing_run);
+  settings.min_multi_draw_run =
+      ReadUintSetting("GWD_MIN_MULTI_DRAW_RUN", settings.min_multi_draw_run);
+  settings.descriptor_report =
+      ReadBoolSetting("GWD_DESCRIPTOR_REPORT", settings.descriptor_report);
+  settings.suballocate =
+      ReadBoolSetting("GWD_SUBALLOCATE", settings.suballocate);
+  settings.suballocation_threshold = ReadUintSetting(
+      "GWD_SUBALLOCATION_THRESHOLD", settings.suballocation_threshold);
+  settings.suballocation_block_size_mb = ReadUintSetting(
+      "GWD_SUBALLOCATION_BLOCK_MB", settings.suballocation_block_size_mb);
+  settings.suballocation_alignment = ReadUintSetting(
+      "GWD_SUBALLOCATION_ALIGNMENT", settings.suballocation_alignment);
+  settings.shadow_buffers =
+      ReadBoolSetting("GWD_SHADOW_BUFFERS", settings.shadow_buffers);
+  settings.shadow_stable_submits = ReadUintSetting(
+      "GWD_SHADOW_STABLE_SUBMITS", settings.shadow_stable_submits);
+  settings.profile_intercepts =
+      ReadBoolSetting("GWD_PROFILE_INTERCEPTS", settings.profile_intercepts);
+  settings.profile_report_interval_s = ReadUintSetting(
+      "GWD_PROFILE_REPORT_INTERVAL_S", settings.profile_report_interval_s);
+  settings.trace_file =
+      ReadStringSetting("GWD_TRACE_FILE", settings.trace_file);
+  return settings;
+}
+
+const LayerSettings& GetLayerSettings() {
+  static const LayerSettings s_settings = ReadLayerSettings();
+  return s_settings;
+}
+
+uint32_t GetUintSetting(const char* name, uint32_t default_value) {
+  return ReadUintSetting(name, default_value);
+}
+
+}  // namespace GWD
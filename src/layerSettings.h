@@ -0,0 +1,127 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+namespace GWD {
+
+// Runtime knobs for the layer. They are read once from the environment, the
+// first time any of them is needed, so they can be flipped per run without
+// rebuilding the layer.
+struct LayerSettings {
+  // GWD_ASYNC_WARNINGS: format and deliver warnings on a background thread
+  // instead of inside the intercepted call
+  bool async_warnings = false;
+  // GWD_WARNING_QUEUE_SIZE: capacity of the async warning ring, rounded up to
+  // a power of two. Warnings that don't fit are counted and dropped.
+  uint32_t warning_queue_size = 4096;
+  // GWD_WARNING_SUMMARY_INTERVAL_MS: how often repeat occurrences of already
+  // reported issues are summarized. 0 only summarizes at instance teardown.
+  uint32_t warning_summary_interval_ms = 10000;
+  // GWD_WARNING_RATE_LIMIT: new issues reported per second for each check,
+  // 0 for no limit. Override per check with GWD_WARNING_RATE_LIMIT_<check>,
+  // e.g. GWD_WARNING_RATE_LIMIT_VertexBufferNotDeviceLocal=5.
+  uint32_t warning_rate_limit = 20;
+  // GWD_LARGE_LINEAR_IMAGE_TEXELS: sampled or attachment images with LINEAR
+  // tiling are flagged once they have at least this many texels
+  uint32_t large_linear_image_texels = 256 * 256;
+  // GWD_ALLOCATION_REPORT: print allocation statistics when a device is
+  // destroyed
+  bool allocation_report = true;
+  // GWD_SMALL_ALLOCATION_SIZE: vkAllocateMemory calls below this many bytes
+  // count as small
+  uint32_t small_allocation_size = 1024 * 1024;
+  // GWD_SMALL_ALLOCATION_RATE: small allocations per second that are flagged
+  // as churn
+  uint32_t small_allocation_rate = 32;
+  // GWD_FRAME_REPORT: print frame pacing statistics when a device is
+  // destroyed
+  bool frame_report = true;
+  // GWD_FRAME_SPIKE_PERCENT: frames whose present interval exceeds the median
+  // by this much, in percent, are reported with their counters. 0 disables
+  // spike reports.
+  uint32_t frame_spike_percent = 200;
+  // GWD_SUBMIT_REPORT: print vkQueueSubmit statistics when a device is
+  // destroyed
+  bool submit_report = true;
+  // GWD_MAX_SUBMITS_PER_FRAME: frames with more vkQueueSubmit calls than this
+  // are flagged. 0 disables the check.
+  uint32_t max_submits_per_frame = 10;
+  // GWD_TINY_SUBMIT_DRAWS: vkQueueSubmit calls with fewer recorded draw calls
+  // than this count as tiny
+  uint32_t tiny_submit_draws = 8;
+  // GWD_MAX_TINY_SUBMITS_PER_FRAME: frames with more tiny submits than this
+  // are flagged. 0 disables the check.
+  uint32_t max_tiny_submits_per_frame = 4;
+  // GWD_DRAW_REPORT: print draw size statistics and instancing candidates
+  // when a device is destroyed
+  bool draw_report = true;
+  // GWD_TINY_DRAW_VERTICES: direct draws of fewer vertices than this, counting
+  // every instance, are tiny
+  uint32_t tiny_draw_vertices = 64;
+  // GWD_MAX_TINY_DRAW_PERCENT: frames where more than this percentage of the
+  // draws are tiny are flagged. 0 disables the check.
+  uint32_t max_tiny_draw_percent = 50;
+  // GWD_MIN_INSTANCING_RUN: runs of at least this many consecutive draws with
+  // the same state and geometry are reported as instancing candidates. 0
+  // disables the check.
+  uint32_t min_instancing_run = 4;
+  // GWD_MIN_MULTI_DRAW_RUN: runs of at least this many consecutive single
+  // indirect draws from one buffer at a fixed stride are reported as
+  // multi-draw candidates. 0 disables the check.
+  uint32_t min_multi_draw_run = 4;
+  // GWD_DESCRIPTOR_REPORT: print descriptor pool usage and descriptor set
+  // churn when a device is destroyed
+  bool descriptor_report = true;
+  // GWD_SUBALLOCATE: serve small vkAllocateMemory calls from large blocks
+  // owned by the layer, see MemorySuballocator
+  bool suballocate = false;
+  // GWD_SUBALLOCATION_THRESHOLD: allocations below this many bytes are
+  // suballocated
+  uint32_t suballocation_threshold = 1024 * 1024;
+  // GWD_SUBALLOCATION_BLOCK_MB: size of the blocks suballocations come from
+  uint32_t suballocation_block_size_mb = 64;
+  // GWD_SUBALLOCATION_ALIGNMENT: alignment of each suballocation. It has to
+  // cover the largest alignment any resource bound at offset 0 may need.
+  uint32_t suballocation_alignment = 64 * 1024;
+  // GWD_SHADOW_BUFFERS: bind DEVICE_LOCAL copies of rarely written
+  // host-visible vertex and index buffers, see BufferShadower
+  bool shadow_buffers = false;
+  // GWD_SHADOW_STABLE_SUBMITS: submits a buffer's memory must go unmapped
+  // before the buffer is shadowed
+  uint32_t shadow_stable_submits = 60;
+  // GWD_PROFILE_INTERCEPTS: time the layer's own work in every intercept
+  // apart from the downstream call, see InterceptProfiler
+  bool profile_intercepts = false;
+  // GWD_PROFILE_REPORT_INTERVAL_S: also print the overhead report every this
+  // many seconds, checked at each present. 0 only reports when a device is
+  // destroyed.
+  uint32_t profile_report_interval_s = 0;
+  // GWD_TRACE_FILE: write a binary trace of the intercepted calls to this
+  // path, see TraceWriter. Empty disables tracing.
+  std::string trace_file;
+};
+
+const LayerSettings& GetLayerSettings();
+
+// For settings whose names are only known at runtime
+uint32_t GetUintSetting(const char* name, uint32_t default_value);
+
+}  // namespace GWD
@@ -0,0 +1,299 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "memorySuballocator.h"
+#include "layerSettings.h"
+
+#include <algorithm>
+
+namespace GWD {
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+MemorySuballocator::MemorySuballocator(
+    VkDevice device, const DeviceFunctions& functions,
+    const VkPhysicalDeviceMemoryProperties& memory_properties,
+    const VkPhysicalDeviceLimits& limits)
+    : m_device(device),
+      m_functions(functions),
+      m_memory_properties(memory_properties) {
+  const LayerSettings& settings = GetLayerSettings();
+  m_threshold = settings.suballocation_threshold;
+  m_block_size = (VkDeviceSize)settings.suballocation_block_size_mb << 20;
+
+  // Every proxy must start where any resource could be bound at offset 0, and
+  // must not share a granularity page or a non-coherent atom with its
+  // neighbours. These limits are all powers of two.
+  m_alignment = std::max<VkDeviceSize>(
+      {settings.suballocation_alignment, limits.bufferImageGranularity,
+       limits.nonCoherentAtomSize, 1});
+}
+
+MemorySuballocator::~MemorySuballocator() {
+  for (auto& type_blocks : m_blocks) {
+    for (auto& block : type_blocks) {
+      if (block->map_count > 0) {
+        m_functions.unmap_memory(m_device, block->memory);
+      }
+      m_functions.free_memory(m_device, block->memory, nullptr);
+    }
+  }
+}
+
+bool MemorySuballocator::ShouldSuballocate(
+    const VkMemoryAllocateInfo* pAllocateInfo) const {
+  if (pAllocateInfo->pNext != nullptr ||
+      pAllocateInfo->allocationSize >= m_threshold ||
+      pAllocateInfo->memoryTypeIndex >= m_memory_properties.memoryTypeCount) {
+    return false;
+  }
+  // Commitment queries only make sense for a real lazily allocated object
+  const VkMemoryPropertyFlags property_flags =
+      m_memory_properties.memoryTypes[pAllocateInfo->memoryTypeIndex]
+          .propertyFlags;
+  return (property_flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) == 0;
+}
+
+bool MemorySuballocator::TakeRange(Block* block, VkDeviceSize size,
+                                   VkDeviceSize* offset) {
+  for (auto range = block->free_ranges.begin();
+       range != block->free_ranges.end(); ++range) {
+    if (range->second < size) {
+      continue;
+    }
+    *offset = range->first;
+    const VkDeviceSize remaining = range->second - size;
+    block->free_ranges.erase(range);
+    if (remaining > 0) {
+      block->free_ranges.emplace(*offset + size, remaining);
+    }
+    return true;
+  }
+  return false;
+}
+
+void MemorySuballocator::ReturnRange(Block* block, VkDeviceSize offset,
+                                     VkDeviceSize size) {
+  auto range = block->free_ranges.emplace(offset, size).first;
+
+  auto next = std::next(range);
+  if (next != block->free_ranges.end() &&
+      range->first + range->second == next->first) {
+    range->second += next->second;
+    block->free_ranges.erase(next);
+  }
+
+  if (range != block->free_ranges.begin()) {
+    auto previous = std::prev(range);
+    if (previous->first + previous->second == range->first) {
+      previous->second += range->second;
+      block->free_ranges.erase(range);
+    }
+  }
+}
+
+// Called with m_mutex held
+MemorySuballocator::Block* MemorySuballocator::NewBlock(
+    uint32_t memory_type_index) {
+  // Don't let a single block take a big bite out of a small heap
+  const uint32_t heap_index =
+      m_memory_properties.memoryTypes[memory_type_index].heapIndex;
+  VkDeviceSize block_size = std::min(
+      m_block_size, m_memory_properties.memoryHeaps[heap_index].size / 8);
+  block_size = AlignUp(std::max(block_size, m_threshold), m_alignment);
+
+  VkMemoryAllocateInfo allocate_info = {};
+  allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocate_info.allocationSize = block_size;
+  allocate_info.memoryTypeIndex = memory_type_index;
+
+  std::unique_ptr<Block> block(new Block);
+  if (m_functions.allocate_memory(m_device, &allocate_info, nullptr,
+                                  &block->memory) != VK_SUCCESS) {
+    return nullptr;
+  }
+  block->size = block_size;
+  block->free_ranges.emplace(0, block_size);
+
+  m_blocks[memory_type_index].push_back(std::move(block));
+  return m_blocks[memory_type_index].back().get();
+}
+
+// Called with m_mutex held. The last block of each type is kept around so an
+// allocate/free loop doesn't turn into a block allocate/free loop.
+void MemorySuballocator::ReleaseBlockIfUnused(uint32_t memory_type_index,
+                                              Block* block) {
+  std::vector<std::unique_ptr<Block>>& type_blocks =
+      m_blocks[memory_type_index];
+  if (block->live_suballocations > 0 || type_blocks.size() <= 1) {
+    return;
+  }
+
+  auto block_iter = std::find_if(
+      type_blocks.begin(), type_blocks.end(),
+      [block](const std::unique_ptr<Block>& entry) {
+        return entry.get() == block;
+      });
+  if (block->map_count > 0) {
+    m_functions.unmap_memory(m_device, block->memory);
+  }
+  m_functions.free_memory(m_device, block->memory, nullptr);
+  type_blocks.erase(block_iter);
+}
+
+VkResult MemorySuballocator::Allocate(const VkMemoryAllocateInfo* pAllocateInfo,
+                                      VkDeviceMemory* pMemory) {
+  const uint32_t memory_type_index = pAllocateInfo->memoryTypeIndex;
+  const VkDeviceSize size =
+      AlignUp(std::max<VkDeviceSize>(pAllocateInfo->allocationSize, 1),
+              m_alignment);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  Block* block = nullptr;
+  VkDeviceSize offset = 0;
+  for (auto& candidate : m_blocks[memory_type_index]) {
+    if (TakeRange(candidate.get(), size, &offset)) {
+      block = candidate.get();
+      break;
+    }
+  }
+  if (block == nullptr) {
+    block = NewBlock(memory_type_index);
+    if (block == nullptr || !TakeRange(block, size, &offset)) {
+      return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+  }
+  block->live_suballocations++;
+
+  std::unique_ptr<Suballocation> suballocation(new Suballocation);
+  suballocation->block = block;
+  suballocation->memory_type_index = memory_type_index;
+  suballocation->offset = offset;
+  suballocation->size = size;
+
+  // The record's address doubles as the proxy handle
+  const VkDeviceMemory proxy =
+      (VkDeviceMemory)(uintptr_t)suballocation.get();
+  m_suballocations.Insert(proxy, std::move(suballocation));
+  *pMemory = proxy;
+
+  return VK_SUCCESS;
+}
+
+bool MemorySuballocator::Free(VkDeviceMemory memory) {
+  Suballocation* suballocation = m_suballocations.Find(memory);
+  if (suballocation == nullptr) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  Block* block = suballocation->block;
+  if (suballocation->mapped && --block->map_count == 0) {
+    m_functions.unmap_memory(m_device, block->memory);
+    block->mapped_data = nullptr;
+  }
+  ReturnRange(block, suballocation->offset, suballocation->size);
+  block->live_suballocations--;
+
+  const uint32_t memory_type_index = suballocation->memory_type_index;
+  m_suballocations.Erase(memory);
+  ReleaseBlockIfUnused(memory_type_index, block);
+
+  return true;
+}
+
+bool MemorySuballocator::Resolve(VkDeviceMemory memory,
+                                 Location* location) const {
+  const Suballocation* suballocation = m_suballocations.Find(memory);
+  if (suballocation == nullptr) {
+    return false;
+  }
+  location->memory = suballocation->block->memory;
+  location->offset = suballocation->offset;
+  location->size = suballocation->size;
+  return true;
+}
+
+VkResult MemorySuballocator::Map(VkDeviceMemory memory, VkDeviceSize offset,
+                                 VkDeviceSize size, void** ppData) {
+  Suballocation* suballocation = m_suballocations.Find(memory);
+  if (suballocation == nullptr) {
+    return VK_ERROR_MEMORY_MAP_FAILED;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (suballocation->mapped) {
+    return VK_ERROR_MEMORY_MAP_FAILED;
+  }
+
+  Block* block = suballocation->block;
+  if (block->map_count == 0) {
+    void* mapped_data = nullptr;
+    const VkResult result = m_functions.map_memory(
+        m_device, block->memory, 0, VK_WHOLE_SIZE, 0, &mapped_data);
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+    block->mapped_data = (char*)mapped_data;
+  }
+  block->map_count++;
+  suballocation->mapped = true;
+
+  *ppData = block->mapped_data + suballocation->offset + offset;
+  return VK_SUCCESS;
+}
+
+void MemorySuballocator::Unmap(VkDeviceMemory memory) {
+  Suballocation* suballocation = m_suballocations.Find(memory);
+  if (suballocation == nullptr) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (!suballocation->mapped) {
+    return;
+  }
+  suballocation->mapped = false;
+
+  Block* block = suballocation->block;
+  if (--block->map_count == 0) {
+    m_functions.unmap_memory(m_device, block->memory);
+    block->mapped_data = nullptr;
+  }
+}
+
+bool MemorySuballocator::TranslateRange(VkMappedMemoryRange* range) const {
+  Location location;
+  if (!Resolve(range->memory, &location)) {
+    return false;
+  }
+  // The proxy's size is a multiple of nonCoherentAtomSize, so the whole-size
+  // range still ends on an atom boundary.
+  if (range->size == VK_WHOLE_SIZE) {
+    range->size = location.size - range->offset;
+  }
+  range->memory = location.memory;
+  range->offset += location.offset;
+  return true;
+}
+
+}  // namespace GWD
@@ -0,0 +1,123 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "concurrentMap.h"
+
+namespace GWD {
+
+// Opt-in fix-it mode (GWD_SUBALLOCATE) that serves small vkAllocateMemory
+// calls from large per-memory-type blocks owned by the layer, to measure what
+// suballocation would buy a title without changing its code.
+//
+// The application gets a proxy VkDeviceMemory, which is really the address of
+// the layer's Suballocation record. Every entry point that takes a
+// VkDeviceMemory has to go through Resolve() before it reaches the driver.
+// Only allocations without a pNext chain are suballocated, so dedicated,
+// exported and device-address allocations never become proxies.
+class MemorySuballocator {
+ public:
+  struct DeviceFunctions {
+    PFN_vkAllocateMemory allocate_memory;
+    PFN_vkFreeMemory free_memory;
+    PFN_vkMapMemory map_memory;
+    PFN_vkUnmapMemory unmap_memory;
+  };
+
+  // Where a proxy allocation really lives
+  struct Location {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+  };
+
+  MemorySuballocator(VkDevice device, const DeviceFunctions& functions,
+                     const VkPhysicalDeviceMemoryProperties& memory_properties,
+                     const VkPhysicalDeviceLimits& limits);
+  // Releases the blocks, so this must run before the device is destroyed
+  ~MemorySuballocator();
+
+  MemorySuballocator(const MemorySuballocator&) = delete;
+  MemorySuballocator& operator=(const MemorySuballocator&) = delete;
+
+  bool ShouldSuballocate(const VkMemoryAllocateInfo* pAllocateInfo) const;
+
+  VkResult Allocate(const VkMemoryAllocateInfo* pAllocateInfo,
+                    VkDeviceMemory* pMemory);
+  // Returns false if memory isn't a proxy
+  bool Free(VkDeviceMemory memory);
+
+  // Lock-free. Returns false if memory isn't a proxy.
+  bool Resolve(VkDeviceMemory memory, Location* location) const;
+
+  // Blocks are mapped whole on first use and shared by their proxies
+  VkResult Map(VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize size,
+               void** ppData);
+  void Unmap(VkDeviceMemory memory);
+
+  // Rewrites a flush/invalidate range onto its block. Returns false if the
+  // range's memory isn't a proxy.
+  bool TranslateRange(VkMappedMemoryRange* range) const;
+
+ private:
+  struct Block {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    // Offset to size, coalesced on free
+    std::map<VkDeviceSize, VkDeviceSize> free_ranges;
+    uint32_t live_suballocations = 0;
+    uint32_t map_count = 0;
+    char* mapped_data = nullptr;
+  };
+
+  struct Suballocation {
+    Block* block = nullptr;
+    uint32_t memory_type_index = 0;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    bool mapped = false;
+  };
+
+  static bool TakeRange(Block* block, VkDeviceSize size, VkDeviceSize* offset);
+  static void ReturnRange(Block* block, VkDeviceSize offset, VkDeviceSize size);
+
+  Block* NewBlock(uint32_t memory_type_index);
+  void ReleaseBlockIfUnused(uint32_t memory_type_index, Block* block);
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  DeviceFunctions m_functions = {};
+  VkPhysicalDeviceMemoryProperties m_memory_properties = {};
+
+  VkDeviceSize m_threshold = 0;
+  VkDeviceSize m_block_size = 0;
+  VkDeviceSize m_alignment = 0;
+
+  std::mutex m_mutex;
+  std::array<std::vector<std::unique_ptr<Block>>, VK_MAX_MEMORY_TYPES>
+      m_blocks;
+
+  ConcurrentMap<VkDeviceMemory, Suballocation> m_suballocations;
+};
+
+}  // namespace GWD
@@ -0,0 +1,450 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "perfWarnings.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include "handleHash.h"
+#include "layerSettings.h"
+
+namespace GWD {
+
+// Indexed by PerfCheck
+static constexpr const char* const kPerfCheckNames[] = {
+    "IndexBufferNotDeviceLocal",
+    "VertexBufferNotDeviceLocal",
+    "AttachmentNotDeviceLocal",
+    "SampledImageNotDeviceLocal",
+    "ImageInHostVisibleMemory",
+    "TransientAttachmentNotLazilyAllocated",
+    "LargeLinearImage",
+    "SmallAllocationChurn",
+    "AllocationCountNearLimit",
+    "ManySubmitsPerFrame",
+    "ManyTinySubmits",
+    "RedundantBind",
+    "IndexBufferCouldBe16Bit",
+    "InstancingCandidate",
+    "ManyTinyDraws",
+    "IndirectBufferNotDeviceLocal",
+    "MultiDrawCandidate",
+    "ComputeBufferNotDeviceLocal",
+};
+static_assert(sizeof(kPerfCheckNames) / sizeof(kPerfCheckNames[0]) ==
+                  (size_t)PerfCheck::kCount,
+              "Every PerfCheck needs a name");
+
+// Indexed by PerfCheck, and prefixed with the entry point when formatted
+static constexpr const char* const kPerfCheckMessages[] = {
+    "is using index buffer that is not DEVICE_LOCAL",
+    "is using vertex buffers that are not DEVICE_LOCAL",
+    "is binding a render target or depth buffer to memory that is not "
+    "DEVICE_LOCAL",
+    "is binding a sampled image to memory that is not DEVICE_LOCAL",
+    "is binding an attachment or sampled image to HOST_VISIBLE memory while "
+    "the device has DEVICE_LOCAL memory that isn't",
+    "is binding a transient attachment to memory that is not "
+    "LAZILY_ALLOCATED",
+    "is creating a large sampled or attachment image with LINEAR tiling",
+    "is being called for many small allocations per second, suballocate them "
+    "from larger blocks instead",
+    "has brought the number of live allocations close to "
+    "maxMemoryAllocationCount",
+    "is being called many times per frame, batch command buffers into fewer "
+    "submits",
+    "is being called many times per frame with only a few draws each time, "
+    "merge the small submits",
+    "is re-binding state that is already bound in this command buffer",
+    "is drawing with 32-bit indices from an index buffer with no more indices "
+    "than 16 bits can address. 16-bit indices rebased with vertexOffset may "
+    "do if each mesh spans fewer than 65536 vertices",
+    "is recording runs of draws with the same state and geometry that one "
+    "instanced draw could replace",
+    "is presenting frames where most draws are tiny, so draw call overhead "
+    "dominates",
+    "is reading indirect draw parameters from a buffer that is not in "
+    "DEVICE_LOCAL memory",
+    "is recording runs of single indirect draws at a fixed stride that one "
+    "call with a larger drawCount could replace",
+    "is dispatching compute work that reads a storage or uniform buffer that "
+    "is not in DEVICE_LOCAL memory",
+};
+static_assert(sizeof(kPerfCheckMessages) / sizeof(kPerfCheckMessages[0]) ==
+                  (size_t)PerfCheck::kCount,
+              "Every PerfCheck needs a message");
+
+const char* GetPerfCheckName(PerfCheck check) {
+  return kPerfCheckNames[(size_t)check];
+}
+
+std::string FormatWarning(const WarningEvent& event) {
+  std::stringstream message;
+  message << event.entry_point << " "
+          << kPerfCheckMessages[(size_t)event.check];
+  if (event.object != 0) {
+    message << " (0x" << std::hex << std::setfill('0') << std::setw(16)
+            << event.object << ")";
+  }
+  return message.str();
+}
+
+size_t WarningAggregator::IssueKeyHash::operator()(const IssueKey& key) const {
+  uint64_t hash = key.object ^ ((uint64_t)(uintptr_t)key.entry_point << 7) ^
+                  (uint64_t)key.check;
+  return (size_t)MixHandleBits(hash);
+}
+
+WarningAggregator::WarningAggregator(uint32_t summary_interval_ms,
+                                     uint32_t default_rate_limit)
+    : m_summary_interval(std::chrono::milliseconds(summary_interval_ms)) {
+  const Clock::time_point now = Clock::now();
+  for (size_t check_index = 0; check_index < m_rate_limiters.size();
+       check_index++) {
+    const std::string setting_name =
+        std::string("GWD_WARNING_RATE_LIMIT_") +
+        GetPerfCheckName((PerfCheck)check_index);
+    m_rate_limiters[check_index].limit =
+        GetUintSetting(setting_name.c_str(), default_rate_limit);
+    m_rate_limiters[check_index].window_start = now;
+  }
+
+  // An interval of 0 means only the final summary is wanted
+  const int64_t first_summary_ticks =
+      summary_interval_ms == 0 ? INT64_MAX
+                               : (now + m_summary_interval)
+                                     .time_since_epoch()
+                                     .count();
+  m_next_summary_ticks.store(first_summary_ticks);
+}
+
+uintptr_t WarningAggregator::GetIssueIndex(const IssueKey& key) {
+  // ConcurrentMap reserves the two lowest keys
+  const uintptr_t index = (uintptr_t)IssueKeyHash()(key);
+  return index > 1 ? index : index + 2;
+}
+
+WarningAggregator::Shard& WarningAggregator::GetShard(const IssueKey& key) {
+  return m_shards[(IssueKeyHash()(key) >> 8) % kShardCount];
+}
+
+// Frames only move forward, so the store is skipped unless a new frame began
+static void MarkSeen(std::atomic<uint64_t>& last_seen_frame, uint64_t frame) {
+  if (last_seen_frame.load(std::memory_order_relaxed) < frame) {
+    last_seen_frame.store(frame, std::memory_order_relaxed);
+  }
+}
+
+bool WarningAggregator::CountRepeat(Shard& shard, const IssueKey& key,
+                                    uint64_t frame) {
+  bool counted = false;
+  shard.issues.Apply(GetIssueIndex(key), [&](IssueStats& stats) {
+    if (stats.key == key) {
+      stats.count.fetch_add(1, std::memory_order_relaxed);
+      MarkSeen(stats.last_seen_frame, frame);
+      counted = true;
+    }
+  });
+  return counted;
+}
+
+WarningAggregator::InsertResult WarningAggregator::InsertIssue(
+    Shard& shard, const IssueKey& key, uint64_t frame) {
+  const uintptr_t index = GetIssueIndex(key);
+  // Only lock holders remove issues, so the pointer stays valid
+  IssueStats* stats = shard.issues.Find(index);
+  if (stats != nullptr) {
+    if (!(stats->key == key)) {
+      return InsertResult::kNoRoom;
+    }
+    // Inserted by another thread since the caller looked
+    stats->count.fetch_add(1, std::memory_order_relaxed);
+    MarkSeen(stats->last_seen_frame, frame);
+    return InsertResult::kAlreadySeen;
+  }
+  // Issues without a handle are few, so there is always room for them
+  if (key.object != 0 && !MakeRoom(shard)) {
+    return InsertResult::kNoRoom;
+  }
+
+  std::unique_ptr<IssueStats> new_stats(new IssueStats);
+  new_stats->key = key;
+  new_stats->count.store(1, std::memory_order_relaxed);
+  new_stats->last_seen_frame.store(frame, std::memory_order_relaxed);
+  new_stats->summarized_count = 1;
+  new_stats->first_seen_frame = frame;
+  shard.issues.Insert(index, std::move(new_stats));
+  return InsertResult::kInserted;
+}
+
+bool WarningAggregator::MakeRoom(Shard& shard) {
+  if (shard.issues.Size() < kMaxIssuesPerShard) {
+    return true;
+  }
+  // Only a summary makes more issues evictable, no point scanning again
+  if (shard.full) {
+    return false;
+  }
+  // Issues without unsummarized occurrences lose nothing but their history
+  shard.issues.RetireIf([](const IssueStats& stats) {
+    return stats.count.load(std::memory_order_relaxed) ==
+           stats.summarized_count;
+  });
+  shard.full = shard.issues.Size() >= kMaxIssuesPerShard;
+  return !shard.full;
+}
+
+bool WarningAggregator::Record(const WarningEvent& event) {
+  IssueKey key = {event.check, event.entry_point, event.object};
+  Shard* shard = &GetShard(key);
+  if (CountRepeat(*shard, key, event.frame)) {
+    return false;
+  }
+
+  InsertResult result;
+  {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    result = InsertIssue(*shard, key, event.frame);
+  }
+  if (result == InsertResult::kNoRoom && key.object != 0) {
+    key.object = 0;
+    shard = &GetShard(key);
+    if (CountRepeat(*shard, key, event.frame)) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    result = InsertIssue(*shard, key, event.frame);
+  }
+  if (result == InsertResult::kAlreadySeen) {
+    return false;
+  }
+  // Left with a hash collision between two issues without a handle, which
+  // is too unlikely to be worth aggregating
+  if (result == InsertResult::kNoRoom) {
+    return true;
+  }
+
+  if (ConsumeRateLimit(event.check, Clock::now())) {
+    return true;
+  }
+
+  // Let the summary mention it, including the first occurrence
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  IssueStats* stats = shard->issues.Find(GetIssueIndex(key));
+  if (stats != nullptr && stats->key == key) {
+    stats->rate_limited = true;
+    stats->summarized_count = 0;
+  }
+  return false;
+}
+
+bool WarningAggregator::ConsumeRateLimit(PerfCheck check,
+                                         Clock::time_point now) {
+  RateLimiter& limiter = m_rate_limiters[(size_t)check];
+  if (limiter.limit == 0) {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(limiter.mutex);
+  if (now - limiter.window_start >= std::chrono::seconds(1)) {
+    limiter.window_start = now;
+    limiter.reported_in_window = 0;
+  }
+  if (limiter.reported_in_window >= limiter.limit) {
+    return false;
+  }
+  limiter.reported_in_window++;
+  return true;
+}
+
+bool WarningAggregator::ClaimSummary() {
+  int64_t next_summary_ticks =
+      m_next_summary_ticks.load(std::memory_order_relaxed);
+  const Clock::time_point now = Clock::now();
+  if (now.time_since_epoch().count() < next_summary_ticks) {
+    return false;
+  }
+  return m_next_summary_ticks.compare_exchange_strong(
+      next_summary_ticks,
+      (now + m_summary_interval).time_since_epoch().count(),
+      std::memory_order_relaxed);
+}
+
+// 41203 -> "41,203"
+static std::string FormatCount(uint64_t count) {
+  std::string digits = std::to_string(count);
+  for (size_t group_end = digits.size(); group_end > 3; group_end -= 3) {
+    digits.insert(group_end - 3, ",");
+  }
+  return digits;
+}
+
+std::string WarningAggregator::BuildSummary() {
+  std::stringstream summary;
+  uint64_t issue_count = 0;
+
+  for (Shard& shard : m_shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.full = false;
+    shard.issues.ForEach([&](IssueStats& stats) {
+      const uint64_t count = stats.count.load(std::memory_order_relaxed);
+      if (count == stats.summarized_count) {
+        stats.idle_summaries++;
+        return;
+      }
+
+      const WarningEvent event = {stats.key.check, stats.key.entry_point,
+                                  stats.key.object, stats.first_seen_frame};
+      // Issues folded across devices may mix their frame counts
+      const uint64_t last_seen_frame = std::max(
+          stats.last_seen_frame.load(std::memory_order_relaxed),
+          stats.first_seen_frame);
+      const uint64_t frame_span = last_seen_frame - stats.first_seen_frame + 1;
+      summary << "\n  " << FormatWarning(event) << ": seen "
+              << FormatCount(count) << " times over " << FormatCount(frame_span)
+              << (frame_span == 1 ? " frame" : " frames");
+      if (stats.rate_limited) {
+        summary << " (first report suppressed by rate limit)";
+        stats.rate_limited = false;
+      }
+      stats.summarized_count = count;
+      stats.idle_summaries = 0;
+      issue_count++;
+    });
+    shard.issues.RetireIf([](const IssueStats& stats) {
+      return stats.idle_summaries >= kIdleSummariesBeforeEviction &&
+             stats.count.load(std::memory_order_relaxed) ==
+                 stats.summarized_count;
+    });
+  }
+
+  if (issue_count == 0) {
+    return std::string();
+  }
+  return "WitchDoctor warning summary, " + std::to_string(issue_count) +
+         " repeated issue(s):" + summary.str();
+}
+
+// How long the delivery thread sleeps when the ring is empty. Producers never
+// signal, so this bounds the delivery latency.
+static constexpr std::chrono::milliseconds kDeliveryInterval(5);
+
+AsyncWarningQueue::AsyncWarningQueue(uint32_t capacity,
+                                     DeliverFunction deliver,
+                                     OverflowFunction report_overflow,
+                                     PeriodicFunction periodic)
+    : m_deliver(std::move(deliver)),
+      m_report_overflow(std::move(report_overflow)),
+      m_periodic(std::move(periodic)) {
+  uint64_t ring_size = 2;
+  while (ring_size < capacity) {
+    ring_size *= 2;
+  }
+  m_mask = ring_size - 1;
+
+  m_cells.reset(new Cell[ring_size]);
+  for (uint64_t cell_index = 0; cell_index < ring_size; cell_index++) {
+    m_cells[cell_index].sequence.store(cell_index, std::memory_order_relaxed);
+  }
+
+  m_delivery_thread = std::thread(&AsyncWarningQueue::DeliveryThread, this);
+}
+
+AsyncWarningQueue::~AsyncWarningQueue() {
+  {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_shutting_down = true;
+  }
+  m_wake_condition.notify_one();
+  m_delivery_thread.join();
+
+  // Anything pushed while the thread was exiting
+  DrainAndReportOverflow();
+}
+
+// Each cell's sequence tells producers and the consumer whose turn it is: a
+// producer may fill the cell when sequence == position, and the consumer may
+// read it when sequence == position + 1.
+void AsyncWarningQueue::Push(const WarningEvent& event) {
+  uint64_t position = m_enqueue_position.load(std::memory_order_relaxed);
+  Cell* cell = nullptr;
+  for (;;) {
+    cell = &m_cells[position & m_mask];
+    const uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+    const int64_t distance = (int64_t)(sequence - position);
+    if (distance == 0) {
+      if (m_enqueue_position.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (distance < 0) {
+      // Full, the consumer hasn't caught up with this lap yet
+      m_dropped_count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      position = m_enqueue_position.load(std::memory_order_relaxed);
+    }
+  }
+
+  cell->event = event;
+  cell->sequence.store(position + 1, std::memory_order_release);
+}
+
+bool AsyncWarningQueue::TryPop(WarningEvent* event) {
+  Cell& cell = m_cells[m_dequeue_position & m_mask];
+  const uint64_t sequence = cell.sequence.load(std::memory_order_acquire);
+  if (sequence != m_dequeue_position + 1) {
+    return false;
+  }
+
+  *event = cell.event;
+  cell.sequence.store(m_dequeue_position + m_mask + 1,
+                      std::memory_order_release);
+  m_dequeue_position++;
+  return true;
+}
+
+void AsyncWarningQueue::DrainAndReportOverflow() {
+  WarningEvent event;
+  while (TryPop(&event)) {
+    m_deliver(event);
+  }
+
+  const uint64_t dropped_count = GetDroppedCount();
+  if (dropped_count != m_reported_dropped_count) {
+    m_report_overflow(dropped_count);
+    m_reported_dropped_count = dropped_count;
+  }
+}
+
+void AsyncWarningQueue::DeliveryThread() {
+  std::unique_lock<std::mutex> lock(m_wake_mutex);
+  while (!m_shutting_down) {
+    lock.unlock();
+    DrainAndReportOverflow();
+    if (m_periodic) {
+      m_periodic();
+    }
+    lock.lock();
+
+    m_wake_condition.wait_for(lock, kDeliveryInterval,
+                              [this]() { return m_shutting_down; });
+  }
+}
+
+}  // namespace GWD
@@ -0,0 +1,233 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "concurrentMap.h"
+
+namespace GWD {
+
+// Every performance check the layer can report. Warnings are carried around as
+// a check ID plus a few raw values and only turned into text at delivery time,
+// so raising one from a hot intercept costs a handful of stores.
+enum class PerfCheck : uint32_t {
+  kIndexBufferNotDeviceLocal,
+  kVertexBufferNotDeviceLocal,
+  kAttachmentNotDeviceLocal,
+  kSampledImageNotDeviceLocal,
+  kImageInHostVisibleMemory,
+  kTransientAttachmentNotLazilyAllocated,
+  kLargeLinearImage,
+  kSmallAllocationChurn,
+  kAllocationCountNearLimit,
+  kManySubmitsPerFrame,
+  kManyTinySubmits,
+  kRedundantBind,
+  kIndexBufferCouldBe16Bit,
+  kInstancingCandidate,
+  kManyTinyDraws,
+  kIndirectBufferNotDeviceLocal,
+  kMultiDrawCandidate,
+  kComputeBufferNotDeviceLocal,
+  kCount
+};
+
+struct WarningEvent {
+  PerfCheck check;
+  // The Vulkan entry point that triggered the check. Must be a string literal
+  // since it outlives the call.
+  const char* entry_point;
+  // The offending handle (VkBuffer, VkDeviceMemory...), or 0 if there is none.
+  uint64_t object;
+  // Frames the reporting device had presented when the check fired
+  uint64_t frame;
+};
+
+const char* GetPerfCheckName(PerfCheck check);
+std::string FormatWarning(const WarningEvent& event);
+
+// Collapses repeats of the same issue, i.e. the same check raised by the same
+// entry point on the same handle. The first occurrence is reported right away
+// (unless its check is over its rate limit), later ones are only counted and
+// show up in periodic summaries. Counting a repeat takes no lock.
+//
+// Issues that have gone quiet for a few summaries are forgotten, so a
+// recurrence is reported as new. Should transient handles still fill a shard,
+// summarized issues are evicted early and, failing that, further handles are
+// folded into one issue per check and entry point.
+class WarningAggregator {
+ public:
+  WarningAggregator(uint32_t summary_interval_ms, uint32_t default_rate_limit);
+
+  WarningAggregator(const WarningAggregator&) = delete;
+  WarningAggregator& operator=(const WarningAggregator&) = delete;
+
+  // Returns true if the event should be delivered now
+  bool Record(const WarningEvent& event);
+
+  // True once per summary interval; the caller that gets true should emit the
+  // summary.
+  bool ClaimSummary();
+
+  // Summary of every issue that was seen again since the last summary, or an
+  // empty string if there is nothing new.
+  std::string BuildSummary();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct IssueKey {
+    PerfCheck check;
+    const char* entry_point;
+    uint64_t object;
+
+    bool operator==(const IssueKey& other) const {
+      return check == other.check && entry_point == other.entry_point &&
+             object == other.object;
+    }
+  };
+
+  struct IssueKeyHash {
+    size_t operator()(const IssueKey& key) const;
+  };
+
+  // Repeats only touch count and last_seen_frame. The rest is written with
+  // the shard's lock held.
+  struct IssueStats {
+    IssueKey key;
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> last_seen_frame{0};
+    uint64_t summarized_count = 0;
+    uint64_t first_seen_frame = 0;
+    bool rate_limited = false;
+    // Summaries in a row the issue had nothing new for
+    uint32_t idle_summaries = 0;
+  };
+
+  // Sharded by key hash so that inserting issues on different threads rarely
+  // shares a lock. Within a shard, issues are looked up by the full key hash;
+  // a handle whose hash collides with another issue's is treated like one
+  // that found the shard full. Each shard is padded out to its own cache line.
+  static constexpr size_t kShardCount = 16;
+  static constexpr size_t kMaxIssuesPerShard = 4096;
+  static constexpr uint32_t kIdleSummariesBeforeEviction = 6;
+  struct Shard {
+    // Taken to insert, evict and summarize issues
+    std::mutex mutex;
+    ConcurrentMap<uintptr_t, IssueStats> issues;
+    // Set when MakeRoom() found nothing to evict, until the next summary
+    bool full = false;
+    char cache_line_padding[64];
+  };
+
+  enum class InsertResult { kInserted, kAlreadySeen, kNoRoom };
+
+  static uintptr_t GetIssueIndex(const IssueKey& key);
+  Shard& GetShard(const IssueKey& key);
+  // Counts a repeat of an issue that is already known, without locking
+  static bool CountRepeat(Shard& shard, const IssueKey& key, uint64_t frame);
+  // Called with the shard's lock held
+  static InsertResult InsertIssue(Shard& shard, const IssueKey& key,
+                                  uint64_t frame);
+  // Called with the shard's lock held. Makes room for a new issue if the
+  // shard is full, and returns false if there is none to be had.
+  static bool MakeRoom(Shard& shard);
+
+  // Only consulted for issues seen for the first time, so a lock is fine
+  struct RateLimiter {
+    std::mutex mutex;
+    uint32_t limit = 0;
+    Clock::time_point window_start;
+    uint32_t reported_in_window = 0;
+  };
+
+  bool ConsumeRateLimit(PerfCheck check, Clock::time_point now);
+
+  std::array<Shard, kShardCount> m_shards;
+  std::array<RateLimiter, (size_t)PerfCheck::kCount> m_rate_limiters;
+
+  const Clock::duration m_summary_interval;
+  std::atomic<int64_t> m_next_summary_ticks;
+};
+
+// Bounded multi-producer, single-consumer ring of warning events, drained by a
+// background thread that formats and delivers them. Push() never blocks: when
+// the ring is full, the event is counted as dropped and discarded.
+class AsyncWarningQueue {
+ public:
+  using DeliverFunction = std::function<void(const WarningEvent& event)>;
+  using OverflowFunction = std::function<void(uint64_t dropped_count)>;
+  // Called on the delivery thread each time it wakes up
+  using PeriodicFunction = std::function<void()>;
+
+  AsyncWarningQueue(uint32_t capacity, DeliverFunction deliver,
+                    OverflowFunction report_overflow,
+                    PeriodicFunction periodic);
+  ~AsyncWarningQueue();
+
+  AsyncWarningQueue(const AsyncWarningQueue&) = delete;
+  AsyncWarningQueue& operator=(const AsyncWarningQueue&) = delete;
+
+  void Push(const WarningEvent& event);
+
+  uint64_t GetDroppedCount() const {
+    return m_dropped_count.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Cell {
+    std::atomic<uint64_t> sequence;
+    WarningEvent event;
+  };
+
+  bool TryPop(WarningEvent* event);
+  void DeliveryThread();
+  void DrainAndReportOverflow();
+
+  std::unique_ptr<Cell[]> m_cells;
+  uint64_t m_mask = 0;
+
+  // Keep the producers' and the consumer's positions on separate cache lines
+  std::atomic<uint64_t> m_enqueue_position{0};
+  char m_cache_line_padding[64];
+  uint64_t m_dequeue_position = 0;
+
+  std::atomic<uint64_t> m_dropped_count{0};
+  uint64_t m_reported_dropped_count = 0;
+
+  DeliverFunction m_deliver;
+  OverflowFunction m_report_overflow;
+  PeriodicFunction m_periodic;
+
+  std::mutex m_wake_mutex;
+  std::condition_variable m_wake_condition;
+  bool m_shutting_down = false;
+  std::thread m_delivery_thread;
+};
+
+}  // namespace GWD
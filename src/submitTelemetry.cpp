@@ -0,0 +1,111 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "submitTelemetry.h"
+#include "layerSettings.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace GWD {
+
+SubmitTelemetry::SubmitTelemetry()
+    : m_max_submits_per_frame(GetLayerSettings().max_submits_per_frame),
+      m_tiny_submit_draws(GetLayerSettings().tiny_submit_draws),
+      m_max_tiny_submits_per_frame(
+          GetLayerSettings().max_tiny_submits_per_frame) {}
+
+void SubmitTelemetry::RecordSubmit(uint32_t submit_info_count,
+                                   uint32_t command_buffer_count,
+                                   uint64_t draw_count) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (Totals* totals : {&m_totals, &m_frame}) {
+    totals->submit_count++;
+    totals->submit_info_count += submit_info_count;
+    totals->command_buffer_count += command_buffer_count;
+    totals->draw_count += draw_count;
+    // Uploads and compute without any draws are tiny as well, as far as the
+    // per-submit cost goes
+    if (draw_count < m_tiny_submit_draws) {
+      totals->tiny_submit_count++;
+    }
+  }
+  m_peak_command_buffers_per_submit = std::max(
+      m_peak_command_buffers_per_submit, (uint64_t)command_buffer_count);
+  m_peak_draws_per_submit = std::max(m_peak_draws_per_submit, draw_count);
+}
+
+SubmitTelemetry::Alerts SubmitTelemetry::RecordPresent() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Alerts alerts;
+  if (m_max_submits_per_frame != 0 &&
+      m_frame.submit_count > m_max_submits_per_frame) {
+    alerts.many_submits = true;
+    m_frames_over_submit_limit++;
+  }
+  if (m_max_tiny_submits_per_frame != 0 &&
+      m_frame.tiny_submit_count > m_max_tiny_submits_per_frame) {
+    alerts.many_tiny_submits = true;
+    m_frames_over_tiny_submit_limit++;
+  }
+  m_peak_submits_per_frame =
+      std::max(m_peak_submits_per_frame, m_frame.submit_count);
+  m_frame_count++;
+  m_frame = Totals();
+  return alerts;
+}
+
+std::string SubmitTelemetry::BuildReport() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::stringstream report;
+  report << "WitchDoctor submit report: " << m_totals.submit_count
+         << " vkQueueSubmit calls with " << m_totals.submit_info_count
+         << " VkSubmitInfos, " << m_totals.command_buffer_count
+         << " command buffers and " << m_totals.draw_count << " draw calls";
+  if (m_totals.submit_count == 0) {
+    return report.str();
+  }
+
+  const double submit_count = (double)m_totals.submit_count;
+  report << std::fixed << std::setprecision(1);
+  report << "\n  per submit: " << m_totals.command_buffer_count / submit_count
+         << " command buffers avg, " << m_peak_command_buffers_per_submit
+         << " peak; " << m_totals.draw_count / submit_count
+         << " draw calls avg, " << m_peak_draws_per_submit << " peak";
+  report << "\n  " << m_totals.tiny_submit_count << " submits with fewer than "
+         << m_tiny_submit_draws << " draw calls";
+
+  if (m_frame_count > 0) {
+    const double frame_count = (double)m_frame_count;
+    report << "\n  per frame: " << m_totals.submit_count / frame_count
+           << " submits avg, " << m_peak_submits_per_frame << " peak; "
+           << m_totals.submit_info_count / frame_count
+           << " VkSubmitInfos avg; "
+           << m_totals.command_buffer_count / frame_count
+           << " command buffers avg";
+    report << "\n  " << m_frames_over_submit_limit << " of " << m_frame_count
+           << " frames with more than " << m_max_submits_per_frame
+           << " submits, " << m_frames_over_tiny_submit_limit
+           << " with more than " << m_max_tiny_submits_per_frame
+           << " tiny submits";
+  }
+
+  return report.str();
+}
+
+}  // namespace GWD
@@ -0,0 +1,73 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+
+namespace GWD {
+
+// Per-device vkQueueSubmit statistics: VkSubmitInfos, command buffers and
+// recorded draw calls per call and per frame. Submits are counted in tens per
+// frame, so everything sits behind a single lock.
+class SubmitTelemetry {
+ public:
+  // What a frame tripped over, for the caller to report
+  struct Alerts {
+    bool many_submits = false;
+    bool many_tiny_submits = false;
+  };
+
+  SubmitTelemetry();
+
+  void RecordSubmit(uint32_t submit_info_count, uint32_t command_buffer_count,
+                    uint64_t draw_count);
+  // Closes the current frame
+  Alerts RecordPresent();
+
+  std::string BuildReport() const;
+
+ private:
+  struct Totals {
+    uint64_t submit_count = 0;
+    uint64_t submit_info_count = 0;
+    uint64_t command_buffer_count = 0;
+    uint64_t draw_count = 0;
+    uint64_t tiny_submit_count = 0;
+  };
+
+  mutable std::mutex m_mutex;
+
+  uint32_t m_max_submits_per_frame = 0;
+  uint32_t m_tiny_submit_draws = 0;
+  uint32_t m_max_tiny_submits_per_frame = 0;
+
+  Totals m_totals;
+  // Largest single vkQueueSubmit call
+  uint64_t m_peak_command_buffers_per_submit = 0;
+  uint64_t m_peak_draws_per_submit = 0;
+
+  Totals m_frame;
+  uint64_t m_frame_count = 0;
+  uint64_t m_peak_submits_per_frame = 0;
+  uint64_t m_frames_over_submit_limit = 0;
+  uint64_t m_frames_over_tiny_submit_limit = 0;
+};
+
+}  // namespace GWD
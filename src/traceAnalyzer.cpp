@@ -0,0 +1,1225 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+// Offline analyzer for traces written with GWD_TRACE_FILE. It replays the
+// recorded calls through the same WitchDoctor checks the layer runs, without
+// a device, and prints one aggregated report instead of a warning stream.
+//
+// Usage: GwdTraceAnalyzer [--threads N] <trace file>
+//
+// The GWD_* settings that tune the checks apply here as well.
+
+#define NOMINMAX
+
+#include "WitchDoc.h"
+#include "traceReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "flat_hash_map.hpp"
+
+namespace GWD {
+
+// Runs batches of tasks on a fixed set of threads, the calling thread
+// included, and waits for the whole batch to finish.
+class WorkerPool {
+ public:
+  explicit WorkerPool(uint32_t thread_count) {
+    for (uint32_t thread_index = 1; thread_index < thread_count;
+         thread_index++) {
+      m_threads.emplace_back(&WorkerPool::WorkerThread, this);
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_shutting_down = true;
+    }
+    m_wake_condition.notify_all();
+    for (auto& thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  uint32_t GetThreadCount() const { return (uint32_t)m_threads.size() + 1; }
+
+  void Run(size_t task_count, const std::function<void(size_t)>& task) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_task = &task;
+      m_task_count = task_count;
+      m_next_task.store(0, std::memory_order_relaxed);
+      m_busy_workers = (uint32_t)m_threads.size();
+      m_generation++;
+    }
+    m_wake_condition.notify_all();
+
+    RunTasks(task, task_count);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done_condition.wait(lock, [this] { return m_busy_workers == 0; });
+    m_task = nullptr;
+  }
+
+ private:
+  void WorkerThread() {
+    uint64_t seen_generation = 0;
+    for (;;) {
+      const std::function<void(size_t)>* task = nullptr;
+      size_t task_count = 0;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake_condition.wait(lock, [this, seen_generation] {
+          return m_shutting_down || m_generation != seen_generation;
+        });
+        if (m_shutting_down) {
+          return;
+        }
+        seen_generation = m_generation;
+        task = m_task;
+        task_count = m_task_count;
+      }
+
+      RunTasks(*task, task_count);
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (--m_busy_workers == 0) {
+        m_done_condition.notify_one();
+      }
+    }
+  }
+
+  void RunTasks(const std::function<void(size_t)>& task, size_t task_count) {
+    for (;;) {
+      const size_t task_index =
+          m_next_task.fetch_add(1, std::memory_order_relaxed);
+      if (task_index >= task_count) {
+        return;
+      }
+      task(task_index);
+    }
+  }
+
+  std::vector<std::thread> m_threads;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake_condition;
+  std::condition_variable m_done_condition;
+  const std::function<void(size_t)>* m_task = nullptr;
+  size_t m_task_count = 0;
+  std::atomic<size_t> m_next_task{0};
+  uint32_t m_busy_workers = 0;
+  uint64_t m_generation = 0;
+  bool m_shutting_down = false;
+};
+
+// Collects every warning the replayed checks raise. Unlike the layer, nothing
+// is rate limited or collapsed on the way in: each issue is counted, and the
+// report groups them by check.
+class AnalysisReport : public WarningReporter {
+ public:
+  void PerformanceWarningMessage(const std::string& message) override {
+    std::lock_guard<std::mutex> lock(m_messages_mutex);
+    m_messages.push_back(message);
+  }
+
+  void ReportWarning(const WarningEvent& event) override {
+    const IssueKey key = {event.check, event.entry_point, event.object};
+    Shard& shard = m_shards[IssueKeyHash()(key) % kShardCount];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.issues[key]++;
+  }
+
+  std::string Build() const;
+
+ private:
+  struct IssueKey {
+    PerfCheck check;
+    const char* entry_point;
+    uint64_t object;
+
+    bool operator==(const IssueKey& other) const {
+      return check == other.check && entry_point == other.entry_point &&
+             object == other.object;
+    }
+  };
+
+  struct IssueKeyHash {
+    size_t operator()(const IssueKey& key) const {
+      return std::hash<uint64_t>()(key.object) ^
+             (std::hash<const void*>()(key.entry_point) << 1) ^
+             ((size_t)key.check << 7);
+    }
+  };
+
+  // Checks raised on every draw of a frame would make a single lock the
+  // bottleneck of the replay
+  static constexpr size_t kShardCount = 16;
+  struct Shard {
+    mutable std::mutex mutex;
+    ska::flat_hash_map<IssueKey, uint64_t, IssueKeyHash> issues;
+    char cache_line_padding[64];
+  };
+
+  std::array<Shard, kShardCount> m_shards;
+
+  mutable std::mutex m_messages_mutex;
+  std::vector<std::string> m_messages;
+};
+
+std::string AnalysisReport::Build() const {
+  static constexpr size_t kTopObjectCount = 5;
+
+  struct CheckSummary {
+    uint64_t count = 0;
+    std::vector<std::pair<const char*, uint64_t>> entry_points;
+    std::vector<std::pair<uint64_t, uint64_t>> objects;
+  };
+  std::array<CheckSummary, (size_t)PerfCheck::kCount> summaries;
+
+  for (const Shard& shard : m_shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (const auto& issue : shard.issues) {
+      CheckSummary& summary = summaries[(size_t)issue.first.check];
+      summary.count += issue.second;
+      auto entry_point = std::find_if(
+          summary.entry_points.begin(), summary.entry_points.end(),
+          [&issue](const std::pair<const char*, uint64_t>& entry) {
+            return strcmp(entry.first, issue.first.entry_point) == 0;
+          });
+      if (entry_point == summary.entry_points.end()) {
+        summary.entry_points.emplace_back(issue.first.entry_point,
+                                          issue.second);
+      } else {
+        entry_point->second += issue.second;
+      }
+      summary.objects.emplace_back(issue.first.object, issue.second);
+    }
+  }
+
+  std::stringstream report;
+  report << "Checks:\n";
+  bool any_issue = false;
+  for (size_t check = 0; check < summaries.size(); check++) {
+    CheckSummary& summary = summaries[check];
+    if (summary.count == 0) {
+      continue;
+    }
+    any_issue = true;
+
+    // Objects are only distinct per entry point so far
+    std::sort(summary.objects.begin(), summary.objects.end());
+    size_t unique_count = 0;
+    for (size_t index = 0; index < summary.objects.size(); index++) {
+      if (unique_count > 0 &&
+          summary.objects[unique_count - 1].first ==
+              summary.objects[index].first) {
+        summary.objects[unique_count - 1].second +=
+            summary.objects[index].second;
+      } else {
+        summary.objects[unique_count++] = summary.objects[index];
+      }
+    }
+    summary.objects.resize(unique_count);
+    std::sort(summary.objects.begin(), summary.objects.end(),
+              [](const std::pair<uint64_t, uint64_t>& a,
+                 const std::pair<uint64_t, uint64_t>& b) {
+                return a.second > b.second;
+              });
+
+    report << "  " << GetPerfCheckName((PerfCheck)check) << ": "
+           << summary.count << " occurrences on " << summary.objects.size()
+           << " objects\n";
+    for (const auto& entry_point : summary.entry_points) {
+      report << "    " << entry_point.first << ": " << entry_point.second
+             << "\n";
+    }
+    report << "    most frequent:";
+    for (size_t index = 0;
+         index < std::min(kTopObjectCount, summary.objects.size()); index++) {
+      report << " 0x" << std::hex << summary.objects[index].first << std::dec
+             << " (" << summary.objects[index].second << ")";
+    }
+    report << "\n";
+  }
+  if (!any_issue) {
+    report << "  no issues found\n";
+  }
+
+  std::lock_guard<std::mutex> lock(m_messages_mutex);
+  for (const std::string& message : m_messages) {
+    report << message << "\n";
+  }
+  return report.str();
+}
+
+// Replays a trace through one WitchDoctor per recorded device.
+//
+// Records of all threads are merged into a single timeline by timestamp.
+// Device, memory and resource records are applied in that order on the
+// calling thread. Command buffer records are deferred and grouped per command
+// buffer: each command buffer is externally synchronized, so its records only
+// need to stay in order relative to each other, and different command buffers
+// are replayed in parallel, just as the application recorded them. Deferred
+// work is run whenever a record could change what it depends on, i.e. before
+// a buffer or command buffer goes away; the other resource records only touch
+// state the command buffer checks don't look at, or handles they can't
+// reference yet.
+class TraceReplay {
+ public:
+  TraceReplay(const TraceReader& reader, WorkerPool* pool,
+              AnalysisReport* report)
+      : m_reader(reader), m_pool(pool), m_report(report) {}
+
+  void Run();
+
+  std::string BuildSummary() const;
+
+ private:
+  // Below this, deferred work is cheaper to replay inline than to hand out
+  static constexpr size_t kMinParallelRecords = 4096;
+  // Deferred work is run early past this, so that traces without resource
+  // churn don't keep a pointer to every record
+  static constexpr size_t kMaxDeferredRecords = 1024 * 1024;
+  static constexpr size_t kRecordTypeCount = 64;
+
+  // A vkQueueSubmit call whose records haven't all been read yet
+  struct PendingSubmit {
+    uint64_t fence = 0;
+    std::vector<uint32_t> command_buffer_counts;
+    std::vector<VkCommandBuffer> command_buffers;
+  };
+
+  struct DeferredCommandBuffer {
+    WitchDoctor* witch_doc = nullptr;
+    uint64_t command_buffer = 0;
+    std::vector<const Trace::RecordHeader*> records;
+  };
+
+  void ReplayRecord(const Trace::RecordHeader* record);
+  void Defer(uint64_t command_buffer, const Trace::RecordHeader* record);
+  void RunDeferred();
+  static void ReplayCommandBufferRecord(WitchDoctor* witch_doc,
+                                        const Trace::RecordHeader* record);
+  void ReplayQueueSubmit(const Trace::RecordHeader* record);
+
+  WitchDoctor* FindDevice(uint64_t device) const;
+  WitchDoctor* FindQueueDevice(uint64_t queue) const;
+  void CreateDevice(const Trace::CreateDevice& record);
+  void DestroyDevice(uint64_t device);
+
+  const TraceReader& m_reader;
+  WorkerPool* m_pool = nullptr;
+  AnalysisReport* m_report = nullptr;
+
+  // Timestamp of the record being replayed, which the checks see as now
+  AllocationTelemetry::Clock::time_point m_current_time;
+
+  ska::flat_hash_map<uint64_t, std::unique_ptr<WitchDoctor>> m_devices;
+  ska::flat_hash_map<uint64_t, WitchDoctor*> m_command_buffer_devices;
+  ska::flat_hash_map<uint64_t, WitchDoctor*> m_queue_devices;
+  // Calls on one queue are externally synchronized, so they never interleave
+  ska::flat_hash_map<uint64_t, PendingSubmit> m_pending_submits;
+
+  // Entries are reused across batches to keep their allocations
+  std::vector<DeferredCommandBuffer> m_deferred;
+  size_t m_deferred_count = 0;
+  size_t m_deferred_records = 0;
+  ska::flat_hash_map<uint64_t, size_t> m_deferred_indices;
+
+  // Statistics for the summary
+  uint32_t m_thread_count = 0;
+  uint64_t m_first_timestamp_ns = 0;
+  uint64_t m_last_timestamp_ns = 0;
+  uint64_t m_parallel_batches = 0;
+  uint64_t m_inline_batches = 0;
+  std::array<uint64_t, kRecordTypeCount> m_record_counts = {};
+};
+
+void TraceReplay::Run() {
+  // Blocks of one thread are flushed, and so appear in the file, in the order
+  // they were filled
+  std::vector<std::vector<const Trace::BlockHeader*>> thread_blocks;
+  ska::flat_hash_map<uint32_t, size_t> thread_indices;
+  for (const Trace::BlockHeader* block : m_reader.GetBlocks()) {
+    auto inserted =
+        thread_indices.emplace(block->thread_id, thread_blocks.size());
+    if (inserted.second) {
+      thread_blocks.emplace_back();
+    }
+    thread_blocks[inserted.first->second].push_back(block);
+  }
+  m_thread_count = (uint32_t)thread_blocks.size();
+
+  std::vector<TraceReader::RecordCursor> cursors;
+  for (auto& blocks : thread_blocks) {
+    cursors.emplace_back(std::move(blocks));
+  }
+
+  // Each thread's records are already in timestamp order
+  using CursorEntry = std::pair<uint64_t, size_t>;
+  std::priority_queue<CursorEntry, std::vector<CursorEntry>,
+                      std::greater<CursorEntry>>
+      next_records;
+  for (size_t cursor_index = 0; cursor_index < cursors.size();
+       cursor_index++) {
+    const Trace::RecordHeader* record = cursors[cursor_index].Get();
+    if (record != nullptr) {
+      next_records.emplace(record->timestamp_ns, cursor_index);
+    }
+  }
+
+  bool first_record = true;
+  while (!next_records.empty()) {
+    const size_t cursor_index = next_records.top().second;
+    next_records.pop();
+
+    TraceReader::RecordCursor& cursor = cursors[cursor_index];
+    const Trace::RecordHeader* record = cursor.Get();
+    if (first_record) {
+      m_first_timestamp_ns = record->timestamp_ns;
+      first_record = false;
+    }
+    m_last_timestamp_ns = record->timestamp_ns;
+    ReplayRecord(record);
+
+    cursor.Next();
+    if (cursor.Get() != nullptr) {
+      next_records.emplace(cursor.Get()->timestamp_ns, cursor_index);
+    }
+  }
+
+  // Devices still alive when the trace ended still get their reports
+  RunDeferred();
+  std::vector<uint64_t> remaining_devices;
+  for (const auto& device : m_devices) {
+    remaining_devices.push_back(device.first);
+  }
+  for (uint64_t device : remaining_devices) {
+    DestroyDevice(device);
+  }
+}
+
+WitchDoctor* TraceReplay::FindDevice(uint64_t device) const {
+  auto found = m_devices.find(device);
+  return found == m_devices.end() ? nullptr : found->second.get();
+}
+
+WitchDoctor* TraceReplay::FindQueueDevice(uint64_t queue) const {
+  auto found = m_queue_devices.find(queue);
+  if (found != m_queue_devices.end()) {
+    return found->second;
+  }
+  // Queues fetched before the trace started can still be placed when there
+  // is no other device they could belong to
+  return m_devices.size() == 1 ? m_devices.begin()->second.get() : nullptr;
+}
+
+void TraceReplay::CreateDevice(const Trace::CreateDevice& record) {
+  std::unique_ptr<WitchDoctor> witch_doc(new WitchDoctor(m_report));
+  witch_doc->Initialize((VkDevice)record.device, record.memory_properties,
+                        record.max_memory_allocation_count);
+  witch_doc->SetTimeSource([this]() { return m_current_time; });
+  m_devices[record.device] = std::move(witch_doc);
+}
+
+void TraceReplay::DestroyDevice(uint64_t device) {
+  WitchDoctor* witch_doc = FindDevice(device);
+  if (witch_doc == nullptr) {
+    return;
+  }
+  witch_doc->PostCallDestroyDevice((VkDevice)device, nullptr);
+
+  for (auto it = m_command_buffer_devices.begin();
+       it != m_command_buffer_devices.end();) {
+    if (it->second == witch_doc) {
+      it = m_command_buffer_devices.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto it = m_queue_devices.begin(); it != m_queue_devices.end();) {
+    if (it->second == witch_doc) {
+      m_pending_submits.erase(it->first);
+      it = m_queue_devices.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  m_devices.erase(device);
+}
+
+void TraceReplay::ReplayRecord(const Trace::RecordHeader* record) {
+  m_record_counts[(size_t)record->type % kRecordTypeCount]++;
+  m_current_time = AllocationTelemetry::Clock::time_point(
+      std::chrono::duration_cast<AllocationTelemetry::Clock::duration>(
+          std::chrono::nanoseconds(record->timestamp_ns)));
+
+  switch (record->type) {
+    case Trace::RecordType::kCreateDevice:
+      if (auto create = TraceReader::GetRecord<Trace::CreateDevice>(record)) {
+        RunDeferred();
+        // A device handle that is reused was destroyed without a trace
+        DestroyDevice(create->device);
+        CreateDevice(*create);
+      }
+      break;
+    case Trace::RecordType::kDestroyDevice:
+      if (auto destroy =
+              TraceReader::GetRecord<Trace::DestroyDevice>(record)) {
+        RunDeferred();
+        DestroyDevice(destroy->device);
+      }
+      break;
+    case Trace::RecordType::kAllocateMemory:
+      if (auto allocate =
+              TraceReader::GetRecord<Trace::AllocateMemory>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(allocate->device)) {
+          VkMemoryAllocateInfo allocate_info = {};
+          allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+          allocate_info.allocationSize = allocate->size;
+          allocate_info.memoryTypeIndex = allocate->memory_type_index;
+          VkDeviceMemory memory = (VkDeviceMemory)allocate->memory;
+          witch_doc->PostCallAllocateMemory(
+              (VkResult)allocate->result, (VkDevice)allocate->device,
+              &allocate_info, nullptr, &memory);
+        }
+      }
+      break;
+    case Trace::RecordType::kFreeMemory:
+      if (auto freed = TraceReader::GetRecord<Trace::FreeMemory>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(freed->device)) {
+          witch_doc->PostCallFreeMemory(
+              (VkDevice)freed->device, (VkDeviceMemory)freed->memory, nullptr);
+        }
+      }
+      break;
+    case Trace::RecordType::kCreateBuffer:
+      if (auto create = TraceReader::GetRecord<Trace::CreateBuffer>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(create->device)) {
+          VkBufferCreateInfo create_info = {};
+          create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+          create_info.flags = create->flags;
+          create_info.size = create->size;
+          create_info.usage = create->usage;
+          VkBuffer buffer = (VkBuffer)create->buffer;
+          witch_doc->PostCallCreateBuffer(VK_SUCCESS, (VkDevice)create->device,
+                                          &create_info, nullptr, &buffer);
+        }
+      }
+      break;
+    case Trace::RecordType::kDestroyBuffer:
+      if (auto destroy =
+              TraceReader::GetRecord<Trace::DestroyBuffer>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(destroy->device)) {
+          RunDeferred();
+          witch_doc->PostCallDestroyBuffer(
+              (VkDevice)destroy->device, (VkBuffer)destroy->buffer, nullptr);
+        }
+      }
+      break;
+    case Trace::RecordType::kBindBufferMemory:
+      if (auto bind = TraceReader::GetRecord<Trace::BindBufferMemory>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(bind->device)) {
+          witch_doc->PostCallBindBufferMemory(
+              VK_SUCCESS, (VkDevice)bind->device, (VkBuffer)bind->buffer,
+              (VkDeviceMemory)bind->memory, bind->offset);
+        }
+      }
+      break;
+    case Trace::RecordType::kCreateImage:
+      if (auto create = TraceReader::GetRecord<Trace::CreateImage>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(create->device)) {
+          VkImageCreateInfo create_info = {};
+          create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+          create_info.format = (VkFormat)create->format;
+          create_info.tiling = (VkImageTiling)create->tiling;
+          create_info.usage = create->usage;
+          create_info.samples = (VkSampleCountFlagBits)create->samples;
+          create_info.extent = {create->width, create->height, create->depth};
+          create_info.arrayLayers = create->array_layers;
+          VkImage image = (VkImage)create->image;
+          witch_doc->PostCallCreateImage(VK_SUCCESS, (VkDevice)create->device,
+                                         &create_info, nullptr, &image);
+        }
+      }
+      break;
+    case Trace::RecordType::kDestroyImage:
+      if (auto destroy = TraceReader::GetRecord<Trace::DestroyImage>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(destroy->device)) {
+          witch_doc->PostCallDestroyImage(
+              (VkDevice)destroy->device, (VkImage)destroy->image, nullptr);
+        }
+      }
+      break;
+    case Trace::RecordType::kBindImageMemory:
+      if (auto bind = TraceReader::GetRecord<Trace::BindImageMemory>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(bind->device)) {
+          witch_doc->PostCallBindImageMemory(
+              VK_SUCCESS, (VkDevice)bind->device, (VkImage)bind->image,
+              (VkDeviceMemory)bind->memory, bind->offset);
+        }
+      }
+      break;
+    case Trace::RecordType::kAllocateCommandBuffer:
+      if (auto allocate =
+              TraceReader::GetRecord<Trace::AllocateCommandBuffer>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(allocate->device)) {
+          VkCommandBufferAllocateInfo allocate_info = {};
+          allocate_info.sType =
+              VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+          allocate_info.commandPool = (VkCommandPool)allocate->command_pool;
+          allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+          allocate_info.commandBufferCount = 1;
+          VkCommandBuffer command_buffer =
+              (VkCommandBuffer)allocate->command_buffer;
+          witch_doc->PostCallAllocateCommandBuffers(
+              VK_SUCCESS, (VkDevice)allocate->device, &allocate_info,
+              &command_buffer);
+          m_command_buffer_devices[allocate->command_buffer] = witch_doc;
+        }
+      }
+      break;
+    case Trace::RecordType::kFreeCommandBuffer:
+      if (auto freed =
+              TraceReader::GetRecord<Trace::FreeCommandBuffer>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(freed->device)) {
+          RunDeferred();
+          VkCommandBuffer command_buffer =
+              (VkCommandBuffer)freed->command_buffer;
+          witch_doc->PostCallFreeCommandBuffers(
+              (VkDevice)freed->device, (VkCommandPool)freed->command_pool, 1,
+              &command_buffer);
+          m_command_buffer_devices.erase(freed->command_buffer);
+        }
+      }
+      break;
+    case Trace::RecordType::kDestroyCommandPool:
+      if (auto destroy =
+              TraceReader::GetRecord<Trace::DestroyCommandPool>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(destroy->device)) {
+          RunDeferred();
+          witch_doc->PostCallDestroyCommandPool(
+              (VkDevice)destroy->device,
+              (VkCommandPool)destroy->command_pool, nullptr);
+        }
+      }
+      break;
+    case Trace::RecordType::kAllocateDescriptorSet:
+      if (auto allocate =
+              TraceReader::GetRecord<Trace::AllocateDescriptorSet>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(allocate->device)) {
+          VkDescriptorSetAllocateInfo allocate_info = {};
+          allocate_info.sType =
+              VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+          allocate_info.descriptorPool =
+              (VkDescriptorPool)allocate->descriptor_pool;
+          allocate_info.descriptorSetCount = 1;
+          VkDescriptorSet descriptor_set =
+              (VkDescriptorSet)allocate->descriptor_set;
+          witch_doc->PostCallAllocateDescriptorSets(
+              VK_SUCCESS, (VkDevice)allocate->device, &allocate_info,
+              &descriptor_set);
+        }
+      }
+      break;
+    case Trace::RecordType::kFreeDescriptorSet:
+      if (auto freed =
+              TraceReader::GetRecord<Trace::FreeDescriptorSet>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(freed->device)) {
+          RunDeferred();
+          VkDescriptorSet descriptor_set =
+              (VkDescriptorSet)freed->descriptor_set;
+          witch_doc->PostCallFreeDescriptorSets(
+              VK_SUCCESS, (VkDevice)freed->device,
+              (VkDescriptorPool)freed->descriptor_pool, 1, &descriptor_set);
+        }
+      }
+      break;
+    case Trace::RecordType::kResetDescriptorPool:
+      if (auto reset =
+              TraceReader::GetRecord<Trace::ResetDescriptorPool>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(reset->device)) {
+          RunDeferred();
+          witch_doc->PostCallResetDescriptorPool(
+              VK_SUCCESS, (VkDevice)reset->device,
+              (VkDescriptorPool)reset->descriptor_pool, 0);
+        }
+      }
+      break;
+    case Trace::RecordType::kDestroyDescriptorPool:
+      if (auto destroy =
+              TraceReader::GetRecord<Trace::DestroyDescriptorPool>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(destroy->device)) {
+          RunDeferred();
+          witch_doc->PostCallDestroyDescriptorPool(
+              (VkDevice)destroy->device,
+              (VkDescriptorPool)destroy->descriptor_pool, nullptr);
+        }
+      }
+      break;
+    case Trace::RecordType::kUpdateDescriptorSet:
+      // Vulkan doesn't allow updating a set that a recording waiting to be
+      // submitted has bound, so this needn't wait for the deferred binds
+      if (auto update =
+              TraceReader::GetRecord<Trace::UpdateDescriptorSet>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(update->device)) {
+          uint32_t buffer_count = update->descriptor_count;
+          const uint64_t* buffers =
+              TraceReader::GetElements<Trace::UpdateDescriptorSet, uint64_t>(
+                  record, &buffer_count);
+          // Only the buffers are traced, so the ranges are made up
+          std::vector<VkDescriptorBufferInfo> buffer_infos(buffer_count);
+          for (uint32_t element = 0; element < buffer_count; element++) {
+            buffer_infos[element].buffer = (VkBuffer)buffers[element];
+            buffer_infos[element].offset = 0;
+            buffer_infos[element].range = VK_WHOLE_SIZE;
+          }
+          VkWriteDescriptorSet write = {};
+          write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+          write.dstSet = (VkDescriptorSet)update->descriptor_set;
+          write.dstBinding = update->binding;
+          write.dstArrayElement = update->array_element;
+          write.descriptorType = (VkDescriptorType)update->descriptor_type;
+          if (buffer_count > 0) {
+            write.descriptorCount = buffer_count;
+            write.pBufferInfo = buffer_infos.data();
+          } else {
+            // Not a buffer type, so nothing reads the descriptors themselves
+            write.descriptorCount = update->descriptor_count;
+          }
+          witch_doc->PostCallUpdateDescriptorSets((VkDevice)update->device, 1,
+                                                  &write, 0, nullptr);
+        }
+      }
+      break;
+    case Trace::RecordType::kCopyDescriptorSet:
+      if (auto copied =
+              TraceReader::GetRecord<Trace::CopyDescriptorSet>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(copied->device)) {
+          VkCopyDescriptorSet copy = {};
+          copy.sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET;
+          copy.srcSet = (VkDescriptorSet)copied->src_set;
+          copy.srcBinding = copied->src_binding;
+          copy.srcArrayElement = copied->src_array_element;
+          copy.dstSet = (VkDescriptorSet)copied->dst_set;
+          copy.dstBinding = copied->dst_binding;
+          copy.dstArrayElement = copied->dst_array_element;
+          copy.descriptorCount = copied->descriptor_count;
+          witch_doc->PostCallUpdateDescriptorSets((VkDevice)copied->device, 0,
+                                                  nullptr, 1, &copy);
+        }
+      }
+      break;
+    case Trace::RecordType::kUpdateDescriptorSetWithTemplate:
+      if (auto update =
+              TraceReader::GetRecord<Trace::UpdateDescriptorSetWithTemplate>(
+                  record)) {
+        if (WitchDoctor* witch_doc = FindDevice(update->device)) {
+          witch_doc->PostCallUpdateDescriptorSetWithTemplate(
+              (VkDevice)update->device,
+              (VkDescriptorSet)update->descriptor_set,
+              (VkDescriptorUpdateTemplate)update->descriptor_update_template,
+              nullptr);
+        }
+      }
+      break;
+    case Trace::RecordType::kBeginCommandBuffer:
+      if (auto begin =
+              TraceReader::GetRecord<Trace::BeginCommandBuffer>(record)) {
+        Defer(begin->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdBindIndexBuffer:
+      if (auto bind =
+              TraceReader::GetRecord<Trace::CmdBindIndexBuffer>(record)) {
+        Defer(bind->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdBindVertexBuffers:
+      if (auto bind =
+              TraceReader::GetRecord<Trace::CmdBindVertexBuffers>(record)) {
+        Defer(bind->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdBindPipeline:
+      if (auto bind = TraceReader::GetRecord<Trace::CmdBindPipeline>(record)) {
+        Defer(bind->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdBindDescriptorSets:
+      if (auto bind =
+              TraceReader::GetRecord<Trace::CmdBindDescriptorSets>(record)) {
+        Defer(bind->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdDraw:
+      if (auto draw = TraceReader::GetRecord<Trace::CmdDraw>(record)) {
+        Defer(draw->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdDrawIndexed:
+      if (auto draw = TraceReader::GetRecord<Trace::CmdDrawIndexed>(record)) {
+        Defer(draw->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdDrawIndirect:
+      if (auto draw = TraceReader::GetRecord<Trace::CmdDrawIndirect>(record)) {
+        Defer(draw->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdDrawIndexedIndirect:
+      if (auto draw =
+              TraceReader::GetRecord<Trace::CmdDrawIndexedIndirect>(record)) {
+        Defer(draw->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdDrawIndirectCount:
+      if (auto draw =
+              TraceReader::GetRecord<Trace::CmdDrawIndirectCount>(record)) {
+        Defer(draw->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdDrawIndexedIndirectCount:
+      if (auto draw =
+              TraceReader::GetRecord<Trace::CmdDrawIndexedIndirectCount>(
+                  record)) {
+        Defer(draw->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdDispatch:
+      if (auto dispatch = TraceReader::GetRecord<Trace::CmdDispatch>(record)) {
+        Defer(dispatch->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdDispatchIndirect:
+      if (auto dispatch =
+              TraceReader::GetRecord<Trace::CmdDispatchIndirect>(record)) {
+        Defer(dispatch->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kCmdExecuteCommands:
+      if (auto execute =
+              TraceReader::GetRecord<Trace::CmdExecuteCommands>(record)) {
+        Defer(execute->command_buffer, record);
+      }
+      break;
+    case Trace::RecordType::kGetDeviceQueue:
+      if (auto get = TraceReader::GetRecord<Trace::GetDeviceQueue>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(get->device)) {
+          m_queue_devices[get->queue] = witch_doc;
+        }
+      }
+      break;
+    case Trace::RecordType::kQueueSubmit:
+      ReplayQueueSubmit(record);
+      break;
+    case Trace::RecordType::kAcquireNextImage:
+      if (auto acquire =
+              TraceReader::GetRecord<Trace::AcquireNextImage>(record)) {
+        if (WitchDoctor* witch_doc = FindDevice(acquire->device)) {
+          uint32_t image_index = acquire->image_index;
+          witch_doc->PostCallAcquireNextImageKHR(
+              (VkResult)acquire->result, (VkDevice)acquire->device,
+              (VkSwapchainKHR)acquire->swapchain, 0, VK_NULL_HANDLE,
+              VK_NULL_HANDLE, &image_index);
+        }
+      }
+      break;
+    case Trace::RecordType::kQueuePresent:
+      if (auto present = TraceReader::GetRecord<Trace::QueuePresent>(record)) {
+        if (WitchDoctor* witch_doc = FindQueueDevice(present->queue)) {
+          // The frame's counters include everything recorded before it
+          RunDeferred();
+          VkPresentInfoKHR present_info = {};
+          present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+          present_info.swapchainCount = present->swapchain_count;
+          witch_doc->PostCallQueuePresentKHR((VkResult)present->result,
+                                             (VkQueue)present->queue,
+                                             &present_info);
+        }
+      }
+      break;
+    default:
+      // Mapping has no checks yet, and newer record types are skipped
+      break;
+  }
+}
+
+void TraceReplay::ReplayQueueSubmit(const Trace::RecordHeader* record) {
+  auto submit = TraceReader::GetRecord<Trace::QueueSubmit>(record);
+  if (submit == nullptr) {
+    return;
+  }
+
+  PendingSubmit& pending = m_pending_submits[submit->queue];
+  if (submit->submit_index == 0 && submit->first_command_buffer == 0) {
+    pending.fence = submit->fence;
+    pending.command_buffer_counts.clear();
+    pending.command_buffers.clear();
+  }
+  if (submit->submit_count != 0) {
+    pending.command_buffer_counts.resize(submit->submit_index + 1);
+    uint32_t command_buffer_count = submit->command_buffer_count;
+    const uint64_t* command_buffers =
+        TraceReader::GetElements<Trace::QueueSubmit, uint64_t>(
+            record, &command_buffer_count);
+    for (uint32_t cb_index = 0; cb_index < command_buffer_count; cb_index++) {
+      pending.command_buffers.push_back(
+          (VkCommandBuffer)command_buffers[cb_index]);
+    }
+    pending.command_buffer_counts[submit->submit_index] +=
+        command_buffer_count;
+  }
+
+  const bool last_record =
+      submit->submit_index + 1 >= submit->submit_count &&
+      submit->first_command_buffer + submit->command_buffer_count >=
+          submit->submit_command_buffer_count;
+  if (!last_record) {
+    return;
+  }
+
+  WitchDoctor* witch_doc = FindQueueDevice(submit->queue);
+  if (witch_doc != nullptr) {
+    // Submits are checked against what their command buffers recorded
+    RunDeferred();
+    std::vector<VkSubmitInfo> submit_infos(
+        pending.command_buffer_counts.size());
+    size_t first_command_buffer = 0;
+    for (size_t submit_index = 0; submit_index < submit_infos.size();
+         submit_index++) {
+      VkSubmitInfo& submit_info = submit_infos[submit_index];
+      submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submit_info.commandBufferCount =
+          pending.command_buffer_counts[submit_index];
+      submit_info.pCommandBuffers =
+          pending.command_buffers.data() + first_command_buffer;
+      first_command_buffer += submit_info.commandBufferCount;
+    }
+    witch_doc->PostCallQueueSubmit(
+        VK_SUCCESS, (VkQueue)submit->queue, (uint32_t)submit_infos.size(),
+        submit_infos.data(), (VkFence)pending.fence);
+  }
+  m_pending_submits.erase(submit->queue);
+}
+
+void TraceReplay::Defer(uint64_t command_buffer,
+                        const Trace::RecordHeader* record) {
+  auto inserted = m_deferred_indices.emplace(command_buffer, m_deferred_count);
+  if (inserted.second) {
+    // Command buffers the layer didn't see allocated are skipped, as in the
+    // layer
+    auto device = m_command_buffer_devices.find(command_buffer);
+    if (device == m_command_buffer_devices.end()) {
+      m_deferred_indices.erase(inserted.first);
+      return;
+    }
+    if (m_deferred_count == m_deferred.size()) {
+      m_deferred.emplace_back();
+    }
+    DeferredCommandBuffer& deferred = m_deferred[m_deferred_count++];
+    deferred.witch_doc = device->second;
+    deferred.command_buffer = command_buffer;
+    deferred.records.clear();
+  }
+  m_deferred[inserted.first->second].records.push_back(record);
+  if (++m_deferred_records >= kMaxDeferredRecords) {
+    RunDeferred();
+  }
+}
+
+void TraceReplay::RunDeferred() {
+  if (m_deferred_count == 0) {
+    return;
+  }
+
+  auto replay = [this](size_t deferred_index) {
+    const DeferredCommandBuffer& deferred = m_deferred[deferred_index];
+    for (const Trace::RecordHeader* record : deferred.records) {
+      ReplayCommandBufferRecord(deferred.witch_doc, record);
+    }
+  };
+  if (m_deferred_records < kMinParallelRecords || m_deferred_count == 1) {
+    for (size_t deferred_index = 0; deferred_index < m_deferred_count;
+         deferred_index++) {
+      replay(deferred_index);
+    }
+    m_inline_batches++;
+  } else {
+    m_pool->Run(m_deferred_count, replay);
+    m_parallel_batches++;
+  }
+
+  m_deferred_count = 0;
+  m_deferred_records = 0;
+  m_deferred_indices.clear();
+}
+
+// Runs on the worker threads. Only the record's command buffer state is
+// written, everything else is read through the checks' own locking.
+void TraceReplay::ReplayCommandBufferRecord(
+    WitchDoctor* witch_doc, const Trace::RecordHeader* record) {
+  switch (record->type) {
+    case Trace::RecordType::kBeginCommandBuffer: {
+      auto begin = TraceReader::GetRecord<Trace::BeginCommandBuffer>(record);
+      VkCommandBufferBeginInfo begin_info = {};
+      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      begin_info.flags = begin->flags;
+      witch_doc->PostCallBeginCommandBuffer(
+          VK_SUCCESS, (VkCommandBuffer)begin->command_buffer, &begin_info);
+      break;
+    }
+    case Trace::RecordType::kCmdBindIndexBuffer: {
+      auto bind = TraceReader::GetRecord<Trace::CmdBindIndexBuffer>(record);
+      witch_doc->PostCallCmdBindIndexBuffer(
+          (VkCommandBuffer)bind->command_buffer, (VkBuffer)bind->buffer,
+          bind->offset, (VkIndexType)bind->index_type);
+      break;
+    }
+    case Trace::RecordType::kCmdBindVertexBuffers: {
+      auto bind = TraceReader::GetRecord<Trace::CmdBindVertexBuffers>(record);
+      uint32_t binding_count = bind->binding_count;
+      const Trace::VertexBufferBinding* bindings =
+          TraceReader::GetElements<Trace::CmdBindVertexBuffers,
+                                   Trace::VertexBufferBinding>(
+              record, &binding_count);
+      std::array<VkBuffer, kMaxTrackedVertexBindings> buffers;
+      std::array<VkDeviceSize, kMaxTrackedVertexBindings> offsets;
+      const uint32_t tracked_count =
+          std::min(binding_count, kMaxTrackedVertexBindings);
+      for (uint32_t binding = 0; binding < tracked_count; binding++) {
+        buffers[binding] = (VkBuffer)bindings[binding].buffer;
+        offsets[binding] = bindings[binding].offset;
+      }
+      witch_doc->PostCallCmdBindVertexBuffers(
+          (VkCommandBuffer)bind->command_buffer, bind->first_binding,
+          tracked_count, buffers.data(), offsets.data());
+      break;
+    }
+    case Trace::RecordType::kCmdBindPipeline: {
+      auto bind = TraceReader::GetRecord<Trace::CmdBindPipeline>(record);
+      witch_doc->PostCallCmdBindPipeline(
+          (VkCommandBuffer)bind->command_buffer,
+          (VkPipelineBindPoint)bind->bind_point, (VkPipeline)bind->pipeline);
+      break;
+    }
+    case Trace::RecordType::kCmdBindDescriptorSets: {
+      auto bind = TraceReader::GetRecord<Trace::CmdBindDescriptorSets>(record);
+      uint32_t set_count = bind->descriptor_set_count;
+      const uint64_t* sets =
+          TraceReader::GetElements<Trace::CmdBindDescriptorSets, uint64_t>(
+              record, &set_count);
+      // One extra set is kept so that binds reaching past the tracked sets
+      // still do so
+      std::array<VkDescriptorSet, kMaxTrackedDescriptorSets + 1>
+          descriptor_sets;
+      const uint32_t replayed_count =
+          std::min(set_count, kMaxTrackedDescriptorSets + 1);
+      for (uint32_t set_index = 0; set_index < replayed_count; set_index++) {
+        descriptor_sets[set_index] = (VkDescriptorSet)sets[set_index];
+      }
+      // The checks only look at how many dynamic offsets there are
+      witch_doc->PostCallCmdBindDescriptorSets(
+          (VkCommandBuffer)bind->command_buffer,
+          (VkPipelineBindPoint)bind->bind_point,
+          (VkPipelineLayout)bind->layout, bind->first_set, replayed_count,
+          descriptor_sets.data(), bind->dynamic_offset_count, nullptr);
+      break;
+    }
+    case Trace::RecordType::kCmdDraw: {
+      auto draw = TraceReader::GetRecord<Trace::CmdDraw>(record);
+      witch_doc->PostCallCmdDraw((VkCommandBuffer)draw->command_buffer,
+                                 draw->vertex_count, draw->instance_count,
+                                 draw->first_vertex, draw->first_instance);
+      break;
+    }
+    case Trace::RecordType::kCmdDrawIndexed: {
+      auto draw = TraceReader::GetRecord<Trace::CmdDrawIndexed>(record);
+      witch_doc->PostCallCmdDrawIndexed(
+          (VkCommandBuffer)draw->command_buffer, draw->index_count,
+          draw->instance_count, draw->first_index, draw->vertex_offset,
+          draw->first_instance);
+      break;
+    }
+    case Trace::RecordType::kCmdDrawIndirect: {
+      auto draw = TraceReader::GetRecord<Trace::CmdDrawIndirect>(record);
+      witch_doc->PostCallCmdDrawIndirect(
+          (VkCommandBuffer)draw->command_buffer, (VkBuffer)draw->buffer,
+          draw->offset, draw->draw_count, draw->stride);
+      break;
+    }
+    case Trace::RecordType::kCmdDrawIndexedIndirect: {
+      auto draw = TraceReader::GetRecord<Trace::CmdDrawIndexedIndirect>(record);
+      witch_doc->PostCallCmdDrawIndexedIndirect(
+          (VkCommandBuffer)draw->command_buffer, (VkBuffer)draw->buffer,
+          draw->offset, draw->draw_count, draw->stride);
+      break;
+    }
+    case Trace::RecordType::kCmdDrawIndirectCount: {
+      auto draw = TraceReader::GetRecord<Trace::CmdDrawIndirectCount>(record);
+      witch_doc->PostCallCmdDrawIndirectCount(
+          (VkCommandBuffer)draw->command_buffer, (VkBuffer)draw->buffer,
+          draw->offset, (VkBuffer)draw->count_buffer, draw->count_buffer_offset,
+          draw->max_draw_count, draw->stride);
+      break;
+    }
+    case Trace::RecordType::kCmdDrawIndexedIndirectCount: {
+      auto draw =
+          TraceReader::GetRecord<Trace::CmdDrawIndexedIndirectCount>(record);
+      witch_doc->PostCallCmdDrawIndexedIndirectCount(
+          (VkCommandBuffer)draw->command_buffer, (VkBuffer)draw->buffer,
+          draw->offset, (VkBuffer)draw->count_buffer, draw->count_buffer_offset,
+          draw->max_draw_count, draw->stride);
+      break;
+    }
+    case Trace::RecordType::kCmdDispatch: {
+      auto dispatch = TraceReader::GetRecord<Trace::CmdDispatch>(record);
+      witch_doc->PostCallCmdDispatch((VkCommandBuffer)dispatch->command_buffer,
+                                     dispatch->group_count_x,
+                                     dispatch->group_count_y,
+                                     dispatch->group_count_z);
+      break;
+    }
+    case Trace::RecordType::kCmdDispatchIndirect: {
+      auto dispatch =
+          TraceReader::GetRecord<Trace::CmdDispatchIndirect>(record);
+      witch_doc->PostCallCmdDispatchIndirect(
+          (VkCommandBuffer)dispatch->command_buffer, (VkBuffer)dispatch->buffer,
+          dispatch->offset);
+      break;
+    }
+    case Trace::RecordType::kCmdExecuteCommands: {
+      auto execute = TraceReader::GetRecord<Trace::CmdExecuteCommands>(record);
+      witch_doc->PostCallCmdExecuteCommands(
+          (VkCommandBuffer)execute->command_buffer,
+          execute->command_buffer_count, nullptr);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+std::string TraceReplay::BuildSummary() const {
+  uint64_t record_count = 0;
+  for (uint64_t count : m_record_counts) {
+    record_count += count;
+  }
+  auto count = [this](Trace::RecordType type) {
+    return m_record_counts[(size_t)type];
+  };
+  const uint64_t draw_count =
+      count(Trace::RecordType::kCmdDraw) +
+      count(Trace::RecordType::kCmdDrawIndexed) +
+      count(Trace::RecordType::kCmdDrawIndirect) +
+      count(Trace::RecordType::kCmdDrawIndexedIndirect) +
+      count(Trace::RecordType::kCmdDrawIndirectCount) +
+      count(Trace::RecordType::kCmdDrawIndexedIndirectCount);
+
+  std::stringstream summary;
+  summary << "Trace: " << m_reader.GetFileSize() / (1024 * 1024) << " MB, "
+          << m_reader.GetBlocks().size() << " blocks from " << m_thread_count
+          << " threads, " << record_count << " records over "
+          << (m_last_timestamp_ns - m_first_timestamp_ns) / 1000000
+          << " ms\n";
+  summary << "  devices: " << count(Trace::RecordType::kCreateDevice)
+          << ", allocations: " << count(Trace::RecordType::kAllocateMemory)
+          << ", buffers: " << count(Trace::RecordType::kCreateBuffer)
+          << ", images: " << count(Trace::RecordType::kCreateImage)
+          << ", command buffer recordings: "
+          << count(Trace::RecordType::kBeginCommandBuffer)
+          << ", draw calls: " << draw_count << ", dispatches: "
+          << count(Trace::RecordType::kCmdDispatch) +
+                 count(Trace::RecordType::kCmdDispatchIndirect)
+          << ", submit records: " << count(Trace::RecordType::kQueueSubmit)
+          << ", presents: " << count(Trace::RecordType::kQueuePresent)
+          << "\n";
+  summary << "  replayed on " << m_pool->GetThreadCount() << " threads, "
+          << m_parallel_batches << " parallel and " << m_inline_batches
+          << " inline batches of command buffer records\n";
+  return summary.str();
+}
+
+}  // namespace GWD
+
+static void PrintUsage() {
+  fprintf(stderr, "Usage: GwdTraceAnalyzer [--threads N] <trace file>\n");
+}
+
+int main(int argc, char** argv) {
+  uint32_t thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+  const char* path = nullptr;
+  for (int arg_index = 1; arg_index < argc; arg_index++) {
+    if (strcmp(argv[arg_index], "--threads") == 0 && arg_index + 1 < argc) {
+      thread_count = std::max((uint32_t)atoi(argv[++arg_index]), 1u);
+    } else if (path == nullptr && argv[arg_index][0] != '-') {
+      path = argv[arg_index];
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (path == nullptr) {
+    PrintUsage();
+    return 1;
+  }
+
+  const auto start_time = std::chrono::steady_clock::now();
+
+  std::string error;
+  std::unique_ptr<GWD::TraceReader> reader =
+      GWD::TraceReader::Open(path, &error);
+  if (!reader) {
+    fprintf(stderr, "GwdTraceAnalyzer: %s\n", error.c_str());
+    return 1;
+  }
+
+  GWD::WorkerPool pool(thread_count);
+  GWD::AnalysisReport report;
+  GWD::TraceReplay replay(*reader, &pool, &report);
+  replay.Run();
+
+  const double elapsed_seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                    start_time)
+          .count();
+  printf("WitchDoctor trace analysis of %s (%.2f s)\n", path,
+         elapsed_seconds);
+  printf("%s", replay.BuildSummary().c_str());
+  printf("%s", report.Build().c_str());
+  return 0;
+}
@@ -0,0 +1,527 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <stdint.h>
+
+#include <type_traits>
+
+// On-disk layout of the binary call traces written with GWD_TRACE_FILE.
+//
+// A trace is a FileHeader followed by fixed-size blocks. Each block is filled
+// by a single thread and starts with a BlockHeader; the records in it inherit
+// the block's thread ID. Blocks appear in the order they were flushed, so
+// records from different threads are only ordered by their timestamps. The
+// file may end in zeroed blocks, which have no block magic and are skipped.
+//
+// Every record is a RecordHeader followed by the record's fixed struct, and
+// for some records an array of elements, padded to 8 bytes. Handles are
+// stored as 64-bit values whatever the platform.
+namespace GWD {
+namespace Trace {
+
+static constexpr uint32_t kFileMagic = 0x54445747;  // "GWDT"
+static constexpr uint32_t kBlockMagic = 0x4b4c4247;  // "GBLK"
+static constexpr uint32_t kVersion = 2;
+static constexpr uint32_t kBlockSize = 64 * 1024;
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t block_size;
+  uint32_t first_block_offset;
+};
+
+struct BlockHeader {
+  uint32_t magic;
+  uint32_t thread_id;
+  // Including this header
+  uint32_t used_bytes;
+  uint32_t reserved;
+};
+
+enum class RecordType : uint16_t {
+  kCreateDevice = 1,
+  kDestroyDevice,
+  kAllocateMemory,
+  kFreeMemory,
+  kMapMemory,
+  kUnmapMemory,
+  kCreateBuffer,
+  kDestroyBuffer,
+  kBindBufferMemory,
+  kCreateImage,
+  kDestroyImage,
+  kBindImageMemory,
+  kAllocateCommandBuffer,
+  kBeginCommandBuffer,
+  kCmdBindIndexBuffer,
+  kCmdBindVertexBuffers,
+  kCmdDraw,
+  kCmdDrawIndexed,
+  kCmdDrawIndirect,
+  kCmdDrawIndexedIndirect,
+  kQueueSubmit,
+  kFreeCommandBuffer,
+  kDestroyCommandPool,
+  kGetDeviceQueue,
+  kAcquireNextImage,
+  kQueuePresent,
+  kCmdBindPipeline,
+  kCmdBindDescriptorSets,
+  kCmdDrawIndirectCount,
+  kCmdDrawIndexedIndirectCount,
+  kAllocateDescriptorSet,
+  kFreeDescriptorSet,
+  kResetDescriptorPool,
+  kDestroyDescriptorPool,
+  kUpdateDescriptorSet,
+  kCopyDescriptorSet,
+  kCmdDispatch,
+  kCmdDispatchIndirect,
+  kUpdateDescriptorSetWithTemplate,
+  kCmdExecuteCommands,
+};
+
+struct RecordHeader {
+  RecordType type;
+  // Including this header and any padding
+  uint16_t size;
+  uint32_t reserved;
+  // Steady clock, in nanoseconds
+  uint64_t timestamp_ns;
+};
+
+struct CreateDevice {
+  static constexpr RecordType kType = RecordType::kCreateDevice;
+  uint64_t device;
+  uint64_t physical_device;
+  uint32_t max_memory_allocation_count;
+  uint32_t reserved;
+  VkPhysicalDeviceMemoryProperties memory_properties;
+};
+
+struct DestroyDevice {
+  static constexpr RecordType kType = RecordType::kDestroyDevice;
+  uint64_t device;
+};
+
+struct AllocateMemory {
+  static constexpr RecordType kType = RecordType::kAllocateMemory;
+  uint64_t device;
+  uint64_t memory;
+  uint64_t size;
+  uint32_t memory_type_index;
+  int32_t result;
+};
+
+struct FreeMemory {
+  static constexpr RecordType kType = RecordType::kFreeMemory;
+  uint64_t device;
+  uint64_t memory;
+};
+
+struct MapMemory {
+  static constexpr RecordType kType = RecordType::kMapMemory;
+  uint64_t device;
+  uint64_t memory;
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct UnmapMemory {
+  static constexpr RecordType kType = RecordType::kUnmapMemory;
+  uint64_t device;
+  uint64_t memory;
+};
+
+struct CreateBuffer {
+  static constexpr RecordType kType = RecordType::kCreateBuffer;
+  uint64_t device;
+  uint64_t buffer;
+  uint64_t size;
+  uint32_t usage;
+  uint32_t flags;
+};
+
+struct DestroyBuffer {
+  static constexpr RecordType kType = RecordType::kDestroyBuffer;
+  uint64_t device;
+  uint64_t buffer;
+};
+
+// One per buffer for vkBindBufferMemory2
+struct BindBufferMemory {
+  static constexpr RecordType kType = RecordType::kBindBufferMemory;
+  uint64_t device;
+  uint64_t buffer;
+  uint64_t memory;
+  uint64_t offset;
+};
+
+struct CreateImage {
+  static constexpr RecordType kType = RecordType::kCreateImage;
+  uint64_t device;
+  uint64_t image;
+  uint32_t format;
+  uint32_t tiling;
+  uint32_t usage;
+  uint32_t samples;
+  uint32_t width;
+  uint32_t height;
+  uint32_t depth;
+  uint32_t array_layers;
+};
+
+struct DestroyImage {
+  static constexpr RecordType kType = RecordType::kDestroyImage;
+  uint64_t device;
+  uint64_t image;
+};
+
+// One per image for vkBindImageMemory2
+struct BindImageMemory {
+  static constexpr RecordType kType = RecordType::kBindImageMemory;
+  uint64_t device;
+  uint64_t image;
+  uint64_t memory;
+  uint64_t offset;
+};
+
+// One per command buffer of a vkAllocateCommandBuffers call
+struct AllocateCommandBuffer {
+  static constexpr RecordType kType = RecordType::kAllocateCommandBuffer;
+  uint64_t device;
+  uint64_t command_pool;
+  uint64_t command_buffer;
+};
+
+// One per command buffer of a vkFreeCommandBuffers call
+struct FreeCommandBuffer {
+  static constexpr RecordType kType = RecordType::kFreeCommandBuffer;
+  uint64_t device;
+  uint64_t command_pool;
+  uint64_t command_buffer;
+};
+
+// Implicitly frees the pool's command buffers
+struct DestroyCommandPool {
+  static constexpr RecordType kType = RecordType::kDestroyCommandPool;
+  uint64_t device;
+  uint64_t command_pool;
+};
+
+// One per descriptor set of a vkAllocateDescriptorSets call
+struct AllocateDescriptorSet {
+  static constexpr RecordType kType = RecordType::kAllocateDescriptorSet;
+  uint64_t device;
+  uint64_t descriptor_pool;
+  uint64_t descriptor_set;
+};
+
+// One per descriptor set of a vkFreeDescriptorSets call
+struct FreeDescriptorSet {
+  static constexpr RecordType kType = RecordType::kFreeDescriptorSet;
+  uint64_t device;
+  uint64_t descriptor_pool;
+  uint64_t descriptor_set;
+};
+
+// Implicitly frees the pool's descriptor sets
+struct ResetDescriptorPool {
+  static constexpr RecordType kType = RecordType::kResetDescriptorPool;
+  uint64_t device;
+  uint64_t descriptor_pool;
+};
+
+// Implicitly frees the pool's descriptor sets
+struct DestroyDescriptorPool {
+  static constexpr RecordType kType = RecordType::kDestroyDescriptorPool;
+  uint64_t device;
+  uint64_t descriptor_pool;
+};
+
+// One per VkWriteDescriptorSet of a vkUpdateDescriptorSets call. For buffer
+// descriptor types it is followed by descriptor_count buffer handles, and
+// large writes are split over several records; ranges are left out. Other
+// types carry no elements.
+struct UpdateDescriptorSet {
+  static constexpr RecordType kType = RecordType::kUpdateDescriptorSet;
+  uint64_t device;
+  uint64_t descriptor_set;
+  uint32_t binding;
+  uint32_t array_element;
+  uint32_t descriptor_type;
+  uint32_t descriptor_count;
+};
+
+// One per VkCopyDescriptorSet of a vkUpdateDescriptorSets call
+struct CopyDescriptorSet {
+  static constexpr RecordType kType = RecordType::kCopyDescriptorSet;
+  uint64_t device;
+  uint64_t src_set;
+  uint64_t dst_set;
+  uint32_t src_binding;
+  uint32_t src_array_element;
+  uint32_t dst_binding;
+  uint32_t dst_array_element;
+  uint32_t descriptor_count;
+  uint32_t reserved;
+};
+
+// Also written for vkUpdateDescriptorSetWithTemplateKHR. The template and its
+// data are left out, so only the update itself can be replayed.
+struct UpdateDescriptorSetWithTemplate {
+  static constexpr RecordType kType =
+      RecordType::kUpdateDescriptorSetWithTemplate;
+  uint64_t device;
+  uint64_t descriptor_set;
+  uint64_t descriptor_update_template;
+};
+
+struct BeginCommandBuffer {
+  static constexpr RecordType kType = RecordType::kBeginCommandBuffer;
+  uint64_t command_buffer;
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+struct CmdBindIndexBuffer {
+  static constexpr RecordType kType = RecordType::kCmdBindIndexBuffer;
+  uint64_t command_buffer;
+  uint64_t buffer;
+  uint64_t offset;
+  uint32_t index_type;
+  uint32_t reserved;
+};
+
+// Followed by binding_count VertexBufferBinding elements
+struct CmdBindVertexBuffers {
+  static constexpr RecordType kType = RecordType::kCmdBindVertexBuffers;
+  uint64_t command_buffer;
+  uint32_t first_binding;
+  uint32_t binding_count;
+};
+
+struct VertexBufferBinding {
+  uint64_t buffer;
+  uint64_t offset;
+};
+
+struct CmdBindPipeline {
+  static constexpr RecordType kType = RecordType::kCmdBindPipeline;
+  uint64_t command_buffer;
+  uint64_t pipeline;
+  uint32_t bind_point;
+  uint32_t reserved;
+};
+
+// Followed by descriptor_set_count descriptor set handles. The dynamic
+// offsets themselves are left out.
+struct CmdBindDescriptorSets {
+  static constexpr RecordType kType = RecordType::kCmdBindDescriptorSets;
+  uint64_t command_buffer;
+  uint64_t layout;
+  uint32_t bind_point;
+  uint32_t first_set;
+  uint32_t descriptor_set_count;
+  uint32_t dynamic_offset_count;
+};
+
+struct CmdDraw {
+  static constexpr RecordType kType = RecordType::kCmdDraw;
+  uint64_t command_buffer;
+  uint32_t vertex_count;
+  uint32_t instance_count;
+  uint32_t first_vertex;
+  uint32_t first_instance;
+};
+
+struct CmdDrawIndexed {
+  static constexpr RecordType kType = RecordType::kCmdDrawIndexed;
+  uint64_t command_buffer;
+  uint32_t index_count;
+  uint32_t instance_count;
+  uint32_t first_index;
+  int32_t vertex_offset;
+  uint32_t first_instance;
+  uint32_t reserved;
+};
+
+struct CmdDrawIndirect {
+  static constexpr RecordType kType = RecordType::kCmdDrawIndirect;
+  uint64_t command_buffer;
+  uint64_t buffer;
+  uint64_t offset;
+  uint32_t draw_count;
+  uint32_t stride;
+};
+
+struct CmdDrawIndexedIndirect {
+  static constexpr RecordType kType = RecordType::kCmdDrawIndexedIndirect;
+  uint64_t command_buffer;
+  uint64_t buffer;
+  uint64_t offset;
+  uint32_t draw_count;
+  uint32_t stride;
+};
+
+// Also written for vkCmdDrawIndirectCountKHR
+struct CmdDrawIndirectCount {
+  static constexpr RecordType kType = RecordType::kCmdDrawIndirectCount;
+  uint64_t command_buffer;
+  uint64_t buffer;
+  uint64_t offset;
+  uint64_t count_buffer;
+  uint64_t count_buffer_offset;
+  uint32_t max_draw_count;
+  uint32_t stride;
+};
+
+// Also written for vkCmdDrawIndexedIndirectCountKHR
+struct CmdDrawIndexedIndirectCount {
+  static constexpr RecordType kType = RecordType::kCmdDrawIndexedIndirectCount;
+  uint64_t command_buffer;
+  uint64_t buffer;
+  uint64_t offset;
+  uint64_t count_buffer;
+  uint64_t count_buffer_offset;
+  uint32_t max_draw_count;
+  uint32_t stride;
+};
+
+struct CmdDispatch {
+  static constexpr RecordType kType = RecordType::kCmdDispatch;
+  uint64_t command_buffer;
+  uint32_t group_count_x;
+  uint32_t group_count_y;
+  uint32_t group_count_z;
+  uint32_t reserved;
+};
+
+struct CmdDispatchIndirect {
+  static constexpr RecordType kType = RecordType::kCmdDispatchIndirect;
+  uint64_t command_buffer;
+  uint64_t buffer;
+  uint64_t offset;
+};
+
+// The secondary command buffers themselves are not recorded, only that the
+// primary's bound state ends here
+struct CmdExecuteCommands {
+  static constexpr RecordType kType = RecordType::kCmdExecuteCommands;
+  uint64_t command_buffer;
+  uint32_t command_buffer_count;
+  uint32_t reserved;
+};
+
+// One per VkSubmitInfo, followed by command_buffer_count command buffer
+// handles. Large batches are split over several records with the same
+// submit_index, and a call without any VkSubmitInfo still gets one empty
+// record. A call's records are written back to back by one thread; the last
+// one has submit_index + 1 == submit_count and ends the submit's command
+// buffers.
+struct QueueSubmit {
+  static constexpr RecordType kType = RecordType::kQueueSubmit;
+  uint64_t queue;
+  uint64_t fence;
+  uint32_t submit_count;
+  uint32_t submit_index;
+  // Of the whole VkSubmitInfo
+  uint32_t submit_command_buffer_count;
+  uint32_t first_command_buffer;
+  uint32_t command_buffer_count;
+  uint32_t reserved;
+};
+
+// Queues are only named by their handle in later records
+struct GetDeviceQueue {
+  static constexpr RecordType kType = RecordType::kGetDeviceQueue;
+  uint64_t device;
+  uint64_t queue;
+  uint32_t queue_family_index;
+  uint32_t queue_index;
+};
+
+struct AcquireNextImage {
+  static constexpr RecordType kType = RecordType::kAcquireNextImage;
+  uint64_t device;
+  uint64_t swapchain;
+  uint32_t image_index;
+  int32_t result;
+};
+
+struct QueuePresent {
+  static constexpr RecordType kType = RecordType::kQueuePresent;
+  uint64_t queue;
+  uint32_t swapchain_count;
+  int32_t result;
+};
+
+// Records are copied into the trace as raw bytes
+#define GWD_TRACE_RECORD(Record)                               \
+  static_assert(std::is_trivially_copyable<Record>::value &&  \
+                    sizeof(Record) % 8 == 0,                   \
+                #Record " must be trivially copyable and 8 byte sized");
+GWD_TRACE_RECORD(RecordHeader)
+GWD_TRACE_RECORD(CreateDevice)
+GWD_TRACE_RECORD(DestroyDevice)
+GWD_TRACE_RECORD(AllocateMemory)
+GWD_TRACE_RECORD(FreeMemory)
+GWD_TRACE_RECORD(MapMemory)
+GWD_TRACE_RECORD(UnmapMemory)
+GWD_TRACE_RECORD(CreateBuffer)
+GWD_TRACE_RECORD(DestroyBuffer)
+GWD_TRACE_RECORD(BindBufferMemory)
+GWD_TRACE_RECORD(CreateImage)
+GWD_TRACE_RECORD(DestroyImage)
+GWD_TRACE_RECORD(BindImageMemory)
+GWD_TRACE_RECORD(AllocateCommandBuffer)
+GWD_TRACE_RECORD(FreeCommandBuffer)
+GWD_TRACE_RECORD(DestroyCommandPool)
+GWD_TRACE_RECORD(AllocateDescriptorSet)
+GWD_TRACE_RECORD(FreeDescriptorSet)
+GWD_TRACE_RECORD(ResetDescriptorPool)
+GWD_TRACE_RECORD(DestroyDescriptorPool)
+GWD_TRACE_RECORD(UpdateDescriptorSet)
+GWD_TRACE_RECORD(CopyDescriptorSet)
+GWD_TRACE_RECORD(UpdateDescriptorSetWithTemplate)
+GWD_TRACE_RECORD(BeginCommandBuffer)
+GWD_TRACE_RECORD(CmdBindIndexBuffer)
+GWD_TRACE_RECORD(CmdBindVertexBuffers)
+GWD_TRACE_RECORD(VertexBufferBinding)
+GWD_TRACE_RECORD(CmdBindPipeline)
+GWD_TRACE_RECORD(CmdBindDescriptorSets)
+GWD_TRACE_RECORD(CmdDraw)
+GWD_TRACE_RECORD(CmdDrawIndexed)
+GWD_TRACE_RECORD(CmdDrawIndirect)
+GWD_TRACE_RECORD(CmdDrawIndexedIndirect)
+GWD_TRACE_RECORD(CmdDrawIndirectCount)
+GWD_TRACE_RECORD(CmdDrawIndexedIndirectCount)
+GWD_TRACE_RECORD(CmdDispatch)
+GWD_TRACE_RECORD(CmdDispatchIndirect)
+GWD_TRACE_RECORD(CmdExecuteCommands)
+GWD_TRACE_RECORD(QueueSubmit)
+GWD_TRACE_RECORD(GetDeviceQueue)
+GWD_TRACE_RECORD(AcquireNextImage)
+GWD_TRACE_RECORD(QueuePresent)
+#undef GWD_TRACE_RECORD
+
+}  // namespace Trace
+}  // namespace GWD
@@ -0,0 +1,159 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define NOMINMAX
+
+#include "traceReader.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else  // defined(WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // defined(WIN32)
+
+namespace GWD {
+
+std::unique_ptr<TraceReader> TraceReader::Open(const std::string& path,
+                                               std::string* error) {
+  std::unique_ptr<TraceReader> reader(new TraceReader);
+
+#if defined(WIN32)
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    *error = "can't open " + path;
+    return nullptr;
+  }
+  reader->m_file = file;
+  LARGE_INTEGER file_size = {};
+  GetFileSizeEx(file, &file_size);
+  reader->m_size = (uint64_t)file_size.QuadPart;
+  if (reader->m_size >= sizeof(Trace::FileHeader)) {
+    HANDLE mapping =
+        CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping != nullptr) {
+      reader->m_mapping = mapping;
+      reader->m_data =
+          (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+  }
+#else   // defined(WIN32)
+  int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file < 0) {
+    *error = "can't open " + path;
+    return nullptr;
+  }
+  struct stat file_stat = {};
+  fstat(file, &file_stat);
+  reader->m_size = (uint64_t)file_stat.st_size;
+  if (reader->m_size >= sizeof(Trace::FileHeader)) {
+    void* mapped =
+        mmap(nullptr, reader->m_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (mapped != MAP_FAILED) {
+      reader->m_data = (const uint8_t*)mapped;
+      // Records are read front to back within each block
+      madvise(mapped, reader->m_size, MADV_WILLNEED);
+    }
+  }
+  // The mapping outlives the descriptor
+  close(file);
+#endif  // defined(WIN32)
+
+  if (reader->m_data == nullptr) {
+    *error = "can't map " + path;
+    return nullptr;
+  }
+
+  const Trace::FileHeader* header = (const Trace::FileHeader*)reader->m_data;
+  if (header->magic != Trace::kFileMagic) {
+    *error = path + " isn't a WitchDoctor trace";
+    return nullptr;
+  }
+  if (header->version != Trace::kVersion ||
+      header->block_size != Trace::kBlockSize) {
+    *error = path + " has unsupported trace version " +
+             std::to_string(header->version);
+    return nullptr;
+  }
+
+  for (uint64_t offset = header->first_block_offset;
+       offset + header->block_size <= reader->m_size;
+       offset += header->block_size) {
+    const Trace::BlockHeader* block =
+        (const Trace::BlockHeader*)(reader->m_data + offset);
+    if (block->magic == Trace::kBlockMagic &&
+        block->used_bytes <= header->block_size) {
+      reader->m_blocks.push_back(block);
+    }
+  }
+
+  return reader;
+}
+
+TraceReader::~TraceReader() {
+#if defined(WIN32)
+  if (m_data != nullptr) {
+    UnmapViewOfFile(m_data);
+  }
+  if (m_mapping != nullptr) {
+    CloseHandle(m_mapping);
+  }
+  if (m_file != nullptr) {
+    CloseHandle(m_file);
+  }
+#else   // defined(WIN32)
+  if (m_data != nullptr) {
+    munmap((void*)m_data, m_size);
+  }
+#endif  // defined(WIN32)
+}
+
+TraceReader::RecordCursor::RecordCursor(
+    std::vector<const Trace::BlockHeader*> blocks)
+    : m_blocks(std::move(blocks)) {
+  Seek();
+}
+
+void TraceReader::RecordCursor::Next() {
+  if (m_record != nullptr) {
+    m_offset += m_record->size;
+    Seek();
+  }
+}
+
+void TraceReader::RecordCursor::Seek() {
+  m_record = nullptr;
+  while (m_block_index < m_blocks.size()) {
+    const Trace::BlockHeader* block = m_blocks[m_block_index];
+    if (m_offset + sizeof(Trace::RecordHeader) <= block->used_bytes) {
+      const Trace::RecordHeader* record =
+          (const Trace::RecordHeader*)((const uint8_t*)block + m_offset);
+      if (record->size >= sizeof(Trace::RecordHeader) &&
+          m_offset + record->size <= block->used_bytes) {
+        m_record = record;
+        return;
+      }
+    }
+    m_block_index++;
+    m_offset = sizeof(Trace::BlockHeader);
+  }
+}
+
+}  // namespace GWD
@@ -0,0 +1,110 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "traceFormat.h"
+
+namespace GWD {
+
+// Read-only view of a trace written by TraceWriter. The whole file is mapped,
+// so records are read in place and blocks can be walked from any thread.
+class TraceReader {
+ public:
+  // Returns nullptr and sets error if the file can't be mapped or isn't a
+  // trace this version understands
+  static std::unique_ptr<TraceReader> Open(const std::string& path,
+                                           std::string* error);
+  ~TraceReader();
+
+  TraceReader(const TraceReader&) = delete;
+  TraceReader& operator=(const TraceReader&) = delete;
+
+  uint64_t GetFileSize() const { return m_size; }
+
+  // Every block that holds records, in file order. Zeroed blocks left at the
+  // end of the file and damaged blocks are skipped.
+  const std::vector<const Trace::BlockHeader*>& GetBlocks() const {
+    return m_blocks;
+  }
+
+  // Walks the records of a sequence of blocks in order, e.g. every block of
+  // one thread. Stops reading a block at the first record whose size doesn't
+  // fit it.
+  class RecordCursor {
+   public:
+    explicit RecordCursor(std::vector<const Trace::BlockHeader*> blocks);
+
+    // nullptr once every record has been read
+    const Trace::RecordHeader* Get() const { return m_record; }
+    void Next();
+
+   private:
+    // Settles on the record at m_offset of the current block, moving on to
+    // the next block when there is none
+    void Seek();
+
+    std::vector<const Trace::BlockHeader*> m_blocks;
+    size_t m_block_index = 0;
+    size_t m_offset = sizeof(Trace::BlockHeader);
+    const Trace::RecordHeader* m_record = nullptr;
+  };
+
+  // The fixed part of a record, or nullptr if the record is too short to
+  // hold it, e.g. when it comes from a newer layer
+  template <typename Record>
+  static const Record* GetRecord(const Trace::RecordHeader* header) {
+    if (header->type != Record::kType ||
+        header->size < sizeof(Trace::RecordHeader) + sizeof(Record)) {
+      return nullptr;
+    }
+    return (const Record*)(header + 1);
+  }
+
+  // The elements following a record's fixed part. element_count is clamped
+  // to what the record actually holds.
+  template <typename Record, typename Element>
+  static const Element* GetElements(const Trace::RecordHeader* header,
+                                    uint32_t* element_count) {
+    const size_t available =
+        (header->size - sizeof(Trace::RecordHeader) - sizeof(Record)) /
+        sizeof(Element);
+    if (*element_count > available) {
+      *element_count = (uint32_t)available;
+    }
+    return (const Element*)((const uint8_t*)(header + 1) + sizeof(Record));
+  }
+
+ private:
+  TraceReader() = default;
+
+  const uint8_t* m_data = nullptr;
+  uint64_t m_size = 0;
+#if defined(WIN32)
+  void* m_file = nullptr;
+  void* m_mapping = nullptr;
+#endif  // defined(WIN32)
+
+  std::vector<const Trace::BlockHeader*> m_blocks;
+};
+
+}  // namespace GWD
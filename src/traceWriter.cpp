@@ -0,0 +1,249 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#define NOMINMAX
+
+#include "traceWriter.h"
+#include "layerSettings.h"
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#if defined(WIN32)
+#include <windows.h>
+#else  // defined(WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif  // defined(WIN32)
+
+namespace GWD {
+
+// Hands the calling thread's buffer back to the writer when the thread exits
+struct ThreadBufferHolder {
+  TraceWriter* writer = nullptr;
+  TraceWriter::ThreadBuffer* buffer = nullptr;
+
+  ~ThreadBufferHolder() {
+    if (buffer != nullptr) {
+      writer->ReleaseThreadBuffer(buffer);
+    }
+  }
+};
+
+static thread_local ThreadBufferHolder t_thread_buffer;
+
+TraceWriter* TraceWriter::Get() {
+  static TraceWriter* s_writer =
+      GetLayerSettings().trace_file.empty()
+          ? nullptr
+          : Create(GetLayerSettings().trace_file);
+  return s_writer;
+}
+
+TraceWriter::TraceWriter(FileHandle file) : m_file(file) {
+  for (auto& segment : m_segments) {
+    segment.store(nullptr, std::memory_order_relaxed);
+  }
+  // Block 0 holds the file header
+  m_next_block_offset.store(Trace::kBlockSize, std::memory_order_relaxed);
+}
+
+TraceWriter* TraceWriter::Create(const std::string& path) {
+#if defined(WIN32)
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+#else   // defined(WIN32)
+  int file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (file < 0) {
+    return nullptr;
+  }
+#endif  // defined(WIN32)
+
+  TraceWriter* writer = new TraceWriter(file);
+  uint8_t* first_segment = writer->GetSegment(0);
+  if (first_segment == nullptr) {
+    // Writers are never destroyed, so this one is simply abandoned
+    return nullptr;
+  }
+
+  Trace::FileHeader header = {};
+  header.magic = Trace::kFileMagic;
+  header.version = Trace::kVersion;
+  header.block_size = Trace::kBlockSize;
+  header.first_block_offset = Trace::kBlockSize;
+  memcpy(first_segment, &header, sizeof(header));
+  return writer;
+}
+
+// Segments are mapped on first use. The file is grown to cover them first, and
+// since blocks are claimed in order, segments are nearly always requested in
+// order too.
+uint8_t* TraceWriter::GetSegment(size_t segment_index) {
+  if (segment_index >= kMaxSegments) {
+    return nullptr;
+  }
+  uint8_t* segment = m_segments[segment_index].load(std::memory_order_acquire);
+  if (segment != nullptr) {
+    return segment;
+  }
+
+  std::lock_guard<std::mutex> lock(m_segment_mutex);
+  segment = m_segments[segment_index].load(std::memory_order_relaxed);
+  if (segment != nullptr) {
+    return segment;
+  }
+
+  const uint64_t segment_offset = segment_index * kSegmentSize;
+  const uint64_t file_size =
+      std::max(m_file_size, segment_offset + kSegmentSize);
+#if defined(WIN32)
+  // Creating the mapping with a larger size grows the file, and the view keeps
+  // the mapping alive once its handle is closed
+  HANDLE mapping =
+      CreateFileMappingA(m_file, nullptr, PAGE_READWRITE,
+                         (DWORD)(file_size >> 32), (DWORD)file_size, nullptr);
+  if (mapping == nullptr) {
+    return nullptr;
+  }
+  segment = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_WRITE,
+                                    (DWORD)(segment_offset >> 32),
+                                    (DWORD)segment_offset, kSegmentSize);
+  CloseHandle(mapping);
+  if (segment == nullptr) {
+    return nullptr;
+  }
+#else   // defined(WIN32)
+  if (file_size > m_file_size && ftruncate(m_file, (off_t)file_size) != 0) {
+    return nullptr;
+  }
+  void* mapped = mmap(nullptr, kSegmentSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, m_file, (off_t)segment_offset);
+  if (mapped == MAP_FAILED) {
+    return nullptr;
+  }
+  segment = (uint8_t*)mapped;
+#endif  // defined(WIN32)
+  m_file_size = file_size;
+
+  m_segments[segment_index].store(segment, std::memory_order_release);
+  return segment;
+}
+
+TraceWriter::ThreadBuffer* TraceWriter::GetThreadBuffer() {
+  if (t_thread_buffer.buffer != nullptr) {
+    return t_thread_buffer.buffer;
+  }
+
+  std::lock_guard<std::mutex> lock(m_thread_buffers_mutex);
+  ThreadBuffer* buffer = nullptr;
+  for (auto& candidate : m_thread_buffers) {
+    if (!candidate->in_use) {
+      buffer = candidate.get();
+      break;
+    }
+  }
+  if (buffer == nullptr) {
+    m_thread_buffers.emplace_back(new ThreadBuffer);
+    buffer = m_thread_buffers.back().get();
+  }
+
+  std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+  buffer->in_use = true;
+  buffer->thread_id = m_next_thread_id++;
+  buffer->used_bytes = sizeof(Trace::BlockHeader);
+
+  t_thread_buffer.writer = this;
+  t_thread_buffer.buffer = buffer;
+  return buffer;
+}
+
+void TraceWriter::ReleaseThreadBuffer(ThreadBuffer* buffer) {
+  std::lock_guard<std::mutex> lock(m_thread_buffers_mutex);
+  std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+  FlushBlock(buffer);
+  buffer->in_use = false;
+}
+
+void TraceWriter::Write(Trace::RecordType type, const void* data, size_t size,
+                        const void* tail, size_t tail_size) {
+  const size_t unpadded_size = sizeof(Trace::RecordHeader) + size + tail_size;
+  const size_t record_size = (unpadded_size + 7) & ~(size_t)7;
+  if (record_size > kMaxRecordSize) {
+    return;
+  }
+
+  Trace::RecordHeader header = {};
+  header.type = type;
+  header.size = (uint16_t)record_size;
+  header.timestamp_ns =
+      (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+
+  ThreadBuffer* buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+
+  if (buffer->used_bytes + record_size > Trace::kBlockSize) {
+    FlushBlock(buffer);
+  }
+
+  uint8_t* record = buffer->data.data() + buffer->used_bytes;
+  memcpy(record, &header, sizeof(header));
+  memcpy(record + sizeof(header), data, size);
+  if (tail_size > 0) {
+    memcpy(record + sizeof(header) + size, tail, tail_size);
+  }
+  memset(record + unpadded_size, 0, record_size - unpadded_size);
+  buffer->used_bytes += (uint32_t)record_size;
+}
+
+// Blocks that can't be placed, because the file couldn't grow, are dropped
+void TraceWriter::FlushBlock(ThreadBuffer* buffer) {
+  if (buffer->used_bytes <= sizeof(Trace::BlockHeader)) {
+    return;
+  }
+
+  Trace::BlockHeader block_header = {};
+  block_header.magic = Trace::kBlockMagic;
+  block_header.thread_id = buffer->thread_id;
+  block_header.used_bytes = buffer->used_bytes;
+  memcpy(buffer->data.data(), &block_header, sizeof(block_header));
+
+  const uint64_t block_offset =
+      m_next_block_offset.fetch_add(Trace::kBlockSize);
+  uint8_t* segment = GetSegment((size_t)(block_offset / kSegmentSize));
+  if (segment != nullptr) {
+    memcpy(segment + block_offset % kSegmentSize, buffer->data.data(),
+           buffer->used_bytes);
+  }
+  buffer->used_bytes = sizeof(Trace::BlockHeader);
+}
+
+void TraceWriter::Flush() {
+  std::lock_guard<std::mutex> lock(m_thread_buffers_mutex);
+  for (auto& buffer : m_thread_buffers) {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    FlushBlock(buffer.get());
+  }
+}
+
+}  // namespace GWD
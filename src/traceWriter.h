@@ -0,0 +1,123 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "traceFormat.h"
+
+namespace GWD {
+
+// Capture mode (GWD_TRACE_FILE) that streams every intercepted call into a
+// binary trace, see traceFormat.h, for offline analysis.
+//
+// Records are copied as raw structs into a per-thread block, so the hot path
+// is a timestamp and a memcpy under a lock only the owning thread normally
+// takes. Full blocks are appended to a memory-mapped file: each flush claims
+// the next block of the file with an atomic add and copies into the mapping,
+// so threads never wait on each other or on file I/O. The file grows in
+// segments that stay mapped until the process exits.
+class TraceWriter {
+ public:
+  // The process-wide writer, or nullptr if tracing is off or the file
+  // couldn't be created. The writer is never destroyed, so that threads still
+  // recording at exit never touch a dead writer.
+  static TraceWriter* Get();
+
+  template <typename Record>
+  void Write(const Record& record) {
+    Write(Record::kType, &record, sizeof(record), nullptr, 0);
+  }
+
+  // For records followed by an array of elements
+  template <typename Record, typename Element>
+  void Write(const Record& record, const Element* elements, size_t count) {
+    Write(Record::kType, &record, sizeof(record), elements,
+          sizeof(Element) * count);
+  }
+
+  // Largest element array that fits in a record next to a fixed part of
+  // fixed_size bytes
+  static constexpr size_t MaxTailSize(size_t fixed_size) {
+    return kMaxRecordSize - sizeof(Trace::RecordHeader) - fixed_size;
+  }
+
+  // Pushes every thread's partial block to the file, e.g. when a device goes
+  // away, so a trace is complete even if the process never exits cleanly.
+  void Flush();
+
+ private:
+  static constexpr size_t kMaxRecordSize =
+      Trace::kBlockSize - sizeof(Trace::BlockHeader);
+  // Also the file growth step. A multiple of the block size, so blocks never
+  // straddle two mappings, and of the 64 KiB Windows mapping granularity.
+  static constexpr uint64_t kSegmentSize = 32 * 1024 * 1024;
+  static constexpr size_t kMaxSegments = 4096;
+
+  struct ThreadBuffer {
+    std::mutex mutex;
+    uint32_t thread_id = 0;
+    uint32_t used_bytes = 0;
+    // Buffers of exited threads are handed to new threads
+    bool in_use = false;
+    std::array<uint8_t, Trace::kBlockSize> data;
+  };
+
+  friend struct ThreadBufferHolder;
+
+#if defined(WIN32)
+  using FileHandle = void*;
+#else   // defined(WIN32)
+  using FileHandle = int;
+#endif  // defined(WIN32)
+
+  // Never destroyed, see Get()
+  explicit TraceWriter(FileHandle file);
+
+  static TraceWriter* Create(const std::string& path);
+  uint8_t* GetSegment(size_t segment_index);
+  ThreadBuffer* GetThreadBuffer();
+  void ReleaseThreadBuffer(ThreadBuffer* buffer);
+
+  void Write(Trace::RecordType type, const void* data, size_t size,
+             const void* tail, size_t tail_size);
+  // Called with the buffer's lock held
+  void FlushBlock(ThreadBuffer* buffer);
+
+  FileHandle m_file;
+
+  // Offset of the next block to be claimed
+  std::atomic<uint64_t> m_next_block_offset{0};
+
+  // Segments are mapped once and published for lock-free lookups
+  std::mutex m_segment_mutex;
+  std::array<std::atomic<uint8_t*>, kMaxSegments> m_segments;
+  uint64_t m_file_size = 0;
+
+  std::mutex m_thread_buffers_mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> m_thread_buffers;
+  uint32_t m_next_thread_id = 1;
+};
+
+}  // namespace GWD
@@ -0,0 +1,472 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+// Times the layer's intercepts on top of the stand-in driver. Every benchmark
+// runs twice, once through the layer and once straight into the driver, so
+// the difference is what the layer adds to each call. The report follows
+// Google Benchmark's console output, without pulling in the library.
+//
+// Usage: GwdInterceptBenchmark [--iterations N] [--filter SUBSTRING]
+
+#include "standInDriver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+namespace GWD {
+
+// The device functions the benchmarks call, fetched either through the layer
+// or straight from the stand-in driver
+struct DeviceProcs {
+  PFN_vkAllocateMemory allocate_memory;
+  PFN_vkFreeMemory free_memory;
+  PFN_vkCreateBuffer create_buffer;
+  PFN_vkDestroyBuffer destroy_buffer;
+  PFN_vkBeginCommandBuffer begin_command_buffer;
+  PFN_vkEndCommandBuffer end_command_buffer;
+  PFN_vkCmdBindPipeline cmd_bind_pipeline;
+  PFN_vkCmdBindDescriptorSets cmd_bind_descriptor_sets;
+  PFN_vkCmdBindVertexBuffers cmd_bind_vertex_buffers;
+  PFN_vkCmdBindIndexBuffer cmd_bind_index_buffer;
+  PFN_vkCmdDraw cmd_draw;
+  PFN_vkCmdDrawIndexed cmd_draw_indexed;
+  PFN_vkCmdDrawIndirect cmd_draw_indirect;
+  PFN_vkCmdDrawIndexedIndirect cmd_draw_indexed_indirect;
+  PFN_vkCmdDispatch cmd_dispatch;
+};
+
+#define GWD_GETPROC(member, func)                                     \
+  procs.member = through_layer                                       \
+                     ? device.GetLayerProc<PFN_vk##func>("vk" #func) \
+                     : device.GetDriverProc<PFN_vk##func>("vk" #func)
+
+static DeviceProcs LoadDeviceProcs(const LayeredDevice& device,
+                                   bool through_layer) {
+  DeviceProcs procs = {};
+  GWD_GETPROC(allocate_memory, AllocateMemory);
+  GWD_GETPROC(free_memory, FreeMemory);
+  GWD_GETPROC(create_buffer, CreateBuffer);
+  GWD_GETPROC(destroy_buffer, DestroyBuffer);
+  GWD_GETPROC(begin_command_buffer, BeginCommandBuffer);
+  GWD_GETPROC(end_command_buffer, EndCommandBuffer);
+  GWD_GETPROC(cmd_bind_pipeline, CmdBindPipeline);
+  GWD_GETPROC(cmd_bind_descriptor_sets, CmdBindDescriptorSets);
+  GWD_GETPROC(cmd_bind_vertex_buffers, CmdBindVertexBuffers);
+  GWD_GETPROC(cmd_bind_index_buffer, CmdBindIndexBuffer);
+  GWD_GETPROC(cmd_draw, CmdDraw);
+  GWD_GETPROC(cmd_draw_indexed, CmdDrawIndexed);
+  GWD_GETPROC(cmd_draw_indirect, CmdDrawIndirect);
+  GWD_GETPROC(cmd_draw_indexed_indirect, CmdDrawIndexedIndirect);
+  GWD_GETPROC(cmd_dispatch, CmdDispatch);
+  return procs;
+}
+
+#undef GWD_GETPROC
+
+// Nothing below dereferences these, so they only need to be distinct
+static const VkPipeline kPipelines[2] = {(VkPipeline)0x1600,
+                                         (VkPipeline)0x1601};
+static const VkPipelineLayout kPipelineLayout = (VkPipelineLayout)0x1700;
+static const VkDescriptorSet kDescriptorSets[2] = {(VkDescriptorSet)0x1800,
+                                                   (VkDescriptorSet)0x1801};
+
+// Large enough that 32-bit indices are warranted
+static constexpr VkDeviceSize kIndexBufferSize = 1 << 20;
+
+struct BenchmarkContext {
+  const DeviceProcs* procs = nullptr;
+  VkDevice device = VK_NULL_HANDLE;
+  VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+  VkBuffer vertex_buffer = VK_NULL_HANDLE;
+  VkBuffer index_buffer = VK_NULL_HANDLE;
+  VkBuffer indirect_buffer = VK_NULL_HANDLE;
+  uint32_t memory_type_index = 0;
+};
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t ElapsedNs(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              start)
+      .count();
+}
+
+// Command buffers are begun again every kCallsPerRecording calls, outside of
+// the timed section, so whatever the layer keeps per recording stays bounded.
+// Every recording starts out with a pipeline, vertex and index buffer bound,
+// the way draws would find them in a real title.
+static constexpr uint64_t kCallsPerRecording = 4096;
+
+template <typename Body>
+static uint64_t TimeRecordedCalls(const BenchmarkContext& context,
+                                  uint64_t iterations, Body body) {
+  const DeviceProcs& procs = *context.procs;
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  const VkDeviceSize vertex_offset = 0;
+
+  uint64_t elapsed_ns = 0;
+  for (uint64_t call_index = 0; call_index < iterations;) {
+    const uint64_t recording_end =
+        std::min(iterations, call_index + kCallsPerRecording);
+    procs.begin_command_buffer(context.command_buffer, &begin_info);
+    procs.cmd_bind_pipeline(context.command_buffer,
+                            VK_PIPELINE_BIND_POINT_GRAPHICS, kPipelines[0]);
+    procs.cmd_bind_vertex_buffers(context.command_buffer, 0, 1,
+                                  &context.vertex_buffer, &vertex_offset);
+    procs.cmd_bind_index_buffer(context.command_buffer, context.index_buffer,
+                                0, VK_INDEX_TYPE_UINT32);
+
+    const Clock::time_point start = Clock::now();
+    for (; call_index < recording_end; call_index++) {
+      body(call_index);
+    }
+    elapsed_ns += ElapsedNs(start);
+    procs.end_command_buffer(context.command_buffer);
+  }
+  return elapsed_ns;
+}
+
+template <typename Body>
+static uint64_t TimeCalls(uint64_t iterations, Body body) {
+  const Clock::time_point start = Clock::now();
+  for (uint64_t call_index = 0; call_index < iterations; call_index++) {
+    body(call_index);
+  }
+  return ElapsedNs(start);
+}
+
+static uint64_t BenchmarkCmdDraw(const BenchmarkContext& context,
+                                 uint64_t iterations) {
+  return TimeRecordedCalls(context, iterations, [&context](uint64_t index) {
+    context.procs->cmd_draw(context.command_buffer, 3, 1,
+                            (uint32_t)(index % kCallsPerRecording) * 3, 0);
+  });
+}
+
+static uint64_t BenchmarkCmdDrawIndexed(const BenchmarkContext& context,
+                                        uint64_t iterations) {
+  return TimeRecordedCalls(context, iterations, [&context](uint64_t index) {
+    context.procs->cmd_draw_indexed(
+        context.command_buffer, 3, 1,
+        (uint32_t)(index % kCallsPerRecording) * 3, 0, 0);
+  });
+}
+
+static uint64_t BenchmarkCmdDrawIndirect(const BenchmarkContext& context,
+                                         uint64_t iterations) {
+  return TimeRecordedCalls(context, iterations, [&context](uint64_t index) {
+    context.procs->cmd_draw_indirect(
+        context.command_buffer, context.indirect_buffer,
+        (index % kCallsPerRecording) * sizeof(VkDrawIndirectCommand), 1,
+        sizeof(VkDrawIndirectCommand));
+  });
+}
+
+static uint64_t BenchmarkCmdDrawIndexedIndirect(
+    const BenchmarkContext& context, uint64_t iterations) {
+  return TimeRecordedCalls(context, iterations, [&context](uint64_t index) {
+    context.procs->cmd_draw_indexed_indirect(
+        context.command_buffer, context.indirect_buffer,
+        (index % kCallsPerRecording) * sizeof(VkDrawIndexedIndirectCommand),
+        1, sizeof(VkDrawIndexedIndirectCommand));
+  });
+}
+
+static uint64_t BenchmarkCmdDispatch(const BenchmarkContext& context,
+                                     uint64_t iterations) {
+  return TimeRecordedCalls(context, iterations, [&context](uint64_t index) {
+    context.procs->cmd_dispatch(context.command_buffer, 64, 1, 1);
+  });
+}
+
+// The bind benchmarks alternate between two bindings, so every bind is a
+// change rather than a redundant one
+static uint64_t BenchmarkCmdBindPipeline(const BenchmarkContext& context,
+                                         uint64_t iterations) {
+  return TimeRecordedCalls(context, iterations, [&context](uint64_t index) {
+    context.procs->cmd_bind_pipeline(context.command_buffer,
+                                     VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                     kPipelines[(index + 1) & 1]);
+  });
+}
+
+static uint64_t BenchmarkCmdBindDescriptorSets(const BenchmarkContext& context,
+                                               uint64_t iterations) {
+  return TimeRecordedCalls(context, iterations, [&context](uint64_t index) {
+    context.procs->cmd_bind_descriptor_sets(
+        context.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+        kPipelineLayout, 0, 1, &kDescriptorSets[index & 1], 0, nullptr);
+  });
+}
+
+static uint64_t BenchmarkCmdBindVertexBuffers(const BenchmarkContext& context,
+                                              uint64_t iterations) {
+  return TimeRecordedCalls(context, iterations, [&context](uint64_t index) {
+    const VkDeviceSize offset = ((index + 1) & 1) * 256;
+    context.procs->cmd_bind_vertex_buffers(context.command_buffer, 0, 1,
+                                           &context.vertex_buffer, &offset);
+  });
+}
+
+static uint64_t BenchmarkCmdBindIndexBuffer(const BenchmarkContext& context,
+                                            uint64_t iterations) {
+  return TimeRecordedCalls(context, iterations, [&context](uint64_t index) {
+    context.procs->cmd_bind_index_buffer(context.command_buffer,
+                                         context.index_buffer,
+                                         ((index + 1) & 1) * 256,
+                                         VK_INDEX_TYPE_UINT32);
+  });
+}
+
+// One iteration is an allocation and its free
+static uint64_t BenchmarkAllocateFreeMemory(const BenchmarkContext& context,
+                                            uint64_t iterations) {
+  VkMemoryAllocateInfo allocate_info = {};
+  allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocate_info.allocationSize = 64 << 10;
+  allocate_info.memoryTypeIndex = context.memory_type_index;
+  return TimeCalls(iterations, [&context, &allocate_info](uint64_t index) {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    context.procs->allocate_memory(context.device, &allocate_info, nullptr,
+                                   &memory);
+    context.procs->free_memory(context.device, memory, nullptr);
+  });
+}
+
+// One iteration is a buffer's creation and destruction
+static uint64_t BenchmarkCreateDestroyBuffer(const BenchmarkContext& context,
+                                             uint64_t iterations) {
+  VkBufferCreateInfo create_info = {};
+  create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  create_info.size = 64 << 10;
+  create_info.usage =
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  return TimeCalls(iterations, [&context, &create_info](uint64_t index) {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    context.procs->create_buffer(context.device, &create_info, nullptr,
+                                 &buffer);
+    context.procs->destroy_buffer(context.device, buffer, nullptr);
+  });
+}
+
+struct Benchmark {
+  const char* name;
+  uint64_t (*run)(const BenchmarkContext& context, uint64_t iterations);
+};
+
+static const Benchmark kBenchmarks[] = {
+    {"vkCmdDraw", BenchmarkCmdDraw},
+    {"vkCmdDrawIndexed", BenchmarkCmdDrawIndexed},
+    {"vkCmdDrawIndirect", BenchmarkCmdDrawIndirect},
+    {"vkCmdDrawIndexedIndirect", BenchmarkCmdDrawIndexedIndirect},
+    {"vkCmdDispatch", BenchmarkCmdDispatch},
+    {"vkCmdBindPipeline", BenchmarkCmdBindPipeline},
+    {"vkCmdBindDescriptorSets", BenchmarkCmdBindDescriptorSets},
+    {"vkCmdBindVertexBuffers", BenchmarkCmdBindVertexBuffers},
+    {"vkCmdBindIndexBuffer", BenchmarkCmdBindIndexBuffer},
+    {"vkAllocateMemory+vkFreeMemory", BenchmarkAllocateFreeMemory},
+    {"vkCreateBuffer+vkDestroyBuffer", BenchmarkCreateDestroyBuffer},
+};
+
+struct BenchmarkOptions {
+  uint64_t iterations = 1000000;
+  std::string filter;
+};
+
+static bool ParseBenchmarkOptions(int argc, char** argv,
+                                  BenchmarkOptions* options) {
+  for (int arg_index = 1; arg_index < argc; arg_index++) {
+    if (arg_index + 1 >= argc) {
+      return false;
+    }
+    const char* value = argv[arg_index + 1];
+    if (strcmp(argv[arg_index], "--iterations") == 0) {
+      options->iterations = strtoull(value, nullptr, 10);
+      if (options->iterations == 0) {
+        return false;
+      }
+    } else if (strcmp(argv[arg_index], "--filter") == 0) {
+      options->filter = value;
+    } else {
+      return false;
+    }
+    arg_index++;
+  }
+  return true;
+}
+
+// The buffers the draws and binds use, created through the layer so it knows
+// them as device-local
+class BenchmarkResources {
+ public:
+  explicit BenchmarkResources(const LayeredDevice& layered_device)
+      : m_layered_device(layered_device),
+        m_procs(LoadDeviceProcs(layered_device, true)) {
+    const VkDevice device = layered_device.GetDevice();
+    m_memory_type_index =
+        layered_device.FindMemoryType(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    VkMemoryAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocate_info.allocationSize = 4 * kIndexBufferSize;
+    allocate_info.memoryTypeIndex = m_memory_type_index;
+    m_procs.allocate_memory(device, &allocate_info, nullptr, &m_memory);
+
+    PFN_vkBindBufferMemory bind_buffer_memory =
+        layered_device.GetLayerProc<PFN_vkBindBufferMemory>(
+            "vkBindBufferMemory");
+    VkBufferCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    create_info.size = kIndexBufferSize;
+    const VkBufferUsageFlags usages[] = {VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                         VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT};
+    VkBuffer* buffers[] = {&m_vertex_buffer, &m_index_buffer,
+                           &m_indirect_buffer};
+    for (uint32_t buffer_index = 0; buffer_index < 3; buffer_index++) {
+      create_info.usage = usages[buffer_index];
+      m_procs.create_buffer(device, &create_info, nullptr,
+                            buffers[buffer_index]);
+      bind_buffer_memory(device, *buffers[buffer_index], m_memory,
+                         buffer_index * kIndexBufferSize);
+    }
+
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.queueFamilyIndex = layered_device.GetQueueFamilyIndex();
+    layered_device.GetLayerProc<PFN_vkCreateCommandPool>(
+        "vkCreateCommandPool")(device, &pool_info, nullptr, &m_command_pool);
+    VkCommandBufferAllocateInfo command_buffer_info = {};
+    command_buffer_info.sType =
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_info.commandPool = m_command_pool;
+    command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_info.commandBufferCount = 1;
+    layered_device.GetLayerProc<PFN_vkAllocateCommandBuffers>(
+        "vkAllocateCommandBuffers")(device, &command_buffer_info,
+                                    &m_command_buffer);
+  }
+
+  ~BenchmarkResources() {
+    const VkDevice device = m_layered_device.GetDevice();
+    m_layered_device.GetLayerProc<PFN_vkDestroyCommandPool>(
+        "vkDestroyCommandPool")(device, m_command_pool, nullptr);
+    m_procs.destroy_buffer(device, m_vertex_buffer, nullptr);
+    m_procs.destroy_buffer(device, m_index_buffer, nullptr);
+    m_procs.destroy_buffer(device, m_indirect_buffer, nullptr);
+    m_procs.free_memory(device, m_memory, nullptr);
+  }
+
+  BenchmarkContext MakeContext(const DeviceProcs* procs) const {
+    BenchmarkContext context;
+    context.procs = procs;
+    context.device = m_layered_device.GetDevice();
+    context.command_buffer = m_command_buffer;
+    context.vertex_buffer = m_vertex_buffer;
+    context.index_buffer = m_index_buffer;
+    context.indirect_buffer = m_indirect_buffer;
+    context.memory_type_index = m_memory_type_index;
+    return context;
+  }
+
+ private:
+  const LayeredDevice& m_layered_device;
+  DeviceProcs m_procs;
+  uint32_t m_memory_type_index = 0;
+  VkDeviceMemory m_memory = VK_NULL_HANDLE;
+  VkBuffer m_vertex_buffer = VK_NULL_HANDLE;
+  VkBuffer m_index_buffer = VK_NULL_HANDLE;
+  VkBuffer m_indirect_buffer = VK_NULL_HANDLE;
+  VkCommandPool m_command_pool = VK_NULL_HANDLE;
+  VkCommandBuffer m_command_buffer = VK_NULL_HANDLE;
+};
+
+static double NsPerCall(uint64_t elapsed_ns, uint64_t iterations) {
+  return (double)elapsed_ns / (double)iterations;
+}
+
+static bool RunBenchmarks(const BenchmarkOptions& options) {
+  std::string error;
+  std::unique_ptr<LayeredDevice> layered_device =
+      LayeredDevice::Create(StandInDriverConfig::MakeDiscrete(), &error);
+  if (!layered_device) {
+    fprintf(stderr, "GwdInterceptBenchmark: %s\n", error.c_str());
+    return false;
+  }
+
+  const DeviceProcs layer_procs = LoadDeviceProcs(*layered_device, true);
+  const DeviceProcs driver_procs = LoadDeviceProcs(*layered_device, false);
+  uint32_t benchmark_count = 0;
+  {
+    BenchmarkResources resources(*layered_device);
+    const BenchmarkContext layer_context = resources.MakeContext(&layer_procs);
+    const BenchmarkContext driver_context =
+        resources.MakeContext(&driver_procs);
+
+    const char* separator =
+        "------------------------------------------------------------------"
+        "----------\n";
+    printf("%s%-34s %10s %10s %10s %10s\n%s", separator, "Benchmark",
+           "Layer", "Driver", "Overhead", "Iterations", separator);
+    for (const Benchmark& benchmark : kBenchmarks) {
+      if (strstr(benchmark.name, options.filter.c_str()) == nullptr) {
+        continue;
+      }
+      // Warm up caches and whatever the layer creates lazily
+      const uint64_t warmup_iterations =
+          std::min(options.iterations, kCallsPerRecording);
+      benchmark.run(layer_context, warmup_iterations);
+      benchmark.run(driver_context, warmup_iterations);
+
+      const double layer_ns = NsPerCall(
+          benchmark.run(layer_context, options.iterations), options.iterations);
+      const double driver_ns =
+          NsPerCall(benchmark.run(driver_context, options.iterations),
+                    options.iterations);
+      printf("%-34s %7.1f ns %7.1f ns %7.1f ns %10llu\n", benchmark.name,
+             layer_ns, driver_ns, layer_ns - driver_ns,
+             (unsigned long long)options.iterations);
+      benchmark_count++;
+    }
+  }
+
+  if (benchmark_count == 0) {
+    fprintf(stderr, "GwdInterceptBenchmark: no benchmark matches '%s'\n",
+            options.filter.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace GWD
+
+int main(int argc, char** argv) {
+  GWD::BenchmarkOptions options;
+  if (!GWD::ParseBenchmarkOptions(argc, argv, &options)) {
+    fprintf(stderr,
+            "Usage: GwdInterceptBenchmark [--iterations N] "
+            "[--filter SUBSTRING]\n");
+    return 1;
+  }
+  return GWD::RunBenchmarks(options) ? 0 : 1;
+}
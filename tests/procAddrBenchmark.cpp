@@ -0,0 +1,195 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+// Compares the layer's hashed vkGetDeviceProcAddr name lookup against the
+// chain of strcmp calls it replaced, built here from the same intercept list.
+// Names the layer intercepts and names it only forwards are timed apart, as
+// the chain has to walk all the way to its end for the latter.
+//
+// Only the name lookup is timed: the layer's vkGetDeviceProcAddr is called
+// without a device, so it doesn't ask the driver below as well.
+//
+// Usage: GwdProcAddrBenchmark [--iterations N]
+
+#include "interceptList.h"
+#include "standInDriver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace GWD {
+
+#define GWD_STRCMP_LOOKUP(func)         \
+  if (strcmp(pName, "vk" #func) == 0) { \
+    return kFoundInChain;               \
+  }
+
+// What GwdGetDeviceProcAddr did before the hash table, minus the intercepts
+// themselves, which are out of reach from here
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+StrcmpChainGetDeviceProcAddr(VkDevice device, const char* pName) {
+  static const PFN_vkVoidFunction kFoundInChain =
+      (PFN_vkVoidFunction)&StrcmpChainGetDeviceProcAddr;
+  GWD_DEVICE_LEVEL_INTERCEPTS(GWD_STRCMP_LOOKUP)
+  return nullptr;
+}
+
+#undef GWD_STRCMP_LOOKUP
+
+#define GWD_INTERCEPT_NAME(func) "vk" #func,
+
+static const char* const kInterceptedNames[] = {
+    GWD_DEVICE_LEVEL_INTERCEPTS(GWD_INTERCEPT_NAME)};
+
+#undef GWD_INTERCEPT_NAME
+
+// Device functions an application would also look up, none of which the
+// layer intercepts
+static const char* const kForwardedNames[] = {
+    "vkCmdSetViewport",          "vkCmdSetScissor",
+    "vkCmdPushConstants",        "vkCmdBeginRenderPass",
+    "vkCmdEndRenderPass",        "vkCmdNextSubpass",
+    "vkCmdCopyBufferToImage",    "vkCmdCopyImage",
+    "vkCmdBlitImage",            "vkCmdClearColorImage",
+    "vkCmdSetStencilReference",  "vkCmdResetQueryPool",
+    "vkCreateGraphicsPipelines", "vkCreateComputePipelines",
+    "vkCreateImageView",         "vkCreateSampler",
+    "vkCreateSemaphore",         "vkCreateRenderPass",
+    "vkCreateFramebuffer",       "vkCreateShaderModule",
+    "vkCreatePipelineLayout",    "vkCreateDescriptorSetLayout",
+    "vkQueueWaitIdle",           "vkDeviceWaitIdle",
+};
+
+struct NameSet {
+  const char* name;
+  std::vector<const char*> proc_names;
+  bool intercepted;
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Looks the names up round robin. Returns the elapsed time and counts how
+// many lookups found an entry point.
+static uint64_t TimeLookups(PFN_vkGetDeviceProcAddr get_device_proc_addr,
+                            const std::vector<const char*>& proc_names,
+                            uint64_t iterations, uint64_t* found_count) {
+  uint64_t found = 0;
+  size_t name_index = 0;
+  const Clock::time_point start = Clock::now();
+  for (uint64_t iteration = 0; iteration < iterations; iteration++) {
+    found += get_device_proc_addr(VK_NULL_HANDLE, proc_names[name_index]) !=
+             nullptr;
+    if (++name_index == proc_names.size()) {
+      name_index = 0;
+    }
+  }
+  const uint64_t elapsed_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                           start)
+          .count();
+  *found_count = found;
+  return elapsed_ns;
+}
+
+static bool RunBenchmarks(uint64_t iterations) {
+  std::string error;
+  std::unique_ptr<LayeredDevice> layered_device =
+      LayeredDevice::Create(StandInDriverConfig::MakeDiscrete(), &error);
+  if (!layered_device) {
+    fprintf(stderr, "GwdProcAddrBenchmark: %s\n", error.c_str());
+    return false;
+  }
+  // What the loader would hand out for the layer's device
+  const PFN_vkGetDeviceProcAddr layer_get_device_proc_addr =
+      layered_device->GetLayerProc<PFN_vkGetDeviceProcAddr>(
+          "vkGetDeviceProcAddr");
+
+  const NameSet name_sets[] = {
+      {"intercepted",
+       std::vector<const char*>(std::begin(kInterceptedNames),
+                                std::end(kInterceptedNames)),
+       true},
+      {"forwarded",
+       std::vector<const char*>(std::begin(kForwardedNames),
+                                std::end(kForwardedNames)),
+       false},
+  };
+  struct Lookup {
+    const char* name;
+    PFN_vkGetDeviceProcAddr get_device_proc_addr;
+  };
+  const Lookup lookups[] = {
+      {"HashTable", layer_get_device_proc_addr},
+      {"StrcmpChain", StrcmpChainGetDeviceProcAddr},
+  };
+
+  const char* separator =
+      "------------------------------------------------------------------"
+      "----\n";
+  printf("%s%-44s %12s %12s\n%s", separator, "Benchmark", "Time",
+         "Iterations", separator);
+  bool all_found = true;
+  for (const NameSet& name_set : name_sets) {
+    for (const Lookup& lookup : lookups) {
+      uint64_t found_count = 0;
+      // Warm up the caches with one pass over the names
+      TimeLookups(lookup.get_device_proc_addr, name_set.proc_names,
+                  name_set.proc_names.size(), &found_count);
+      const uint64_t elapsed_ns =
+          TimeLookups(lookup.get_device_proc_addr, name_set.proc_names,
+                      iterations, &found_count);
+
+      const std::string benchmark_name = std::string("vkGetDeviceProcAddr/") +
+                                         lookup.name + "/" + name_set.name;
+      printf("%-44s %9.1f ns %12llu\n", benchmark_name.c_str(),
+             (double)elapsed_ns / (double)iterations,
+             (unsigned long long)iterations);
+
+      const uint64_t expected_count = name_set.intercepted ? iterations : 0;
+      if (found_count != expected_count) {
+        fprintf(stderr,
+                "GwdProcAddrBenchmark: %s found %llu of %llu %s names\n",
+                lookup.name, (unsigned long long)found_count,
+                (unsigned long long)iterations, name_set.name);
+        all_found = false;
+      }
+    }
+  }
+  return all_found;
+}
+
+}  // namespace GWD
+
+int main(int argc, char** argv) {
+  uint64_t iterations = 10000000;
+  if (argc == 3 && strcmp(argv[1], "--iterations") == 0) {
+    iterations = strtoull(argv[2], nullptr, 10);
+  } else if (argc != 1) {
+    iterations = 0;
+  }
+  if (iterations == 0) {
+    fprintf(stderr, "Usage: GwdProcAddrBenchmark [--iterations N]\n");
+    return 1;
+  }
+  return GWD::RunBenchmarks(iterations) ? 0 : 1;
+}
@@ -0,0 +1,386 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+// Records from 1, 2, 4, ... up to --max-threads threads at once through the
+// layer on the stand-in driver, and reports throughput and the latency
+// distribution of a bind+draw sequence at every thread count.
+//
+// Every thread records into its own command pool, so nothing but the layer's
+// shared state is contended: the command buffer states every command looks
+// up, the buffer and memory records that each recording's scratch buffers
+// are bound through with vkBindBufferMemory2, and the warnings the redundant
+// binds raise. Run with GWD_ASYNC_WARNINGS=1 to have those go through the
+// warning queue rather than straight to the reporter.
+//
+// Usage: GwdRecordingStressBenchmark [--max-threads N] [--sequences N]
+
+#include "standInDriver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace GWD {
+
+struct StressOptions {
+  uint32_t max_thread_count = 64;
+  // Bind+draw sequences per thread and thread count
+  uint32_t sequence_count = 100000;
+};
+
+static bool ParseStressOptions(int argc, char** argv, StressOptions* options) {
+  for (int arg_index = 1; arg_index < argc; arg_index += 2) {
+    if (arg_index + 1 >= argc) {
+      return false;
+    }
+    const uint32_t value = (uint32_t)atoi(argv[arg_index + 1]);
+    if (strcmp(argv[arg_index], "--max-threads") == 0) {
+      options->max_thread_count = std::min(std::max(value, 1u), 1024u);
+    } else if (strcmp(argv[arg_index], "--sequences") == 0) {
+      options->sequence_count = std::max(value, 1u);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The device functions the recording threads call, all through the layer
+struct RecordingProcs {
+  PFN_vkAllocateMemory allocate_memory;
+  PFN_vkFreeMemory free_memory;
+  PFN_vkCreateBuffer create_buffer;
+  PFN_vkDestroyBuffer destroy_buffer;
+  PFN_vkBindBufferMemory2 bind_buffer_memory2;
+  PFN_vkCreateCommandPool create_command_pool;
+  PFN_vkDestroyCommandPool destroy_command_pool;
+  PFN_vkAllocateCommandBuffers allocate_command_buffers;
+  PFN_vkBeginCommandBuffer begin_command_buffer;
+  PFN_vkEndCommandBuffer end_command_buffer;
+  PFN_vkCmdBindPipeline cmd_bind_pipeline;
+  PFN_vkCmdBindDescriptorSets cmd_bind_descriptor_sets;
+  PFN_vkCmdBindVertexBuffers cmd_bind_vertex_buffers;
+  PFN_vkCmdBindIndexBuffer cmd_bind_index_buffer;
+  PFN_vkCmdDrawIndexed cmd_draw_indexed;
+};
+
+#define GWD_GETPROC(member, func) \
+  procs.member = device.GetLayerProc<PFN_vk##func>("vk" #func)
+
+static RecordingProcs LoadRecordingProcs(const LayeredDevice& device) {
+  RecordingProcs procs = {};
+  GWD_GETPROC(allocate_memory, AllocateMemory);
+  GWD_GETPROC(free_memory, FreeMemory);
+  GWD_GETPROC(create_buffer, CreateBuffer);
+  GWD_GETPROC(destroy_buffer, DestroyBuffer);
+  GWD_GETPROC(bind_buffer_memory2, BindBufferMemory2);
+  GWD_GETPROC(create_command_pool, CreateCommandPool);
+  GWD_GETPROC(destroy_command_pool, DestroyCommandPool);
+  GWD_GETPROC(allocate_command_buffers, AllocateCommandBuffers);
+  GWD_GETPROC(begin_command_buffer, BeginCommandBuffer);
+  GWD_GETPROC(end_command_buffer, EndCommandBuffer);
+  GWD_GETPROC(cmd_bind_pipeline, CmdBindPipeline);
+  GWD_GETPROC(cmd_bind_descriptor_sets, CmdBindDescriptorSets);
+  GWD_GETPROC(cmd_bind_vertex_buffers, CmdBindVertexBuffers);
+  GWD_GETPROC(cmd_bind_index_buffer, CmdBindIndexBuffer);
+  GWD_GETPROC(cmd_draw_indexed, CmdDrawIndexed);
+  return procs;
+}
+
+#undef GWD_GETPROC
+
+// Nothing dereferences these, so they only need to be distinct
+static const VkPipeline kPipelines[2] = {(VkPipeline)0x1600,
+                                         (VkPipeline)0x1601};
+static const VkPipelineLayout kPipelineLayout = (VkPipelineLayout)0x1700;
+static const VkDescriptorSet kDescriptorSets[2] = {(VkDescriptorSet)0x1800,
+                                                   (VkDescriptorSet)0x1801};
+
+static constexpr uint32_t kCallsPerSequence = 5;
+static constexpr uint32_t kSequencesPerRecording = 1000;
+// Every this many sequences the pipeline is bound again unchanged
+static constexpr uint32_t kRedundantBindInterval = 16;
+static constexpr uint32_t kScratchBuffersPerRecording = 8;
+// Large enough that 32-bit indices are warranted
+static constexpr VkDeviceSize kBufferSize = 1 << 20;
+
+using Clock = std::chrono::steady_clock;
+
+// One recording thread's objects, created through the layer from the thread
+// itself
+class RecordingThread {
+ public:
+  RecordingThread(const LayeredDevice& layered_device,
+                  const RecordingProcs& procs)
+      : m_device(layered_device.GetDevice()), m_procs(procs) {
+    VkMemoryAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocate_info.allocationSize =
+        (2 + kScratchBuffersPerRecording) * kBufferSize;
+    allocate_info.memoryTypeIndex =
+        layered_device.FindMemoryType(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_procs.allocate_memory(m_device, &allocate_info, nullptr, &m_memory);
+
+    VkBuffer geometry_buffers[2] = {};
+    CreateBuffers(2, 0, geometry_buffers);
+    m_vertex_buffer = geometry_buffers[0];
+    m_index_buffer = geometry_buffers[1];
+
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.queueFamilyIndex = layered_device.GetQueueFamilyIndex();
+    m_procs.create_command_pool(m_device, &pool_info, nullptr,
+                                &m_command_pool);
+    VkCommandBufferAllocateInfo command_buffer_info = {};
+    command_buffer_info.sType =
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_buffer_info.commandPool = m_command_pool;
+    command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_buffer_info.commandBufferCount = 1;
+    m_procs.allocate_command_buffers(m_device, &command_buffer_info,
+                                     &m_command_buffer);
+  }
+
+  ~RecordingThread() {
+    m_procs.destroy_command_pool(m_device, m_command_pool, nullptr);
+    m_procs.destroy_buffer(m_device, m_vertex_buffer, nullptr);
+    m_procs.destroy_buffer(m_device, m_index_buffer, nullptr);
+    m_procs.free_memory(m_device, m_memory, nullptr);
+  }
+
+  RecordingThread(const RecordingThread&) = delete;
+  RecordingThread& operator=(const RecordingThread&) = delete;
+
+  // Appends the latency of every sequence to latencies_ns
+  void Record(uint32_t sequence_count, std::vector<uint32_t>* latencies_ns) {
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkBuffer scratch_buffers[kScratchBuffersPerRecording] = {};
+    uint32_t pipeline_index = 0;
+
+    for (uint32_t sequence = 0; sequence < sequence_count; sequence++) {
+      const uint32_t recording_sequence = sequence % kSequencesPerRecording;
+      if (recording_sequence == 0) {
+        if (sequence != 0) {
+          EndRecording(scratch_buffers);
+        }
+        m_procs.begin_command_buffer(m_command_buffer, &begin_info);
+        CreateBuffers(kScratchBuffersPerRecording, 2 * kBufferSize,
+                      scratch_buffers);
+      }
+      if (sequence % kRedundantBindInterval != 0) {
+        pipeline_index ^= 1;
+      }
+      const VkDeviceSize offset = (sequence & 1) * 256;
+
+      const Clock::time_point start = Clock::now();
+      m_procs.cmd_bind_pipeline(m_command_buffer,
+                                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                kPipelines[pipeline_index]);
+      m_procs.cmd_bind_descriptor_sets(
+          m_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, kPipelineLayout,
+          0, 1, &kDescriptorSets[sequence & 1], 0, nullptr);
+      m_procs.cmd_bind_vertex_buffers(m_command_buffer, 0, 1,
+                                      &m_vertex_buffer, &offset);
+      m_procs.cmd_bind_index_buffer(m_command_buffer, m_index_buffer, offset,
+                                    VK_INDEX_TYPE_UINT32);
+      m_procs.cmd_draw_indexed(m_command_buffer, 3, 1,
+                               recording_sequence * 3, 0, 0);
+      latencies_ns->push_back((uint32_t)std::min<int64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                               start)
+              .count(),
+          UINT32_MAX));
+    }
+    EndRecording(scratch_buffers);
+  }
+
+ private:
+  // Creates count buffers and binds them with a single vkBindBufferMemory2,
+  // back to back from memory_offset on
+  void CreateBuffers(uint32_t count, VkDeviceSize memory_offset,
+                     VkBuffer* buffers) {
+    VkBufferCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    create_info.size = kBufferSize;
+    create_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                        VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    std::vector<VkBindBufferMemoryInfo> bind_infos(count);
+    for (uint32_t buffer_index = 0; buffer_index < count; buffer_index++) {
+      m_procs.create_buffer(m_device, &create_info, nullptr,
+                            &buffers[buffer_index]);
+      VkBindBufferMemoryInfo& bind_info = bind_infos[buffer_index];
+      bind_info.sType = VK_STRUCTURE_TYPE_BIND_BUFFER_MEMORY_INFO;
+      bind_info.buffer = buffers[buffer_index];
+      bind_info.memory = m_memory;
+      bind_info.memoryOffset = memory_offset + buffer_index * kBufferSize;
+    }
+    m_procs.bind_buffer_memory2(m_device, count, bind_infos.data());
+  }
+
+  void EndRecording(VkBuffer* scratch_buffers) {
+    m_procs.end_command_buffer(m_command_buffer);
+    for (uint32_t buffer_index = 0; buffer_index < kScratchBuffersPerRecording;
+         buffer_index++) {
+      m_procs.destroy_buffer(m_device, scratch_buffers[buffer_index], nullptr);
+    }
+  }
+
+  VkDevice m_device;
+  const RecordingProcs& m_procs;
+  VkDeviceMemory m_memory = VK_NULL_HANDLE;
+  VkBuffer m_vertex_buffer = VK_NULL_HANDLE;
+  VkBuffer m_index_buffer = VK_NULL_HANDLE;
+  VkCommandPool m_command_pool = VK_NULL_HANDLE;
+  VkCommandBuffer m_command_buffer = VK_NULL_HANDLE;
+};
+
+struct StressResult {
+  double elapsed_seconds = 0.0;
+  uint64_t sequence_count = 0;
+  std::vector<uint32_t> latencies_ns;
+};
+
+// All threads set up first and only start recording together, so the time
+// covers nothing but contended recording
+static StressResult RunStress(const LayeredDevice& layered_device,
+                              const RecordingProcs& procs,
+                              uint32_t thread_count, uint32_t sequence_count) {
+  std::mutex mutex;
+  std::condition_variable threads_ready;
+  std::condition_variable recording_started;
+  uint32_t ready_threads = 0;
+  bool started = false;
+  std::vector<std::vector<uint32_t>> thread_latencies(thread_count);
+
+  std::vector<std::thread> threads;
+  for (uint32_t thread_index = 0; thread_index < thread_count;
+       thread_index++) {
+    threads.emplace_back([&, thread_index] {
+      RecordingThread recording_thread(layered_device, procs);
+      std::vector<uint32_t>& latencies_ns = thread_latencies[thread_index];
+      latencies_ns.reserve(sequence_count);
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (++ready_threads == thread_count) {
+          threads_ready.notify_one();
+        }
+        recording_started.wait(lock, [&started] { return started; });
+      }
+      recording_thread.Record(sequence_count, &latencies_ns);
+    });
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    threads_ready.wait(lock, [&ready_threads, thread_count] {
+      return ready_threads == thread_count;
+    });
+    started = true;
+  }
+  const Clock::time_point start = Clock::now();
+  recording_started.notify_all();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  StressResult result;
+  result.elapsed_seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  result.sequence_count = (uint64_t)thread_count * sequence_count;
+  result.latencies_ns.reserve(result.sequence_count);
+  for (const std::vector<uint32_t>& latencies_ns : thread_latencies) {
+    result.latencies_ns.insert(result.latencies_ns.end(),
+                               latencies_ns.begin(), latencies_ns.end());
+  }
+  return result;
+}
+
+// Reorders latencies_ns partially
+static uint32_t Percentile(std::vector<uint32_t>* latencies_ns,
+                           double percentile) {
+  const size_t rank = std::min(
+      (size_t)(percentile / 100.0 * (double)latencies_ns->size()),
+      latencies_ns->size() - 1);
+  std::nth_element(latencies_ns->begin(), latencies_ns->begin() + rank,
+                   latencies_ns->end());
+  return (*latencies_ns)[rank];
+}
+
+static bool RunBenchmarks(const StressOptions& options) {
+  std::string error;
+  std::unique_ptr<LayeredDevice> layered_device =
+      LayeredDevice::Create(StandInDriverConfig::MakeDiscrete(), &error);
+  if (!layered_device) {
+    fprintf(stderr, "GwdRecordingStressBenchmark: %s\n", error.c_str());
+    return false;
+  }
+  const RecordingProcs procs = LoadRecordingProcs(*layered_device);
+
+  printf("%u calls per sequence, %u sequences per thread\n",
+         kCallsPerSequence, options.sequence_count);
+  const char* separator =
+      "------------------------------------------------------------------"
+      "--------------\n";
+  printf("%s%-24s %12s %12s %8s %8s %8s %8s\n%s", separator, "Benchmark",
+         "Sequences/s", "Calls/s", "p50", "p99", "p99.9", "max", separator);
+  for (uint32_t thread_count = 1;; thread_count *= 2) {
+    thread_count = std::min(thread_count, options.max_thread_count);
+    StressResult result = RunStress(*layered_device, procs, thread_count,
+                                    options.sequence_count);
+
+    const double sequences_per_second =
+        (double)result.sequence_count / result.elapsed_seconds;
+    const uint32_t p50 = Percentile(&result.latencies_ns, 50.0);
+    const uint32_t p99 = Percentile(&result.latencies_ns, 99.0);
+    const uint32_t p999 = Percentile(&result.latencies_ns, 99.9);
+    const uint32_t max = *std::max_element(result.latencies_ns.begin(),
+                                           result.latencies_ns.end());
+    const std::string benchmark_name =
+        "Recording/threads:" + std::to_string(thread_count);
+    printf("%-24s %11.2fM %11.2fM %5u ns %5u ns %5u ns %5u ns\n",
+           benchmark_name.c_str(), sequences_per_second / 1e6,
+           sequences_per_second * kCallsPerSequence / 1e6, p50, p99, p999,
+           max);
+
+    if (thread_count == options.max_thread_count) {
+      break;
+    }
+  }
+  return true;
+}
+
+}  // namespace GWD
+
+int main(int argc, char** argv) {
+  GWD::StressOptions options;
+  if (!GWD::ParseStressOptions(argc, argv, &options)) {
+    fprintf(stderr,
+            "Usage: GwdRecordingStressBenchmark [--max-threads N] "
+            "[--sequences N]\n");
+    return 1;
+  }
+  return GWD::RunBenchmarks(options) ? 0 : 1;
+}
@@ -0,0 +1,779 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "standInDriver.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+
+// The layer's only export, see layerCore.cpp
+extern "C" VKAPI_ATTR VkResult VKAPI_CALL
+gwdNegotiateLoaderLayerInterfaceVersion(
+    VkNegotiateLayerInterface* pVersionStruct);
+
+namespace GWD {
+
+uint32_t StandInDriverConfig::AddMemoryHeap(VkDeviceSize size,
+                                            VkMemoryHeapFlags flags) {
+  const uint32_t heap_index = memory_properties.memoryHeapCount++;
+  memory_properties.memoryHeaps[heap_index].size = size;
+  memory_properties.memoryHeaps[heap_index].flags = flags;
+  return heap_index;
+}
+
+uint32_t StandInDriverConfig::AddMemoryType(uint32_t heap_index,
+                                            VkMemoryPropertyFlags flags) {
+  const uint32_t type_index = memory_properties.memoryTypeCount++;
+  memory_properties.memoryTypes[type_index].heapIndex = heap_index;
+  memory_properties.memoryTypes[type_index].propertyFlags = flags;
+  return type_index;
+}
+
+void StandInDriverConfig::AddQueueFamily(VkQueueFlags flags,
+                                         uint32_t queue_count) {
+  VkQueueFamilyProperties family = {};
+  family.queueFlags = flags;
+  family.queueCount = queue_count;
+  queue_families.push_back(family);
+}
+
+StandInDriverConfig StandInDriverConfig::MakeDiscrete() {
+  StandInDriverConfig config;
+  const uint32_t video_heap =
+      config.AddMemoryHeap(8ull << 30, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT);
+  const uint32_t system_heap = config.AddMemoryHeap(16ull << 30, 0);
+  config.AddMemoryType(video_heap, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  config.AddMemoryType(system_heap, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  config.AddMemoryType(system_heap, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                                        VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+  config.AddQueueFamily(
+      VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT, 1);
+  config.AddQueueFamily(VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT, 2);
+  config.AddQueueFamily(VK_QUEUE_TRANSFER_BIT, 1);
+  return config;
+}
+
+static std::mutex s_config_mutex;
+static StandInDriverConfig s_config = StandInDriverConfig::MakeDiscrete();
+
+void SetStandInDriverConfig(const StandInDriverConfig& config) {
+  std::lock_guard<std::mutex> lock(s_config_mutex);
+  s_config = config;
+}
+
+namespace {
+
+// What the loader expects at the start of every dispatchable object
+struct DispatchableObject {
+  void* dispatch_key = nullptr;
+};
+
+struct Instance;
+
+struct PhysicalDevice : DispatchableObject {
+  Instance* instance = nullptr;
+};
+
+struct Instance : DispatchableObject {
+  StandInDriverConfig config;
+  PhysicalDevice physical_device;
+};
+
+struct Queue : DispatchableObject {
+  uint32_t family_index = 0;
+  uint32_t queue_index = 0;
+};
+
+struct Device : DispatchableObject {
+  const StandInDriverConfig* config = nullptr;
+  std::vector<std::unique_ptr<Queue>> queues;
+};
+
+struct Memory {
+  VkDeviceSize size = 0;
+  std::unique_ptr<uint8_t[]> data;
+};
+
+struct Buffer {
+  VkDeviceSize size = 0;
+};
+
+struct CommandPool {
+  // Command buffers are externally synchronized through their pool
+  std::vector<DispatchableObject*> command_buffers;
+};
+
+// Fences and other objects nothing is ever asked of
+struct Object {};
+
+template <typename Handle, typename Type>
+Handle ToHandle(Type* object) {
+  return (Handle)(uintptr_t)object;
+}
+
+template <typename Type, typename Handle>
+Type* FromHandle(Handle handle) {
+  return (Type*)(uintptr_t)handle;
+}
+
+// Instance and physical device functions
+
+VKAPI_ATTR VkResult VKAPI_CALL
+StandInCreateInstance(const VkInstanceCreateInfo* pCreateInfo,
+                      const VkAllocationCallbacks* pAllocator,
+                      VkInstance* pInstance) {
+  Instance* instance = new Instance;
+  instance->dispatch_key = instance;
+  {
+    std::lock_guard<std::mutex> lock(s_config_mutex);
+    instance->config = s_config;
+  }
+  instance->physical_device.dispatch_key = instance;
+  instance->physical_device.instance = instance;
+  *pInstance = ToHandle<VkInstance>(instance);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+StandInDestroyInstance(VkInstance instance,
+                       const VkAllocationCallbacks* pAllocator) {
+  delete FromHandle<Instance>(instance);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInEnumeratePhysicalDevices(
+    VkInstance instance, uint32_t* pPhysicalDeviceCount,
+    VkPhysicalDevice* pPhysicalDevices) {
+  if (pPhysicalDevices == nullptr) {
+    *pPhysicalDeviceCount = 1;
+    return VK_SUCCESS;
+  }
+  if (*pPhysicalDeviceCount == 0) {
+    return VK_INCOMPLETE;
+  }
+  *pPhysicalDeviceCount = 1;
+  pPhysicalDevices[0] = ToHandle<VkPhysicalDevice>(
+      &FromHandle<Instance>(instance)->physical_device);
+  return VK_SUCCESS;
+}
+
+const StandInDriverConfig& GetConfig(VkPhysicalDevice physicalDevice) {
+  return FromHandle<PhysicalDevice>(physicalDevice)->instance->config;
+}
+
+VKAPI_ATTR void VKAPI_CALL StandInGetPhysicalDeviceProperties(
+    VkPhysicalDevice physicalDevice, VkPhysicalDeviceProperties* pProperties) {
+  *pProperties = {};
+  pProperties->apiVersion = VK_API_VERSION_1_1;
+  strncpy(pProperties->deviceName, "WitchDoctor stand-in driver",
+          sizeof(pProperties->deviceName) - 1);
+  pProperties->limits.maxMemoryAllocationCount =
+      GetConfig(physicalDevice).max_memory_allocation_count;
+  pProperties->limits.bufferImageGranularity = 1024;
+  pProperties->limits.nonCoherentAtomSize = 64;
+  pProperties->limits.maxVertexInputBindings = 32;
+  pProperties->limits.maxBoundDescriptorSets = 8;
+  pProperties->limits.minUniformBufferOffsetAlignment = 256;
+  pProperties->limits.minStorageBufferOffsetAlignment = 256;
+}
+
+VKAPI_ATTR void VKAPI_CALL StandInGetPhysicalDeviceMemoryProperties(
+    VkPhysicalDevice physicalDevice,
+    VkPhysicalDeviceMemoryProperties* pMemoryProperties) {
+  *pMemoryProperties = GetConfig(physicalDevice).memory_properties;
+}
+
+VKAPI_ATTR void VKAPI_CALL StandInGetPhysicalDeviceQueueFamilyProperties(
+    VkPhysicalDevice physicalDevice, uint32_t* pQueueFamilyPropertyCount,
+    VkQueueFamilyProperties* pQueueFamilyProperties) {
+  const std::vector<VkQueueFamilyProperties>& families =
+      GetConfig(physicalDevice).queue_families;
+  if (pQueueFamilyProperties == nullptr) {
+    *pQueueFamilyPropertyCount = (uint32_t)families.size();
+    return;
+  }
+  *pQueueFamilyPropertyCount =
+      std::min(*pQueueFamilyPropertyCount, (uint32_t)families.size());
+  for (uint32_t family_index = 0; family_index < *pQueueFamilyPropertyCount;
+       family_index++) {
+    pQueueFamilyProperties[family_index] = families[family_index];
+  }
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInEnumerateDeviceExtensionProperties(
+    VkPhysicalDevice physicalDevice, const char* pLayerName,
+    uint32_t* pPropertyCount, VkExtensionProperties* pProperties) {
+  *pPropertyCount = 0;
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+StandInCreateDevice(VkPhysicalDevice physicalDevice,
+                    const VkDeviceCreateInfo* pCreateInfo,
+                    const VkAllocationCallbacks* pAllocator,
+                    VkDevice* pDevice) {
+  Device* device = new Device;
+  device->dispatch_key = device;
+  device->config = &GetConfig(physicalDevice);
+  for (uint32_t queue_info_index = 0;
+       queue_info_index < pCreateInfo->queueCreateInfoCount;
+       queue_info_index++) {
+    const VkDeviceQueueCreateInfo& queue_info =
+        pCreateInfo->pQueueCreateInfos[queue_info_index];
+    for (uint32_t queue_index = 0; queue_index < queue_info.queueCount;
+         queue_index++) {
+      std::unique_ptr<Queue> queue(new Queue);
+      queue->dispatch_key = device;
+      queue->family_index = queue_info.queueFamilyIndex;
+      queue->queue_index = queue_index;
+      device->queues.push_back(std::move(queue));
+    }
+  }
+  *pDevice = ToHandle<VkDevice>(device);
+  return VK_SUCCESS;
+}
+
+// Device functions
+
+VKAPI_ATTR void VKAPI_CALL
+StandInDestroyDevice(VkDevice device, const VkAllocationCallbacks* pAllocator) {
+  delete FromHandle<Device>(device);
+}
+
+VKAPI_ATTR void VKAPI_CALL StandInGetDeviceQueue(VkDevice device,
+                                                 uint32_t queueFamilyIndex,
+                                                 uint32_t queueIndex,
+                                                 VkQueue* pQueue) {
+  *pQueue = VK_NULL_HANDLE;
+  for (const auto& queue : FromHandle<Device>(device)->queues) {
+    if (queue->family_index == queueFamilyIndex &&
+        queue->queue_index == queueIndex) {
+      *pQueue = ToHandle<VkQueue>(queue.get());
+    }
+  }
+}
+
+// Work completes as soon as it is submitted
+VKAPI_ATTR VkResult VKAPI_CALL StandInQueueSubmit(VkQueue queue,
+                                                  uint32_t submitCount,
+                                                  const VkSubmitInfo* pSubmits,
+                                                  VkFence fence) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInQueueWaitIdle(VkQueue queue) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInDeviceWaitIdle(VkDevice device) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInAllocateMemory(
+    VkDevice device, const VkMemoryAllocateInfo* pAllocateInfo,
+    const VkAllocationCallbacks* pAllocator, VkDeviceMemory* pMemory) {
+  if (pAllocateInfo->memoryTypeIndex >=
+      FromHandle<Device>(device)->config->memory_properties.memoryTypeCount) {
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  Memory* memory = new Memory;
+  memory->size = pAllocateInfo->allocationSize;
+  *pMemory = ToHandle<VkDeviceMemory>(memory);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL StandInFreeMemory(
+    VkDevice device, VkDeviceMemory memory,
+    const VkAllocationCallbacks* pAllocator) {
+  delete FromHandle<Memory>(memory);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInMapMemory(VkDevice device,
+                                                VkDeviceMemory memory,
+                                                VkDeviceSize offset,
+                                                VkDeviceSize size,
+                                                VkMemoryMapFlags flags,
+                                                void** ppData) {
+  Memory* memory_object = FromHandle<Memory>(memory);
+  if (!memory_object->data) {
+    memory_object->data.reset(new uint8_t[(size_t)memory_object->size]);
+  }
+  *ppData = memory_object->data.get() + offset;
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL StandInUnmapMemory(VkDevice device,
+                                              VkDeviceMemory memory) {}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInFlushMappedMemoryRanges(
+    VkDevice device, uint32_t memoryRangeCount,
+    const VkMappedMemoryRange* pMemoryRanges) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInInvalidateMappedMemoryRanges(
+    VkDevice device, uint32_t memoryRangeCount,
+    const VkMappedMemoryRange* pMemoryRanges) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+StandInCreateBuffer(VkDevice device, const VkBufferCreateInfo* pCreateInfo,
+                    const VkAllocationCallbacks* pAllocator,
+                    VkBuffer* pBuffer) {
+  Buffer* buffer = new Buffer;
+  buffer->size = pCreateInfo->size;
+  *pBuffer = ToHandle<VkBuffer>(buffer);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+StandInDestroyBuffer(VkDevice device, VkBuffer buffer,
+                     const VkAllocationCallbacks* pAllocator) {
+  delete FromHandle<Buffer>(buffer);
+}
+
+// Any memory type will do
+VKAPI_ATTR void VKAPI_CALL StandInGetBufferMemoryRequirements(
+    VkDevice device, VkBuffer buffer,
+    VkMemoryRequirements* pMemoryRequirements) {
+  const uint32_t memory_type_count =
+      FromHandle<Device>(device)->config->memory_properties.memoryTypeCount;
+  pMemoryRequirements->size = (FromHandle<Buffer>(buffer)->size + 255) & ~255;
+  pMemoryRequirements->alignment = 256;
+  pMemoryRequirements->memoryTypeBits =
+      memory_type_count >= 32 ? ~0u : (1u << memory_type_count) - 1;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInBindBufferMemory(
+    VkDevice device, VkBuffer buffer, VkDeviceMemory memory,
+    VkDeviceSize memoryOffset) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+StandInBindBufferMemory2(VkDevice device, uint32_t bindInfoCount,
+                         const VkBindBufferMemoryInfo* pBindInfos) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+StandInCreateFence(VkDevice device, const VkFenceCreateInfo* pCreateInfo,
+                   const VkAllocationCallbacks* pAllocator, VkFence* pFence) {
+  *pFence = ToHandle<VkFence>(new Object);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+StandInDestroyFence(VkDevice device, VkFence fence,
+                    const VkAllocationCallbacks* pAllocator) {
+  delete FromHandle<Object>(fence);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInGetFenceStatus(VkDevice device,
+                                                     VkFence fence) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInResetFences(VkDevice device,
+                                                  uint32_t fenceCount,
+                                                  const VkFence* pFences) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInWaitForFences(VkDevice device,
+                                                    uint32_t fenceCount,
+                                                    const VkFence* pFences,
+                                                    VkBool32 waitAll,
+                                                    uint64_t timeout) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInCreateCommandPool(
+    VkDevice device, const VkCommandPoolCreateInfo* pCreateInfo,
+    const VkAllocationCallbacks* pAllocator, VkCommandPool* pCommandPool) {
+  *pCommandPool = ToHandle<VkCommandPool>(new CommandPool);
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+StandInDestroyCommandPool(VkDevice device, VkCommandPool commandPool,
+                          const VkAllocationCallbacks* pAllocator) {
+  CommandPool* pool = FromHandle<CommandPool>(commandPool);
+  if (pool == nullptr) {
+    return;
+  }
+  for (DispatchableObject* command_buffer : pool->command_buffers) {
+    delete command_buffer;
+  }
+  delete pool;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInResetCommandPool(
+    VkDevice device, VkCommandPool commandPool,
+    VkCommandPoolResetFlags flags) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInAllocateCommandBuffers(
+    VkDevice device, const VkCommandBufferAllocateInfo* pAllocateInfo,
+    VkCommandBuffer* pCommandBuffers) {
+  CommandPool* pool = FromHandle<CommandPool>(pAllocateInfo->commandPool);
+  for (uint32_t buffer_index = 0;
+       buffer_index < pAllocateInfo->commandBufferCount; buffer_index++) {
+    DispatchableObject* command_buffer = new DispatchableObject;
+    command_buffer->dispatch_key = FromHandle<Device>(device);
+    pool->command_buffers.push_back(command_buffer);
+    pCommandBuffers[buffer_index] = ToHandle<VkCommandBuffer>(command_buffer);
+  }
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL StandInFreeCommandBuffers(
+    VkDevice device, VkCommandPool commandPool, uint32_t commandBufferCount,
+    const VkCommandBuffer* pCommandBuffers) {
+  CommandPool* pool = FromHandle<CommandPool>(commandPool);
+  for (uint32_t buffer_index = 0; buffer_index < commandBufferCount;
+       buffer_index++) {
+    DispatchableObject* command_buffer =
+        FromHandle<DispatchableObject>(pCommandBuffers[buffer_index]);
+    auto entry = std::find(pool->command_buffers.begin(),
+                           pool->command_buffers.end(), command_buffer);
+    if (entry != pool->command_buffers.end()) {
+      pool->command_buffers.erase(entry);
+      delete command_buffer;
+    }
+  }
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInBeginCommandBuffer(
+    VkCommandBuffer commandBuffer, const VkCommandBufferBeginInfo* pBeginInfo) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+StandInEndCommandBuffer(VkCommandBuffer commandBuffer) {
+  return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL StandInResetCommandBuffer(
+    VkCommandBuffer commandBuffer, VkCommandBufferResetFlags flags) {
+  return VK_SUCCESS;
+}
+
+// Commands
+
+VKAPI_ATTR void VKAPI_CALL
+StandInCmdBindPipeline(VkCommandBuffer commandBuffer,
+                       VkPipelineBindPoint pipelineBindPoint,
+                       VkPipeline pipeline) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdBindDescriptorSets(
+    VkCommandBuffer commandBuffer, VkPipelineBindPoint pipelineBindPoint,
+    VkPipelineLayout layout, uint32_t firstSet, uint32_t descriptorSetCount,
+    const VkDescriptorSet* pDescriptorSets, uint32_t dynamicOffsetCount,
+    const uint32_t* pDynamicOffsets) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdBindIndexBuffer(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+    VkIndexType indexType) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdBindVertexBuffers(
+    VkCommandBuffer commandBuffer, uint32_t firstBinding, uint32_t bindingCount,
+    const VkBuffer* pBuffers, const VkDeviceSize* pOffsets) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdDraw(VkCommandBuffer commandBuffer,
+                                          uint32_t vertexCount,
+                                          uint32_t instanceCount,
+                                          uint32_t firstVertex,
+                                          uint32_t firstInstance) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdDrawIndexed(
+    VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount,
+    uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdDrawIndirect(VkCommandBuffer commandBuffer,
+                                                  VkBuffer buffer,
+                                                  VkDeviceSize offset,
+                                                  uint32_t drawCount,
+                                                  uint32_t stride) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdDrawIndexedIndirect(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+    uint32_t drawCount, uint32_t stride) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdDispatch(VkCommandBuffer commandBuffer,
+                                              uint32_t groupCountX,
+                                              uint32_t groupCountY,
+                                              uint32_t groupCountZ) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdDispatchIndirect(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdCopyBuffer(
+    VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkBuffer dstBuffer,
+    uint32_t regionCount, const VkBufferCopy* pRegions) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdPipelineBarrier(
+    VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStageMask,
+    VkPipelineStageFlags dstStageMask, VkDependencyFlags dependencyFlags,
+    uint32_t memoryBarrierCount, const VkMemoryBarrier* pMemoryBarriers,
+    uint32_t bufferMemoryBarrierCount,
+    const VkBufferMemoryBarrier* pBufferMemoryBarriers,
+    uint32_t imageMemoryBarrierCount,
+    const VkImageMemoryBarrier* pImageMemoryBarriers) {}
+
+VKAPI_ATTR void VKAPI_CALL StandInCmdExecuteCommands(
+    VkCommandBuffer commandBuffer, uint32_t commandBufferCount,
+    const VkCommandBuffer* pCommandBuffers) {}
+
+struct ProcEntry {
+  const char* name;
+  PFN_vkVoidFunction proc;
+};
+
+#define STAND_IN_PROC(func) \
+  { "vk" #func, (PFN_vkVoidFunction)StandIn##func }
+
+// Entry points that take a VkInstance or VkPhysicalDevice
+static const ProcEntry kInstanceProcs[] = {
+    STAND_IN_PROC(CreateInstance),
+    STAND_IN_PROC(DestroyInstance),
+    STAND_IN_PROC(EnumeratePhysicalDevices),
+    STAND_IN_PROC(GetPhysicalDeviceProperties),
+    STAND_IN_PROC(GetPhysicalDeviceMemoryProperties),
+    STAND_IN_PROC(GetPhysicalDeviceQueueFamilyProperties),
+    STAND_IN_PROC(EnumerateDeviceExtensionProperties),
+    STAND_IN_PROC(CreateDevice),
+};
+
+static const ProcEntry kDeviceProcs[] = {
+    STAND_IN_PROC(DestroyDevice),
+    STAND_IN_PROC(GetDeviceQueue),
+    STAND_IN_PROC(QueueSubmit),
+    STAND_IN_PROC(QueueWaitIdle),
+    STAND_IN_PROC(DeviceWaitIdle),
+    STAND_IN_PROC(AllocateMemory),
+    STAND_IN_PROC(FreeMemory),
+    STAND_IN_PROC(MapMemory),
+    STAND_IN_PROC(UnmapMemory),
+    STAND_IN_PROC(FlushMappedMemoryRanges),
+    STAND_IN_PROC(InvalidateMappedMemoryRanges),
+    STAND_IN_PROC(CreateBuffer),
+    STAND_IN_PROC(DestroyBuffer),
+    STAND_IN_PROC(GetBufferMemoryRequirements),
+    STAND_IN_PROC(BindBufferMemory),
+    STAND_IN_PROC(BindBufferMemory2),
+    STAND_IN_PROC(CreateFence),
+    STAND_IN_PROC(DestroyFence),
+    STAND_IN_PROC(GetFenceStatus),
+    STAND_IN_PROC(ResetFences),
+    STAND_IN_PROC(WaitForFences),
+    STAND_IN_PROC(CreateCommandPool),
+    STAND_IN_PROC(DestroyCommandPool),
+    STAND_IN_PROC(ResetCommandPool),
+    STAND_IN_PROC(AllocateCommandBuffers),
+    STAND_IN_PROC(FreeCommandBuffers),
+    STAND_IN_PROC(BeginCommandBuffer),
+    STAND_IN_PROC(EndCommandBuffer),
+    STAND_IN_PROC(ResetCommandBuffer),
+    STAND_IN_PROC(CmdBindPipeline),
+    STAND_IN_PROC(CmdBindDescriptorSets),
+    STAND_IN_PROC(CmdBindIndexBuffer),
+    STAND_IN_PROC(CmdBindVertexBuffers),
+    STAND_IN_PROC(CmdDraw),
+    STAND_IN_PROC(CmdDrawIndexed),
+    STAND_IN_PROC(CmdDrawIndirect),
+    STAND_IN_PROC(CmdDrawIndexedIndirect),
+    STAND_IN_PROC(CmdDispatch),
+    STAND_IN_PROC(CmdDispatchIndirect),
+    STAND_IN_PROC(CmdCopyBuffer),
+    STAND_IN_PROC(CmdPipelineBarrier),
+    STAND_IN_PROC(CmdExecuteCommands),
+};
+
+#undef STAND_IN_PROC
+
+template <size_t kCount>
+PFN_vkVoidFunction FindProc(const ProcEntry (&procs)[kCount],
+                            const char* name) {
+  for (const ProcEntry& entry : procs) {
+    if (strcmp(entry.name, name) == 0) {
+      return entry.proc;
+    }
+  }
+  return nullptr;
+}
+
+// Stands in for the loader's callback, which the layer calls on dispatchable
+// objects it creates itself
+VKAPI_ATTR VkResult VKAPI_CALL StandInSetDeviceLoaderData(VkDevice device,
+                                                          void* object) {
+  ((DispatchableObject*)object)->dispatch_key =
+      FromHandle<DispatchableObject>(device)->dispatch_key;
+  return VK_SUCCESS;
+}
+
+}  // namespace
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+StandInGetDeviceProcAddr(VkDevice device, const char* pName) {
+  if (strcmp(pName, "vkGetDeviceProcAddr") == 0) {
+    return (PFN_vkVoidFunction)StandInGetDeviceProcAddr;
+  }
+  return FindProc(kDeviceProcs, pName);
+}
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+StandInGetInstanceProcAddr(VkInstance instance, const char* pName) {
+  if (strcmp(pName, "vkGetInstanceProcAddr") == 0) {
+    return (PFN_vkVoidFunction)StandInGetInstanceProcAddr;
+  }
+  PFN_vkVoidFunction proc = FindProc(kInstanceProcs, pName);
+  if (proc == nullptr && instance != VK_NULL_HANDLE) {
+    proc = StandInGetDeviceProcAddr(VK_NULL_HANDLE, pName);
+  }
+  return proc;
+}
+
+std::unique_ptr<LayeredDevice> LayeredDevice::Create(
+    const StandInDriverConfig& config, std::string* error) {
+  std::unique_ptr<LayeredDevice> layered_device(new LayeredDevice);
+  layered_device->m_config = config;
+  SetStandInDriverConfig(config);
+
+  VkNegotiateLayerInterface negotiate = {};
+  negotiate.sType = LAYER_NEGOTIATE_INTERFACE_STRUCT;
+  negotiate.loaderLayerInterfaceVersion = 2;
+  if (gwdNegotiateLoaderLayerInterfaceVersion(&negotiate) != VK_SUCCESS) {
+    *error = "the layer refused loader interface version 2";
+    return nullptr;
+  }
+  layered_device->m_layer_gipa = negotiate.pfnGetInstanceProcAddr;
+  layered_device->m_layer_gdpa = negotiate.pfnGetDeviceProcAddr;
+  const PFN_vkGetInstanceProcAddr layer_gipa = layered_device->m_layer_gipa;
+
+  VkLayerInstanceLink instance_link = {};
+  instance_link.pfnNextGetInstanceProcAddr = StandInGetInstanceProcAddr;
+  VkLayerInstanceCreateInfo instance_link_info = {};
+  instance_link_info.sType = VK_STRUCTURE_TYPE_LOADER_INSTANCE_CREATE_INFO;
+  instance_link_info.function = VK_LAYER_LINK_INFO;
+  instance_link_info.u.pLayerInfo = &instance_link;
+
+  VkInstanceCreateInfo instance_info = {};
+  instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  instance_info.pNext = &instance_link_info;
+  PFN_vkCreateInstance create_instance =
+      (PFN_vkCreateInstance)layer_gipa(VK_NULL_HANDLE, "vkCreateInstance");
+  if (create_instance(&instance_info, nullptr,
+                      &layered_device->m_instance) != VK_SUCCESS) {
+    *error = "vkCreateInstance failed";
+    return nullptr;
+  }
+  const VkInstance instance = layered_device->m_instance;
+
+  uint32_t physical_device_count = 1;
+  VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+  PFN_vkEnumeratePhysicalDevices enumerate_physical_devices =
+      (PFN_vkEnumeratePhysicalDevices)layer_gipa(instance,
+                                                 "vkEnumeratePhysicalDevices");
+  enumerate_physical_devices(instance, &physical_device_count,
+                             &physical_device);
+
+  // One queue of every family, so the layer sees all of them in use
+  std::vector<VkDeviceQueueCreateInfo> queue_infos;
+  const float queue_priority = 1.0f;
+  bool found_graphics_family = false;
+  for (uint32_t family_index = 0; family_index < config.queue_families.size();
+       family_index++) {
+    VkDeviceQueueCreateInfo queue_info = {};
+    queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue_info.queueFamilyIndex = family_index;
+    queue_info.queueCount = 1;
+    queue_info.pQueuePriorities = &queue_priority;
+    queue_infos.push_back(queue_info);
+    if (!found_graphics_family &&
+        (config.queue_families[family_index].queueFlags &
+         VK_QUEUE_GRAPHICS_BIT) != 0) {
+      layered_device->m_queue_family_index = family_index;
+      found_graphics_family = true;
+    }
+  }
+  if (!found_graphics_family) {
+    *error = "the configuration has no graphics queue family";
+    return nullptr;
+  }
+
+  VkLayerDeviceLink device_link = {};
+  device_link.pfnNextGetInstanceProcAddr = StandInGetInstanceProcAddr;
+  device_link.pfnNextGetDeviceProcAddr = StandInGetDeviceProcAddr;
+  VkLayerDeviceCreateInfo loader_data_info = {};
+  loader_data_info.sType = VK_STRUCTURE_TYPE_LOADER_DEVICE_CREATE_INFO;
+  loader_data_info.function = VK_LOADER_DATA_CALLBACK;
+  loader_data_info.u.pfnSetDeviceLoaderData = StandInSetDeviceLoaderData;
+  VkLayerDeviceCreateInfo device_link_info = {};
+  device_link_info.sType = VK_STRUCTURE_TYPE_LOADER_DEVICE_CREATE_INFO;
+  device_link_info.pNext = &loader_data_info;
+  device_link_info.function = VK_LAYER_LINK_INFO;
+  device_link_info.u.pLayerInfo = &device_link;
+
+  VkDeviceCreateInfo device_info = {};
+  device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  device_info.pNext = &device_link_info;
+  device_info.queueCreateInfoCount = (uint32_t)queue_infos.size();
+  device_info.pQueueCreateInfos = queue_infos.data();
+  PFN_vkCreateDevice create_device =
+      (PFN_vkCreateDevice)layer_gipa(instance, "vkCreateDevice");
+  if (create_device(physical_device, &device_info, nullptr,
+                    &layered_device->m_device) != VK_SUCCESS) {
+    *error = "vkCreateDevice failed";
+    return nullptr;
+  }
+
+  layered_device->GetLayerProc<PFN_vkGetDeviceQueue>("vkGetDeviceQueue")(
+      layered_device->m_device, layered_device->m_queue_family_index, 0,
+      &layered_device->m_queue);
+  return layered_device;
+}
+
+LayeredDevice::~LayeredDevice() {
+  if (m_device != VK_NULL_HANDLE) {
+    GetLayerProc<PFN_vkDestroyDevice>("vkDestroyDevice")(m_device, nullptr);
+  }
+  if (m_instance != VK_NULL_HANDLE) {
+    PFN_vkDestroyInstance destroy_instance =
+        (PFN_vkDestroyInstance)m_layer_gipa(m_instance, "vkDestroyInstance");
+    destroy_instance(m_instance, nullptr);
+  }
+}
+
+uint32_t LayeredDevice::FindMemoryType(VkMemoryPropertyFlags flags) const {
+  const VkPhysicalDeviceMemoryProperties& memory_properties =
+      m_config.memory_properties;
+  for (uint32_t type_index = 0; type_index < memory_properties.memoryTypeCount;
+       type_index++) {
+    if ((memory_properties.memoryTypes[type_index].propertyFlags & flags) ==
+        flags) {
+      return type_index;
+    }
+  }
+  return UINT32_MAX;
+}
+
+}  // namespace GWD
@@ -0,0 +1,108 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <vulkan/vk_layer.h>
+#include <vulkan/vulkan.h>
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace GWD {
+
+// A null driver to put below the layer, so the layer can be exercised and
+// timed without a GPU. It answers the next-layer vkGetInstanceProcAddr and
+// vkGetDeviceProcAddr with entry points that create handles and otherwise do
+// nothing, and reports the memory heaps, memory types and queue families it
+// was configured with.
+//
+// Dispatchable handles start with a dispatch key like the loader's, which
+// queues, command buffers and physical devices share with their parent.
+// Memory is backed by host allocations when it is mapped.
+struct StandInDriverConfig {
+  VkPhysicalDeviceMemoryProperties memory_properties = {};
+  std::vector<VkQueueFamilyProperties> queue_families;
+  uint32_t max_memory_allocation_count = 4096;
+
+  // Returns the index of the new heap or type
+  uint32_t AddMemoryHeap(VkDeviceSize size, VkMemoryHeapFlags flags);
+  uint32_t AddMemoryType(uint32_t heap_index, VkMemoryPropertyFlags flags);
+  void AddQueueFamily(VkQueueFlags flags, uint32_t queue_count);
+
+  // A discrete GPU: DEVICE_LOCAL video memory, host-visible system memory
+  // with a cached and an uncached type, and graphics, async compute and
+  // transfer queue families
+  static StandInDriverConfig MakeDiscrete();
+};
+
+// Applies to instances created afterwards
+void SetStandInDriverConfig(const StandInDriverConfig& config);
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+StandInGetInstanceProcAddr(VkInstance instance, const char* pName);
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+StandInGetDeviceProcAddr(VkDevice device, const char* pName);
+
+// Brings up an instance and a device through the layer on top of the stand-in
+// driver, chaining them the way the loader does, and tears them down again.
+// Device functions can be fetched through the layer, to time the intercepts,
+// or from the driver directly, to time the same call without the layer.
+class LayeredDevice {
+ public:
+  // Returns nullptr and sets error if the layer refuses the chain
+  static std::unique_ptr<LayeredDevice> Create(
+      const StandInDriverConfig& config, std::string* error);
+  ~LayeredDevice();
+
+  LayeredDevice(const LayeredDevice&) = delete;
+  LayeredDevice& operator=(const LayeredDevice&) = delete;
+
+  VkDevice GetDevice() const { return m_device; }
+  // A queue of the first graphics family
+  VkQueue GetQueue() const { return m_queue; }
+  uint32_t GetQueueFamilyIndex() const { return m_queue_family_index; }
+  const StandInDriverConfig& GetConfig() const { return m_config; }
+
+  template <typename Function>
+  Function GetLayerProc(const char* name) const {
+    return (Function)m_layer_gdpa(m_device, name);
+  }
+
+  template <typename Function>
+  Function GetDriverProc(const char* name) const {
+    return (Function)StandInGetDeviceProcAddr(m_device, name);
+  }
+
+  // The first memory type with all of flags, or UINT32_MAX
+  uint32_t FindMemoryType(VkMemoryPropertyFlags flags) const;
+
+ private:
+  LayeredDevice() = default;
+
+  StandInDriverConfig m_config;
+  PFN_vkGetInstanceProcAddr m_layer_gipa = nullptr;
+  PFN_vkGetDeviceProcAddr m_layer_gdpa = nullptr;
+  VkInstance m_instance = VK_NULL_HANDLE;
+  VkDevice m_device = VK_NULL_HANDLE;
+  VkQueue m_queue = VK_NULL_HANDLE;
+  uint32_t m_queue_family_index = 0;
+};
+
+}  // namespace GWD
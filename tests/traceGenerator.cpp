@@ -0,0 +1,206 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#include "traceGenerator.h"
+#include "traceWriter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace GWD {
+
+using namespace TraceGeneratorHandles;
+
+bool ParseTraceGeneratorOptions(int argc, char** argv,
+                                TraceGeneratorOptions* options) {
+  for (int arg_index = 1; arg_index < argc; arg_index += 2) {
+    if (arg_index + 1 >= argc) {
+      return false;
+    }
+    const uint32_t value = (uint32_t)atoi(argv[arg_index + 1]);
+    if (strcmp(argv[arg_index], "--threads") == 0) {
+      // Every thread's command buffer goes into a single submit record
+      options->thread_count = std::min(std::max(value, 1u), 1024u);
+    } else if (strcmp(argv[arg_index], "--frames") == 0) {
+      options->frame_count = value;
+    } else if (strcmp(argv[arg_index], "--draws") == 0) {
+      options->draws_per_command_buffer = value;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+RecordCounts ExpectedRecordCounts(const TraceGeneratorOptions& options) {
+  const uint64_t recordings =
+      (uint64_t)options.thread_count * options.frame_count;
+
+  RecordCounts counts = {};
+  auto count = [&counts](Trace::RecordType type) -> uint64_t& {
+    return counts[(size_t)type];
+  };
+  count(Trace::RecordType::kCreateDevice) = 1;
+  count(Trace::RecordType::kGetDeviceQueue) = 1;
+  count(Trace::RecordType::kAllocateCommandBuffer) = options.thread_count;
+  count(Trace::RecordType::kAllocateMemory) = 1;
+  count(Trace::RecordType::kCreateBuffer) = 2;
+  count(Trace::RecordType::kBindBufferMemory) = 2;
+  count(Trace::RecordType::kBeginCommandBuffer) = recordings;
+  count(Trace::RecordType::kCmdBindPipeline) = 2 * recordings;
+  count(Trace::RecordType::kCmdBindVertexBuffers) = recordings;
+  count(Trace::RecordType::kCmdBindIndexBuffer) = recordings;
+  count(Trace::RecordType::kCmdDrawIndexed) =
+      recordings * options.draws_per_command_buffer;
+  count(Trace::RecordType::kAcquireNextImage) = options.frame_count;
+  count(Trace::RecordType::kQueueSubmit) = options.frame_count;
+  count(Trace::RecordType::kQueuePresent) = options.frame_count;
+  count(Trace::RecordType::kDestroyBuffer) = 2;
+  count(Trace::RecordType::kFreeMemory) = 1;
+  count(Trace::RecordType::kDestroyCommandPool) = 1;
+  count(Trace::RecordType::kDestroyDevice) = 1;
+  return counts;
+}
+
+// The second pipeline bind is redundant, for the checks to find
+static void RecordCommandBuffer(TraceWriter* writer, uint64_t command_buffer,
+                                uint32_t draw_count) {
+  writer->Write(Trace::BeginCommandBuffer{command_buffer, 0, 0});
+  writer->Write(Trace::CmdBindPipeline{command_buffer, kPipeline, 0, 0});
+  writer->Write(Trace::CmdBindPipeline{command_buffer, kPipeline, 0, 0});
+  const Trace::VertexBufferBinding binding = {kVertexBuffer, 0};
+  writer->Write(Trace::CmdBindVertexBuffers{command_buffer, 0, 1}, &binding,
+                1);
+  writer->Write(Trace::CmdBindIndexBuffer{
+      command_buffer, kIndexBuffer, 0, (uint32_t)VK_INDEX_TYPE_UINT32, 0});
+  for (uint32_t draw_index = 0; draw_index < draw_count; draw_index++) {
+    writer->Write(Trace::CmdDrawIndexed{
+        command_buffer, kGeneratedIndicesPerDraw, 1,
+        draw_index * kGeneratedIndicesPerDraw, 0, 0, 0});
+  }
+}
+
+void GenerateTrace(TraceWriter* writer, const TraceGeneratorOptions& options) {
+  const VkDeviceSize buffer_size = 1024 * 1024;
+
+  // Geometry in host-visible memory that isn't DEVICE_LOCAL, which the
+  // checks are expected to point out
+  Trace::CreateDevice create_device = {};
+  create_device.device = kDevice;
+  create_device.max_memory_allocation_count = 4096;
+  create_device.memory_properties.memoryTypeCount = 2;
+  create_device.memory_properties.memoryTypes[0].propertyFlags =
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  create_device.memory_properties.memoryTypes[0].heapIndex = 0;
+  create_device.memory_properties.memoryTypes[1].propertyFlags =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  create_device.memory_properties.memoryTypes[1].heapIndex = 1;
+  create_device.memory_properties.memoryHeapCount = 2;
+  create_device.memory_properties.memoryHeaps[0].size = 1ull << 32;
+  create_device.memory_properties.memoryHeaps[0].flags =
+      VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+  create_device.memory_properties.memoryHeaps[1].size = 1ull << 32;
+  writer->Write(create_device);
+
+  writer->Write(Trace::GetDeviceQueue{kDevice, kQueue, 0, 0});
+  for (uint32_t thread_index = 0; thread_index < options.thread_count;
+       thread_index++) {
+    writer->Write(Trace::AllocateCommandBuffer{
+        kDevice, kCommandPool, kFirstCommandBuffer + thread_index});
+  }
+  writer->Write(
+      Trace::AllocateMemory{kDevice, kMemory, 2 * buffer_size, 1, 0});
+  writer->Write(Trace::CreateBuffer{kDevice, kVertexBuffer, buffer_size,
+                                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 0});
+  writer->Write(Trace::CreateBuffer{kDevice, kIndexBuffer, buffer_size,
+                                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 0});
+  writer->Write(
+      Trace::BindBufferMemory{kDevice, kVertexBuffer, kMemory, 0});
+  writer->Write(
+      Trace::BindBufferMemory{kDevice, kIndexBuffer, kMemory, buffer_size});
+
+  // The recording threads live for the whole trace and record one frame at a
+  // time, like a title's job system would
+  std::mutex mutex;
+  std::condition_variable frame_started;
+  std::condition_variable frame_recorded;
+  uint32_t started_frame = 0;
+  uint32_t recording_threads = 0;
+
+  std::vector<std::thread> threads;
+  for (uint32_t thread_index = 0; thread_index < options.thread_count;
+       thread_index++) {
+    threads.emplace_back([&, thread_index] {
+      for (uint32_t frame = 1; frame <= options.frame_count; frame++) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          frame_started.wait(
+              lock, [&started_frame, frame] { return started_frame >= frame; });
+        }
+        RecordCommandBuffer(writer, kFirstCommandBuffer + thread_index,
+                            options.draws_per_command_buffer);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--recording_threads == 0) {
+          frame_recorded.notify_one();
+        }
+      }
+    });
+  }
+
+  std::vector<uint64_t> command_buffers;
+  for (uint32_t thread_index = 0; thread_index < options.thread_count;
+       thread_index++) {
+    command_buffers.push_back(kFirstCommandBuffer + thread_index);
+  }
+
+  for (uint32_t frame = 1; frame <= options.frame_count; frame++) {
+    writer->Write(Trace::AcquireNextImage{kDevice, kSwapchain,
+                                          (frame - 1) % 3, VK_SUCCESS});
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      recording_threads = options.thread_count;
+      started_frame = frame;
+      frame_started.notify_all();
+      frame_recorded.wait(
+          lock, [&recording_threads] { return recording_threads == 0; });
+    }
+    writer->Write(
+        Trace::QueueSubmit{kQueue, 0, 1, 0, options.thread_count, 0,
+                           options.thread_count, 0},
+        command_buffers.data(), command_buffers.size());
+    writer->Write(Trace::QueuePresent{kQueue, 1, VK_SUCCESS});
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  writer->Write(Trace::DestroyBuffer{kDevice, kVertexBuffer});
+  writer->Write(Trace::DestroyBuffer{kDevice, kIndexBuffer});
+  writer->Write(Trace::FreeMemory{kDevice, kMemory});
+  writer->Write(Trace::DestroyCommandPool{kDevice, kCommandPool});
+  writer->Write(Trace::DestroyDevice{kDevice});
+  writer->Flush();
+}
+
+}  // namespace GWD
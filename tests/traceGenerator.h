@@ -0,0 +1,72 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include "traceFormat.h"
+
+namespace GWD {
+
+class TraceWriter;
+
+// Writes the trace of a synthetic title without a device: one device, one
+// queue, and a fixed set of recording threads. Each frame every thread records
+// its own command buffer with one pipeline, one vertex and one index buffer
+// bound, followed by draws_per_command_buffer indexed draws; the main thread
+// then submits all of them in one batch and presents.
+//
+// Everything is deterministic apart from timestamps and thread IDs, so tests
+// can check what comes back out of the trace against ExpectedRecordCounts()
+// and the handles below.
+struct TraceGeneratorOptions {
+  uint32_t thread_count = 8;
+  uint32_t frame_count = 100;
+  uint32_t draws_per_command_buffer = 2000;
+};
+
+namespace TraceGeneratorHandles {
+static constexpr uint64_t kDevice = 0x1000;
+static constexpr uint64_t kQueue = 0x1100;
+static constexpr uint64_t kSwapchain = 0x1200;
+static constexpr uint64_t kCommandPool = 0x1300;
+static constexpr uint64_t kMemory = 0x1400;
+static constexpr uint64_t kVertexBuffer = 0x1500;
+static constexpr uint64_t kIndexBuffer = 0x1501;
+static constexpr uint64_t kPipeline = 0x1600;
+// Thread i records into kFirstCommandBuffer + i
+static constexpr uint64_t kFirstCommandBuffer = 0x10000;
+}  // namespace TraceGeneratorHandles
+
+// Every indexed draw covers one triangle, so the nth draw of a command buffer
+// starts at index 3 * n
+static constexpr uint32_t kGeneratedIndicesPerDraw = 3;
+
+using RecordCounts = std::array<uint64_t, 64>;
+
+// Reads --threads N, --frames N and --draws N. Returns false on anything else.
+bool ParseTraceGeneratorOptions(int argc, char** argv,
+                                TraceGeneratorOptions* options);
+
+// How many records of each type GenerateTrace() writes, by RecordType value
+RecordCounts ExpectedRecordCounts(const TraceGeneratorOptions& options);
+
+// Returns once every thread's records have been flushed to the file
+void GenerateTrace(TraceWriter* writer, const TraceGeneratorOptions& options);
+
+}  // namespace GWD
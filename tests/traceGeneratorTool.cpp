@@ -0,0 +1,58 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+// Writes a synthetic trace to GWD_TRACE_FILE, e.g. to time GwdTraceAnalyzer
+// on a large capture without a device. The defaults give 8 threads and about
+// 1.6M records.
+//
+// Usage: GwdTraceGenerator [--threads N] [--frames N] [--draws N]
+
+#include "layerSettings.h"
+#include "traceGenerator.h"
+#include "traceWriter.h"
+
+#include <stdio.h>
+
+static void PrintUsage() {
+  fprintf(stderr,
+          "Usage: GwdTraceGenerator [--threads N] [--frames N] [--draws N]\n");
+}
+
+int main(int argc, char** argv) {
+  GWD::TraceGeneratorOptions options;
+  if (!GWD::ParseTraceGeneratorOptions(argc, argv, &options)) {
+    PrintUsage();
+    return 1;
+  }
+
+  GWD::TraceWriter* writer = GWD::TraceWriter::Get();
+  if (writer == nullptr) {
+    fprintf(stderr,
+            "GwdTraceGenerator: set GWD_TRACE_FILE to a writable path\n");
+    return 1;
+  }
+
+  GWD::GenerateTrace(writer, options);
+
+  uint64_t record_count = 0;
+  for (uint64_t count : GWD::ExpectedRecordCounts(options)) {
+    record_count += count;
+  }
+  printf("Wrote %llu records from %u recording threads to %s\n",
+         (unsigned long long)record_count, options.thread_count,
+         GWD::GetLayerSettings().trace_file.c_str());
+  return 0;
+}
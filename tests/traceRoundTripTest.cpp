@@ -0,0 +1,216 @@
+/*
+ Copyright 2020 Google Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+*/
+
+// Writes a synthetic trace to GWD_TRACE_FILE from several threads, reads it
+// back and checks that every record arrived intact and in order. The
+// GwdTraceAnalyzer test then replays the same file.
+//
+// Usage: GwdTraceRoundTripTest [--threads N] [--frames N] [--draws N]
+
+#include "layerSettings.h"
+#include "traceGenerator.h"
+#include "traceReader.h"
+#include "traceWriter.h"
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "flat_hash_map.hpp"
+
+namespace GWD {
+
+using namespace TraceGeneratorHandles;
+
+static uint32_t s_failure_count = 0;
+
+static void Check(bool condition, const char* what) {
+  if (!condition && s_failure_count++ < 20) {
+    fprintf(stderr, "GwdTraceRoundTripTest: %s\n", what);
+  }
+}
+
+// Recording state of one command buffer, as seen from the trace
+struct CommandBufferRecording {
+  uint32_t thread_id = 0;
+  uint32_t recording_count = 0;
+  uint32_t draw_count = 0;
+};
+
+static void CheckRecord(const TraceGeneratorOptions& options,
+                        const Trace::RecordHeader* record, uint32_t thread_id,
+                        ska::flat_hash_map<uint64_t, CommandBufferRecording>*
+                            command_buffers) {
+  // Everything but the command buffer records and their draw indices is
+  // fixed, so only those are followed
+  auto recording = [command_buffers,
+                    thread_id](uint64_t command_buffer) -> bool {
+    auto entry = command_buffers->find(command_buffer);
+    return entry != command_buffers->end() &&
+           entry->second.thread_id == thread_id;
+  };
+
+  switch (record->type) {
+    case Trace::RecordType::kBeginCommandBuffer: {
+      auto begin = TraceReader::GetRecord<Trace::BeginCommandBuffer>(record);
+      Check(begin != nullptr, "short BeginCommandBuffer record");
+      if (begin == nullptr) {
+        break;
+      }
+      CommandBufferRecording& state = (*command_buffers)[begin->command_buffer];
+      Check(state.recording_count == 0 ||
+                state.draw_count == options.draws_per_command_buffer,
+            "command buffer re-recorded before all of its draws arrived");
+      Check(state.recording_count == 0 || state.thread_id == thread_id,
+            "command buffer recorded from more than one thread");
+      state.thread_id = thread_id;
+      state.recording_count++;
+      state.draw_count = 0;
+      break;
+    }
+    case Trace::RecordType::kCmdBindVertexBuffers: {
+      auto bind = TraceReader::GetRecord<Trace::CmdBindVertexBuffers>(record);
+      Check(bind != nullptr && recording(bind->command_buffer),
+            "vertex buffer bind outside of a recording");
+      if (bind == nullptr) {
+        break;
+      }
+      uint32_t binding_count = bind->binding_count;
+      const Trace::VertexBufferBinding* bindings =
+          TraceReader::GetElements<Trace::CmdBindVertexBuffers,
+                                   Trace::VertexBufferBinding>(
+              record, &binding_count);
+      Check(binding_count == 1 && bindings[0].buffer == kVertexBuffer &&
+                bindings[0].offset == 0,
+            "vertex buffer bindings don't match what was written");
+      break;
+    }
+    case Trace::RecordType::kCmdDrawIndexed: {
+      auto draw = TraceReader::GetRecord<Trace::CmdDrawIndexed>(record);
+      Check(draw != nullptr && recording(draw->command_buffer),
+            "draw outside of a recording");
+      if (draw == nullptr || !recording(draw->command_buffer)) {
+        break;
+      }
+      CommandBufferRecording& state = (*command_buffers)[draw->command_buffer];
+      Check(draw->index_count == kGeneratedIndicesPerDraw &&
+                draw->first_index ==
+                    state.draw_count * kGeneratedIndicesPerDraw,
+            "draws of a command buffer out of order");
+      state.draw_count++;
+      break;
+    }
+    case Trace::RecordType::kQueueSubmit: {
+      auto submit = TraceReader::GetRecord<Trace::QueueSubmit>(record);
+      Check(submit != nullptr && submit->queue == kQueue &&
+                submit->command_buffer_count == options.thread_count,
+            "submit record doesn't match what was written");
+      if (submit == nullptr) {
+        break;
+      }
+      uint32_t command_buffer_count = submit->command_buffer_count;
+      const uint64_t* submitted =
+          TraceReader::GetElements<Trace::QueueSubmit, uint64_t>(
+              record, &command_buffer_count);
+      for (uint32_t index = 0; index < command_buffer_count; index++) {
+        Check(submitted[index] == kFirstCommandBuffer + index,
+              "submitted command buffers don't match what was written");
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static bool RunRoundTrip(const TraceGeneratorOptions& options) {
+  TraceWriter* writer = TraceWriter::Get();
+  if (writer == nullptr) {
+    fprintf(stderr,
+            "GwdTraceRoundTripTest: set GWD_TRACE_FILE to a writable path\n");
+    return false;
+  }
+  GenerateTrace(writer, options);
+
+  std::string error;
+  std::unique_ptr<TraceReader> reader =
+      TraceReader::Open(GetLayerSettings().trace_file, &error);
+  if (!reader) {
+    fprintf(stderr, "GwdTraceRoundTripTest: %s\n", error.c_str());
+    return false;
+  }
+
+  // Blocks of one thread are in file order, and so are its records
+  ska::flat_hash_map<uint32_t, std::vector<const Trace::BlockHeader*>>
+      thread_blocks;
+  for (const Trace::BlockHeader* block : reader->GetBlocks()) {
+    thread_blocks[block->thread_id].push_back(block);
+  }
+  // The main thread writes the device, resource and submit records
+  Check(thread_blocks.size() == options.thread_count + 1,
+        "records don't come from the expected number of threads");
+
+  RecordCounts counts = {};
+  uint64_t record_count = 0;
+  ska::flat_hash_map<uint64_t, CommandBufferRecording> command_buffers;
+  for (const auto& thread : thread_blocks) {
+    uint64_t last_timestamp_ns = 0;
+    for (TraceReader::RecordCursor cursor(thread.second);
+         cursor.Get() != nullptr; cursor.Next()) {
+      const Trace::RecordHeader* record = cursor.Get();
+      Check((size_t)record->type < counts.size(), "unknown record type");
+      if ((size_t)record->type >= counts.size()) {
+        continue;
+      }
+      Check(record->timestamp_ns >= last_timestamp_ns,
+            "records of a thread out of order");
+      last_timestamp_ns = record->timestamp_ns;
+      counts[(size_t)record->type]++;
+      record_count++;
+      CheckRecord(options, record, thread.first, &command_buffers);
+    }
+  }
+
+  Check(counts == ExpectedRecordCounts(options),
+        "record counts don't match what was written");
+  Check(command_buffers.size() == options.thread_count,
+        "recorded command buffers don't match what was written");
+  for (const auto& command_buffer : command_buffers) {
+    Check(command_buffer.second.recording_count == options.frame_count &&
+              command_buffer.second.draw_count ==
+                  options.draws_per_command_buffer,
+          "a command buffer lost records");
+  }
+
+  printf("Read back %llu records in %zu blocks from %zu threads\n",
+         (unsigned long long)record_count, reader->GetBlocks().size(),
+         thread_blocks.size());
+  return s_failure_count == 0;
+}
+
+}  // namespace GWD
+
+int main(int argc, char** argv) {
+  GWD::TraceGeneratorOptions options;
+  if (!GWD::ParseTraceGeneratorOptions(argc, argv, &options)) {
+    fprintf(stderr,
+            "Usage: GwdTraceRoundTripTest [--threads N] [--frames N] "
+            "[--draws N]\n");
+    return 1;
+  }
+  return GWD::RunRoundTrip(options) ? 0 : 1;
+}